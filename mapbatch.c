@@ -0,0 +1,322 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Render a batch of extents with a shared feature fetch.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** msDrawMapBatch() renders the same map (layers, styles, size) for a list of
+** extents, typically the adjacent tiles requested by a seeding client.
+**
+** When the extents share a scale and are reasonably close together, the
+** features of the vector layers are fetched once for the union of the
+** extents and kept in memory as inline features, so WhichShapes/NextShape
+** on the datasource runs once per layer instead of once per image. Every
+** image is then drawn with msDrawMap() on its own copy of the map, so label
+** placement stays independent from one image to the next.
+**
+** With thread support the images are distributed over numworkers threads,
+** each owning one copy of the map (a mapObj belongs to one thread at a time).
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+
+
+/* don't share features when the union is much larger than the images */
+#define MS_BATCH_MAX_UNION_RATIO 2.0
+
+typedef struct {
+  mapObj *map;
+  rectObj *extents;
+  imageObj **images;
+  int first;
+  int step;
+  int numextents;
+  int status;
+} batchWorkerObj;
+
+/*
+** Can the features of this layer be read once and drawn from memory? Only
+** plain vector layers whose features don't depend on the image being drawn.
+*/
+static int batchLayerIsShareable(layerObj *layer)
+{
+  if(layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_LINE &&
+      layer->type != MS_LAYER_POLYGON && layer->type != MS_LAYER_ANNOTATION)
+    return MS_FALSE;
+
+  if(layer->connectiontype == MS_INLINE || layer->connectiontype == MS_GRATICULE ||
+      layer->connectiontype == MS_WMS || layer->connectiontype == MS_RASTER || layer->features)
+    return MS_FALSE;
+
+  if(layer->transform != MS_TRUE || layer->cluster.region || layer->numjoins > 0 ||
+      layer->maxfeatures > 0 || layer->startindex > 0 ||
+      layer->_geomtransform.type != MS_GEOMTRANSFORM_NONE)
+    return MS_FALSE;
+
+  /* auto styles come from the datasource */
+  if(layer->styleitem && strcasecmp(layer->styleitem, "AUTO") == 0)
+    return MS_FALSE;
+
+  return MS_TRUE;
+}
+
+/*
+** Read the features of layer in rect (map coordinates) and turn the layer
+** into an inline layer holding them. The layer's filter has already been
+** applied by the datasource, and the item list is kept in the ITEMS
+** processing key so class expressions resolve to the same values.
+*/
+static int batchFetchLayer(mapObj *map, layerObj *layer, rectObj rect)
+{
+  featureListNodeObjPtr features = NULL;
+  shapeObj shape;
+  char *items = NULL;
+  int i, status;
+
+  status = msLayerOpen(layer);
+  if(status != MS_SUCCESS) return MS_FAILURE;
+
+  status = msLayerWhichItems(layer, MS_TRUE, NULL);
+  if(status != MS_SUCCESS) {
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  for(i=0; i<layer->numitems; i++) {
+    if(strchr(layer->items[i], ',')) {
+      msLayerClose(layer);
+      return MS_DONE; /* can't be expressed as ITEMS, leave the layer alone */
+    }
+  }
+
+#ifdef USE_PROJ
+  if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
+    msProjectRect(&map->projection, &layer->projection, &rect);
+#endif
+
+  status = msLayerWhichShapes(layer, rect, MS_FALSE);
+  if(status == MS_SUCCESS) {
+    msInitShape(&shape);
+    while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+      if(insertFeatureList(&features, &shape) == NULL) {
+        msFreeShape(&shape);
+        status = MS_FAILURE;
+        break;
+      }
+      msFreeShape(&shape);
+    }
+  }
+
+  if(status == MS_FAILURE) {
+    freeFeatureList(features);
+    msLayerClose(layer);
+    return MS_FAILURE;
+  }
+
+  for(i=0; i<layer->numitems; i++) {
+    if(i > 0) items = msStringConcatenate(items, ",");
+    items = msStringConcatenate(items, layer->items[i]);
+  }
+
+  msLayerClose(layer);
+
+  /* from now on this is an inline layer */
+  layer->features = features;
+  layer->connectiontype = MS_INLINE;
+  if(msInitializeVirtualTable(layer) != MS_SUCCESS) {
+    msFree(items);
+    return MS_FAILURE;
+  }
+  if(items) {
+    msLayerSetProcessingKey(layer, "ITEMS", items);
+    msFree(items);
+  }
+
+  if(layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msDrawMapBatch(): layer %s features read once for all extents.\n", layer->name);
+
+  return MS_SUCCESS;
+}
+
+/*
+** Fetch the features of all shareable layers for the union of the extents.
+** Returns MS_FAILURE only on a datasource error, not fetching is fine.
+*/
+static int batchFetchFeatures(mapObj *map, rectObj *extents, int numextents)
+{
+  rectObj rect, unionrect;
+  double cellsize=0, area=0;
+  int i;
+
+  if(msTestConfigOption(map, "MS_NONSQUARE", MS_FALSE))
+    return MS_SUCCESS;
+
+  for(i=0; i<numextents; i++) {
+    double c;
+
+    rect = extents[i];
+    c = msAdjustExtent(&rect, map->width, map->height);
+    if(i == 0) {
+      cellsize = c;
+      unionrect = rect;
+    } else {
+      /* scale dependent settings would differ between images */
+      if(fabs(c - cellsize) > cellsize*1e-6)
+        return MS_SUCCESS;
+      msMergeRect(&unionrect, &rect);
+    }
+    area += (rect.maxx - rect.minx)*(rect.maxy - rect.miny);
+  }
+
+  if((unionrect.maxx - unionrect.minx)*(unionrect.maxy - unionrect.miny) > area*MS_BATCH_MAX_UNION_RATIO)
+    return MS_SUCCESS;
+
+  /* layer visibility and scale tokens as for the images */
+  rect = extents[0];
+  map->cellsize = msAdjustExtent(&rect, map->width, map->height);
+  if(msCalculateScale(rect, map->units, map->width, map->height, map->resolution, &map->scaledenom) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *layer = GET_LAYER(map, i);
+
+    if(!msLayerIsVisible(map, layer) || !batchLayerIsShareable(layer))
+      continue;
+
+    if(batchFetchLayer(map, layer, unionrect) == MS_FAILURE)
+      return MS_FAILURE;
+  }
+
+  return MS_SUCCESS;
+}
+
+static void batchWorker(void *arg)
+{
+  batchWorkerObj *worker = (batchWorkerObj *) arg;
+  int i;
+
+  for(i=worker->first; i<worker->numextents; i+=worker->step) {
+    worker->map->extent = worker->extents[i];
+    worker->images[i] = msDrawMap(worker->map, MS_FALSE);
+    if(worker->images[i] == NULL) {
+      worker->status = MS_FAILURE;
+      return;
+    }
+  }
+}
+
+/*
+** Draws map for each of the numextents extents (map coordinates, as for
+** map->extent) and returns an array of numextents images, to be released
+** with msFreeImage() and msFree(). The map itself is left untouched.
+** numworkers is the number of threads to render with, it has no effect
+** when MapServer is built without thread support.
+*/
+imageObj **msDrawMapBatch(mapObj *map, rectObj *extents, int numextents, int numworkers)
+{
+  mapObj **maps;
+  batchWorkerObj *workers;
+  void **args;
+  imageObj **images = NULL;
+  int i, status = MS_SUCCESS;
+
+  if(numextents <= 0) {
+    msSetError(MS_MISCERR, "No extents to draw.", "msDrawMapBatch()");
+    return NULL;
+  }
+
+#ifndef USE_THREAD
+  numworkers = 1;
+#endif
+  if(numworkers < 1) numworkers = 1;
+  if(numworkers > numextents) numworkers = numextents;
+
+  /* all copies are made here, before any worker starts */
+  maps = (mapObj **) msSmallCalloc(numworkers, sizeof(mapObj *));
+  maps[0] = msNewMapObj();
+  if(maps[0] == NULL || msCopyMap(maps[0], map) != MS_SUCCESS) {
+    msSetError(MS_MISCERR, "Failed to copy map.", "msDrawMapBatch()");
+    status = MS_FAILURE;
+  }
+
+  if(status == MS_SUCCESS)
+    status = batchFetchFeatures(maps[0], extents, numextents);
+
+  for(i=1; i<numworkers && status == MS_SUCCESS; i++) {
+    maps[i] = msNewMapObj();
+    if(maps[i] == NULL || msCopyMap(maps[i], maps[0]) != MS_SUCCESS) {
+      msSetError(MS_MISCERR, "Failed to copy map.", "msDrawMapBatch()");
+      status = MS_FAILURE;
+    }
+  }
+
+  if(status == MS_SUCCESS) {
+    images = (imageObj **) msSmallCalloc(numextents, sizeof(imageObj *));
+    workers = (batchWorkerObj *) msSmallMalloc(numworkers * sizeof(batchWorkerObj));
+    args = (void **) msSmallMalloc(numworkers * sizeof(void *));
+
+    for(i=0; i<numworkers; i++) {
+      workers[i].map = maps[i];
+      workers[i].extents = extents;
+      workers[i].images = images;
+      workers[i].first = i;
+      workers[i].step = numworkers;
+      workers[i].numextents = numextents;
+      workers[i].status = MS_SUCCESS;
+      args[i] = workers + i;
+    }
+
+    if(numworkers == 1)
+      batchWorker(args[0]);
+    else
+      msRunThreads(batchWorker, args, numworkers);
+
+    for(i=0; i<numworkers; i++) {
+      if(workers[i].status != MS_SUCCESS) status = MS_FAILURE;
+    }
+    if(status != MS_SUCCESS) {
+      /* the worker's error may have been recorded on another thread */
+      if(numworkers > 1)
+        msSetError(MS_MISCERR, "Failed to draw one of the extents.", "msDrawMapBatch()");
+      for(i=0; i<numextents; i++)
+        if(images[i]) msFreeImage(images[i]);
+      msFree(images);
+      images = NULL;
+    }
+
+    msFree(workers);
+    msFree(args);
+  }
+
+  for(i=0; i<numworkers; i++)
+    if(maps[i]) msFreeMap(maps[i]);
+  msFree(maps);
+
+  return images;
+}
@@ -143,6 +143,8 @@ typedef struct {
   cairo_surface_t *surface;
   cairo_t *cr;
   bufferObj *outputStream;
+  FILE *outputFile; /* when set, pdf/svg output goes straight to msIO */
+  int streamed;     /* the output was sent already, outputStream is incomplete */
   int use_alpha;
 } cairo_renderer;
 
@@ -675,9 +677,18 @@ int renderGlyphsCairo(imageObj *img,double x, double y, labelStyleObj *style, ch
 }
 
 
+/*
+** Output of the pdf and svg surfaces. It is kept in outputStream, except
+** when saveImageCairo() streams the final response of mapserv: it is then
+** written through msIO as cairo produces it.
+*/
 cairo_status_t _stream_write_fn(void *b, const unsigned char *data, unsigned int length)
 {
-  msBufferAppend((bufferObj*)b,(void*)data,length);
+  cairo_renderer *r = (cairo_renderer*)b;
+  if(r->outputFile)
+    msIO_fwrite(data,1,length,r->outputFile);
+  else
+    msBufferAppend(r->outputStream,(void*)data,length);
   return CAIRO_STATUS_SUCCESS;
 }
 
@@ -698,14 +709,14 @@ imageObj* createImageCairo(int width, int height, outputFormatObj *format,colorO
       msBufferInit(r->outputStream);
       r->surface = cairo_pdf_surface_create_for_stream(
                      _stream_write_fn,
-                     r->outputStream,
+                     r,
                      width,height);
     } else if(!strcasecmp(format->driver,"cairo/svg")) {
       r->outputStream = (bufferObj*)malloc(sizeof(bufferObj));
       msBufferInit(r->outputStream);
       r->surface = cairo_svg_surface_create_for_stream(
                      _stream_write_fn,
-                     r->outputStream,
+                     r,
                      width,height);
     } else if(!strcasecmp(format->driver,"cairo/winGDI") && format->device) {
 #if CAIRO_HAS_WIN32_SURFACE
@@ -878,12 +889,31 @@ int saveImageCairo(imageObj *img, mapObj *map, FILE *fp, outputFormatObj *format
 {
   cairo_renderer *r = CAIRO_RENDERER(img);
   if(!strcasecmp(img->format->driver,"cairo/pdf") || !strcasecmp(img->format->driver,"cairo/svg")) {
-    cairo_surface_finish (r->surface);
+    if(r->streamed) {
+      msSetError(MS_RENDERERERR, "The cairo image was already streamed out.", "saveImageCairo()");
+      return MS_FAILURE;
+    }
 
-    if (map != NULL && !strcasecmp(img->format->driver,"cairo/pdf"))
+    /* the geospatial pdf is rewritten by GDAL, it needs the whole document */
+    if (map != NULL && !strcasecmp(img->format->driver,"cairo/pdf") &&
+        msGetOutputFormatOption(img->format, "GEO_ENCODING", NULL) != NULL) {
+      cairo_surface_finish (r->surface);
       msTransformToGeospatialPDF(img, map, r);
-
-    msIO_fwrite(r->outputStream->data,r->outputStream->size,1,fp);
+      msIO_fwrite(r->outputStream->data,r->outputStream->size,1,fp);
+    } else if (fp == stdout && msIO_getStdoutStreaming()) {
+      /* mapserv response: send what cairo produced so far, and the rest as it comes */
+      msIO_fwrite(r->outputStream->data,r->outputStream->size,1,fp);
+      msBufferFree(r->outputStream);
+      msBufferInit(r->outputStream);
+      r->outputFile = fp;
+      r->streamed = MS_TRUE;
+      cairo_surface_finish (r->surface);
+      r->outputFile = NULL;
+    } else {
+      /* keep the document, the image may be saved again */
+      cairo_surface_finish (r->surface);
+      msIO_fwrite(r->outputStream->data,r->outputStream->size,1,fp);
+    }
   } else {
     /* not supported */
   }
@@ -895,6 +925,10 @@ unsigned char* saveImageBufferCairo(imageObj *img, int *size_ptr, outputFormatOb
   cairo_renderer *r = CAIRO_RENDERER(img);
   unsigned char *data;
   assert(!strcasecmp(img->format->driver,"cairo/pdf") || !strcasecmp(img->format->driver,"cairo/svg"));
+  if(r->streamed) {
+    msSetError(MS_RENDERERERR, "The cairo image was already streamed out.", "saveImageBufferCairo()");
+    return NULL;
+  }
   cairo_surface_finish (r->surface);
   data = msSmallMalloc(r->outputStream->size);
   memcpy(data,r->outputStream->data,r->outputStream->size);
@@ -41,10 +41,43 @@
 #include "mapthread.h"
 #include "cpl_string.h"
 
+#include <sys/stat.h>
+
 #define GEO_TRANS(tr,x,y)  ((tr)[0]+(tr)[1]*(x)+(tr)[2]*(y))
 
 extern int InvGeoTransform(double *gt_in, double *gt_out);
 
+/*
+** Contours are generated by blocks of CONTOUR_BLOCK_SIZE cells of the
+** virtual grid (source pixels sampled every grid step), aligned on the
+** origin of the raster. The lines of a block only depend on the dataset,
+** band, levels, grid step and block position, so they are kept in a
+** process-wide cache shared by the following requests (the same tile
+** again, or neighbouring tiles at the same resolution). Blocks that are
+** not cached are contoured in parallel, and the lines of all blocks of a
+** request are joined again where they cross block edges (adjacent blocks
+** share one row/column of cells, so the lines meet on it).
+*/
+#define MS_CONTOUR_BLOCK_SIZE 128
+#define MS_CONTOUR_MAX_THREADS 4
+#define MS_CONTOUR_CACHE_MAXPOINTS 1000000
+
+typedef struct {
+  double level;
+  lineObj line;
+} contourLineObj;
+
+typedef struct contourBlockObj {
+  char *key;
+  contourLineObj *lines;
+  int numlines;
+  int numpoints;
+  struct contourBlockObj *next;
+} contourBlockObj;
+
+static contourBlockObj *contour_cache = NULL; /* most recently used first */
+static int contour_cache_points = 0;
+
 typedef struct {
 
   /* OGR DataSource */
@@ -58,8 +91,19 @@ typedef struct {
   OGRDataSourceH hOGRDS;
   double cellsize;
 
+  char *path; /* dataset, for the contour cache */
+  contourLineObj *lines; /* contours generated by blocks */
+  int numlines;
+  int useblocks;
+
 } contourLayerInfo;
 
+static int msContourLayerReadBlocks(layerObj *layer, GDALRasterBandH hBand, int band,
+                                    double *adfGeoTransform, int stepx, int stepy,
+                                    int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                                    int blocksize);
+static void msContourFreeLines(contourLineObj *lines, int numlines);
+
 
 static int msContourLayerInitItemInfo(layerObj *layer)
 {
@@ -121,6 +165,8 @@ static void msContourLayerInfoFree(layerObj *layer)
     return;
 
   freeLayer(&clinfo->ogrLayer);
+  msFree(clinfo->path);
+  msContourFreeLines(clinfo->lines, clinfo->numlines);
   free(clinfo);
 
   layer->layerinfo = NULL;
@@ -153,6 +199,8 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
     return MS_FAILURE;    
   }
 
+  clinfo->useblocks = MS_FALSE;
+
   bands = CSLTokenizeStringComplex(
                CSLFetchNameValue(layer->processing,"BANDS"), " ,", FALSE, FALSE );
   if (CSLCount(bands) > 0) {
@@ -382,6 +430,26 @@ static int msContourLayerReadRaster(layerObj *layer, rectObj rect)
       msDebug( "msContourLayerReadRaster(): src=%d,%d,%d,%d, dst=%d,%d,%d,%d\n",
                src_xoff, src_yoff, src_xsize, src_ysize,
                0, 0, dst_xsize, dst_ysize );
+
+    /* generate (or reuse) the contours by blocks of the virtual grid */
+    {
+      const char *pszBlockSize = CSLFetchNameValue(layer->processing, "CONTOUR_BLOCK_SIZE");
+      int blocksize = pszBlockSize ? atoi(pszBlockSize) : MS_CONTOUR_BLOCK_SIZE;
+
+      clinfo->useblocks = (blocksize > 0 && clinfo->path != NULL &&
+                           adfGeoTransform[2] == 0 && adfGeoTransform[4] == 0);
+      if (clinfo->useblocks) {
+        char buf[64];
+        clinfo->cellsize = MAX(dst_cellsize_x, dst_cellsize_y);
+        sprintf(buf, "%lf", clinfo->cellsize);
+        msInsertHashTable(&layer->metadata, "__data_cellsize__", buf);
+
+        return msContourLayerReadBlocks(layer, hBand, band, adfGeoTransform,
+                                        virtual_grid_step_x, virtual_grid_step_y,
+                                        src_xoff, src_yoff, src_xsize, src_ysize,
+                                        blocksize);
+      }
+    }
   } else {
     src_xoff = 0;
     src_yoff = 0;
@@ -486,13 +554,562 @@ static char* msContourGetOption(layerObj *layer, const char *name)
   return value;
 }
 
+/* Parse CONTOUR_INTERVAL and CONTOUR_LEVELS, returns the number of levels. */
+static int msContourGetLevels(layerObj *layer, double *interval, double *levels, int maxlevels)
+{
+  char *option;
+  int levelCount = 0;
+
+  *interval = 1.0;
+
+  option = msContourGetOption(layer, "CONTOUR_INTERVAL");
+  if (option) {
+    *interval = atof(option);
+    free(option);
+  }
+
+  option = msContourGetOption(layer, "CONTOUR_LEVELS");
+  if (option) {
+    int i,c;
+    char **levelsTmp;
+    levelsTmp = CSLTokenizeStringComplex(option, ",", FALSE, FALSE);
+    c = CSLCount(levelsTmp);
+    for (i=0;i<c && i<maxlevels ;++i)
+      levels[levelCount++] = atof(levelsTmp[i]);
+
+    CSLDestroy(levelsTmp);
+    free(option);
+  }
+
+  return levelCount;
+}
+
+static void msContourFreeLines(contourLineObj *lines, int numlines)
+{
+  int i;
+
+  for (i=0; i<numlines; i++)
+    free(lines[i].line.point);
+  free(lines);
+}
+
+/* Copy numlines lines at the end of *plines. */
+static void msContourAppendLines(contourLineObj **plines, int *pnumlines,
+                                 contourLineObj *lines, int numlines)
+{
+  int i;
+
+  if (numlines == 0)
+    return;
+
+  *plines = (contourLineObj *) msSmallRealloc(*plines, sizeof(contourLineObj) * (*pnumlines + numlines));
+  for (i=0; i<numlines; i++) {
+    contourLineObj *dst = *plines + *pnumlines + i;
+    dst->level = lines[i].level;
+    dst->line.numpoints = lines[i].line.numpoints;
+    dst->line.point = (pointObj *) msSmallMalloc(sizeof(pointObj) * lines[i].line.numpoints);
+    memcpy(dst->line.point, lines[i].line.point, sizeof(pointObj) * lines[i].line.numpoints);
+  }
+  *pnumlines += numlines;
+}
+
+/************************************************************************/
+/*                          contour block cache                         */
+/************************************************************************/
+
+static void msContourFreeBlock(contourBlockObj *block)
+{
+  msContourFreeLines(block->lines, block->numlines);
+  msFree(block->key);
+  free(block);
+}
+
+/* Append a copy of the lines of the cached block key, returns MS_FALSE if */
+/* it is not cached. */
+static int msContourCacheLookup(const char *key, contourLineObj **plines, int *pnumlines)
+{
+  contourBlockObj **link, *block;
+
+  msAcquireLock(TLOCK_CONTOURCACHE);
+
+  for (link = &contour_cache; (block = *link) != NULL; link = &block->next) {
+    if (strcmp(block->key, key) == 0)
+      break;
+  }
+
+  if (block) {
+    /* move to front */
+    *link = block->next;
+    block->next = contour_cache;
+    contour_cache = block;
+
+    msContourAppendLines(plines, pnumlines, block->lines, block->numlines);
+  }
+
+  msReleaseLock(TLOCK_CONTOURCACHE);
+
+  return (block != NULL);
+}
+
+/* Hand the lines of a block over to the cache. */
+static void msContourCacheStore(const char *key, contourLineObj *lines, int numlines)
+{
+  contourBlockObj *block, **link;
+  int i;
+
+  block = (contourBlockObj *) msSmallCalloc(1, sizeof(contourBlockObj));
+  block->key = msStrdup(key);
+  block->lines = lines;
+  block->numlines = numlines;
+  for (i=0; i<numlines; i++)
+    block->numpoints += lines[i].line.numpoints;
+
+  msAcquireLock(TLOCK_CONTOURCACHE);
+
+  block->next = contour_cache;
+  contour_cache = block;
+  contour_cache_points += block->numpoints;
+
+  /* drop the least recently used blocks, but keep the new one */
+  while (contour_cache_points > MS_CONTOUR_CACHE_MAXPOINTS && contour_cache->next) {
+    for (link = &contour_cache; (*link)->next; link = &(*link)->next)
+      ;
+    block = *link;
+    *link = NULL;
+    contour_cache_points -= block->numpoints;
+    msContourFreeBlock(block);
+  }
+
+  msReleaseLock(TLOCK_CONTOURCACHE);
+}
+
+void msContourCacheCleanup()
+{
+  contourBlockObj *block;
+
+  msAcquireLock(TLOCK_CONTOURCACHE);
+  while ((block = contour_cache) != NULL) {
+    contour_cache = block->next;
+    msContourFreeBlock(block);
+  }
+  contour_cache_points = 0;
+  msReleaseLock(TLOCK_CONTOURCACHE);
+}
+
+/************************************************************************/
+/*                         msContourStitchLines()                       */
+/*                                                                      */
+/*      Join the lines of the same level whose ends meet (within        */
+/*      tolerance), i.e. the pieces of a contour cut at block edges.    */
+/************************************************************************/
+
+typedef struct {
+  double level;
+  double qx, qy; /* end point, in units of the tolerance */
+  int line;
+  int end;       /* 0 for the first point, 1 for the last */
+} contourEndObj;
+
+static int msContourCompareEnds(const void *a, const void *b)
+{
+  const contourEndObj *e1 = (const contourEndObj *) a;
+  const contourEndObj *e2 = (const contourEndObj *) b;
+
+  if (e1->level != e2->level) return (e1->level < e2->level) ? -1 : 1;
+  if (e1->qx != e2->qx) return (e1->qx < e2->qx) ? -1 : 1;
+  if (e1->qy != e2->qy) return (e1->qy < e2->qy) ? -1 : 1;
+  return 0;
+}
+
+/* Append the points of src to dst, reversed if needed, skipping the */
+/* first one when it is the last point of dst already. */
+static void msContourAppendPoints(lineObj *dst, int *maxpoints, lineObj *src, int reverse, int skipfirst)
+{
+  int i;
+
+  if (dst->numpoints + src->numpoints > *maxpoints) {
+    *maxpoints = MS_MAX(*maxpoints * 2, dst->numpoints + src->numpoints);
+    dst->point = (pointObj *) msSmallRealloc(dst->point, sizeof(pointObj) * *maxpoints);
+  }
+  for (i = skipfirst ? 1 : 0; i<src->numpoints; i++)
+    dst->point[dst->numpoints++] = src->point[reverse ? src->numpoints - 1 - i : i];
+}
+
+static contourLineObj *msContourStitchLines(contourLineObj *lines, int numlines,
+                                            double tolerance, int *pnumstitched)
+{
+  contourEndObj *ends;
+  contourLineObj *stitched;
+  int *match, *visited;
+  int i, numstitched = 0;
+
+  ends = (contourEndObj *) msSmallMalloc(sizeof(contourEndObj) * 2 * MS_MAX(numlines, 1));
+  match = (int *) msSmallMalloc(sizeof(int) * 2 * MS_MAX(numlines, 1));
+  for (i=0; i<2*numlines; i++) {
+    lineObj *line = &lines[i/2].line;
+    pointObj *p = &line->point[(i%2) ? line->numpoints-1 : 0];
+    ends[i].level = lines[i/2].level;
+    ends[i].qx = floor(p->x / tolerance + 0.5);
+    ends[i].qy = floor(p->y / tolerance + 0.5);
+    ends[i].line = i/2;
+    ends[i].end = i%2;
+    match[i] = -1;
+  }
+
+  qsort(ends, 2*numlines, sizeof(contourEndObj), msContourCompareEnds);
+
+  /* match ends two by two, rings closed within a block are left alone */
+  for (i=0; i+1<2*numlines; i++) {
+    if (msContourCompareEnds(&ends[i], &ends[i+1]) == 0 && ends[i].line != ends[i+1].line) {
+      match[ends[i].line*2 + ends[i].end] = ends[i+1].line*2 + ends[i+1].end;
+      match[ends[i+1].line*2 + ends[i+1].end] = ends[i].line*2 + ends[i].end;
+      i++;
+    }
+  }
+  free(ends);
+
+  stitched = (contourLineObj *) msSmallMalloc(sizeof(contourLineObj) * MS_MAX(numlines, 1));
+  visited = (int *) msSmallCalloc(MS_MAX(numlines, 1), sizeof(int));
+
+  for (i=0; i<numlines; i++) {
+    int cur = i, start = 0, n, maxpoints = 0;
+    lineObj *line;
+
+    if (visited[i])
+      continue;
+
+    /* go back to the first piece of the chain (or around a ring) */
+    for (n=0; n<numlines && match[cur*2 + start] >= 0; n++) {
+      int other = match[cur*2 + start];
+      if (other/2 == i)
+        break;
+      cur = other/2;
+      start = 1 - other%2;
+    }
+
+    line = &stitched[numstitched].line;
+    stitched[numstitched].level = lines[i].level;
+    line->numpoints = 0;
+    line->point = NULL;
+
+    visited[cur] = MS_TRUE;
+    msContourAppendPoints(line, &maxpoints, &lines[cur].line, start == 1, MS_FALSE);
+    while (match[cur*2 + 1 - start] >= 0) {
+      int other = match[cur*2 + 1 - start];
+      if (visited[other/2])
+        break;
+      cur = other/2;
+      start = other%2;
+      visited[cur] = MS_TRUE;
+      msContourAppendPoints(line, &maxpoints, &lines[cur].line, start == 1, MS_TRUE);
+    }
+    numstitched++;
+  }
+
+  free(match);
+  free(visited);
+
+  *pnumstitched = numstitched;
+  return stitched;
+}
+
+/************************************************************************/
+/*                        msContourLayerReadBlocks()                    */
+/************************************************************************/
+
+typedef struct {
+  char *key;
+  int xoff, yoff, xsize, ysize; /* source window */
+  int nx, ny;                   /* cells read */
+  double adfGeoTransform[6];
+  double *buffer;
+  GDALDatasetH hDS;
+  OGRDataSourceH hOGRDS;
+  OGRLayerH hLayer;
+  CPLErr eErr;
+} contourBlockJobObj;
+
+typedef struct {
+  contourBlockJobObj *jobs;
+  int first;
+  int step;
+  int numjobs;
+  double interval;
+  double *levels;
+  int levelCount;
+} contourWorkerObj;
+
+static void msContourBlockWorker(void *arg)
+{
+  contourWorkerObj *worker = (contourWorkerObj *) arg;
+  int i;
+
+  for (i=worker->first; i<worker->numjobs; i+=worker->step) {
+    contourBlockJobObj *job = worker->jobs + i;
+    OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn(job->hLayer);
+
+    job->eErr = GDALContourGenerate(GDALGetRasterBand(job->hDS, 1), worker->interval, 0.0,
+                                    worker->levelCount, worker->levels,
+                                    FALSE, 0.0, job->hLayer,
+                                    OGR_FD_GetFieldIndex(hDefn, "ID"),
+                                    OGR_FD_GetFieldIndex(hDefn, "elev"),
+                                    NULL, NULL);
+  }
+}
+
+/* Read the source window of a block and prepare its datasets. */
+static int msContourPrepareBlock(layerObj *layer, GDALRasterBandH hBand, contourBlockJobObj *job)
+{
+  OGRSFDriverH hDriver;
+  OGRFieldDefnH hFld;
+  char pointer[64], memDSPointer[128];
+
+  job->buffer = (double *) malloc(sizeof(double) * job->nx * job->ny);
+  if (job->buffer == NULL) {
+    msSetError(MS_MEMERR, "Malloc(): Out of memory.", "msContourLayerReadBlocks()");
+    return MS_FAILURE;
+  }
+
+  if (GDALRasterIO(hBand, GF_Read, job->xoff, job->yoff, job->xsize, job->ysize,
+                   job->buffer, job->nx, job->ny, GDT_Float64, 0, 0) != CE_None) {
+    msSetError(MS_IOERR, "GDALRasterIO() failed: %s",
+               "msContourLayerReadBlocks()", CPLGetLastErrorMsg());
+    return MS_FAILURE;
+  }
+
+  memset(pointer, 0, sizeof(pointer));
+  CPLPrintPointer(pointer, job->buffer, sizeof(pointer));
+  sprintf(memDSPointer,"MEM:::DATAPOINTER=%s,PIXELS=%d,LINES=%d,BANDS=1,DATATYPE=Float64",
+          pointer, job->nx, job->ny);
+  job->hDS = GDALOpen(memDSPointer, GA_ReadOnly);
+  if (job->hDS == NULL) {
+    msSetError(MS_IMGERR, "Unable to open GDAL Memory dataset.", "msContourLayerReadBlocks()");
+    return MS_FAILURE;
+  }
+  GDALSetGeoTransform(job->hDS, job->adfGeoTransform);
+
+  hDriver = OGRGetDriverByName("Memory");
+  if (hDriver == NULL) {
+    msSetError(MS_OGRERR, "Unable to get OGR driver 'Memory'.", "msContourLayerReadBlocks()");
+    return MS_FAILURE;
+  }
+  job->hOGRDS = OGR_Dr_CreateDataSource(hDriver, NULL, NULL);
+  if (job->hOGRDS == NULL) {
+    msSetError(MS_OGRERR, "Unable to create OGR DataSource.", "msContourLayerReadBlocks()");
+    return MS_FAILURE;
+  }
+  job->hLayer = OGR_DS_CreateLayer(job->hOGRDS, layer->name, NULL, wkbLineString, NULL);
+
+  hFld = OGR_Fld_Create("ID", OFTInteger);
+  OGR_L_CreateField(job->hLayer, hFld, FALSE);
+  OGR_Fld_Destroy(hFld);
+  hFld = OGR_Fld_Create("elev", OFTReal);
+  OGR_L_CreateField(job->hLayer, hFld, FALSE);
+  OGR_Fld_Destroy(hFld);
+
+  return MS_SUCCESS;
+}
+
+/* Turn the features generated for a block into contour lines. */
+static contourLineObj *msContourBlockLines(contourBlockJobObj *job, int *pnumlines)
+{
+  OGRFeatureH hFeature;
+  contourLineObj *lines = NULL;
+  int numlines = 0, elevField;
+
+  elevField = OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(job->hLayer), "elev");
+  lines = (contourLineObj *) msSmallMalloc(sizeof(contourLineObj) * MS_MAX(1, OGR_L_GetFeatureCount(job->hLayer, TRUE)));
+
+  OGR_L_ResetReading(job->hLayer);
+  while ((hFeature = OGR_L_GetNextFeature(job->hLayer)) != NULL) {
+    OGRGeometryH hGeom = OGR_F_GetGeometryRef(hFeature);
+    int i, n = hGeom ? OGR_G_GetPointCount(hGeom) : 0;
+
+    if (n >= 2) {
+      lines[numlines].level = OGR_F_GetFieldAsDouble(hFeature, elevField);
+      lines[numlines].line.numpoints = n;
+      lines[numlines].line.point = (pointObj *) msSmallMalloc(sizeof(pointObj) * n);
+      for (i=0; i<n; i++) {
+        lines[numlines].line.point[i].x = OGR_G_GetX(hGeom, i);
+        lines[numlines].line.point[i].y = OGR_G_GetY(hGeom, i);
+#ifdef USE_POINT_Z_M
+        lines[numlines].line.point[i].z = 0;
+        lines[numlines].line.point[i].m = 0;
+#endif
+      }
+      numlines++;
+    }
+    OGR_F_Destroy(hFeature);
+  }
+
+  *pnumlines = numlines;
+  return lines;
+}
+
+static void msContourFreeBlockJob(contourBlockJobObj *job)
+{
+  if (job->hOGRDS)
+    OGR_DS_Destroy(job->hOGRDS);
+  if (job->hDS)
+    GDALClose(job->hDS);
+  free(job->buffer);
+  msFree(job->key);
+}
+
+static int msContourLayerReadBlocks(layerObj *layer, GDALRasterBandH hBand, int band,
+                                    double *adfGeoTransform, int stepx, int stepy,
+                                    int src_xoff, int src_yoff, int src_xsize, int src_ysize,
+                                    int blocksize)
+{
+  contourLayerInfo *clinfo = (contourLayerInfo *) layer->layerinfo;
+  contourBlockJobObj *jobs;
+  contourLineObj *lines = NULL;
+  double interval, levels[1000];
+  int levelCount, numlines = 0, numjobs = 0, status = MS_SUCCESS;
+  int ncx, ncy, bx, by, bx0, bx1, by0, by1, i;
+  char *levelkey = NULL;
+  long mtime = 0;
+  struct stat st;
+
+  levelCount = msContourGetLevels(layer, &interval, levels, (int)(sizeof(levels)/sizeof(double)));
+
+  /* cache key parts common to all blocks */
+  if (stat(clinfo->path, &st) == 0)
+    mtime = (long) st.st_mtime;
+  {
+    char buf[64];
+    sprintf(buf, "%.15g", interval);
+    levelkey = msStringConcatenate(levelkey, buf);
+    for (i=0; i<levelCount; i++) {
+      sprintf(buf, ",%.15g", levels[i]);
+      levelkey = msStringConcatenate(levelkey, buf);
+    }
+  }
+
+  /* cells of the virtual grid, and the blocks covering the window */
+  ncx = GDALGetRasterXSize(clinfo->hOrigDS) / stepx;
+  ncy = GDALGetRasterYSize(clinfo->hOrigDS) / stepy;
+  bx0 = (src_xoff / stepx) / blocksize;
+  bx1 = MIN((src_xoff + src_xsize) / stepx, ncx - 1) / blocksize;
+  by0 = (src_yoff / stepy) / blocksize;
+  by1 = MIN((src_yoff + src_ysize) / stepy, ncy - 1) / blocksize;
+
+  jobs = (contourBlockJobObj *) msSmallCalloc((bx1-bx0+1)*(by1-by0+1), sizeof(contourBlockJobObj));
+
+  for (by=by0; by<=by1 && status == MS_SUCCESS; by++) {
+    for (bx=bx0; bx<=bx1 && status == MS_SUCCESS; bx++) {
+      contourBlockJobObj *job = jobs + numjobs;
+      char *key;
+      int cx = bx*blocksize, cy = by*blocksize;
+
+      /* the last row/column is shared with the next block */
+      job->nx = MIN(blocksize + 1, ncx - cx);
+      job->ny = MIN(blocksize + 1, ncy - cy);
+      if (job->nx < 2 || job->ny < 2)
+        continue;
+
+      key = msStrdup(clinfo->path);
+      {
+        char buf[160];
+        sprintf(buf, ",%ld,%d,%d,%d,%d,%d,%d,", mtime, band, stepx, stepy, blocksize, bx, by);
+        key = msStringConcatenate(key, buf);
+      }
+      key = msStringConcatenate(key, levelkey);
+
+      if (msContourCacheLookup(key, &lines, &numlines)) {
+        msFree(key);
+        continue;
+      }
+
+      job->key = key;
+      job->xoff = cx * stepx;
+      job->yoff = cy * stepy;
+      job->xsize = job->nx * stepx;
+      job->ysize = job->ny * stepy;
+      job->adfGeoTransform[0] = adfGeoTransform[0] + job->xoff * adfGeoTransform[1];
+      job->adfGeoTransform[1] = adfGeoTransform[1] * stepx;
+      job->adfGeoTransform[2] = 0;
+      job->adfGeoTransform[3] = adfGeoTransform[3] + job->yoff * adfGeoTransform[5];
+      job->adfGeoTransform[4] = 0;
+      job->adfGeoTransform[5] = adfGeoTransform[5] * stepy;
+      numjobs++;
+
+      status = msContourPrepareBlock(layer, hBand, job);
+    }
+  }
+  msFree(levelkey);
+
+  if (layer->debug)
+    msDebug("msContourLayerReadBlocks(): %d blocks, %d to generate.\n",
+            (bx1-bx0+1)*(by1-by0+1), numjobs);
+
+  if (status == MS_SUCCESS && numjobs > 0) {
+    const char *pszThreads = CSLFetchNameValue(layer->processing, "CONTOUR_THREADS");
+    int numworkers = pszThreads ? atoi(pszThreads) : MS_CONTOUR_MAX_THREADS;
+    contourWorkerObj *workers;
+    void **args;
+
+    numworkers = MAX(1, MIN(numworkers, numjobs));
+    workers = (contourWorkerObj *) msSmallMalloc(numworkers * sizeof(contourWorkerObj));
+    args = (void **) msSmallMalloc(numworkers * sizeof(void *));
+    for (i=0; i<numworkers; i++) {
+      workers[i].jobs = jobs;
+      workers[i].first = i;
+      workers[i].step = numworkers;
+      workers[i].numjobs = numjobs;
+      workers[i].interval = interval;
+      workers[i].levels = levels;
+      workers[i].levelCount = levelCount;
+      args[i] = workers + i;
+    }
+
+    if (numworkers == 1)
+      msContourBlockWorker(args[0]);
+    else
+      msRunThreads(msContourBlockWorker, args, numworkers);
+
+    free(workers);
+    free(args);
+
+    for (i=0; i<numjobs; i++) {
+      contourLineObj *blocklines;
+      int numblocklines;
+
+      if (jobs[i].eErr != CE_None) {
+        msSetError(MS_IOERR, "GDALContourGenerate() failed.", "msContourLayerReadBlocks()");
+        status = MS_FAILURE;
+        break;
+      }
+      blocklines = msContourBlockLines(jobs + i, &numblocklines);
+      msContourAppendLines(&lines, &numlines, blocklines, numblocklines);
+      msContourCacheStore(jobs[i].key, blocklines, numblocklines);
+    }
+  }
+
+  for (i=0; i<numjobs; i++)
+    msContourFreeBlockJob(jobs + i);
+  free(jobs);
+
+  if (status != MS_SUCCESS) {
+    msContourFreeLines(lines, numlines);
+    return MS_FAILURE;
+  }
+
+  msContourFreeLines(clinfo->lines, clinfo->numlines);
+  clinfo->lines = msContourStitchLines(lines, numlines,
+                                       MIN(ABS(adfGeoTransform[1]), ABS(adfGeoTransform[5])) * 1e-3,
+                                       &clinfo->numlines);
+  msContourFreeLines(lines, numlines);
+
+  return MS_SUCCESS;
+}
+
 static int msContourLayerGenerateContour(layerObj *layer)
 {
   OGRSFDriverH hDriver;
   OGRFieldDefnH hFld;
   OGRLayerH hLayer;
   const char *elevItem;
-  char *option;
   double interval = 1.0, levels[1000];
   int levelCount = 0;
   GDALRasterBandH hBand = NULL;
@@ -508,8 +1125,9 @@ static int msContourLayerGenerateContour(layerObj *layer)
     return MS_FAILURE;
   }
 
-  hBand = GDALGetRasterBand(clinfo->hDS, 1);
-  if (hBand == NULL)
+  if (!clinfo->useblocks)
+    hBand = GDALGetRasterBand(clinfo->hDS, 1);
+  if (hBand == NULL && !clinfo->useblocks)
   {
     msSetError(MS_IMGERR,
                "Band %d does not exist on dataset.",
@@ -555,25 +1173,46 @@ static int msContourLayerGenerateContour(layerObj *layer)
     elevItem = NULL;
   }
 
-  option = msContourGetOption(layer, "CONTOUR_INTERVAL");
-  if (option) {
-    interval = atof(option);
-    free(option);
-  }
+  if (clinfo->useblocks) {
+    /* lines already generated by msContourLayerReadBlocks() */
+    int i, j, idField, elevField;
+    OGRErr eOGRErr;
+
+    idField = OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(hLayer), "ID");
+    elevField = (elevItem == NULL) ? -1 :
+                OGR_FD_GetFieldIndex(OGR_L_GetLayerDefn(hLayer), elevItem);
+
+    for (i=0; i<clinfo->numlines; i++) {
+      OGRFeatureH hFeature = OGR_F_Create(OGR_L_GetLayerDefn(hLayer));
+      OGRGeometryH hGeom = OGR_G_CreateGeometry(wkbLineString);
+      lineObj *line = &clinfo->lines[i].line;
+
+      for (j=0; j<line->numpoints; j++)
+        OGR_G_AddPoint_2D(hGeom, line->point[j].x, line->point[j].y);
+      OGR_F_SetGeometryDirectly(hFeature, hGeom);
+      OGR_F_SetFieldInteger(hFeature, idField, i);
+      if (elevField >= 0)
+        OGR_F_SetFieldDouble(hFeature, elevField, clinfo->lines[i].level);
+      eOGRErr = OGR_L_CreateFeature(hLayer, hFeature);
+      OGR_F_Destroy(hFeature);
+      if (eOGRErr != OGRERR_NONE) {
+        msSetError(MS_OGRERR, "Unable to write contour feature.",
+                   "msContourLayerGenerateContour()");
+        return MS_FAILURE;
+      }
+    }
 
-  option = msContourGetOption(layer, "CONTOUR_LEVELS");
-  if (option) {
-    int i,c;
-    char **levelsTmp;
-    levelsTmp = CSLTokenizeStringComplex(option, ",", FALSE, FALSE);
-    c = CSLCount(levelsTmp);
-    for (i=0;i<c && i<(int)(sizeof(levels)/sizeof(double)) ;++i)
-      levels[levelCount++] = atof(levelsTmp[i]);
+    msContourFreeLines(clinfo->lines, clinfo->numlines);
+    clinfo->lines = NULL;
+    clinfo->numlines = 0;
 
-    CSLDestroy(levelsTmp);
-    free(option);
+    msConnPoolRegister(&clinfo->ogrLayer, clinfo->hOGRDS, msContourOGRCloseConnection);
+
+    return MS_SUCCESS;
   }
-    
+
+  levelCount = msContourGetLevels(layer, &interval, levels, (int)(sizeof(levels)/sizeof(double)));
+
   eErr = GDALContourGenerate( hBand, interval, 0.0,
                               levelCount, levels,
                               FALSE, 0.0, hLayer,
@@ -616,6 +1255,8 @@ int msContourLayerOpen(layerObj *layer)
   /* Open the original Dataset */
   msTryBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->data);
   decrypted_path = msDecryptStringTokens(layer->map, szPath);
+  msFree(clinfo->path);
+  clinfo->path = msStrdup(szPath);
 
   msAcquireLock(TLOCK_GDAL);
   if (decrypted_path) {
@@ -641,9 +1282,11 @@ int msContourLayerOpen(layerObj *layer)
   if (msContourLayerGenerateContour(layer) != MS_SUCCESS)
     return MS_FAILURE;
 
-  GDALClose(clinfo->hDS);
-  clinfo->hDS = NULL;  
-  free(clinfo->buffer);
+  if (clinfo->hDS) {
+    GDALClose(clinfo->hDS);
+    clinfo->hDS = NULL;
+    free(clinfo->buffer);
+  }
 
   /* Open our virtual ogr layer */
   if (msLayerOpen(&clinfo->ogrLayer) != MS_SUCCESS)
@@ -741,9 +1384,11 @@ int msContourLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   if (msContourLayerGenerateContour(layer) != MS_SUCCESS)
     return MS_FAILURE;
 
-  GDALClose(clinfo->hDS);
-  clinfo->hDS = NULL;
-  free(clinfo->buffer);  
+  if (clinfo->hDS) {
+    GDALClose(clinfo->hDS);
+    clinfo->hDS = NULL;
+    free(clinfo->buffer);
+  }
   
   /* Open our virtual ogr layer */
   if (msLayerOpen(&clinfo->ogrLayer) != MS_SUCCESS)
@@ -864,5 +1509,9 @@ int msContourLayerInitializeVirtualTable(layerObj *layer)
   msSetError(MS_MISCERR, "Contour Layer needs GDAL support, but it it not compiled in", "msContourLayerInitializeVirtualTable()");
   return MS_FAILURE;
 }
+
+void msContourCacheCleanup()
+{
+}
 #endif
 
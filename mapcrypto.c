@@ -32,7 +32,10 @@
 #include <stdlib.h>   /* rand() */
 #include <time.h>     /* time() */
 
+#include <sys/stat.h>  /* stat() */
+
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -246,6 +249,8 @@ int msReadEncryptionKeyFromFile(const char *keyfile, unsigned char *k)
  * The first time that msLoadEncryptionKey() is called for a given mapObj
  * it will load the encryption key and cache it in mapObj->encryption_key.
  * If the key is already set in the mapObj then it does nothing and returns.
+ * The key file itself is only read again when its modification time
+ * changes, the last key read is kept for the whole process.
  *
  * The location of the encryption key can be specified in two ways,
  * either by setting the environment variable MS_ENCRYPTION_KEY or using
@@ -254,6 +259,65 @@ int msReadEncryptionKeyFromFile(const char *keyfile, unsigned char *k)
  * Returns MS_SUCCESS/MS_FAILURE.
  **********************************************************************/
 
+/*
+** The last key read from file, shared by all the maps of the process so
+** that a long running process doesn't read the key file for each new map.
+** Protected by TLOCK_CRYPTOCACHE.
+*/
+static char *cachedKeyFile = NULL;
+static long cachedKeyMTime = -1;
+static unsigned char cachedKey[MS_ENCRYPTION_KEY_SIZE];
+
+static long keyFileMTime(const char *keyfile)
+{
+  struct stat sb;
+
+  if (stat(keyfile, &sb) != 0)
+    return -1;
+  return (long) sb.st_mtime;
+}
+
+static int msReadCachedEncryptionKey(const char *keyfile, unsigned char *k)
+{
+  long mtime;
+  int status = MS_SUCCESS;
+
+  mtime = keyFileMTime(keyfile);
+
+  msAcquireLock(TLOCK_CRYPTOCACHE);
+  if (mtime != -1 && cachedKeyFile && cachedKeyMTime == mtime &&
+      strcmp(cachedKeyFile, keyfile) == 0) {
+    memcpy(k, cachedKey, MS_ENCRYPTION_KEY_SIZE);
+  } else {
+    status = msReadEncryptionKeyFromFile(keyfile, k);
+    msFree(cachedKeyFile);
+    cachedKeyFile = NULL;
+    if (status == MS_SUCCESS && mtime != -1) {
+      cachedKeyFile = msStrdup(keyfile);
+      cachedKeyMTime = mtime;
+      memcpy(cachedKey, k, MS_ENCRYPTION_KEY_SIZE);
+    }
+  }
+  msReleaseLock(TLOCK_CRYPTOCACHE);
+
+  return status;
+}
+
+/**********************************************************************
+ *                       msEncryptionKeyCacheCleanup()
+ *
+ * Forget the encryption key cached by msLoadEncryptionKey().
+ **********************************************************************/
+
+void msEncryptionKeyCacheCleanup()
+{
+  msAcquireLock(TLOCK_CRYPTOCACHE);
+  msFree(cachedKeyFile);
+  cachedKeyFile = NULL;
+  memset(cachedKey, 0, MS_ENCRYPTION_KEY_SIZE);
+  msReleaseLock(TLOCK_CRYPTOCACHE);
+}
+
 static int msLoadEncryptionKey(mapObj *map)
 {
   const char *keyfile;
@@ -272,7 +336,7 @@ static int msLoadEncryptionKey(mapObj *map)
     keyfile = getenv("MS_ENCRYPTION_KEY");
 
   if (keyfile &&
-      msReadEncryptionKeyFromFile(keyfile,map->encryption_key) == MS_SUCCESS) {
+      msReadCachedEncryptionKey(keyfile,map->encryption_key) == MS_SUCCESS) {
     map->encryption_key_loaded = MS_TRUE;
   } else {
     msSetError(MS_MISCERR, "Failed reading encryption key. Make sure "
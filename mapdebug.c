@@ -258,7 +258,8 @@ debugLevel msGetGlobalDebugLevel()
 
 /* msDebugInitFromEnv()
 **
-** Init debug state from MS_ERRORFILE and MS_DEBUGLEVEL env vars if set
+** Init debug state from MS_ERRORFILE, MS_DEBUGLEVEL and MS_TRACEFILE env
+** vars if set
 **
 ** Returns MS_SUCCESS/MS_FAILURE
 */
@@ -274,6 +275,11 @@ int msDebugInitFromEnv()
   if( (val=getenv( "MS_DEBUGLEVEL" )) != NULL )
     msSetGlobalDebugLevel(atoi(val));
 
+  if( (val=getenv( "MS_TRACEFILE" )) != NULL ) {
+    if ( msTraceSetFile(val, NULL) != MS_SUCCESS )
+      return MS_FAILURE;
+  }
+
   return MS_SUCCESS;
 }
 
@@ -278,6 +278,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   imageObj *image = NULL;
   struct mstimeval mapstarttime, mapendtime;
   struct mstimeval starttime, endtime;
+  traceSpanObj mapspan, layerspan, span;
 
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
   enum MS_CONNECTION_TYPE lastconnectiontype;
@@ -287,6 +288,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #endif
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&mapstarttime, NULL);
+  msTraceStart(&mapspan, querymap ? "map.drawquery" : "map.draw", NULL);
+  layerspan.active = MS_FALSE;
 
   if(querymap) { /* use queryMapObj image dimensions */
     if(map->querymap.width != -1) map->width = map->querymap.width;
@@ -298,6 +301,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
   if(!image) {
     msSetError(MS_IMGERR, "Unable to initialize image.", "msDrawMap()");
+    msTraceEnd(&mapspan, -1, -1);
     return(NULL);
   }
 
@@ -330,6 +334,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     pasOWSReqInfo = (httpRequestObj *)malloc((numOWSLayers+1)*sizeof(httpRequestObj));
     if (pasOWSReqInfo == NULL) {
       msSetError(MS_MEMERR, "Allocation of httpRequestObj failed.", "msDrawMap()");
+      msTraceEnd(&mapspan, -1, -1);
       return NULL;
     }
     msHTTPInitRequestObj(pasOWSReqInfo, numOWSLayers+1);
@@ -349,6 +354,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           msFreeWmsParamsObj(&sLastWMSParams);
           msFreeImage(image);
           msFree(pasOWSReqInfo);
+          msTraceEnd(&mapspan, -1, -1);
           return NULL;
         }
       }
@@ -360,6 +366,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           msFreeWmsParamsObj(&sLastWMSParams);
           msFreeImage(image);
           msFree(pasOWSReqInfo);
+          msTraceEnd(&mapspan, -1, -1);
           return NULL;
         }
       }
@@ -376,6 +383,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   if(numOWSRequests && msOWSExecuteRequests(pasOWSReqInfo, numOWSRequests, map, MS_TRUE) == MS_FAILURE) {
     msFreeImage(image);
     msFree(pasOWSReqInfo);
+    msTraceEnd(&mapspan, -1, -1);
     return NULL;
   }
 
@@ -401,6 +409,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
       if(!msLayerIsVisible(map, lp)) continue;
 
+      msTraceStart(&layerspan, "layer.draw", lp->name);
+
       if(lp->connectiontype == MS_WMS) {
 #ifdef USE_WMS_LYR
         if(MS_RENDERER_PLUGIN(image->format) || MS_RENDERER_RAWDATA(image->format))
@@ -409,6 +419,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           msSetError(MS_WMSCONNERR, "Output format '%s' doesn't support WMS layers.", "msDrawMap()", image->format->name);
           status = MS_FAILURE;
         }
+        msTraceEnd(&layerspan, -1, -1);
 
         if(status == MS_FAILURE) {
           msSetError(MS_WMSCONNERR,
@@ -420,6 +431,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           msFreeImage(image);
           msHTTPFreeRequestObj(pasOWSReqInfo, numOWSRequests);
           msFree(pasOWSReqInfo);
+          msTraceEnd(&mapspan, -1, -1);
           return(NULL);
         }
 
@@ -427,6 +439,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 #else /* ndef USE_WMS_LYR */
         msSetError(MS_WMSCONNERR, "MapServer not built with WMS Client support, unable to render layer '%s'.", "msDrawMap()", lp->name);
         msFreeImage(image);
+        msTraceEnd(&layerspan, -1, -1);
+        msTraceEnd(&mapspan, -1, -1);
         return(NULL);
 #endif
       } else { /* Default case: anything but WMS layers */
@@ -434,6 +448,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
           status = msDrawQueryLayer(map, lp, image);
         else
           status = msDrawLayer(map, lp, image);
+        msTraceEnd(&layerspan, -1, -1);
         if(status == MS_FAILURE) {
           msSetError(MS_IMGERR, "Failed to draw layer named '%s'.", "msDrawMap()", lp->name);
           msFreeImage(image);
@@ -443,6 +458,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
             msFree(pasOWSReqInfo);
           }
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
+          msTraceEnd(&mapspan, -1, -1);
           return(NULL);
         }
       }
@@ -467,6 +483,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
     if(MS_SUCCESS != msEmbedScalebar(map, image)) {
       msFreeImage( image );
+      msTraceEnd(&mapspan, -1, -1);
       return NULL;
     }
 
@@ -478,13 +495,17 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   if(map->legend.status == MS_EMBED && !map->legend.postlabelcache) {
     if( msEmbedLegend(map, image) != MS_SUCCESS ) {
       msFreeImage( image );
+      msTraceEnd(&mapspan, -1, -1);
       return NULL;
     }
   }
 
   if(map->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&starttime, NULL);
+  msTraceStart(&span, "labelcache.draw", NULL);
+  status = msDrawLabelCache(image, map);
+  msTraceEnd(&span, map->labelcache.numlabels, -1);
 
-  if(msDrawLabelCache(image, map) != MS_SUCCESS) {
+  if(status != MS_SUCCESS) {
     msFreeImage(image);
 #if defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
     if (pasOWSReqInfo) {
@@ -492,6 +513,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
       msFree(pasOWSReqInfo);
     }
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
+    msTraceEnd(&mapspan, -1, -1);
     return(NULL);
   }
 
@@ -510,6 +532,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
     if(!msLayerIsVisible(map, lp)) continue;
 
     if(map->debug >= MS_DEBUGLEVEL_TUNING || lp->debug >= MS_DEBUGLEVEL_TUNING) msGettimeofday(&starttime, NULL);
+    msTraceStart(&layerspan, "layer.draw", lp->name);
 
     if(lp->connectiontype == MS_WMS) {
 #ifdef USE_WMS_LYR
@@ -525,6 +548,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
       else
         status = msDrawLayer(map, lp, image);
     }
+    msTraceEnd(&layerspan, -1, -1);
 
     if(status == MS_FAILURE) {
       msFreeImage(image);
@@ -534,6 +558,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
         msFree(pasOWSReqInfo);
       }
 #endif /* USE_WMS_LYR || USE_WFS_LYR */
+      msTraceEnd(&mapspan, -1, -1);
       return(NULL);
     }
 
@@ -565,6 +590,7 @@ imageObj *msDrawMap(mapObj *map, int querymap)
 
     if(MS_SUCCESS != msEmbedScalebar(map, image)) {
       msFreeImage( image );
+      msTraceEnd(&mapspan, -1, -1);
       return NULL;
     }
 
@@ -581,6 +607,8 @@ imageObj *msDrawMap(mapObj *map, int querymap)
   }
 #endif
 
+  msTraceEnd(&mapspan, -1, -1);
+
   if(map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&mapendtime, NULL);
     msDebug("msDrawMap() total time: %.3fs\n",
@@ -687,6 +715,10 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
 
   if(layer->opacity == 0) return MS_SUCCESS; /* layer is completely transparent, skip it */
 
+  /* the layer's occupancy grid may tell there is nothing here, before any I/O */
+  if(!msLayerIsOccupied(map, layer))
+    return MS_SUCCESS;
+
   /* conditions may have changed since this layer last drawn, so set
      layer->project true to recheck projection needs (Bug #673) */
   layer->project = MS_TRUE;
@@ -900,6 +932,24 @@ int msDrawLayer(mapObj *map, layerObj *layer, imageObj *image)
   return(retcode);
 }
 
+/*
+** msLayerNextShape() that adds the time spent to *elapsed when tracing.
+*/
+static int msTraceLayerNextShape(layerObj *layer, shapeObj *shape, traceSpanObj *span, double *elapsed)
+{
+  double start;
+  int status;
+
+  if(!span->active)
+    return msLayerNextShape(layer, shape);
+
+  start = msTraceNow();
+  status = msLayerNextShape(layer, shape);
+  *elapsed += msTraceNow() - start;
+
+  return status;
+}
+
 int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 {
   int         status, retcode=MS_SUCCESS;
@@ -915,6 +965,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   double minfeaturesize = -1;
   int maxfeatures=-1;
   int featuresdrawn=0;
+  traceSpanObj span, shapespan;
+  double shapetime=0;
+  long featuresread=0;
 
   if (image)
     maxfeatures=msLayerGetMaxFeaturesToDraw(layer, image->format);
@@ -933,7 +986,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
 #endif
 
   /* open this layer */
+  msTraceStart(&span, "layer.open", layer->name);
   status = msLayerOpen(layer);
+  msTraceEnd(&span, -1, -1);
   if(status != MS_SUCCESS) return MS_FAILURE;
 
   /* build item list */
@@ -958,7 +1013,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     searchrect.maxy = map->height-1;
   }
 
+  msTraceStart(&span, "layer.whichshapes", layer->name);
   status = msLayerWhichShapes(layer, searchrect, MS_FALSE);
+  msTraceEnd(&span, -1, -1);
   if(status == MS_DONE) { /* no overlap */
     msLayerClose(layer);
     return MS_SUCCESS;
@@ -978,7 +1035,12 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
   if(layer->minfeaturesize > 0)
     minfeaturesize = Pix2LayerGeoref(map, layer, layer->minfeaturesize);
 
-  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+  /* layer.render covers the whole loop, layer.nextshape only the time spent fetching */
+  msTraceStart(&span, "layer.render", layer->name);
+  msTraceStart(&shapespan, "layer.nextshape", layer->name);
+
+  while((status = msTraceLayerNextShape(layer, &shape, &shapespan, &shapetime)) == MS_SUCCESS) {
+    featuresread++;
 
     /* Check if the shape size is ok to be drawn */
     if((shape.type == MS_SHAPE_LINE || shape.type == MS_SHAPE_POLYGON) && (minfeaturesize > 0) && (msShapeCheckSize(&shape, minfeaturesize) == MS_FALSE)) {
@@ -1114,6 +1176,9 @@ int msDrawVectorLayer(mapObj *map, layerObj *layer, imageObj *image)
     msFreeShape(&shape);
   }
 
+  msTraceEndAggregate(&shapespan, shapetime, featuresread, -1);
+  msTraceEnd(&span, featuresdrawn, -1);
+
   if (classgroup)
     msFree(classgroup);
 
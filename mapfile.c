@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <float.h>
+#include <sys/stat.h>
 
 #include "mapserver.h"
 #include "mapfile.h"
@@ -658,9 +659,9 @@ static void writeColor(FILE *stream, int indent, const char *name, colorObj *def
     sprintf(buffer+4, "%02x", color->blue);
     sprintf(buffer+6, "%02x", color->alpha);
     *(buffer+8) = 0;
-    fprintf(stream, "%s \"#%s\"\n", name, buffer);
+    msIO_fprintf(stream, "%s \"#%s\"\n", name, buffer);
   } else {
-    fprintf(stream, "%s %d %d %d\n", name, color->red, color->green, color->blue);
+    msIO_fprintf(stream, "%s %d %d %d\n", name, color->red, color->green, color->blue);
   }
 #endif
 }
@@ -2414,7 +2415,7 @@ static void writeExpression(FILE *stream, int indent, const char *name, expressi
   writeIndent(stream, ++indent);
   switch(exp->type) {
     case(MS_LIST):
-      fprintf(stream, "%s {%s}", name, exp->string);
+      msIO_fprintf(stream, "%s {%s}", name, exp->string);
       break;
     case(MS_REGEX):
       msIO_fprintf(stream, "%s /%s/", name, exp->string);
@@ -2474,39 +2475,29 @@ int loadHashTable(hashTableObj *ptable)
 
 static void writeHashTable(FILE *stream, int indent, const char *title, hashTableObj *table)
 {
-  struct hashObj *tp;
-  int i;
+  const char *key;
 
   if(!table) return;
   if(msHashIsEmpty(table)) return;
 
   indent++;
   writeBlockBegin(stream, indent, title);
-  for (i=0; i<MS_HASHSIZE; i++) {
-    if (table->items[i] != NULL) {
-      for (tp=table->items[i]; tp!=NULL; tp=tp->next)
-        writeNameValuePair(stream, indent, tp->key, tp->data);
-    }
-  }
+  for (key=msFirstKeyFromHashTable(table); key!=NULL; key=msNextKeyFromHashTable(table, key))
+    writeNameValuePair(stream, indent, key, msLookupHashTable(table, key));
   writeBlockEnd(stream, indent, title);
 }
 
 static void writeHashTableInline(FILE *stream, int indent, char *name, hashTableObj* table)
 {
-  struct hashObj *tp = NULL;
-  int i;
+  const char *key;
 
   if(!table) return;
   if(msHashIsEmpty(table)) return;
 
   ++indent;
-  for (i=0; i<MS_HASHSIZE; ++i) {
-    if (table->items[i] != NULL) {
-      for (tp=table->items[i]; tp!=NULL; tp=tp->next) {
-        writeIndent(stream, indent);
-        msIO_fprintf(stream, "%s \"%s\" \"%s\"\n", name, tp->key, tp->data);
-      }
-    }
+  for (key=msFirstKeyFromHashTable(table); key!=NULL; key=msNextKeyFromHashTable(table, key)) {
+    writeIndent(stream, indent);
+    msIO_fprintf(stream, "%s \"%s\" \"%s\"\n", name, key, msLookupHashTable(table, key));
   }
 }
 
@@ -4634,7 +4625,7 @@ static void writeLayer(FILE *stream, int indent, layerObj *layer)
 
   if(layer->_geomtransform.type == MS_GEOMTRANSFORM_EXPRESSION) {
     writeIndent(stream, indent + 1);
-    fprintf(stream, "GEOMTRANSFORM (%s)\n", layer->_geomtransform.string);
+    msIO_fprintf(stream, "GEOMTRANSFORM (%s)\n", layer->_geomtransform.string);
   }
   
   writeString(stream, indent, "HEADER", NULL, layer->header);
@@ -5817,6 +5808,8 @@ int initMap(mapObj *map)
   map->cellsize = 0;
   map->shapepath = NULL;
   map->mappath = NULL;
+  map->mapfile = NULL;
+  map->mapfile_mtime = 0;
 
   MS_INIT_COLOR(map->imagecolor, 255,255,255,255); /* white */
 
@@ -6412,6 +6405,24 @@ mapObj *msLoadMapFromString(char *buffer, char *new_mappath)
   return map;
 }
 
+/*
+** Remember the file a map was loaded from and its modification time, they
+** identify the map content for the OWS response cache (see mapowscache.c).
+*/
+static void setMapfileIdentity(mapObj *map, const char *filename)
+{
+  char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
+  struct stat stat_buf;
+
+  if(NULL == getcwd(szCWDPath, MS_MAXPATHLEN))
+    return;
+
+  msFree(map->mapfile);
+  map->mapfile = msStrdup(msBuildPath(szPath, szCWDPath, filename));
+  if(stat(map->mapfile, &stat_buf) == 0)
+    map->mapfile_mtime = (long) stat_buf.st_mtime;
+}
+
 /*
 ** Sets up file-based mapfile loading and calls loadMapInternal to do the work.
 */
@@ -6421,6 +6432,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
   struct mstimeval starttime, endtime;
   char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
   int debuglevel;
+  traceSpanObj span;
 
   debuglevel = (int)msGetGlobalDebugLevel();
 
@@ -6446,14 +6458,21 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
     }
   }
 
+  msTraceStart(&span, "mapfile.load", NULL);
+
   /*
   ** Allocate mapObj structure
   */
   map = (mapObj *)calloc(sizeof(mapObj),1);
-  MS_CHECK_ALLOC(map, sizeof(mapObj), NULL);
+  if(!map) {
+    msSetError(MS_MEMERR, NULL, "msLoadMap()");
+    msTraceEnd(&span, -1, -1);
+    return(NULL);
+  }
 
   if(initMap(map) == -1) { /* initialize this map */
     msFree(map);
+    msTraceEnd(&span, -1, -1);
     return(NULL);
   }
 
@@ -6472,6 +6491,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
 
     if (msTransformXmlMapfile(getenv("MS_XMLMAPFILE_XSLT"), filename, msyyin) != MS_SUCCESS) {
       fclose(msyyin);
+      msTraceEnd(&span, -1, -1);
       return NULL;
     }
     fseek ( msyyin , 0 , SEEK_SET );
@@ -6480,6 +6500,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
     if((msyyin = fopen(filename,"r")) == NULL) {
       msSetError(MS_IOERR, "(%s)", "msLoadMap()", filename);
       msReleaseLock( TLOCK_PARSER );
+      msTraceEnd(&span, -1, -1);
       return NULL;
     }
 #ifdef USE_XMLMAPFILE
@@ -6517,10 +6538,13 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
       fclose(msyyin);
       msyyin = NULL;
     }
+    msTraceEnd(&span, -1, -1);
     return NULL;
   }
   msReleaseLock( TLOCK_PARSER );
 
+  setMapfileIdentity(map, filename);
+
   if (debuglevel >= MS_DEBUGLEVEL_TUNING) {
     /* In debug mode, report time spent loading/parsing mapfile. */
     msGettimeofday(&endtime, NULL);
@@ -6528,6 +6552,7 @@ mapObj *msLoadMap(char *filename, char *new_mappath)
             (endtime.tv_sec+endtime.tv_usec/1.0e6)-
             (starttime.tv_sec+starttime.tv_usec/1.0e6) );
   }
+  msTraceEnd(&span, -1, -1);
 
   return map;
 }
@@ -45,6 +45,9 @@
 
 static int    bGDALInitialized = 0;
 
+/* default memory budget of windowed output, in megabytes */
+#define MS_GDAL_WINDOW_SIZE 64
+
 /************************************************************************/
 /*                          msGDALInitialize()                          */
 /************************************************************************/
@@ -139,6 +142,43 @@ void CleanVSIDir( const char *pszDir )
   CSLDestroy( papszFiles );
 }
 
+/************************************************************************/
+/*                           StreamVSIFile()                            */
+/*                                                                      */
+/*      Copy a temporary file to stdout and delete it.                  */
+/************************************************************************/
+
+static int StreamVSIFile( const char *filename, const char *pszFunction )
+
+{
+  FILE *fp;
+  unsigned char block[4000];
+  int bytes_read;
+
+  if( msIO_needBinaryStdout() == MS_FAILURE )
+    return MS_FAILURE;
+
+  /* We aren't sure how far back GDAL exports the VSI*L API, so
+     we only use it if we suspect we need it.  But we do need it if
+     holding temporary file in memory. */
+  fp = VSIFOpenL( filename, "rb" );
+  if( fp == NULL ) {
+    msSetError( MS_MISCERR,
+                "Failed to open %s for streaming to stdout.",
+                pszFunction, filename );
+    return MS_FAILURE;
+  }
+
+  while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
+    msIO_fwrite( block, 1, bytes_read, stdout );
+
+  VSIFCloseL( fp );
+
+  VSIUnlink( filename );
+
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                          msSaveImageGDAL()                           */
 /************************************************************************/
@@ -518,36 +558,292 @@ int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename )
   /*      stdout and delete the file.                                     */
   /* -------------------------------------------------------------------- */
   if( bFileIsTemporary ) {
-    FILE *fp;
-    unsigned char block[4000];
-    int bytes_read;
-
-    if( msIO_needBinaryStdout() == MS_FAILURE )
+    if( StreamVSIFile( filename, "msSaveImageGDAL()" ) != MS_SUCCESS )
       return MS_FAILURE;
 
-    /* We aren't sure how far back GDAL exports the VSI*L API, so
-       we only use it if we suspect we need it.  But we do need it if
-       holding temporary file in memory. */
-    fp = VSIFOpenL( filename, "rb" );
-    if( fp == NULL ) {
-      msSetError( MS_MISCERR,
-                  "Failed to open %s for streaming to stdout.",
-                  "msSaveImageGDAL()", filename );
-      return MS_FAILURE;
+    CleanVSIDir( "/vsimem/msout" );
+
+    free( filename );
+  }
+
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                     msGetRasterWindowLinesGDAL()                     */
+/*                                                                      */
+/*      Number of lines to render at a time when saving layer with      */
+/*      msSaveRasterLayerGDAL(), or 0 when the map fits in a single     */
+/*      window or can't be rendered by windows, in which case it        */
+/*      should be drawn in one image and saved with msSaveImageGDAL()   */
+/*      as usual.  The window size is given in megabytes by the         */
+/*      MS_GDAL_WINDOW_SIZE config option (0 disables windows).         */
+/************************************************************************/
+
+int msGetRasterWindowLinesGDAL( mapObj *map, layerObj *layer )
+
+{
+  outputFormatObj *format = map->outputformat;
+  const char *value;
+  double dfWindowSize = MS_GDAL_WINDOW_SIZE;
+  double dfLineSize;
+  GDALDriverH hDriver;
+  int nLines;
+
+  if( format == NULL || !MS_RENDERER_RAWDATA(format)
+      || format->driver == NULL || strncasecmp(format->driver, "GDAL/", 5) != 0 )
+    return 0;
+
+  /* masks and rotations are computed for the whole image */
+  if( layer->mask || map->gt.rotation_angle != 0.0 || map->height < 3 )
+    return 0;
+
+#ifdef USE_EXEMPI
+  if( msXmpPresent(map) )
+    return 0;
+#endif
+
+  value = msGetConfigOption( map, "MS_GDAL_WINDOW_SIZE" );
+  if( value != NULL )
+    dfWindowSize = atof( value );
+  if( dfWindowSize <= 0 )
+    return 0;
+
+  dfLineSize = (double) map->width * MS_MAX(format->bands, 1);
+  if( format->imagemode == MS_IMAGEMODE_INT16 )
+    dfLineSize *= 2;
+  else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+    dfLineSize *= 4;
+
+  if( dfLineSize * map->height <= dfWindowSize * 1024 * 1024 )
+    return 0;
+
+  nLines = MS_MAX( (int) (dfWindowSize * 1024 * 1024 / dfLineSize), 2 );
+
+  /* the output is written as we go, the driver must support Create() */
+  msGDALInitialize();
+  msAcquireLock( TLOCK_GDAL );
+  hDriver = GDALGetDriverByName( format->driver+5 );
+  if( hDriver == NULL
+      || GDALGetMetadataItem( hDriver, GDAL_DCAP_CREATE, NULL ) == NULL )
+    nLines = 0;
+  msReleaseLock( TLOCK_GDAL );
+
+  return nLines;
+}
+
+/************************************************************************/
+/*                       msSaveRasterLayerGDAL()                        */
+/*                                                                      */
+/*      Render a raster layer into a file of the (raw mode) map         */
+/*      output format a window of nWindowLines lines at a time, so      */
+/*      that only one window of the map is held in memory.  The         */
+/*      lines are written directly in the output dataset, which is      */
+/*      streamed to stdout through a temporary file on disk if no       */
+/*      filename is given.                                              */
+/************************************************************************/
+
+int msSaveRasterLayerGDAL( mapObj *map, layerObj *layer, char *filename,
+                           int nWindowLines )
+
+{
+  outputFormatObj *format = map->outputformat;
+  int  bFileIsTemporary = MS_FALSE;
+  GDALDriverH  hOutputDriver;
+  GDALDatasetH hOutputDS;
+  GDALDataType eDataType = GDT_Byte;
+  char        **papszOptions = NULL;
+  int          nBands = format->bands, nPixelSize = 1;
+  int          nHeight = map->height, iLine, nLines;
+  int          status = MS_SUCCESS;
+  rectObj      sExtent = map->extent;
+  double       dfLineStep;
+
+  if( nWindowLines < 2 || nHeight < 2 ) {
+    msSetError( MS_MISCERR, "Invalid window size.", "msSaveRasterLayerGDAL()" );
+    return MS_FAILURE;
+  }
+
+  if( format->imagemode == MS_IMAGEMODE_INT16 ) {
+    eDataType = GDT_Int16;
+    nPixelSize = 2;
+  } else if( format->imagemode == MS_IMAGEMODE_FLOAT32 ) {
+    eDataType = GDT_Float32;
+    nPixelSize = 4;
+  } else if( format->imagemode != MS_IMAGEMODE_BYTE ) {
+    msSetError( MS_MISCERR, "Only raw image modes can be written by windows.",
+                "msSaveRasterLayerGDAL()" );
+    return MS_FAILURE;
+  }
+
+  msGDALInitialize();
+
+  /* -------------------------------------------------------------------- */
+  /*      The temporary file stays on disk, holding it in memory would    */
+  /*      defeat the purpose.                                             */
+  /* -------------------------------------------------------------------- */
+  if( filename == NULL ) {
+    const char *pszExtension = format->extension;
+    if( pszExtension == NULL )
+      pszExtension = "img.tmp";
+
+    filename = msTmpFile(map, map->mappath, NULL, pszExtension);
+    bFileIsTemporary = MS_TRUE;
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Create the output dataset.                                      */
+  /* -------------------------------------------------------------------- */
+  msAcquireLock( TLOCK_GDAL );
+  hOutputDriver = GDALGetDriverByName( format->driver+5 );
+  if( hOutputDriver == NULL ) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MISCERR, "Failed to find %s driver.",
+                "msSaveRasterLayerGDAL()", format->driver+5 );
+    if( bFileIsTemporary ) free( filename );
+    return MS_FAILURE;
+  }
+
+  papszOptions = (char**)calloc(sizeof(char *),(format->numformatoptions+1));
+  if (papszOptions == NULL) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MEMERR, "Out of memory allocating %u bytes.\n", "msSaveRasterLayerGDAL()",
+                (unsigned int)(sizeof(char *)*(format->numformatoptions+1)));
+    if( bFileIsTemporary ) free( filename );
+    return MS_FAILURE;
+  }
+
+  memcpy( papszOptions, format->formatoptions,
+          sizeof(char *) * format->numformatoptions );
+
+  hOutputDS = GDALCreate( hOutputDriver, filename, map->width, nHeight,
+                          nBands, eDataType, papszOptions );
+
+  free( papszOptions );
+
+  if( hOutputDS == NULL ) {
+    msReleaseLock( TLOCK_GDAL );
+    msSetError( MS_MISCERR, "Failed to create output %s file.\n%s",
+                "msSaveRasterLayerGDAL()", format->driver+5,
+                CPLGetLastErrorMsg() );
+    if( bFileIsTemporary ) free( filename );
+    return MS_FAILURE;
+  }
+
+  {
+    char *pszWKT;
+
+    GDALSetGeoTransform( hOutputDS, map->gt.geotransform );
+
+    pszWKT = msProjectionObj2OGCWKT( &(map->projection) );
+    if( pszWKT != NULL ) {
+      GDALSetProjection( hOutputDS, pszWKT );
+      msFree( pszWKT );
     }
+  }
 
-    while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
-      msIO_fwrite( block, 1, bytes_read, stdout );
+  if( msGetOutputFormatOption(format,"NULLVALUE",NULL) != NULL ) {
+    int iBand;
+    const char *nullvalue = msGetOutputFormatOption(format,
+                            "NULLVALUE",NULL);
 
-    VSIFCloseL( fp );
+    for( iBand = 0; iBand < nBands; iBand++ ) {
+      GDALRasterBandH hBand = GDALGetRasterBand( hOutputDS, iBand+1 );
+      GDALSetRasterNoDataValue( hBand, atof(nullvalue) );
+    }
+  }
 
-    VSIUnlink( filename );
-    CleanVSIDir( "/vsimem/msout" );
+  if( map->resolution > 0 ) {
+    char res[30];
+
+    sprintf( res, "%lf", map->resolution );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_XRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_YRESOLUTION", res, NULL );
+    GDALSetMetadataItem( hOutputDS, "TIFFTAG_RESOLUTIONUNIT", "2", NULL );
+  }
+  msReleaseLock( TLOCK_GDAL );
+
+  /* -------------------------------------------------------------------- */
+  /*      Draw the layer window by window.  The extent is pixel center    */
+  /*      based, so a window needs at least two lines.                    */
+  /* -------------------------------------------------------------------- */
+  dfLineStep = (sExtent.maxy - sExtent.miny) / (nHeight - 1);
 
+  for( iLine = 0; iLine < nHeight && status == MS_SUCCESS; iLine += nLines ) {
+    imageObj *window;
+    GByte *pabyData;
+    int iBand;
+
+    nLines = MS_MIN( nWindowLines, nHeight - iLine );
+    if( nHeight - iLine - nLines == 1 )
+      nLines++;
+
+    map->height = nLines;
+    map->extent.maxy = sExtent.maxy - iLine * dfLineStep;
+    map->extent.miny = map->extent.maxy - (nLines - 1) * dfLineStep;
+    msMapComputeGeotransform( map );
+
+    window = msImageCreate( map->width, nLines, format,
+                            map->web.imagepath, map->web.imageurl,
+                            map->resolution, map->defresolution,
+                            &map->imagecolor );
+    if( window == NULL ) {
+      status = MS_FAILURE;
+      break;
+    }
+
+    status = msDrawRasterLayerLow( map, layer, window, NULL );
+    if( status != MS_SUCCESS ) {
+      msFreeImage( window );
+      break;
+    }
+
+    if( format->imagemode == MS_IMAGEMODE_INT16 )
+      pabyData = (GByte *) window->img.raw_16bit;
+    else if( format->imagemode == MS_IMAGEMODE_FLOAT32 )
+      pabyData = (GByte *) window->img.raw_float;
+    else
+      pabyData = (GByte *) window->img.raw_byte;
+
+    msAcquireLock( TLOCK_GDAL );
+    for( iBand = 0; iBand < nBands && status == MS_SUCCESS; iBand++ ) {
+      GDALRasterBandH hBand = GDALGetRasterBand( hOutputDS, iBand+1 );
+
+      if( GDALRasterIO( hBand, GF_Write, 0, iLine, map->width, nLines,
+                        pabyData + (size_t) iBand * map->width * nLines * nPixelSize,
+                        map->width, nLines, eDataType, 0, 0 ) != CE_None ) {
+        msSetError( MS_MISCERR, "Failed to write lines %d to %d.\n%s",
+                    "msSaveRasterLayerGDAL()", iLine, iLine + nLines - 1,
+                    CPLGetLastErrorMsg() );
+        status = MS_FAILURE;
+      }
+    }
+    msReleaseLock( TLOCK_GDAL );
+
+    msFreeImage( window );
+
+    if( layer->debug >= MS_DEBUGLEVEL_VV )
+      msDebug( "msSaveRasterLayerGDAL(): wrote lines %d to %d of %d.\n",
+               iLine, iLine + nLines - 1, nHeight );
+  }
+
+  map->height = nHeight;
+  map->extent = sExtent;
+  msMapComputeGeotransform( map );
+
+  msAcquireLock( TLOCK_GDAL );
+  GDALClose( hOutputDS );
+  msReleaseLock( TLOCK_GDAL );
+
+  if( bFileIsTemporary ) {
+    if( status == MS_SUCCESS )
+      status = StreamVSIFile( filename, "msSaveRasterLayerGDAL()" );
+    else
+      VSIUnlink( filename );
     free( filename );
   }
 
-  return MS_SUCCESS;
+  return status;
 }
 
 /************************************************************************/
@@ -28,11 +28,20 @@
  ****************************************************************************/
 
 #include <ctype.h>
-
 #include "mapserver.h"
 #include "maphash.h"
 
-
+/*
+** Items are kept in an array in insertion order, which is also the
+** iteration order. Lookups go through an open addressing (linear probing)
+** index of that array, with at most half of its slots in use. Each item
+** caches the hash of its key, so probes only compare keys whose hash
+** matches and growing the table does not hash keys again.
+**
+** A removed item keeps its slot, key and value until the table next grows
+** or is freed: callers may still hold the key or value (re-inserting a
+** value just looked up, or iterating on from a key just removed).
+*/
 
 static unsigned hash(const char *key)
 {
@@ -41,37 +50,127 @@ static unsigned hash(const char *key)
   for(hashval=0; *key!='\0'; key++)
     hashval = tolower(*key) + 31 * hashval;
 
-  return(hashval % MS_HASHSIZE);
+  return(hashval);
 }
 
-hashTableObj *msCreateHashTable()
+static int allocHashItems(hashTableObj *table, int maxentries)
 {
   int i;
-  hashTableObj *table;
 
-  table = (hashTableObj *) msSmallMalloc(sizeof(hashTableObj));
-  table->items = (struct hashObj **) msSmallMalloc(sizeof(struct hashObj *)*MS_HASHSIZE);
+  table->items = (struct hashObj *) malloc(sizeof(struct hashObj)*maxentries);
+  MS_CHECK_ALLOC(table->items, sizeof(struct hashObj)*maxentries, MS_FAILURE);
+  table->slots = (int *) malloc(sizeof(int)*maxentries*2);
+  if(table->slots == NULL) {
+    free(table->items);
+    table->items = NULL;
+    MS_CHECK_ALLOC(table->slots, sizeof(int)*maxentries*2, MS_FAILURE);
+  }
 
-  for (i=0; i<MS_HASHSIZE; i++)
-    table->items[i] = NULL;
+  for (i=0; i<maxentries*2; i++)
+    table->slots[i] = -1;
+  table->numslots = maxentries*2;
+  table->maxentries = maxentries;
+  table->numentries = 0;
   table->numitems = 0;
 
-  return table;
+  return MS_SUCCESS;
 }
 
-int initHashTable( hashTableObj *table )
+/*
+** Slot holding the item with key prefix+key (prefix may be NULL), or the
+** free slot ending the probe sequence when there is no such item.
+*/
+static int findSlot(hashTableObj *table, unsigned hashval, const char *prefix, int prefixlen, const char *key)
 {
-  int i;
+  unsigned mask = table->numslots - 1;
+  unsigned i = hashval & mask;
+  struct hashObj *tp;
 
-  table->items = (struct hashObj **) malloc(sizeof(struct hashObj *)*MS_HASHSIZE);
-  MS_CHECK_ALLOC(table->items, sizeof(struct hashObj *)*MS_HASHSIZE, MS_FAILURE);
+  while (table->slots[i] != -1) {
+    tp = table->items + table->slots[i];
+    if (!tp->removed && tp->hashval == hashval) {
+      if (prefix == NULL) {
+        if (strcasecmp(key, tp->key) == 0)
+          break;
+      } else if (strncasecmp(prefix, tp->key, prefixlen) == 0 &&
+                 strcasecmp(key, tp->key + prefixlen) == 0)
+        break;
+    }
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+static struct hashObj *findItem(hashTableObj *table, const char *key)
+{
+  int slot;
+
+  if (!table || !table->items || !key)
+    return NULL;
+
+  slot = table->slots[findSlot(table, hash(key), NULL, 0, key)];
+  return (slot == -1) ? NULL : table->items + slot;
+}
+
+/*
+** Make room for at least one more item: drop removed items and double the
+** size of the table when more than half of the items are in use.
+*/
+static int growHashTable(hashTableObj *table)
+{
+  struct hashObj *items = table->items;
+  int *slots = table->slots;
+  int i, numentries = table->numentries;
+  int maxentries = table->maxentries;
+  struct hashObj *tp;
+
+  if (table->numitems*2 >= maxentries)
+    maxentries *= 2;
+
+  if (allocHashItems(table, maxentries) != MS_SUCCESS) {
+    table->items = items;
+    table->slots = slots;
+    return MS_FAILURE;
+  }
+
+  for (i=0; i<numentries; i++) {
+    if (items[i].removed) {
+      msFree(items[i].key);
+      msFree(items[i].data);
+      continue;
+    }
+    tp = table->items + table->numentries;
+    *tp = items[i];
+    table->slots[findSlot(table, tp->hashval, NULL, 0, tp->key)] = table->numentries;
+    table->numentries++;
+    table->numitems++;
+  }
+
+  free(items);
+  free(slots);
 
-  for (i=0; i<MS_HASHSIZE; i++)
-    table->items[i] = NULL;
-  table->numitems = 0;
   return MS_SUCCESS;
 }
 
+hashTableObj *msCreateHashTable()
+{
+  hashTableObj *table;
+
+  table = (hashTableObj *) msSmallMalloc(sizeof(hashTableObj));
+  if (initHashTable(table) != MS_SUCCESS) {
+    free(table);
+    return NULL;
+  }
+
+  return table;
+}
+
+int initHashTable( hashTableObj *table )
+{
+  return allocHashItems(table, MS_HASH_INITSIZE);
+}
+
 void msFreeHashTable( hashTableObj *table )
 {
   if( table != NULL ) {
@@ -93,22 +192,18 @@ int msHashIsEmpty( hashTableObj *table )
 void msFreeHashItems( hashTableObj *table )
 {
   int i;
-  struct hashObj *tp=NULL;
-  struct hashObj *prev_tp=NULL;
 
   if (table) {
     if(table->items) {
-      for (i=0; i<MS_HASHSIZE; i++) {
-        if (table->items[i] != NULL) {
-          for (tp=table->items[i]; tp!=NULL; prev_tp=tp,tp=tp->next,free(prev_tp)) {
-            msFree(tp->key);
-            msFree(tp->data);
-          }
-        }
-        if (tp) free(tp);
+      for (i=0; i<table->numentries; i++) {
+        msFree(table->items[i].key);
+        msFree(table->items[i].data);
       }
       free(table->items);
+      free(table->slots);
       table->items = NULL;
+      table->slots = NULL;
+      table->numentries = table->maxentries = table->numslots = 0;
     } else {
       msSetError(MS_HASHERR, "No items allocated.", "msFreeHashItems()");
     }
@@ -121,46 +216,80 @@ struct hashObj *msInsertHashTable(hashTableObj *table,
                                   const char *key, const char *value) {
   struct hashObj *tp;
   unsigned hashval;
+  char *data;
+  int slot;
 
-  if (!table || !key || !value) {
+  if (!table || !table->items || !key || !value) {
     msSetError(MS_HASHERR, "Invalid hash table or key",
                "msInsertHashTable");
     return NULL;
   }
 
-  for (tp=table->items[hash(key)]; tp!=NULL; tp=tp->next)
-    if(strcasecmp(key, tp->key) == 0)
-      break;
+  /* copied first, value (or key) may belong to an item freed below */
+  if ((data = msStrdup(value)) == NULL)
+    return NULL;
+
+  hashval = hash(key);
+  slot = findSlot(table, hashval, NULL, 0, key);
+
+  if (table->slots[slot] == -1) { /* not found */
+    char *newkey = msStrdup(key);
 
-  if (tp == NULL) { /* not found */
-    tp = (struct hashObj *) malloc(sizeof(*tp));
-    MS_CHECK_ALLOC(tp, sizeof(*tp), NULL);
-    tp->key = msStrdup(key);
-    hashval = hash(key);
-    tp->next = table->items[hashval];
-    table->items[hashval] = tp;
+    if (table->numentries == table->maxentries) {
+      if (growHashTable(table) != MS_SUCCESS) {
+        free(newkey);
+        free(data);
+        return NULL;
+      }
+      slot = findSlot(table, hashval, NULL, 0, newkey);
+    }
+    tp = table->items + table->numentries;
+    tp->key = newkey;
+    tp->hashval = hashval;
+    tp->removed = MS_FALSE;
+    table->slots[slot] = table->numentries;
+    table->numentries++;
     table->numitems++;
   } else {
+    tp = table->items + table->slots[slot];
     free(tp->data);
   }
 
-  if ((tp->data = msStrdup(value)) == NULL)
-    return NULL;
+  tp->data = data;
 
   return tp;
 }
 
 char *msLookupHashTable(hashTableObj *table, const char *key)
 {
-  struct hashObj *tp;
+  struct hashObj *tp = findItem(table, key);
 
-  if (!table || !key) {
-    return(NULL);
+  return tp ? tp->data : NULL;
+}
+
+char *msLookupHashTablePrefixed(hashTableObj *table, const char **prefixes,
+                                int numprefixes, const char *key)
+{
+  unsigned keyhash, prefixhash, scale;
+  const char *p;
+  int i, slot;
+
+  if (!table || !table->items || !key || table->numitems == 0)
+    return NULL;
+
+  /* hash(prefix+key) == hash(prefix)*31^strlen(key) + hash(key) */
+  for (keyhash=0, scale=1, p=key; *p!='\0'; p++) {
+    keyhash = tolower(*p) + 31 * keyhash;
+    scale *= 31;
   }
 
-  for (tp=table->items[hash(key)]; tp!=NULL; tp=tp->next)
-    if (strcasecmp(key, tp->key) == 0)
-      return(tp->data);
+  for (i=0; i<numprefixes; i++) {
+    prefixhash = hash(prefixes[i]);
+    slot = table->slots[findSlot(table, prefixhash*scale + keyhash,
+                                 prefixes[i], strlen(prefixes[i]), key)];
+    if (slot != -1)
+      return table->items[slot].data;
+  }
 
   return NULL;
 }
@@ -168,56 +297,37 @@ char *msLookupHashTable(hashTableObj *table, const char *key)
 int msRemoveHashTable(hashTableObj *table, const char *key)
 {
   struct hashObj *tp;
-  struct hashObj *prev_tp=NULL;
-  int status = MS_FAILURE;
 
   if (!table || !key) {
     msSetError(MS_HASHERR, "No hash table", "msRemoveHashTable");
     return MS_FAILURE;
   }
 
-  tp=table->items[hash(key)];
+  tp = findItem(table, key);
   if (!tp) {
     msSetError(MS_HASHERR, "No such hash entry", "msRemoveHashTable");
     return MS_FAILURE;
   }
 
-  prev_tp = NULL;
-  while (tp != NULL) {
-    if (strcasecmp(key, tp->key) == 0) {
-      status = MS_SUCCESS;
-      if (prev_tp) {
-        prev_tp->next = tp->next;
-        free(tp);
-        break;
-      } else {
-        table->items[hash(key)] = tp->next;
-        free(tp);
-        break;
-      }
-    }
-    prev_tp = tp;
-    tp = tp->next;
-  }
-
-  if (status == MS_SUCCESS)
-    table->numitems--;
+  /* key and value are freed once the table is resized, see above */
+  tp->removed = MS_TRUE;
+  table->numitems--;
 
-  return status;
+  return MS_SUCCESS;
 }
 
 const char *msFirstKeyFromHashTable( hashTableObj *table )
 {
-  int hash_index;
+  int i;
 
   if (!table) {
     msSetError(MS_HASHERR, "No hash table", "msFirstKeyFromHashTable");
     return NULL;
   }
 
-  for (hash_index = 0; hash_index < MS_HASHSIZE; hash_index++ ) {
-    if (table->items[hash_index] != NULL )
-      return table->items[hash_index]->key;
+  for (i=0; i<table->numentries; i++) {
+    if (!table->items[i].removed)
+      return table->items[i].key;
   }
 
   return NULL;
@@ -225,8 +335,8 @@ const char *msFirstKeyFromHashTable( hashTableObj *table )
 
 const char *msNextKeyFromHashTable( hashTableObj *table, const char *lastKey )
 {
-  int hash_index;
   struct hashObj *link;
+  int i;
 
   if (!table) {
     msSetError(MS_HASHERR, "No hash table", "msNextKeyFromHashTable");
@@ -236,19 +346,24 @@ const char *msNextKeyFromHashTable( hashTableObj *table, const char *lastKey )
   if ( lastKey == NULL )
     return msFirstKeyFromHashTable( table );
 
-  hash_index = hash(lastKey);
-  for ( link = table->items[hash_index];
-        link != NULL && strcasecmp(lastKey,link->key) != 0;
-        link = link->next ) {}
-
-  if ( link != NULL && link->next != NULL )
-    return link->next->key;
+  link = findItem(table, lastKey);
+  if (link == NULL) {
+    /* lastKey may have been removed during the iteration, go on from the
+       place it had (the last one if it was removed more than once) */
+    for (i=table->numentries-1; i>=0; i--) {
+      if (table->items[i].removed && strcasecmp(lastKey, table->items[i].key) == 0) {
+        link = table->items + i;
+        break;
+      }
+    }
+    if (link == NULL)
+      return NULL;
+  }
 
-  while ( ++hash_index < MS_HASHSIZE ) {
-    if ( table->items[hash_index] != NULL )
-      return table->items[hash_index]->key;
+  for (i=link-table->items+1; i<table->numentries; i++) {
+    if (!table->items[i].removed)
+      return table->items[i].key;
   }
 
   return NULL;
 }
-
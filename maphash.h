@@ -40,7 +40,8 @@ extern "C" {
 #define  MS_DLL_EXPORT
 #endif
 
-#define MS_HASHSIZE 41
+/* number of items a new table has room for, it grows as needed */
+#define MS_HASH_INITSIZE 8
 
   /* =========================================================================
    * Structs
@@ -48,15 +49,20 @@ extern "C" {
 
 #ifndef SWIG
   struct hashObj {
-    struct hashObj *next;  /* pointer to next item */
     char           *key;   /* string key that is hashed */
     char           *data;  /* string stored in this item */
+    unsigned        hashval; /* case insensitive hash of key */
+    int             removed; /* key and data kept until the table grows */
   };
 #endif /*SWIG*/
 
   typedef struct {
 #ifndef SWIG
-    struct hashObj **items;  /* the hash table */
+    struct hashObj *items;  /* the items, in insertion order */
+    int             *slots;  /* open addressing index into items, -1 if free */
+    int              numslots; /* power of 2, twice maxentries */
+    int              numentries; /* used entries of items, removed ones included */
+    int              maxentries; /* allocated entries of items */
 #endif
 #ifdef SWIG
     %immutable;
@@ -117,6 +123,19 @@ extern "C" {
    */
   MS_DLL_EXPORT char *msLookupHashTable( hashTableObj *table, const char *key);
 
+  /* msLookupHashTablePrefixed - get the value of the first of several
+   *     prefixed variants of a key, e.g. "wms_title" then "ows_title"
+   * ARGS:
+   *     table - the target hash table
+   *     prefixes - the prefixes, in order of precedence
+   *     numprefixes - number of prefixes
+   *     key   - key string without prefix
+   * RETURNS:
+   *     string value of the first prefix+key present, or NULL
+   */
+  MS_DLL_EXPORT char *msLookupHashTablePrefixed( hashTableObj *table,
+      const char **prefixes, int numprefixes, const char *key);
+
   /* msRemoveHashTable - remove item from table at key
    * ARGS:
    *     table - target hash table
@@ -130,7 +149,7 @@ extern "C" {
    * ARGS:
    *     table - target hash table
    * RETURNS:
-   *     first key as a string
+   *     first key as a string, keys are returned in insertion order
    */
   MS_DLL_EXPORT const char *msFirstKeyFromHashTable( hashTableObj *table );
 
@@ -139,7 +158,8 @@ extern "C" {
    *     table - target hash table
    *     prevkey - the previous key
    * RETURNS:
-   *     the key of the item of following prevkey as a string
+   *     the key of the item of following prevkey as a string, prevkey
+   *     may have been removed since it was returned
    */
   MS_DLL_EXPORT const char *msNextKeyFromHashTable( hashTableObj *table,
       const char *prevkey );
@@ -133,6 +133,7 @@ void msHTTPInitRequestObj(httpRequestObj *pasReqInfo, int numRequests)
     pasReqInfo[i].nMaxBytes = 0;
     pasReqInfo[i].nStatus = 0;
     pasReqInfo[i].pszContentType = NULL;
+    pasReqInfo[i].nMaxAge = -1;
     pasReqInfo[i].pszErrBuf = NULL;
     pasReqInfo[i].pszUserAgent = NULL;
     pasReqInfo[i].pszHTTPCookieData = NULL;
@@ -266,6 +267,43 @@ static size_t msHTTPWriteFct(void *buffer, size_t size, size_t nmemb,
   }
 }
 
+/**********************************************************************
+ *                          msHTTPHeaderFct()
+ *
+ * CURL_HEADERFUNCTION callback. Picks the freshness lifetime of the
+ * response from its Cache-Control header, or from Expires when there is
+ * no Cache-Control max-age.
+ **********************************************************************/
+static size_t msHTTPHeaderFct(void *buffer, size_t size, size_t nmemb,
+                              void *reqInfo)
+{
+  httpRequestObj *psReq = (httpRequestObj *)reqInfo;
+  size_t len = size*nmemb;
+  char *pszHeader, *pszValue;
+
+  pszHeader = (char *) msSmallMalloc(len+1);
+  memcpy(pszHeader, buffer, len);
+  pszHeader[len] = '\0';
+
+  if (strncmp(pszHeader, "HTTP/", 5) == 0) {
+    /* status line, the response before was a redirection */
+    psReq->nMaxAge = -1;
+  } else if (strncasecmp(pszHeader, "Cache-Control:", 14) == 0) {
+    msStringToLower(pszHeader);
+    if (strstr(pszHeader, "no-cache") || strstr(pszHeader, "no-store"))
+      psReq->nMaxAge = 0;
+    else if ((pszValue = strstr(pszHeader, "max-age=")) != NULL)
+      psReq->nMaxAge = MS_MAX(0, atoi(pszValue + 8));
+  } else if (strncasecmp(pszHeader, "Expires:", 8) == 0 && psReq->nMaxAge == -1) {
+    time_t expires = curl_getdate(pszHeader + 8, NULL);
+    time_t now = time(NULL);
+    psReq->nMaxAge = (expires > now) ? (int)(expires - now) : 0;
+  }
+
+  msFree(pszHeader);
+  return len;
+}
+
 /**********************************************************************
  *                          msGetCURLAuthType()
  *
@@ -508,6 +546,7 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
     if (pasReqInfo[i].pszContentType)
       free(pasReqInfo[i].pszContentType);
     pasReqInfo[i].pszContentType = NULL;
+    pasReqInfo[i].nMaxAge = -1;
 
     /* Check local cache if requested */
     if (bCheckLocalCache && pasReqInfo[i].pszOutputFile != NULL ) {
@@ -660,6 +699,8 @@ int msHTTPExecuteRequests(httpRequestObj *pasReqInfo, int numRequests,
 
     curl_easy_setopt(http_handle, CURLOPT_WRITEDATA, &(pasReqInfo[i]));
     curl_easy_setopt(http_handle, CURLOPT_WRITEFUNCTION, msHTTPWriteFct);
+    curl_easy_setopt(http_handle, CURLOPT_HEADERDATA, &(pasReqInfo[i]));
+    curl_easy_setopt(http_handle, CURLOPT_HEADERFUNCTION, msHTTPHeaderFct);
 
     /* Provide a buffer where libcurl can write human readable error msgs
      */
@@ -66,6 +66,8 @@ extern "C" {
     int     height;
     int     nStatus;            /* 200=success, value < 0 if request failed */
     char    *pszContentType;    /* Content-Type of the response */
+    int     nMaxAge;            /* seconds the response stays fresh (from
+                                   Cache-Control or Expires), -1 if not given */
     char    *pszErrBuf;         /* Buffer where curl can write errors */
     char    *pszPostRequest;    /* post request content (NULL for GET) */
     char    *pszPostContentType;/* post request MIME type */
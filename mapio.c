@@ -660,6 +660,31 @@ int msIO_needBinaryStdin()
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                       msIO_setStdoutStreaming()                      */
+/*                                                                      */
+/*      Called by the mapserv executable, where whatever is written     */
+/*      to stdout is the final response and is never written again.    */
+/*      Renderers may then send their output to stdout as they          */
+/*      produce it rather than keeping a copy of the whole document.    */
+/*      Everywhere else (mapscript, output captured in a buffer) the    */
+/*      output of an image must remain available for another save.     */
+/************************************************************************/
+
+static int stdout_streaming = MS_FALSE;
+
+void msIO_setStdoutStreaming( int streaming )
+
+{
+  stdout_streaming = streaming;
+}
+
+int msIO_getStdoutStreaming()
+
+{
+  return stdout_streaming;
+}
+
 /* ==================================================================== */
 /*      memory buffer io handling functions.                            */
 /* ==================================================================== */
@@ -114,6 +114,11 @@ extern "C" {
   int msIO_needBinaryStdout( void );
   int msIO_needBinaryStdin( void );
 
+  /* set by mapserv, output written to stdout is final and may be streamed */
+
+  void MS_DLL_EXPORT msIO_setStdoutStreaming( int streaming );
+  int MS_DLL_EXPORT msIO_getStdoutStreaming( void );
+
 #ifdef __cplusplus
 }
 #endif
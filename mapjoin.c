@@ -28,6 +28,10 @@
  ****************************************************************************/
 
 #include "mapserver.h"
+#include "mapthread.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 
@@ -154,6 +158,214 @@ int msJoinClose(joinObj *join)
   return MS_FAILURE;
 }
 
+/*  */
+/* Join table indexes */
+/*  */
+
+/*
+** XBase and CSV join tables are indexed on their "to" column the first time
+** they are used: a hash of the key values gives, for each key, the chain of
+** matching rows in file order, so a join costs one lookup per feature instead
+** of a scan of the whole table.
+**
+** Indexes are kept process wide (FastCGI, mapscript) in a small list keyed
+** on the table path and column, and rebuilt when the file modification time
+** (to the nanosecond where the platform has it) or size changes. An index
+** whose row count differs from the table as it is read now is not used, and
+** CSV tables, which are read whole, also check the keys row by row. They are
+** reference counted, an index replaced while in use is freed by its last user.
+*/
+#define MS_JOIN_INDEX_CACHE_SIZE 16
+
+typedef struct {
+  long sec; /* -1 if the table couldn't be stat'ed */
+  long nsec; /* 0 where the platform doesn't have it */
+  long size;
+} joinTableStampObj;
+
+typedef struct joinIndexObj {
+  char *path;
+  int column;
+  joinTableStampObj stamp;
+  int refcount;
+
+  int numrows;
+  char **keys;     /* key of each row */
+  int *buckets;    /* first row of each hash bucket, -1 if none */
+  int numbuckets;  /* a power of 2 */
+  int *chain;      /* next row in the same bucket, -1 at the end */
+
+  struct joinIndexObj *next;
+} joinIndexObj;
+
+static joinIndexObj *join_index_cache = NULL;
+
+static unsigned joinIndexHash(const char *key)
+{
+  unsigned hashval;
+
+  for(hashval=0; *key!='\0'; key++)
+    hashval = *key + 31 * hashval;
+
+  return hashval;
+}
+
+static void joinTableStamp(const char *path, joinTableStampObj *stamp)
+{
+  struct stat sb;
+
+  stamp->sec = -1;
+  stamp->nsec = stamp->size = 0;
+  if(stat(path, &sb) != 0)
+    return;
+
+  stamp->sec = (long) sb.st_mtime;
+#if defined(__APPLE__)
+  stamp->nsec = (long) sb.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  stamp->nsec = 0;
+#else
+  stamp->nsec = (long) sb.st_mtim.tv_nsec;
+#endif
+  stamp->size = (long) sb.st_size;
+}
+
+static void joinIndexFree(joinIndexObj *index)
+{
+  msFree(index->path);
+  msFreeCharArray(index->keys, index->numrows);
+  msFree(index->buckets);
+  msFree(index->chain);
+  msFree(index);
+}
+
+/*
+** Build an index over numrows keys (taken over by the index).
+*/
+static joinIndexObj *joinIndexCreate(const char *path, int column, const joinTableStampObj *stamp, char **keys, int numrows)
+{
+  joinIndexObj *index;
+  int i, *tails;
+
+  index = (joinIndexObj *) msSmallCalloc(1, sizeof(joinIndexObj));
+  index->path = msStrdup(path);
+  index->column = column;
+  index->stamp = *stamp;
+  index->numrows = numrows;
+  index->keys = keys;
+
+  index->numbuckets = 16;
+  while(index->numbuckets < numrows) index->numbuckets *= 2;
+  index->buckets = (int *) msSmallMalloc(sizeof(int)*index->numbuckets);
+  index->chain = (int *) msSmallMalloc(sizeof(int)*(numrows>0?numrows:1));
+  tails = (int *) msSmallMalloc(sizeof(int)*index->numbuckets);
+  for(i=0; i<index->numbuckets; i++)
+    index->buckets[i] = tails[i] = -1;
+
+  /* append so that chains are in file order */
+  for(i=0; i<numrows; i++) {
+    unsigned b = joinIndexHash(keys[i]) & (index->numbuckets-1);
+    index->chain[i] = -1;
+    if(tails[b] == -1)
+      index->buckets[b] = i;
+    else
+      index->chain[tails[b]] = i;
+    tails[b] = i;
+  }
+  free(tails);
+
+  return index;
+}
+
+/*
+** Look for an up to date index of path/column over numrows rows in the
+** cache, NULL if none.
+*/
+static joinIndexObj *joinIndexAcquire(const char *path, int column, const joinTableStampObj *stamp, int numrows)
+{
+  joinIndexObj *index;
+
+  if(stamp->sec == -1)
+    return NULL;
+
+  msAcquireLock(TLOCK_JOININDEX);
+  for(index=join_index_cache; index; index=index->next) {
+    if(index->column == column && index->numrows == numrows &&
+        index->stamp.sec == stamp->sec && index->stamp.nsec == stamp->nsec &&
+        index->stamp.size == stamp->size && strcmp(index->path, path) == 0) {
+      index->refcount++;
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_JOININDEX);
+
+  return index;
+}
+
+/*
+** Add a freshly built index to the cache (with a reference for the caller),
+** replacing older versions of the same table and trimming the cache.
+*/
+static void joinIndexStore(joinIndexObj *index)
+{
+  joinIndexObj **link, *cur;
+  int count = 0;
+
+  msAcquireLock(TLOCK_JOININDEX);
+  index->refcount = 2; /* cache + caller */
+  index->next = join_index_cache;
+  join_index_cache = index;
+
+  link = &(index->next);
+  while((cur = *link) != NULL) {
+    count++;
+    if((cur->column == index->column && strcmp(cur->path, index->path) == 0) ||
+        count >= MS_JOIN_INDEX_CACHE_SIZE) {
+      *link = cur->next;
+      if(--cur->refcount == 0) joinIndexFree(cur);
+      count--;
+    } else
+      link = &(cur->next);
+  }
+  msReleaseLock(TLOCK_JOININDEX);
+}
+
+static void joinIndexRelease(joinIndexObj *index)
+{
+  if(!index) return;
+
+  msAcquireLock(TLOCK_JOININDEX);
+  if(--index->refcount == 0) joinIndexFree(index);
+  msReleaseLock(TLOCK_JOININDEX);
+}
+
+/*
+** Return the first row at or after row (-1 to start) matching target.
+*/
+static int joinIndexNext(joinIndexObj *index, const char *target, int row)
+{
+  if(row < 0)
+    row = index->buckets[joinIndexHash(target) & (index->numbuckets-1)];
+  else
+    row = index->chain[row];
+
+  while(row != -1 && strcmp(index->keys[row], target) != 0)
+    row = index->chain[row];
+
+  return row;
+}
+
+void msJoinIndexCleanup(void)
+{
+  msAcquireLock(TLOCK_JOININDEX);
+  while(join_index_cache) {
+    joinIndexObj *next = join_index_cache->next;
+    if(--join_index_cache->refcount == 0) joinIndexFree(join_index_cache);
+    join_index_cache = next;
+  }
+  msReleaseLock(TLOCK_JOININDEX);
+}
+
 /*  */
 /* XBASE join functions */
 /*  */
@@ -162,11 +374,13 @@ typedef struct {
   int fromindex, toindex;
   char *target;
   int nextrecord;
+  joinIndexObj *index;
 } msDBFJoinInfo;
 
 int msDBFJoinConnect(layerObj *layer, joinObj *join)
 {
-  int i;
+  int i, n;
+  joinTableStampObj stamp;
   char szPath[MS_MAXPATHLEN];
   msDBFJoinInfo *joininfo;
 
@@ -186,6 +400,7 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
   joininfo->nextrecord = 0;
+  joininfo->index = NULL;
 
   join->joininfo = joininfo;
 
@@ -221,6 +436,27 @@ int msDBFJoinConnect(layerObj *layer, joinObj *join)
   join->items = msDBFGetItems(joininfo->hDBF);
   if(!join->items) return(MS_FAILURE);
 
+  /* index the "to" column, or reuse a previous index of this table */
+  joinTableStamp(szPath, &stamp);
+  n = msDBFGetRecordCount(joininfo->hDBF);
+  if((joininfo->index = joinIndexAcquire(szPath, joininfo->toindex, &stamp, n)) == NULL) {
+    char **keys = (char **) msSmallMalloc(sizeof(char *)*(n>0?n:1));
+
+    for(i=0; i<n; i++) {
+      const char *key = msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex);
+      if(!key) {
+        msFreeCharArray(keys, i);
+        return(MS_FAILURE);
+      }
+      keys[i] = msStrdup(key);
+    }
+    joininfo->index = joinIndexCreate(szPath, joininfo->toindex, &stamp, keys, n);
+    if(stamp.sec != -1)
+      joinIndexStore(joininfo->index);
+    else
+      joininfo->index->refcount = 1;
+  }
+
   return(MS_SUCCESS);
 }
 
@@ -243,11 +479,17 @@ int msDBFJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrecord = 0; /* starting with the first record */
+  if(!joininfo->index) {
+    msSetError(MS_JOINERR, "Join table has not been indexed.", "msDBFJoinPrepare()");
+    return(MS_FAILURE);
+  }
 
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  /* first matching record */
+  joininfo->nextrecord = joinIndexNext(joininfo->index, joininfo->target, -1);
+
   return(MS_SUCCESS);
 }
 
@@ -274,11 +516,9 @@ int msDBFJoinNext(joinObj *join)
 
   n = msDBFGetRecordCount(joininfo->hDBF);
 
-  for(i=joininfo->nextrecord; i<n; i++) { /* find a match */
-    if(strcmp(joininfo->target, msDBFReadStringAttribute(joininfo->hDBF, i, joininfo->toindex)) == 0) break;
-  }
+  i = joininfo->nextrecord; /* next match, from the index */
 
-  if(i == n) { /* unable to do the join */
+  if(i == -1 || i >= n) { /* unable to do the join */
     if((join->values = (char **)malloc(sizeof(char *)*join->numitems)) == NULL) {
       msSetError(MS_MEMERR, NULL, "msDBFJoinNext()");
       return(MS_FAILURE);
@@ -286,14 +526,14 @@ int msDBFJoinNext(joinObj *join)
     for(i=0; i<join->numitems; i++)
       join->values[i] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrecord = n;
+    joininfo->nextrecord = -1;
     return(MS_DONE);
   }
 
   if((join->values = msDBFGetValues(joininfo->hDBF,i)) == NULL)
     return(MS_FAILURE);
 
-  joininfo->nextrecord = i+1; /* so we know where to start looking next time through */
+  joininfo->nextrecord = joinIndexNext(joininfo->index, joininfo->target, i); /* so we know where to start looking next time through */
 
   return(MS_SUCCESS);
 }
@@ -306,6 +546,7 @@ int msDBFJoinClose(joinObj *join)
 
   if(joininfo->hDBF) msDBFClose(joininfo->hDBF);
   if(joininfo->target) free(joininfo->target);
+  joinIndexRelease(joininfo->index);
   free(joininfo);
   joininfo = NULL;
 
@@ -321,11 +562,13 @@ typedef struct {
   char ***rows;
   int numrows;
   int nextrow;
+  joinIndexObj *index;
 } msCSVJoinInfo;
 
 int msCSVJoinConnect(layerObj *layer, joinObj *join)
 {
   int i;
+  joinTableStampObj stamp;
   FILE *stream;
   char szPath[MS_MAXPATHLEN];
   msCSVJoinInfo *joininfo;
@@ -345,6 +588,7 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
   /* initialize any members that won't get set later on in this function */
   joininfo->target = NULL;
   joininfo->nextrow = 0;
+  joininfo->index = NULL;
 
   join->joininfo = joininfo;
 
@@ -355,6 +599,7 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
       return(MS_FAILURE);
     }
   }
+  joinTableStamp(szPath, &stamp);
 
   /* once through to get the number of rows */
   joininfo->numrows = 0;
@@ -405,6 +650,29 @@ int msCSVJoinConnect(layerObj *layer, joinObj *join)
     sprintf(join->items[i], "%d", i+1);
   }
 
+  /* index the "to" column, or reuse a previous index of this table if it has the same keys */
+  if((joininfo->index = joinIndexAcquire(szPath, joininfo->toindex, &stamp, joininfo->numrows)) != NULL) {
+    for(i=0; i<joininfo->numrows; i++) {
+      if(strcmp(joininfo->index->keys[i], joininfo->rows[i][joininfo->toindex]) != 0) {
+        joinIndexRelease(joininfo->index);
+        joininfo->index = NULL;
+        stamp.sec = -1; /* changed under the stamp, keep the new index to ourselves */
+        break;
+      }
+    }
+  }
+  if(joininfo->index == NULL) {
+    char **keys = (char **) msSmallMalloc(sizeof(char *)*(joininfo->numrows>0?joininfo->numrows:1));
+
+    for(i=0; i<joininfo->numrows; i++)
+      keys[i] = msStrdup(joininfo->rows[i][joininfo->toindex]);
+    joininfo->index = joinIndexCreate(szPath, joininfo->toindex, &stamp, keys, joininfo->numrows);
+    if(stamp.sec != -1)
+      joinIndexStore(joininfo->index);
+    else
+      joininfo->index->refcount = 1;
+  }
+
   return(MS_SUCCESS);
 }
 
@@ -427,11 +695,17 @@ int msCSVJoinPrepare(joinObj *join, shapeObj *shape)
     return(MS_FAILURE);
   }
 
-  joininfo->nextrow = 0; /* starting with the first record */
+  if(!joininfo->index) {
+    msSetError(MS_JOINERR, "Join table has not been indexed.", "msCSVJoinPrepare()");
+    return(MS_FAILURE);
+  }
 
   if(joininfo->target) free(joininfo->target); /* clear last target */
   joininfo->target = msStrdup(shape->values[joininfo->fromindex]);
 
+  /* first matching row */
+  joininfo->nextrow = joinIndexNext(joininfo->index, joininfo->target, -1);
+
   return(MS_SUCCESS);
 }
 
@@ -451,27 +725,26 @@ int msCSVJoinNext(joinObj *join)
     join->values = NULL;
   }
 
-  for(i=joininfo->nextrow; i<joininfo->numrows; i++) { /* find a match     */
-    if(strcmp(joininfo->target, joininfo->rows[i][joininfo->toindex]) == 0) break;
-  }
+  i = joininfo->nextrow; /* next match, from the index */
+  if(i == -1) i = joininfo->numrows;
 
   if((join->values = (char ** )malloc(sizeof(char *)*join->numitems)) == NULL) {
     msSetError(MS_MEMERR, NULL, "msCSVJoinNext()");
     return(MS_FAILURE);
   }
 
-  if(i == joininfo->numrows) { /* unable to do the join     */
+  if(i >= joininfo->numrows) { /* unable to do the join     */
     for(j=0; j<join->numitems; j++)
       join->values[j] = msStrdup("\0"); /* intialize to zero length strings */
 
-    joininfo->nextrow = joininfo->numrows;
+    joininfo->nextrow = -1;
     return(MS_DONE);
   }
 
   for(j=0; j<join->numitems; j++)
     join->values[j] = msStrdup(joininfo->rows[i][j]);
 
-  joininfo->nextrow = i+1; /* so we know where to start looking next time through */
+  joininfo->nextrow = joinIndexNext(joininfo->index, joininfo->target, i); /* so we know where to start looking next time through */
 
   return(MS_SUCCESS);
 }
@@ -487,6 +760,7 @@ int msCSVJoinClose(joinObj *join)
     msFreeCharArray(joininfo->rows[i], join->numitems);
   free(joininfo->rows);
   if(joininfo->target) free(joininfo->target);
+  joinIndexRelease(joininfo->index);
   free(joininfo);
   joininfo = NULL;
 
@@ -42,9 +42,57 @@
 
 #define  KML_MAXFEATURES_TODRAW 1000
 
+/* xmlOutputBuffer callback, appends to a bufferObj */
+static int kmlBufferWrite(void *context, const char *data, int len)
+{
+  msBufferAppend((bufferObj *)context, (void *)data, len);
+  return len;
+}
+
+/* room kmlFormatCoordinate() may need: "%.8f" of -DBL_MAX is 319 chars */
+#define KML_COORD_MAXLEN 320
+
+/* Same as sprintf(p, "%.8f", v), without going through sprintf for every */
+/* ordinate. p has room for KML_COORD_MAXLEN chars. Returns the end of the */
+/* string. */
+static char *kmlFormatCoordinate(char *p, double v)
+{
+  char digits[24];
+  unsigned long long n, ipart;
+  int i, nd = 0;
+
+  if (!(v > -1e9 && v < 1e9)) {
+    nd = snprintf(p, KML_COORD_MAXLEN, "%.8f", v);
+    if (nd < 0) nd = 0;
+    return p + MS_MIN(nd, KML_COORD_MAXLEN - 1);
+  }
+
+  if (v < 0) {
+    *p++ = '-';
+    v = -v;
+  }
+  n = (unsigned long long)(v * 1e8 + 0.5);
+  ipart = n / 100000000;
+  do {
+    digits[nd++] = (char)('0' + ipart % 10);
+    ipart /= 10;
+  } while (ipart);
+  while (nd)
+    *p++ = digits[--nd];
+  *p++ = '.';
+  n %= 100000000;
+  for (i=7; i>=0; i--) {
+    p[i] = (char)('0' + n % 10);
+    n /= 10;
+  }
+  p += 8;
+  *p = '\0';
+  return p;
+}
+
 KmlRenderer::KmlRenderer(int width, int height, outputFormatObj *format, colorObj* color/*=NULL*/)
   : Width(width), Height(height), MapCellsize(1.0), XmlDoc(NULL), LayerNode(NULL), GroundOverlayNode(NULL),
-    PlacemarkNode(NULL), GeomNode(NULL),
+    PlacemarkNode(NULL), GeomNode(NULL), DescriptionNode(NULL), CurrentShapeName(NULL),
     Items(NULL), NumItems(0), FirstLayer(MS_TRUE), map(NULL), currentLayer(NULL),
     mElevationFromAttribute( false ), mElevationAttributeIndex( -1 ), mCurrentElevationValue(0.0)
 
@@ -97,10 +145,23 @@ KmlRenderer::KmlRenderer(int width, int height, outputFormatObj *format, colorOb
 
   StyleHashTable = msCreateHashTable();
 
+  msBufferInit(&Body);
+  BodyOut = xmlOutputBufferCreateIO(kmlBufferWrite, NULL, &Body, NULL);
 }
 
 KmlRenderer::~KmlRenderer()
 {
+  if (BodyOut)
+    xmlOutputBufferClose(BodyOut);
+  msBufferFree(&Body);
+
+  if (LayerNode)
+    xmlFreeNode(LayerNode);
+  if (DescriptionNode && DescriptionNode->parent == NULL)
+    xmlFreeNode(DescriptionNode);
+  if (GeomNode && GeomNode->parent == NULL)
+    xmlFreeNode(GeomNode);
+
   if (XmlDoc)
     xmlFreeDoc(XmlDoc);
 
@@ -121,13 +182,17 @@ imageObj* KmlRenderer::createImage(int, int, outputFormatObj*, colorObj*)
 int KmlRenderer::saveImage(imageObj *, FILE *fp, outputFormatObj *format)
 {
   /* -------------------------------------------------------------------- */
-  /*      Write out the document.                                         */
+  /*      Write out the document: the document level nodes (name,         */
+  /*      styles) followed by the folders already serialized in Body.     */
   /* -------------------------------------------------------------------- */
 
-  int bufSize = 0;
-  xmlChar *buf = NULL;
+  bufferObj head;
+  xmlOutputBufferPtr headOut;
+  const char *footer = "  </Document>\n</kml>\n";
   msIOContext *context = NULL;
   int chunkSize = 4096;
+  unsigned char *parts[3];
+  size_t partSizes[3];
 #if defined(CPL_ZIP_API_OFFERED)
   int bZip = MS_FALSE;
 #endif
@@ -135,8 +200,6 @@ int KmlRenderer::saveImage(imageObj *, FILE *fp, outputFormatObj *format)
   if( msIO_needBinaryStdout() == MS_FAILURE )
     return MS_FAILURE;
 
-  xmlDocDumpFormatMemoryEnc(XmlDoc, &buf, &bufSize, "UTF-8", 1);
-
 #if defined(USE_OGR)
   if (format && format->driver && strcasecmp(format->driver, "kmz") == 0) {
 #if defined(CPL_ZIP_API_OFFERED)
@@ -144,10 +207,31 @@ int KmlRenderer::saveImage(imageObj *, FILE *fp, outputFormatObj *format)
 #else
     msSetError( MS_MISCERR, "kmz format support unavailable, perhaps you need to upgrade to GDAL/OGR 1.8?",
                 "KmlRenderer::saveImage()");
-    xmlFree(buf);
     return MS_FAILURE;
 #endif
   }
+#endif
+
+  xmlOutputBufferFlush(BodyOut);
+
+  msBufferInit(&head);
+  headOut = xmlOutputBufferCreateIO(kmlBufferWrite, NULL, &head, NULL);
+  xmlOutputBufferWriteString(headOut, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                             "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n"
+                             "  <Document>\n");
+  for (xmlNodePtr node = DocNode->children; node; node = node->next) {
+    xmlOutputBufferWriteString(headOut, "    ");
+    xmlNodeDumpOutput(headOut, XmlDoc, node, 2, 1, "UTF-8");
+    xmlOutputBufferWriteString(headOut, "\n");
+  }
+  xmlOutputBufferClose(headOut);
+
+  parts[0] = head.data;
+  partSizes[0] = head.size;
+  parts[1] = Body.data;
+  partSizes[1] = Body.size;
+  parts[2] = (unsigned char *) footer;
+  partSizes[2] = strlen(footer);
 
 #if defined(CPL_ZIP_API_OFFERED)
   if (bZip) {
@@ -160,14 +244,17 @@ int KmlRenderer::saveImage(imageObj *, FILE *fp, outputFormatObj *format)
     zip_filename = msTmpFile(NULL, NULL, "/vsimem/kmlzip/", "kmz" );
     hZip = CPLCreateZip( zip_filename, NULL );
     CPLCreateFileInZip( hZip, "mapserver.kml", NULL );
-    for (int i=0; i<bufSize; i+=chunkSize) {
-      int size = chunkSize;
-      if (i + size > bufSize)
-        size = bufSize - i;
-      CPLWriteFileInZip( hZip,  buf+i, size);
+    for (int p=0; p<3; p++) {
+      for (size_t i=0; i<partSizes[p]; i+=chunkSize) {
+        size_t size = chunkSize;
+        if (i + size > partSizes[p])
+          size = partSizes[p] - i;
+        CPLWriteFileInZip( hZip, parts[p]+i, (int)size);
+      }
     }
     CPLCloseFileInZip( hZip );
     CPLCloseZip( hZip );
+    msBufferFree(&head);
 
     context = msIO_getHandler(fp);
     fpZip = VSIFOpenL( zip_filename, "r" );
@@ -179,33 +266,53 @@ int KmlRenderer::saveImage(imageObj *, FILE *fp, outputFormatObj *format)
         msIO_fwrite( buffer, 1, bytes_read, fp );
     }
     VSIFCloseL( fpZip );
+    VSIUnlink( zip_filename );
     msFree( zip_filename);
-    xmlFree(buf);
     return(MS_SUCCESS);
   }
-#endif
-
 #endif
 
   context = msIO_getHandler(fp);
 
+  for (int p=0; p<3; p++) {
+    for (size_t i=0; i<partSizes[p]; i+=chunkSize) {
+      size_t size = chunkSize;
+      if (i + size > partSizes[p])
+        size = partSizes[p] - i;
 
-  for (int i=0; i<bufSize; i+=chunkSize) {
-    int size = chunkSize;
-    if (i + size > bufSize)
-      size = bufSize - i;
-
-    if (context)
-      msIO_contextWrite(context, buf+i, size);
-    else
-      msIO_fwrite(buf+i, 1, size, fp);
+      if (context)
+        msIO_contextWrite(context, parts[p]+i, (int)size);
+      else
+        msIO_fwrite(parts[p]+i, 1, size, fp);
+    }
   }
 
-  xmlFree(buf);
+  msBufferFree(&head);
 
   return(MS_SUCCESS);
 }
 
+/************************************************************************/
+/*                             writeLayerNodes                          */
+/*                                                                      */
+/*      Serialize the nodes added to the current folder (placemarks,    */
+/*      ground overlays, ...) and free them.                            */
+/************************************************************************/
+void KmlRenderer::writeLayerNodes()
+{
+  xmlNodePtr node;
+
+  if (!LayerNode)
+    return;
+
+  while ((node = LayerNode->children) != NULL) {
+    xmlUnlinkNode(node);
+    xmlOutputBufferWriteString(BodyOut, "      ");
+    xmlNodeDumpOutput(BodyOut, XmlDoc, node, 3, 1, "UTF-8");
+    xmlOutputBufferWriteString(BodyOut, "\n");
+    xmlFreeNode(node);
+  }
+}
 
 /************************************************************************/
 /*                               processLayer                           */
@@ -426,6 +533,10 @@ int KmlRenderer::startNewLayer(imageObj *img, layerObj *layer)
   }
 
   setupRenderingParams(&layer->metadata);
+
+  xmlOutputBufferWriteString(BodyOut, "    <Folder>\n");
+  writeLayerNodes();
+
   return MS_SUCCESS;
 }
 
@@ -433,7 +544,10 @@ int KmlRenderer::closeNewLayer(imageObj *img, layerObj *layer)
 {
   flushPlacemark();
 
-  xmlAddChild(DocNode, LayerNode);
+  writeLayerNodes();
+  xmlOutputBufferWriteString(BodyOut, "    </Folder>\n");
+  xmlFreeNode(LayerNode);
+  LayerNode = NULL;
 
   if(Items) {
     msFreeCharArray(Items, NumItems);
@@ -477,6 +591,7 @@ int KmlRenderer::mergeRasterBuffer(imageObj *image, rasterBufferObj *rb)
     tmpUrl = msStringConcatenate(tmpUrl, ".png");
 
     createGroundOverlayNode(LayerNode, tmpUrl, currentLayer);
+    writeLayerNodes();
     msFree(tmpFileName);
     msFree(tmpUrl);
     fclose(tmpFile);
@@ -665,26 +780,50 @@ void KmlRenderer::renderPolygon(imageObj*, shapeObj *p, colorObj *color)
 
 void KmlRenderer::addCoordsNode(xmlNodePtr parentNode, pointObj *pts, int numPts)
 {
-  char lineBuf[128];
+  char *coords, *p;
+  size_t size;
 
   xmlNodePtr coordsNode = xmlNewChild(parentNode, NULL, BAD_CAST "coordinates", NULL);
-  xmlNodeAddContent(coordsNode, BAD_CAST "\n");
 
-  for (int i=0; i<numPts; i++) {
-    if( mElevationFromAttribute ) {
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, mCurrentElevationValue);
-    } else if (AltitudeMode == relativeToGround || AltitudeMode == absolute) {
 #ifdef USE_POINT_Z_M
-      sprintf(lineBuf, "\t%.8f,%.8f,%.8f\n", pts[i].x, pts[i].y, pts[i].z);
+  int withZ = (!mElevationFromAttribute && (AltitudeMode == relativeToGround || AltitudeMode == absolute));
 #else
-      msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
+  if (!mElevationFromAttribute && (AltitudeMode == relativeToGround || AltitudeMode == absolute))
+    msSetError(MS_MISCERR, "Z coordinates support not available  (mapserver not compiled with USE_POINT_Z_M option)", "KmlRenderer::addCoordsNode()");
 #endif
-    } else
-      sprintf(lineBuf, "\t%.8f,%.8f\n", pts[i].x, pts[i].y);
 
-    xmlNodeAddContent(coordsNode, BAD_CAST lineBuf);
+  /* the whole content is formatted at once: one text node per geometry, */
+  /* sized for ordinates of up to 20 chars and grown for larger ones */
+  size = numPts * 3 * 24 + 8;
+  p = coords = (char *) msSmallMalloc(size);
+  *p++ = '\n';
+  for (int i=0; i<numPts; i++) {
+    size_t used = p - coords;
+    if (size - used < 3 * (KML_COORD_MAXLEN + 1) + 3) {
+      size = size * 2 + 3 * (KML_COORD_MAXLEN + 1) + 3;
+      coords = (char *) msSmallRealloc(coords, size);
+      p = coords + used;
+    }
+    *p++ = '\t';
+    p = kmlFormatCoordinate(p, pts[i].x);
+    *p++ = ',';
+    p = kmlFormatCoordinate(p, pts[i].y);
+    if( mElevationFromAttribute ) {
+      *p++ = ',';
+      p = kmlFormatCoordinate(p, mCurrentElevationValue);
+    }
+#ifdef USE_POINT_Z_M
+    else if (withZ) {
+      *p++ = ',';
+      p = kmlFormatCoordinate(p, pts[i].z);
+    }
+#endif
+    *p++ = '\n';
   }
-  xmlNodeAddContent(coordsNode, BAD_CAST "\t");
+  *p++ = '\t';
+
+  xmlNodeAddContentLen(coordsNode, BAD_CAST coords, (int)(p - coords));
+  msFree(coords);
 }
 
 void KmlRenderer::renderGlyphs(imageObj*, double x, double y, labelStyleObj *style, char *text)
@@ -885,8 +1024,7 @@ xmlNodePtr KmlRenderer::createGroundOverlayNode(xmlNodePtr parentNode, char *ima
 
 void KmlRenderer::startShape(imageObj *, shapeObj *shape)
 {
-  if (PlacemarkNode)
-    flushPlacemark();
+  flushPlacemark();
 
   CurrentShapeIndex=-1;
   CurrentDrawnShapeIndex = -1;
@@ -1179,7 +1317,15 @@ void KmlRenderer::flushPlacemark()
 
     if (GeomNode)
       xmlAddChild(PlacemarkNode, GeomNode);
+
+    writeLayerNodes();
+  } else if (DescriptionNode) {
+    xmlFreeNode(DescriptionNode);
   }
+
+  PlacemarkNode = NULL;
+  GeomNode = NULL;
+  DescriptionNode = NULL;
 }
 
 
@@ -63,6 +63,11 @@ protected:
   xmlNodePtr  LayerNode;
   xmlNodePtr  GroundOverlayNode;
 
+  // folders and placemarks are serialized as soon as they are complete,
+  // only the document level nodes (styles) are kept as a tree
+  bufferObj   Body;
+  xmlOutputBufferPtr BodyOut;
+
   xmlNodePtr  PlacemarkNode;
   xmlNodePtr  GeomNode;
   xmlNodePtr  DescriptionNode;
@@ -137,6 +142,7 @@ protected:
 
   char* lookupPlacemarkStyle();
   void flushPlacemark();
+  void writeLayerNodes();
   xmlNodePtr getGeomParentNode(const char *geomName);
   char* getLayerName(layerObj *layer);
   void processLayer(layerObj *layer, outputFormatObj *format);
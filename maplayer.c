@@ -36,6 +36,7 @@
 #include "mapparser.h"
 
 #include <assert.h>
+#include <float.h>
 
 
 static int populateVirtualTable(layerVTableObj *vtable);
@@ -594,6 +595,455 @@ parse_error:
   return MS_FAILURE;
 }
 
+/*
+** Translation of MapServer expressions to SQL WHERE clauses, so that
+** datasources with a SQL dialect can filter rows before they are returned.
+**
+** The translation is conservative: the SQL clause never rejects a feature
+** the expression would accept, so the expression is still evaluated on the
+** features returned. Parts that cannot be translated (regexes, functions,
+** arithmetic, time, spatial operators, items of unknown type) are left out
+** of AND and OR combinations as "no restriction", and make a NOT fail as a
+** whole. Items are compared the way msEvalExpression() sees them: a NULL
+** value is an empty string, or 0 in numeric comparisons.
+*/
+
+typedef struct {
+  layerObj *layer;
+  sqlDialectObj *dialect;
+  tokenListNodeObjPtr node;
+} sqlTranslatorObj;
+
+static char *sqlTranslateOr(sqlTranslatorObj *t, int exact);
+
+static int sqlIsBoundary(tokenListNodeObjPtr node)
+{
+  return (node == NULL || node->token == MS_TOKEN_LOGICAL_AND ||
+          node->token == MS_TOKEN_LOGICAL_OR || node->token == ')');
+}
+
+/* skip the rest of an operand we can't translate, up to the next AND/OR */
+static void sqlSkipOperand(sqlTranslatorObj *t)
+{
+  int depth = 0;
+
+  while(t->node && (depth > 0 || !sqlIsBoundary(t->node))) {
+    if(t->node->token == '(') depth++;
+    else if(t->node->token == ')') depth--;
+    t->node = t->node->next;
+  }
+}
+
+static char *sqlQuoteIdentifier(sqlTranslatorObj *t, const char *item)
+{
+  char quoted[256];
+
+  if(strchr(item, t->dialect->identifier_close) || strlen(item) + 3 > sizeof(quoted))
+    return NULL;
+  snprintf(quoted, sizeof(quoted), "%c%s%c", t->dialect->identifier_open, item, t->dialect->identifier_close);
+  return msStrdup(quoted);
+}
+
+static char *sqlQuoteString(const char *value)
+{
+  char *quoted, *p;
+
+  /* backslashes and control characters are dialect dependent, leave them alone */
+  for(p=(char *)value; *p; p++)
+    if(*p == '\\' || (unsigned char)*p < 0x20) return NULL;
+
+  quoted = msStrdup("'");
+  for(; *value; value++) {
+    char c[2] = { *value, '\0' };
+    quoted = msStringConcatenate(quoted, (*value == '\'') ? "''" : c);
+  }
+  return msStringConcatenate(quoted, "'");
+}
+
+static char *sqlFormatNumber(double value)
+{
+  char number[64];
+
+  if(value != value || value > DBL_MAX || value < -DBL_MAX) return NULL;
+  snprintf(number, sizeof(number), "%.17g", value);
+  return msStrdup(number);
+}
+
+/* does a comparison hold for an empty (NULL) item? */
+static int sqlCompareEmpty(int op, double num, const char *str)
+{
+  int cmp = str ? -(str[0] != '\0') : (0.0 < num ? -1 : (0.0 > num ? 1 : 0));
+
+  switch(op) {
+    case MS_TOKEN_COMPARISON_EQ: return cmp == 0;
+    case MS_TOKEN_COMPARISON_NE: return cmp != 0;
+    case MS_TOKEN_COMPARISON_GT: return cmp > 0;
+    case MS_TOKEN_COMPARISON_LT: return cmp < 0;
+    case MS_TOKEN_COMPARISON_GE: return cmp >= 0;
+    case MS_TOKEN_COMPARISON_LE: return cmp <= 0;
+  }
+  return MS_FALSE;
+}
+
+/*
+** Finish a comparison on column: make its value on NULL items the same as
+** the expression's (true or false, never unknown).
+*/
+static char *sqlNullSafe(char *column, char *predicate, int nullmatches)
+{
+  char *sql = msStringConcatenate(NULL, "(");
+
+  sql = msStringConcatenate(sql, predicate);
+  sql = msStringConcatenate(sql, nullmatches ? " OR " : " AND ");
+  sql = msStringConcatenate(sql, column);
+  sql = msStringConcatenate(sql, nullmatches ? " IS NULL)" : " IS NOT NULL)");
+  msFree(column);
+  msFree(predicate);
+  return sql;
+}
+
+/* [item] IN "a,b,c" */
+static char *sqlTranslateIn(sqlTranslatorObj *t, const char *item, int numeric, const char *list)
+{
+  char **values, *column, *sql;
+  int i, n, nullmatches = MS_FALSE;
+
+  if((column = sqlQuoteIdentifier(t, item)) == NULL) return NULL;
+
+  values = msStringSplit(list, ',', &n);
+  sql = msStringConcatenate(msStrdup(column), " IN (");
+  for(i=0; i<n && sql; i++) {
+    char *value = numeric ? sqlFormatNumber(atof(values[i])) : sqlQuoteString(values[i]);
+
+    if(value == NULL) {
+      msFree(sql);
+      sql = NULL;
+      break;
+    }
+    if((numeric && atof(values[i]) == 0.0) || (!numeric && values[i][0] == '\0'))
+      nullmatches = MS_TRUE;
+    if(i > 0) sql = msStringConcatenate(sql, ",");
+    sql = msStringConcatenate(sql, value);
+    msFree(value);
+  }
+  msFreeCharArray(values, n);
+
+  if(sql == NULL) {
+    msFree(column);
+    return NULL;
+  }
+  sql = msStringConcatenate(sql, ")");
+  return sqlNullSafe(column, sql, nullmatches);
+}
+
+/* binding <op> literal, either way round */
+static char *sqlTranslateComparison(sqlTranslatorObj *t)
+{
+  tokenListNodeObjPtr lhs = t->node, op, rhs;
+  tokenListNodeObjPtr binding, literal;
+  char *column, *value, *sql;
+  int type, numeric, token;
+
+  if(!lhs || !(op = lhs->next) || !(rhs = op->next) || !sqlIsBoundary(rhs->next))
+    return NULL;
+  t->node = rhs->next;
+
+  if(lhs->token == MS_TOKEN_BINDING_DOUBLE || lhs->token == MS_TOKEN_BINDING_INTEGER ||
+      lhs->token == MS_TOKEN_BINDING_STRING) {
+    binding = lhs;
+    literal = rhs;
+  } else if(op->token != IN) {
+    binding = rhs;
+    literal = lhs;
+  } else
+    return NULL;
+
+  numeric = (binding->token != MS_TOKEN_BINDING_STRING);
+  if(numeric && binding->token != MS_TOKEN_BINDING_DOUBLE && binding->token != MS_TOKEN_BINDING_INTEGER)
+    return NULL;
+
+  type = t->dialect->itemtype(t->layer, binding->tokenval.bindval.item, t->dialect->data);
+  if(type != (numeric ? MS_SQL_ITEM_NUMBER : MS_SQL_ITEM_STRING))
+    return NULL;
+
+  if(op->token == IN) {
+    if(literal->token != MS_TOKEN_LITERAL_STRING) return NULL;
+    return sqlTranslateIn(t, binding->tokenval.bindval.item, numeric, literal->tokenval.strval);
+  }
+
+  if(literal->token != (numeric ? MS_TOKEN_LITERAL_NUMBER : MS_TOKEN_LITERAL_STRING))
+    return NULL;
+
+  /* literal <op> binding is binding <reversed op> literal */
+  token = op->token;
+  if(binding == rhs) {
+    switch(token) {
+      case MS_TOKEN_COMPARISON_GT: token = MS_TOKEN_COMPARISON_LT; break;
+      case MS_TOKEN_COMPARISON_LT: token = MS_TOKEN_COMPARISON_GT; break;
+      case MS_TOKEN_COMPARISON_GE: token = MS_TOKEN_COMPARISON_LE; break;
+      case MS_TOKEN_COMPARISON_LE: token = MS_TOKEN_COMPARISON_GE; break;
+    }
+  }
+
+  /* string ordering depends on the database collation */
+  if(!numeric && token != MS_TOKEN_COMPARISON_EQ && token != MS_TOKEN_COMPARISON_NE)
+    return NULL;
+
+  switch(token) {
+    case MS_TOKEN_COMPARISON_EQ: sql = " = "; break;
+    case MS_TOKEN_COMPARISON_NE: sql = " <> "; break;
+    case MS_TOKEN_COMPARISON_GT: sql = " > "; break;
+    case MS_TOKEN_COMPARISON_LT: sql = " < "; break;
+    case MS_TOKEN_COMPARISON_GE: sql = " >= "; break;
+    case MS_TOKEN_COMPARISON_LE: sql = " <= "; break;
+    default: return NULL;
+  }
+
+  value = numeric ? sqlFormatNumber(literal->tokenval.dblval) : sqlQuoteString(literal->tokenval.strval);
+  if(value == NULL) return NULL;
+  if((column = sqlQuoteIdentifier(t, binding->tokenval.bindval.item)) == NULL) {
+    msFree(value);
+    return NULL;
+  }
+
+  sql = msStringConcatenate(msStrdup(column), sql);
+  sql = msStringConcatenate(sql, value);
+  msFree(value);
+
+  return sqlNullSafe(column, sql, sqlCompareEmpty(token, numeric ? literal->tokenval.dblval : 0,
+                     numeric ? NULL : literal->tokenval.strval));
+}
+
+/* NOT operand | ( expression ) | comparison */
+static char *sqlTranslateOperand(sqlTranslatorObj *t, int exact)
+{
+  tokenListNodeObjPtr start = t->node;
+  char *sql = NULL;
+
+  if(t->node == NULL) return NULL;
+
+  if(t->node->token == MS_TOKEN_LOGICAL_NOT) {
+    char *operand;
+
+    t->node = t->node->next;
+    if((operand = sqlTranslateOperand(t, MS_TRUE)) != NULL) {
+      sql = msStringConcatenate(msStrdup("(NOT "), operand);
+      sql = msStringConcatenate(sql, ")");
+      msFree(operand);
+    }
+  } else if(t->node->token == '(') {
+    t->node = t->node->next;
+    sql = sqlTranslateOr(t, exact);
+    if(t->node && t->node->token == ')')
+      t->node = t->node->next;
+    else {
+      msFree(sql);
+      sql = NULL;
+    }
+  } else {
+    sql = sqlTranslateComparison(t);
+  }
+
+  /* anything else (e.g. arithmetic on a parenthesized expression) */
+  if(!sqlIsBoundary(t->node)) {
+    msFree(sql);
+    sql = NULL;
+  }
+  if(sql == NULL) {
+    t->node = start;
+    sqlSkipOperand(t);
+  }
+
+  return sql;
+}
+
+static char *sqlTranslateAnd(sqlTranslatorObj *t, int exact)
+{
+  char *sql = NULL;
+  int failed = MS_FALSE;
+
+  while(1) {
+    char *operand = sqlTranslateOperand(t, exact);
+
+    if(operand == NULL)
+      failed = MS_TRUE;
+    else if(sql == NULL)
+      sql = operand;
+    else {
+      sql = msStringConcatenate(sql, " AND ");
+      sql = msStringConcatenate(sql, operand);
+      msFree(operand);
+    }
+
+    if(!t->node || t->node->token != MS_TOKEN_LOGICAL_AND) break;
+    t->node = t->node->next;
+  }
+
+  /* dropping an AND operand only widens the selection */
+  if(failed && exact) {
+    msFree(sql);
+    return NULL;
+  }
+  return sql;
+}
+
+static char *sqlTranslateOr(sqlTranslatorObj *t, int exact)
+{
+  char *sql = NULL;
+  int n = 0, failed = MS_FALSE;
+
+  while(1) {
+    char *operand = sqlTranslateAnd(t, exact);
+
+    if(operand == NULL)
+      failed = MS_TRUE;
+    else if(sql == NULL)
+      sql = operand;
+    else {
+      sql = msStringConcatenate(sql, " OR ");
+      sql = msStringConcatenate(sql, operand);
+      msFree(operand);
+    }
+    n++;
+
+    if(!t->node || t->node->token != MS_TOKEN_LOGICAL_OR) break;
+    t->node = t->node->next;
+  }
+
+  /* an OR operand we can't translate could match anything */
+  if(failed) {
+    msFree(sql);
+    return NULL;
+  }
+  if(n > 1) {
+    char *grouped = msStringConcatenate(msStrdup("("), sql);
+
+    msFree(sql);
+    sql = msStringConcatenate(grouped, ")");
+  }
+  return sql;
+}
+
+/*
+** Translate expression into a SQL WHERE clause selecting (at least) the
+** features it matches, or return NULL if nothing can be translated. item is
+** the item a plain string expression is compared with (e.g. the FILTERITEM).
+** The expression must have been tokenized (see msLayerWhichItems()).
+*/
+char *msExpressionToSQL(layerObj *layer, expressionObj *expression, const char *item, sqlDialectObj *dialect)
+{
+  sqlTranslatorObj t;
+  char *sql;
+
+  if(!expression->string) return NULL;
+
+  if(expression->type == MS_STRING) {
+    char *column, *value;
+
+    if(!item || (expression->flags & MS_EXP_INSENSITIVE) ||
+        dialect->itemtype(layer, item, dialect->data) != MS_SQL_ITEM_STRING)
+      return NULL;
+
+    t.dialect = dialect;
+    if((value = sqlQuoteString(expression->string)) == NULL) return NULL;
+    if((column = sqlQuoteIdentifier(&t, item)) == NULL) {
+      msFree(value);
+      return NULL;
+    }
+    sql = msStringConcatenate(msStrdup(column), " = ");
+    sql = msStringConcatenate(sql, value);
+    msFree(value);
+    return sqlNullSafe(column, sql, expression->string[0] == '\0');
+  }
+
+  if(expression->type != MS_EXPRESSION || expression->tokens == NULL)
+    return NULL;
+
+  t.layer = layer;
+  t.dialect = dialect;
+  t.node = expression->tokens;
+
+  sql = sqlTranslateOr(&t, MS_FALSE);
+  if(t.node != NULL) { /* trailing tokens, the expression wasn't understood */
+    msFree(sql);
+    return NULL;
+  }
+
+  return sql;
+}
+
+/*
+** Translate the expressions of the classes layer would draw a feature with
+** at the current scale into one SQL WHERE clause, so a database layer only
+** returns the features that end up classified. Returns NULL when every
+** feature may be drawn: a class without a (translatable) expression, a
+** layer whose features are used for more than its classes, ...
+*/
+char *msLayerClassesToSQL(layerObj *layer, sqlDialectObj *dialect)
+{
+  mapObj *map = layer->map;
+  int *classgroup = NULL;
+  int i, numclasses = 0;
+  char *sql = NULL;
+
+  if(!map || layer->numclasses <= 0 || layer->index < 0 || layer->index >= map->numlayers)
+    return NULL;
+
+  if(layer->type != MS_LAYER_POINT && layer->type != MS_LAYER_LINE &&
+      layer->type != MS_LAYER_POLYGON && layer->type != MS_LAYER_ANNOTATION)
+    return NULL;
+
+  /* cluster and union source layers are copies, clusters count all features */
+  if(GET_LAYER(map, layer->index) != layer || layer->cluster.region)
+    return NULL;
+
+  /* another layer reads its tiles from this one */
+  for(i=0; i<map->numlayers; i++) {
+    layerObj *lp = GET_LAYER(map, i);
+    if(lp != layer && lp->tileindex && layer->name && strcmp(lp->tileindex, layer->name) == 0)
+      return NULL;
+  }
+
+  if(layer->classgroup)
+    classgroup = msAllocateValidClassGroups(layer, &numclasses);
+  if(classgroup == NULL)
+    numclasses = layer->numclasses;
+
+  for(i=0; i<numclasses; i++) {
+    classObj *c = layer->class[classgroup ? classgroup[i] : i];
+    char *operand;
+
+    /* classes msShapeGetClass() skips, or whose features aren't drawn */
+    if(c->status == MS_OFF || c->status == MS_DELETE) continue;
+    if(map->scaledenom > 0) {
+      if(c->maxscaledenom > 0 && map->scaledenom > c->maxscaledenom) continue;
+      if(c->minscaledenom > 0 && map->scaledenom <= c->minscaledenom) continue;
+    }
+
+    operand = msExpressionToSQL(layer, &(c->expression), layer->classitem, dialect);
+    if(operand == NULL) { /* this class may draw any feature */
+      msFree(sql);
+      msFree(classgroup);
+      return NULL;
+    }
+
+    if(sql == NULL)
+      sql = msStringConcatenate(msStrdup("("), operand);
+    else {
+      sql = msStringConcatenate(sql, " OR ");
+      sql = msStringConcatenate(sql, operand);
+    }
+    msFree(operand);
+  }
+  msFree(classgroup);
+
+  /* no class is drawn at this scale */
+  if(sql == NULL)
+    return msStrdup("(1=0)");
+
+  return msStringConcatenate(sql, ")");
+}
+
 /*
 ** This function builds a list of items necessary to draw or query a particular layer by
 ** examining the contents of the various xxxxitem parameters and expressions. That list is
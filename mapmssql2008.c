@@ -155,6 +155,7 @@ typedef struct ms_MSSQL2008_layer_info_t {
   msODBCconn * conn;          /* Connection to db */
   msGeometryParserInfo gpi;   /* struct for the geometry parser */
   int geometry_format;        /* Geometry format to be retrieved from the database */
+  char *column_types;         /* "name<tab>type" lines of the geom_table columns, see msMSSQL2008GetColumnTypes() */
 } msMSSQL2008LayerInfo;
 
 #define SQL_COLUMN_NAME_MAX_LENGTH 128
@@ -548,8 +549,8 @@ static int executeSQL(msODBCconn *conn, const char * sql)
   }
 }
 
-/* Get columns name from query results */
-static int columnName(msODBCconn *conn, int index, char *buffer, int bufferLength)
+/* Get columns name (and optionally SQL type) from query results */
+static int columnName(msODBCconn *conn, int index, char *buffer, int bufferLength, SQLSMALLINT *columnType)
 {
   SQLRETURN rc;
 
@@ -572,6 +573,8 @@ static int columnName(msODBCconn *conn, int index, char *buffer, int bufferLengt
          &nullable);
 
   if (rc == SQL_SUCCESS || rc == SQL_SUCCESS_WITH_INFO) {
+    if (columnType)
+      *columnType = dataType;
     if (bufferLength < SQL_COLUMN_NAME_MAX_LENGTH + 1)
       strlcpy(buffer, (const char *)columnName, bufferLength);
     else
@@ -626,6 +629,7 @@ int msMSSQL2008LayerOpen(layerObj *layer)
   layerinfo->urid_name = NULL;
   layerinfo->user_srid = NULL;
   layerinfo->index_name = NULL;
+  layerinfo->column_types = NULL;
   layerinfo->conn = NULL;
 
   layerinfo->conn = (msODBCconn *) msConnPoolRequest(layer);
@@ -757,10 +761,11 @@ int msMSSQL2008LayerInitItemInfo(layerObj *layer)
 }
 
 /* Prepare and execute the SQL statement for this layer */
-static int prepare_database(layerObj *layer, rectObj rect, char **query_string)
+static int prepare_database(layerObj *layer, rectObj rect, const char *class_filter, char **query_string)
 {
   msMSSQL2008LayerInfo *layerinfo;
   char        *columns_wanted = 0;
+  char        *filter = 0;
   char        *data_source = 0;
   char        *f_table_name = 0;
   char    *geom_table = 0;
@@ -901,25 +906,37 @@ static int prepare_database(layerObj *layer, rectObj rect, char **query_string)
     data_source = tmp;
   }
 
+  /* the FILTER (raw SQL) and the classes of the features we draw */
+  if(layer->filter.string) {
+    filter = msStringConcatenate(msStrdup("("), layer->filter.string);
+    filter = msStringConcatenate(filter, ")");
+  }
+  if(class_filter && strlen(class_filter) < sizeof(query_string_temp) / 2) {
+    if(filter)
+      filter = msStringConcatenate(filter, " and ");
+    filter = msStringConcatenate(filter, (char *) class_filter);
+  }
+
   /* test whether we should omit spatial filtering */
   msMSSQL2008LayerGetExtent(layer, &extent);
   if (rect.minx <= extent.minx && rect.miny <= extent.miny && 
       rect.maxx >= extent.maxx && rect.maxy >= extent.maxy) {
       /* no spatial filter used */
-      if(!layer->filter.string) {
+      if(!filter) {
         snprintf(query_string_temp, sizeof(query_string_temp),  "SELECT %s from %s", columns_wanted, data_source );
       } else {
-        snprintf(query_string_temp, sizeof(query_string_temp), "SELECT %s from %s WHERE (%s)", columns_wanted, data_source, layer->filter.string );
+        snprintf(query_string_temp, sizeof(query_string_temp), "SELECT %s from %s WHERE %s", columns_wanted, data_source, filter );
       }
   }
   else {
-      if(!layer->filter.string) {
+      if(!filter) {
         snprintf(query_string_temp, sizeof(query_string_temp),  "SELECT %s from %s WHERE %s.STIntersects(%s) = 1 ", columns_wanted, data_source, layerinfo->geom_column, box3d );
       } else {
-        snprintf(query_string_temp, sizeof(query_string_temp), "SELECT %s from %s WHERE (%s) and %s.STIntersects(%s) = 1 ", columns_wanted, data_source, layer->filter.string, layerinfo->geom_column, box3d );
+        snprintf(query_string_temp, sizeof(query_string_temp), "SELECT %s from %s WHERE %s and %s.STIntersects(%s) = 1 ", columns_wanted, data_source, filter, layerinfo->geom_column, box3d );
       }
   }
 
+  msFree(filter);
   msFree(data_source);
   msFree(f_table_name);
   msFree(columns_wanted);
@@ -939,11 +956,98 @@ static int prepare_database(layerObj *layer, rectObj rect, char **query_string)
   }
 }
 
+/* Read the types of the geom_table columns, as "name<tab>type" lines where */
+/* type is 'n' (number) or '-' (not used in SQL filters) */
+static char *msMSSQL2008GetColumnTypes(layerObj *layer)
+{
+  msMSSQL2008LayerInfo *layerinfo = getMSSQL2008LayerInfo(layer);
+  char *sql;
+  SQLSMALLINT cols = 0;
+  int t;
+
+  if(layerinfo->column_types)
+    return layerinfo->column_types;
+
+  layerinfo->column_types = msConnPoolGetMetadata(layer, layerinfo->geom_table, "columntypes");
+  if(layerinfo->column_types || strstr(layerinfo->geom_table, "!BOX!"))
+    return layerinfo->column_types;
+
+  sql = msSmallMalloc(strlen(layerinfo->geom_table) + 30);
+  sprintf(sql, "SELECT top 0 * FROM %s", layerinfo->geom_table);
+  if (!executeSQL(layerinfo->conn, sql)) {
+    if(layer->debug) {
+      msDebug("msMSSQL2008GetColumnTypes(): Error (%s) executing SQL: %s\n", layerinfo->conn->errorMessage, sql);
+    }
+    msFree(sql);
+    return NULL;
+  }
+  msFree(sql);
+
+  SQLNumResultCols(layerinfo->conn->hstmt, &cols);
+  layerinfo->column_types = msStrdup("");
+  for(t = 0; t < cols; t++) {
+    char colBuff[256];
+    SQLSMALLINT colType = SQL_UNKNOWN_TYPE;
+
+    if(!columnName(layerinfo->conn, t + 1, colBuff, sizeof(colBuff), &colType))
+      continue;
+
+    /* strings are left out, their comparisons depend on the collation, and
+       floating point columns as MapServer compares their text form */
+    layerinfo->column_types = msStringConcatenate(layerinfo->column_types, colBuff);
+    switch(colType) {
+      case SQL_TINYINT:
+      case SQL_SMALLINT:
+      case SQL_INTEGER:
+      case SQL_BIGINT:
+        layerinfo->column_types = msStringConcatenate(layerinfo->column_types, "\tn\n");
+        break;
+      default:
+        layerinfo->column_types = msStringConcatenate(layerinfo->column_types, "\t-\n");
+    }
+  }
+  msConnPoolSetMetadata(layer, layerinfo->geom_table, "columntypes", layerinfo->column_types);
+
+  return layerinfo->column_types;
+}
+
+/* sqlDialectObj item type callback, data is the layerinfo->column_types */
+static int msMSSQL2008GetItemType(layerObj *layer, const char *item, void *data)
+{
+  const char *line = (const char *) data;
+  size_t length = strlen(item);
+
+  while(line && *line) {
+    if(strncmp(line, item, length) == 0 && line[length] == '\t')
+      return line[length+1] == 'n' ? MS_SQL_ITEM_NUMBER : MS_SQL_ITEM_UNKNOWN;
+    line = strchr(line, '\n');
+    if(line) line++;
+  }
+  return MS_SQL_ITEM_UNKNOWN;
+}
+
+/* SQL selecting the features the layer classes draw, or NULL for all of them */
+static char *msMSSQL2008BuildSQLClasses(layerObj *layer)
+{
+  sqlDialectObj dialect;
+
+  if(layer->numclasses <= 0 || !msMSSQL2008GetColumnTypes(layer))
+    return NULL;
+
+  dialect.identifier_open = '[';
+  dialect.identifier_close = ']';
+  dialect.itemtype = msMSSQL2008GetItemType;
+  dialect.data = getMSSQL2008LayerInfo(layer)->column_types;
+
+  return msLayerClassesToSQL(layer, &dialect);
+}
+
 /* Execute SQL query for this layer */
 int msMSSQL2008LayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
   msMSSQL2008LayerInfo  *layerinfo = 0;
   char    *query_str = 0;
+  char    *class_filter = 0;
   int     set_up_result;
 
   if(layer->debug) {
@@ -965,7 +1069,13 @@ int msMSSQL2008LayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return MS_FAILURE;
   }
 
-  set_up_result = prepare_database(layer, rect, &query_str);
+  /* when drawing, only fetch the features one of the classes draws */
+  if(!isQuery) {
+    class_filter = msMSSQL2008BuildSQLClasses(layer);
+  }
+
+  set_up_result = prepare_database(layer, rect, class_filter, &query_str);
+  msFree(class_filter);
 
   if(set_up_result != MS_SUCCESS) {
     msFree(query_str);
@@ -1041,6 +1151,11 @@ int msMSSQL2008LayerClose(layerObj *layer)
       layerinfo->geom_table = NULL;
     }
 
+    if(layerinfo->column_types) {
+      msFree(layerinfo->column_types);
+      layerinfo->column_types = NULL;
+    }
+
     setMSSQL2008LayerInfo(layer, NULL);
     msFree(layerinfo);
   }
@@ -1871,7 +1986,7 @@ int msMSSQL2008LayerGetItems(layerObj *layer)
   for(t = 0; t < cols; t++) {
     char colBuff[256];
 
-    columnName(layerinfo->conn, t + 1, colBuff, sizeof(colBuff));
+    columnName(layerinfo->conn, t + 1, colBuff, sizeof(colBuff), NULL);
 
     if(strcmp(colBuff, layerinfo->geom_column) != 0) {
       /* this isnt the geometry column */
@@ -91,6 +91,7 @@ void msFreeMap(mapObj *map)
   msFree(map->name);
   msFree(map->shapepath);
   msFree(map->mappath);
+  msFree(map->mapfile);
 
   msFreeProjection(&(map->projection));
   msFreeProjection(&(map->latlon));
@@ -173,6 +174,12 @@ int msSetConfigOption( mapObj *map, const char *key, const char *value)
       return MS_FAILURE;
   }
 
+  /* Same for MS_TRACEFILE so that the mapfile load itself can be traced */
+  if( strcasecmp(key,"MS_TRACEFILE") == 0 ) {
+    if (msTraceSetFile( value, map->mappath ) != MS_SUCCESS)
+      return MS_FAILURE;
+  }
+
   if( msLookupHashTable( &(map->configoptions), key ) != NULL )
     msRemoveHashTable( &(map->configoptions), key );
   msInsertHashTable( &(map->configoptions), key, value );
@@ -217,6 +224,8 @@ void msApplyMapConfigOptions( mapObj *map )
       msSetPROJ_LIB( value, map->mappath );
     } else if( strcasecmp(key,"MS_ERRORFILE") == 0 ) {
       msSetErrorFile( value, map->mappath );
+    } else if( strcasecmp(key,"MS_TRACEFILE") == 0 ) {
+      msTraceSetFile( value, map->mappath );
     } else {
 
 #if defined(USE_GDAL) && GDAL_RELEASE_DATE > 20030601
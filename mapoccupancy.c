@@ -0,0 +1,585 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Coarse occupancy grids to skip layers with no data in view.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** An occupancy grid records where a layer has features, so that drawing a
+** view with nothing in it can be skipped before the datasource is opened
+** (ocean tiles of a land layer, tiles outside of a national dataset). It is
+** enabled per layer with
+**
+**   PROCESSING "OCCUPANCY=roads.occ"
+**
+** relative paths being resolved against the MS_OCCUPANCY_DIR config option,
+** or the mapfile's directory when it is not set. The file is built offline
+** with msoccupancy (msLayerBuildOccupancy()) and has to be rebuilt when the
+** data changes. While it is missing the layer is drawn as usual.
+**
+** The grid covers the layer extent with 2^levels x 2^levels cells, in the
+** layer's coordinates. A cell is set when a feature may touch it: points
+** mark their cell, lines and polygon rings the cells of the bounds of each
+** segment, and polygon interiors the cells whose center they contain. The
+** layer FILTER is not applied while building, so the grid holds for any
+** filter. Only the finest level is stored; the coarser levels are built when
+** the file is loaded and let a large view be answered from a few cells.
+**
+** File format: "MSOCCUPANCY 1" line, a line with levels, a line with the
+** extent (minx miny maxx maxy), then the finest level as a bitmap, row by
+** row from miny, bit i of the grid in byte i/8 at bit i%8.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mapserver.h"
+#include "mapthread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+
+#define MS_OCCUPANCY_MAGIC "MSOCCUPANCY 1"
+#define MS_OCCUPANCY_MAX_LEVELS 12
+
+#define OCC_BIT(bits, n, x, y) ((bits)[((y)*(n)+(x)) >> 3] & (1 << (((y)*(n)+(x)) & 7)))
+#define OCC_SET(bits, n, x, y) ((bits)[((y)*(n)+(x)) >> 3] |= (1 << (((y)*(n)+(x)) & 7)))
+
+typedef struct occupancyGridObj {
+  char *filename;
+  long mtime;
+  rectObj extent;
+  int levels; /* the finest level has 2^levels cells on a side */
+  unsigned char *bits[MS_OCCUPANCY_MAX_LEVELS+1]; /* one bitmap per level, 0 is a single cell */
+  struct occupancyGridObj *next;
+} occupancyGridObj;
+
+static occupancyGridObj *occupancy_grids = NULL;
+
+static int occupancyBitmapSize(int level)
+{
+  int n = 1 << level;
+  return (n*n + 7) / 8;
+}
+
+static void occupancyFreeGrid(occupancyGridObj *grid)
+{
+  int i;
+
+  if(!grid) return;
+  for(i=0; i<=grid->levels; i++)
+    msFree(grid->bits[i]);
+  msFree(grid->filename);
+  msFree(grid);
+}
+
+static occupancyGridObj *occupancyNewGrid(rectObj extent, int levels)
+{
+  occupancyGridObj *grid;
+  int i;
+
+  grid = (occupancyGridObj *) msSmallCalloc(1, sizeof(occupancyGridObj));
+  grid->extent = extent;
+  grid->levels = levels;
+  for(i=0; i<=levels; i++)
+    grid->bits[i] = (unsigned char *) msSmallCalloc(1, occupancyBitmapSize(i));
+  return grid;
+}
+
+/* derive the coarser levels from the finest one */
+static void occupancyBuildPyramid(occupancyGridObj *grid)
+{
+  int level, x, y;
+
+  for(level=grid->levels-1; level>=0; level--) {
+    int n = 1 << level;
+
+    memset(grid->bits[level], 0, occupancyBitmapSize(level));
+    for(y=0; y<2*n; y++)
+      for(x=0; x<2*n; x++)
+        if(OCC_BIT(grid->bits[level+1], 2*n, x, y))
+          OCC_SET(grid->bits[level], n, x/2, y/2);
+  }
+}
+
+/* cell of coordinate v along an axis of n cells from min to max */
+static int occupancyCell(double v, double min, double max, int n)
+{
+  double f;
+
+  if(max <= min) return 0;
+  f = (v - min) / (max - min) * n;
+  if(f < 0) return 0;
+  if(f >= n) return n-1;
+  return (int) f;
+}
+
+/* msLayerGetOccupancyFile()
+**
+** Resolve the layer's OCCUPANCY processing key into path (MS_MAXPATHLEN).
+** Returns NULL when the layer has no occupancy grid.
+*/
+char *msLayerGetOccupancyFile(mapObj *map, layerObj *layer, char *path)
+{
+  const char *file = msLayerGetProcessingKey(layer, "OCCUPANCY");
+  const char *dir;
+
+  if(file == NULL || *file == '\0')
+    return NULL;
+
+  dir = msGetConfigOption(map, "MS_OCCUPANCY_DIR");
+  if(dir == NULL) dir = map->mappath;
+
+  return msBuildPath(path, dir, file);
+}
+
+/************************************************************************/
+/*                              Building                                */
+/************************************************************************/
+
+static void occupancyMarkRect(occupancyGridObj *grid, double minx, double miny, double maxx, double maxy)
+{
+  int n = 1 << grid->levels;
+  int x, y, x0, y0, x1, y1;
+
+  x0 = occupancyCell(minx, grid->extent.minx, grid->extent.maxx, n);
+  x1 = occupancyCell(maxx, grid->extent.minx, grid->extent.maxx, n);
+  y0 = occupancyCell(miny, grid->extent.miny, grid->extent.maxy, n);
+  y1 = occupancyCell(maxy, grid->extent.miny, grid->extent.maxy, n);
+
+  for(y=y0; y<=y1; y++)
+    for(x=x0; x<=x1; x++)
+      OCC_SET(grid->bits[grid->levels], n, x, y);
+}
+
+static int compareCrossings(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+/*
+** Set the cells whose center is inside the polygon (even-odd over all
+** rings, as polygons are drawn), one row of cell centers at a time.
+*/
+static void occupancyFillPolygon(occupancyGridObj *grid, shapeObj *shape)
+{
+  int n = 1 << grid->levels;
+  double cw, ch, *crossings;
+  int numpoints = 0, i, j, k, r, row, row0, row1;
+
+  cw = (grid->extent.maxx - grid->extent.minx) / n;
+  ch = (grid->extent.maxy - grid->extent.miny) / n;
+  if(cw <= 0 || ch <= 0) return; /* the boundary cells are all there is */
+
+  for(i=0; i<shape->numlines; i++)
+    numpoints += shape->line[i].numpoints;
+  crossings = (double *) msSmallMalloc(sizeof(double) * (numpoints + 1));
+
+  row0 = occupancyCell(shape->bounds.miny, grid->extent.miny, grid->extent.maxy, n);
+  row1 = occupancyCell(shape->bounds.maxy, grid->extent.miny, grid->extent.maxy, n);
+
+  for(row=row0; row<=row1; row++) {
+    double yc = grid->extent.miny + (row + 0.5) * ch;
+    int numcrossings = 0;
+
+    for(r=0; r<shape->numlines; r++) {
+      lineObj *line = &(shape->line[r]);
+
+      for(i=0, j=line->numpoints-1; i<line->numpoints; j=i++) {
+        pointObj *p1 = &(line->point[j]), *p2 = &(line->point[i]);
+
+        if((p1->y <= yc) != (p2->y <= yc))
+          crossings[numcrossings++] = p1->x + (yc - p1->y) * (p2->x - p1->x) / (p2->y - p1->y);
+      }
+    }
+
+    qsort(crossings, numcrossings, sizeof(double), compareCrossings);
+
+    for(k=0; k+1<numcrossings; k+=2) {
+      double x0 = ceil((crossings[k] - grid->extent.minx) / cw - 0.5);
+      double x1 = floor((crossings[k+1] - grid->extent.minx) / cw - 0.5);
+
+      if(x0 < 0) x0 = 0;
+      if(x1 > n-1) x1 = n-1;
+      for(i=(int)x0; i<=(int)x1; i++)
+        OCC_SET(grid->bits[grid->levels], n, i, row);
+    }
+  }
+
+  msFree(crossings);
+}
+
+static void occupancyMarkShape(occupancyGridObj *grid, shapeObj *shape)
+{
+  int i, j;
+
+  for(i=0; i<shape->numlines; i++) {
+    lineObj *line = &(shape->line[i]);
+
+    for(j=0; j<line->numpoints; j++) {
+      pointObj *p1 = &(line->point[j]), *p2 = p1;
+
+      /* segments of lines and rings, single points otherwise */
+      if(shape->type != MS_SHAPE_POINT && j+1 < line->numpoints)
+        p2 = &(line->point[j+1]);
+      else if(shape->type != MS_SHAPE_POINT && line->numpoints > 1)
+        continue;
+
+      occupancyMarkRect(grid, MS_MIN(p1->x, p2->x), MS_MIN(p1->y, p2->y),
+                        MS_MAX(p1->x, p2->x), MS_MAX(p1->y, p2->y));
+    }
+  }
+
+  if(shape->type == MS_SHAPE_POLYGON)
+    occupancyFillPolygon(grid, shape);
+}
+
+/*
+** Mark every feature of the (open) layer within extent. Features reaching
+** outside of extent are merged into *bounds and make the return MS_DONE, so
+** the caller can start over with a larger grid.
+*/
+static int occupancyScanLayer(layerObj *layer, occupancyGridObj *grid, rectObj *bounds)
+{
+  shapeObj shape;
+  int status, outside = MS_FALSE;
+
+  status = msLayerWhichShapes(layer, grid->extent, MS_FALSE);
+  if(status == MS_DONE)
+    return MS_SUCCESS; /* nothing there */
+  if(status != MS_SUCCESS)
+    return MS_FAILURE;
+
+  msInitShape(&shape);
+  while((status = msLayerNextShape(layer, &shape)) == MS_SUCCESS) {
+    if(shape.numlines > 0) {
+      if(shape.bounds.minx < grid->extent.minx || shape.bounds.miny < grid->extent.miny ||
+          shape.bounds.maxx > grid->extent.maxx || shape.bounds.maxy > grid->extent.maxy) {
+        msMergeRect(bounds, &shape.bounds);
+        outside = MS_TRUE;
+      }
+      occupancyMarkShape(grid, &shape);
+    }
+    msFreeShape(&shape);
+  }
+  if(status != MS_DONE)
+    return MS_FAILURE;
+
+  return outside ? MS_DONE : MS_SUCCESS;
+}
+
+static int occupancyWriteGrid(occupancyGridObj *grid, const char *filename)
+{
+  char tmpfilename[MS_MAXPATHLEN];
+  int size = occupancyBitmapSize(grid->levels);
+  FILE *fp;
+
+  snprintf(tmpfilename, sizeof(tmpfilename), "%s.%ld.tmp", filename, (long) getpid());
+  if((fp = fopen(tmpfilename, "wb")) == NULL) {
+    msSetError(MS_IOERR, "Unable to create occupancy grid (%s).", "msLayerBuildOccupancy()", tmpfilename);
+    return MS_FAILURE;
+  }
+
+  fprintf(fp, "%s\n%d\n%.17g %.17g %.17g %.17g\n", MS_OCCUPANCY_MAGIC, grid->levels,
+          grid->extent.minx, grid->extent.miny, grid->extent.maxx, grid->extent.maxy);
+  if(fwrite(grid->bits[grid->levels], 1, size, fp) != (size_t) size || fclose(fp) != 0) {
+    msSetError(MS_IOERR, "Failed writing occupancy grid (%s).", "msLayerBuildOccupancy()", tmpfilename);
+    remove(tmpfilename);
+    return MS_FAILURE;
+  }
+
+  /* readers see either the previous grid or the new one */
+  if(rename(tmpfilename, filename) != 0) {
+    remove(filename);
+    if(rename(tmpfilename, filename) != 0) {
+      msSetError(MS_IOERR, "Unable to rename %s to %s.", "msLayerBuildOccupancy()", tmpfilename, filename);
+      remove(tmpfilename);
+      return MS_FAILURE;
+    }
+  }
+
+  return MS_SUCCESS;
+}
+
+/* msLayerBuildOccupancy()
+**
+** Read all features of layer and write its occupancy grid, with 2^levels
+** cells on a side (1 to MS_OCCUPANCY_MAX_LEVELS), to the file named by its
+** OCCUPANCY processing key.
+*/
+int msLayerBuildOccupancy(mapObj *map, layerObj *layer, int levels)
+{
+  char path[MS_MAXPATHLEN];
+  occupancyGridObj *grid = NULL;
+  expressionObj filter;
+  char *filteritem;
+  int maxfeatures, startindex;
+  rectObj extent, bounds;
+  int status;
+
+  if(msLayerGetOccupancyFile(map, layer, path) == NULL) {
+    msSetError(MS_MISCERR, "Layer %s has no OCCUPANCY processing key.", "msLayerBuildOccupancy()", layer->name);
+    return MS_FAILURE;
+  }
+  if(layer->type == MS_LAYER_RASTER || layer->connectiontype == MS_WMS) {
+    msSetError(MS_MISCERR, "Occupancy grids are only supported for vector layers (layer %s).", "msLayerBuildOccupancy()", layer->name);
+    return MS_FAILURE;
+  }
+  if(levels < 1 || levels > MS_OCCUPANCY_MAX_LEVELS) {
+    msSetError(MS_MISCERR, "Occupancy grid levels must be between 1 and %d.", "msLayerBuildOccupancy()", MS_OCCUPANCY_MAX_LEVELS);
+    return MS_FAILURE;
+  }
+
+  /* every feature counts, whatever the filter of the request */
+  filter = layer->filter;
+  filteritem = layer->filteritem;
+  maxfeatures = layer->maxfeatures;
+  startindex = layer->startindex;
+  initExpression(&(layer->filter));
+  layer->filteritem = NULL;
+  layer->maxfeatures = -1;
+  layer->startindex = -1;
+
+  status = msLayerOpen(layer);
+  if(status == MS_SUCCESS)
+    status = msLayerWhichItems(layer, MS_FALSE, NULL);
+
+  /*
+  ** Features outside a LAYER EXTENT are drawn all the same, the grid covers
+  ** the extent of the data itself. LAYER EXTENT is only used for the data
+  ** sources that can't tell.
+  */
+  if(status == MS_SUCCESS) {
+    rectObj layerextent = layer->extent;
+
+    layer->extent.minx = layer->extent.miny = layer->extent.maxx = layer->extent.maxy = -1.0;
+    status = msLayerGetExtent(layer, &extent);
+    layer->extent = layerextent;
+
+    if(status != MS_SUCCESS || !MS_VALID_EXTENT(extent)) {
+      if(MS_VALID_EXTENT(layer->extent)) {
+        msResetErrorList();
+        extent = layer->extent;
+        status = MS_SUCCESS;
+      } else {
+        msSetError(MS_MISCERR, "Unable to get the extent of layer %s, set its EXTENT.", "msLayerBuildOccupancy()", layer->name);
+        status = MS_FAILURE;
+      }
+    }
+  }
+
+  while(status == MS_SUCCESS) {
+    grid = occupancyNewGrid(extent, levels);
+    bounds = extent;
+    status = occupancyScanLayer(layer, grid, &bounds);
+    if(status != MS_DONE)
+      break;
+
+    /* the extent was too small, scan again over the full bounds */
+    occupancyFreeGrid(grid);
+    grid = NULL;
+    extent = bounds;
+    status = MS_SUCCESS;
+  }
+
+  msLayerClose(layer);
+
+  freeExpression(&(layer->filter));
+  layer->filter = filter;
+  layer->filteritem = filteritem;
+  layer->maxfeatures = maxfeatures;
+  layer->startindex = startindex;
+
+  if(status == MS_SUCCESS)
+    status = occupancyWriteGrid(grid, path);
+
+  occupancyFreeGrid(grid);
+  return status;
+}
+
+/************************************************************************/
+/*                              Testing                                 */
+/************************************************************************/
+
+static occupancyGridObj *occupancyReadGrid(const char *filename, long mtime)
+{
+  occupancyGridObj *grid;
+  char line[256];
+  rectObj extent;
+  int levels, size;
+  FILE *fp;
+
+  if((fp = fopen(filename, "rb")) == NULL)
+    return NULL;
+
+  if(fgets(line, sizeof(line), fp) == NULL || strncmp(line, MS_OCCUPANCY_MAGIC, strlen(MS_OCCUPANCY_MAGIC)) != 0 ||
+      fgets(line, sizeof(line), fp) == NULL || sscanf(line, "%d", &levels) != 1 ||
+      levels < 0 || levels > MS_OCCUPANCY_MAX_LEVELS ||
+      fgets(line, sizeof(line), fp) == NULL ||
+      sscanf(line, "%lf %lf %lf %lf", &extent.minx, &extent.miny, &extent.maxx, &extent.maxy) != 4) {
+    fclose(fp);
+    return NULL;
+  }
+
+  grid = occupancyNewGrid(extent, levels);
+  size = occupancyBitmapSize(levels);
+  if(fread(grid->bits[levels], 1, size, fp) != (size_t) size) {
+    fclose(fp);
+    occupancyFreeGrid(grid);
+    return NULL;
+  }
+  fclose(fp);
+
+  occupancyBuildPyramid(grid);
+  grid->filename = msStrdup(filename);
+  grid->mtime = mtime;
+
+  return grid;
+}
+
+/*
+** Is any finest cell in x0..x1, y0..y1 set below cell x, y of level?
+*/
+static int occupancyHasCell(occupancyGridObj *grid, int level, int x, int y, int x0, int y0, int x1, int y1)
+{
+  int shift = grid->levels - level, i, j;
+
+  if(!OCC_BIT(grid->bits[level], 1 << level, x, y))
+    return MS_FALSE;
+
+  /* a set cell entirely in range has a set finest cell in range */
+  if((x << shift) >= x0 && ((x+1) << shift) - 1 <= x1 &&
+      (y << shift) >= y0 && ((y+1) << shift) - 1 <= y1)
+    return MS_TRUE;
+
+  shift--;
+  for(j=2*y; j<=2*y+1; j++) {
+    if((j << shift) > y1 || ((j+1) << shift) - 1 < y0) continue;
+    for(i=2*x; i<=2*x+1; i++) {
+      if((i << shift) > x1 || ((i+1) << shift) - 1 < x0) continue;
+      if(occupancyHasCell(grid, level+1, i, j, x0, y0, x1, y1))
+        return MS_TRUE;
+    }
+  }
+
+  return MS_FALSE;
+}
+
+static int occupancyTest(occupancyGridObj *grid, rectObj rect)
+{
+  int n = 1 << grid->levels;
+
+  if(!msRectOverlap(&rect, &(grid->extent)))
+    return MS_FALSE;
+
+  return occupancyHasCell(grid, 0, 0, 0,
+                          occupancyCell(rect.minx, grid->extent.minx, grid->extent.maxx, n),
+                          occupancyCell(rect.miny, grid->extent.miny, grid->extent.maxy, n),
+                          occupancyCell(rect.maxx, grid->extent.minx, grid->extent.maxx, n),
+                          occupancyCell(rect.maxy, grid->extent.miny, grid->extent.maxy, n));
+}
+
+/* msLayerIsOccupied()
+**
+** Returns MS_FALSE when the layer's occupancy grid shows it has no features
+** in map->extent, MS_TRUE otherwise (including when there is no usable
+** grid). Loaded grids are kept for the life of the process and reloaded
+** when their file changes.
+*/
+int msLayerIsOccupied(mapObj *map, layerObj *layer)
+{
+  char path[MS_MAXPATHLEN];
+  occupancyGridObj **link, *grid;
+  struct stat stat_buf;
+  rectObj rect;
+  int occupied;
+
+  if(layer->transform != MS_TRUE || layer->type == MS_LAYER_RASTER ||
+      layer->connectiontype == MS_WMS || layer->cluster.region)
+    return MS_TRUE;
+
+  if(msLayerGetOccupancyFile(map, layer, path) == NULL)
+    return MS_TRUE;
+
+  if(stat(path, &stat_buf) != 0) {
+    if(layer->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msLayerIsOccupied(): No occupancy grid %s for layer (%s).\n", path, layer->name);
+    return MS_TRUE;
+  }
+
+  msAcquireLock(TLOCK_OCCUPANCY);
+
+  for(link=&occupancy_grids; (grid = *link) != NULL; link=&(grid->next))
+    if(strcmp(grid->filename, path) == 0) break;
+
+  if(grid && grid->mtime != (long) stat_buf.st_mtime) {
+    *link = grid->next;
+    occupancyFreeGrid(grid);
+    grid = NULL;
+  }
+  if(grid == NULL && (grid = occupancyReadGrid(path, (long) stat_buf.st_mtime)) != NULL) {
+    grid->next = occupancy_grids;
+    occupancy_grids = grid;
+  }
+
+  if(grid == NULL) {
+    msReleaseLock(TLOCK_OCCUPANCY);
+    if(layer->debug)
+      msDebug("msLayerIsOccupied(): Ignoring unreadable occupancy grid %s of layer (%s).\n", path, layer->name);
+    return MS_TRUE;
+  }
+
+  rect = map->extent;
+#ifdef USE_PROJ
+  if((map->projection.numargs > 0) && (layer->projection.numargs > 0))
+    msProjectRect(&map->projection, &layer->projection, &rect);
+#endif
+
+  occupied = occupancyTest(grid, rect);
+
+  msReleaseLock(TLOCK_OCCUPANCY);
+
+  if(!occupied && layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msLayerIsOccupied(): Layer (%s) has no features in MAP.EXTENT according to %s.\n", layer->name, path);
+
+  return occupied;
+}
+
+void msOccupancyCacheCleanup(void)
+{
+  occupancyGridObj *grid;
+
+  msAcquireLock(TLOCK_OCCUPANCY);
+  while((grid = occupancy_grids) != NULL) {
+    occupancy_grids = grid->next;
+    occupancyFreeGrid(grid);
+  }
+  msReleaseLock(TLOCK_OCCUPANCY);
+}
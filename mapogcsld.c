@@ -29,6 +29,7 @@
 #include "mapogcsld.h"
 #include "mapogcfilter.h"
 #include "mapserver.h"
+#include "mapthread.h"
 
 #ifdef USE_OGR
 #include "cpl_string.h"
@@ -51,6 +52,238 @@
 #define SLD_MARK_SYMBOL_X "sld_mark_symbol_x"
 #define SLD_MARK_SYMBOL_X_FILLED "sld_mark_symbol_x_filled"
 
+static int sldApply(mapObj *map, char *psSLDXML, const char *pszURL, int nMaxAge,
+                    int iLayer, char *pszStyleLayerName, char **ppszLayerNames);
+
+#if (defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR)) && defined(USE_OGR)
+
+/*
+** Cache of parsed SLDs, keyed by URL (as long as the HTTP response is
+** fresh) or by the SLD_BODY document. An entry keeps a copy of the layers
+** (classes, styles, expressions) built by msSLDParseSLD() and of the
+** symbols the parsing added to the map. Using it copies the layers and
+** adds the missing symbols to the map instead of parsing the document
+** again. Entries are only valid for the mapfile they were parsed against
+** (the styles refer to its symbols), maps not loaded from a file are not
+** cached.
+*/
+#define MS_SLD_CACHE_SIZE 32
+
+typedef struct sldCacheEntryObj {
+  char *key;            /* SLD URL or SLD document */
+  int isurl;
+  unsigned hashval;
+  char *mapfile;
+  long mapfile_mtime;
+  time_t expires;       /* 0 if it does not expire */
+  layerObj *layers;
+  int numlayers;
+  int firstsymbol;      /* symbols below this index come from the mapfile */
+  symbolObj **symbols;  /* symbols added to the map by the parsing */
+  int numsymbols;
+  struct sldCacheEntryObj *next;
+} sldCacheEntryObj;
+
+static sldCacheEntryObj *sld_cache = NULL; /* most recently used first */
+
+static unsigned sldCacheHash(const char *key)
+{
+  unsigned hashval;
+
+  for(hashval=0; *key!='\0'; key++)
+    hashval = *key + 31 * hashval;
+
+  return hashval;
+}
+
+static void sldCacheFreeEntry(sldCacheEntryObj *entry)
+{
+  int i;
+
+  for (i=0; i<entry->numlayers; i++)
+    freeLayer(&entry->layers[i]);
+  msFree(entry->layers);
+  for (i=0; i<entry->numsymbols; i++) {
+    msFreeSymbol(entry->symbols[i]);
+    msFree(entry->symbols[i]);
+  }
+  msFree(entry->symbols);
+  msFree(entry->key);
+  msFree(entry->mapfile);
+  msFree(entry);
+}
+
+static void sldRemapStyleSymbols(styleObj **styles, int numstyles, int firstsymbol, int *remap)
+{
+  int i;
+
+  for (i=0; i<numstyles; i++) {
+    if (styles[i]->symbol >= firstsymbol)
+      styles[i]->symbol = remap[styles[i]->symbol - firstsymbol];
+  }
+}
+
+/*
+** Copy of the layers of a cached SLD for map, or NULL when there is no
+** (fresh) entry for key.
+*/
+static layerObj *sldCacheLookup(mapObj *map, const char *key, int isurl, int *pnLayers)
+{
+  sldCacheEntryObj **link, *entry;
+  layerObj *pasLayers = NULL;
+  unsigned hashval;
+  time_t now = time(NULL);
+  int i, j, k, *remap;
+
+  if (map->mapfile == NULL || key == NULL)
+    return NULL;
+
+  hashval = sldCacheHash(key);
+
+  msAcquireLock(TLOCK_SLDCACHE);
+
+  for (link = &sld_cache; (entry = *link) != NULL; ) {
+    if (entry->expires != 0 && entry->expires <= now) {
+      *link = entry->next;
+      sldCacheFreeEntry(entry);
+      continue;
+    }
+    if (entry->hashval == hashval && entry->isurl == isurl &&
+        entry->mapfile_mtime == map->mapfile_mtime &&
+        strcmp(entry->key, key) == 0 && strcmp(entry->mapfile, map->mapfile) == 0 &&
+        entry->firstsymbol <= map->symbolset.numsymbols)
+      break;
+    link = &entry->next;
+  }
+
+  if (entry) {
+    /* move to front */
+    *link = entry->next;
+    entry->next = sld_cache;
+    sld_cache = entry;
+
+    /* the symbols made by the parsing, reuse those already in the map */
+    remap = (int *) msSmallMalloc(sizeof(int) * (entry->numsymbols + 1));
+    for (k=0; k<entry->numsymbols; k++) {
+      remap[k] = -1;
+      if (entry->symbols[k]->name)
+        remap[k] = msGetSymbolIndex(&(map->symbolset), entry->symbols[k]->name, MS_FALSE);
+      if (remap[k] < 0) {
+        symbolObj *psSymbol = msGrowSymbolSet(&(map->symbolset));
+        if (psSymbol == NULL)
+          break;
+        msCopySymbol(psSymbol, entry->symbols[k], map);
+        remap[k] = map->symbolset.numsymbols++;
+      }
+    }
+
+    if (k == entry->numsymbols) {
+      pasLayers = (layerObj *) msSmallMalloc(sizeof(layerObj) * entry->numlayers);
+      for (i=0; i<entry->numlayers; i++) {
+        initLayer(&pasLayers[i], map);
+        msCopyLayer(&pasLayers[i], &entry->layers[i]);
+        for (j=0; j<pasLayers[i].numclasses; j++) {
+          classObj *psClass = pasLayers[i].class[j];
+          sldRemapStyleSymbols(psClass->styles, psClass->numstyles, entry->firstsymbol, remap);
+          for (k=0; k<psClass->numlabels; k++)
+            sldRemapStyleSymbols(psClass->labels[k]->styles, psClass->labels[k]->numstyles,
+                                 entry->firstsymbol, remap);
+        }
+      }
+      *pnLayers = entry->numlayers;
+    }
+    msFree(remap);
+  }
+
+  msReleaseLock(TLOCK_SLDCACHE);
+
+  if (pasLayers && map->debug >= MS_DEBUGLEVEL_V)
+    msDebug("sldCacheLookup(): using the cached SLD %s\n", isurl ? key : "body");
+
+  return pasLayers;
+}
+
+/*
+** Keep a copy of the layers just parsed (and of the symbols added to the
+** map from firstsymbol on) for the next requests.
+*/
+static void sldCacheStore(mapObj *map, const char *key, int isurl, time_t expires,
+                          layerObj *pasLayers, int nLayers, int firstsymbol)
+{
+  sldCacheEntryObj *entry, **link;
+  int i, n;
+
+  if (map->mapfile == NULL || key == NULL || nLayers <= 0)
+    return;
+
+  /* spatial filters are applied as a query, they can't be copied */
+  for (i=0; i<nLayers; i++) {
+    if (pasLayers[i].layerinfo)
+      return;
+  }
+
+  entry = (sldCacheEntryObj *) msSmallCalloc(1, sizeof(sldCacheEntryObj));
+  entry->key = msStrdup(key);
+  entry->isurl = isurl;
+  entry->hashval = sldCacheHash(key);
+  entry->mapfile = msStrdup(map->mapfile);
+  entry->mapfile_mtime = map->mapfile_mtime;
+  entry->expires = expires;
+
+  entry->layers = (layerObj *) msSmallMalloc(sizeof(layerObj) * nLayers);
+  for (i=0; i<nLayers; i++) {
+    initLayer(&entry->layers[i], NULL);
+    msCopyLayer(&entry->layers[i], &pasLayers[i]);
+  }
+  entry->numlayers = nLayers;
+
+  entry->firstsymbol = firstsymbol;
+  entry->numsymbols = map->symbolset.numsymbols - firstsymbol;
+  if (entry->numsymbols > 0) {
+    entry->symbols = (symbolObj **) msSmallMalloc(sizeof(symbolObj *) * entry->numsymbols);
+    for (i=0; i<entry->numsymbols; i++) {
+      entry->symbols[i] = (symbolObj *) msSmallMalloc(sizeof(symbolObj));
+      msCopySymbol(entry->symbols[i], map->symbolset.symbol[firstsymbol + i], NULL);
+    }
+  }
+
+  msAcquireLock(TLOCK_SLDCACHE);
+
+  entry->next = sld_cache;
+  sld_cache = entry;
+
+  for (link = &sld_cache, n = 0; *link; n++) {
+    if (n >= MS_SLD_CACHE_SIZE) {
+      entry = *link;
+      *link = entry->next;
+      sldCacheFreeEntry(entry);
+    } else
+      link = &(*link)->next;
+  }
+
+  msReleaseLock(TLOCK_SLDCACHE);
+}
+
+void msSLDCacheCleanup(void)
+{
+  sldCacheEntryObj *entry;
+
+  msAcquireLock(TLOCK_SLDCACHE);
+  while ((entry = sld_cache) != NULL) {
+    sld_cache = entry->next;
+    sldCacheFreeEntry(entry);
+  }
+  msReleaseLock(TLOCK_SLDCACHE);
+}
+
+#else
+
+void msSLDCacheCleanup(void)
+{
+}
+
+#endif
+
 /************************************************************************/
 /*                             msSLDApplySLDURL                         */
 /*                                                                      */
@@ -66,45 +299,55 @@ int msSLDApplySLDURL(mapObj *map, char *szURL, int iLayer,
   /* needed for libcurl function msHTTPGetFile in maphttp.c */
 #if defined(USE_CURL)
 
-  char *pszSLDTmpFile = NULL;
-  int status = 0;
+  httpRequestObj *pasReqInfo;
   char *pszSLDbuf=NULL;
-  FILE *fp = NULL;
+  int nMaxAge = -1;
   int nStatus = MS_FAILURE;
 
   if (map && szURL) {
-    pszSLDTmpFile = msTmpFile(map, map->mappath, NULL, "sld.xml");
-    if (pszSLDTmpFile == NULL) {
-      pszSLDTmpFile = msTmpFile(map, NULL, NULL, "sld.xml" );
+    int nMaxRemoteSLDBytes;
+    const char *pszMaxRemoteSLDBytes = msOWSLookupMetadata(&(map->web.metadata), "MO", "remote_sld_max_bytes");
+    if(!pszMaxRemoteSLDBytes) {
+      nMaxRemoteSLDBytes = 1024*1024; /* 1 megaByte */
+    } else {
+      nMaxRemoteSLDBytes = atoi(pszMaxRemoteSLDBytes);
     }
-    if (pszSLDTmpFile == NULL) {
-      msSetError(MS_WMSERR, "Could not determine temporary file %s. Please make sure that the temporary path is set. The temporary path can be defined for example by setting TMPPATH in the map file. Please check the MapServer documentation on temporary path settings.", "msSLDApplySLDURL()", pszSLDTmpFile);
+
+    /* a fresh copy of this SLD may be cached already */
+    nStatus = sldApply(map, NULL, szURL, 0, iLayer, pszStyleLayerName, ppszLayerNames);
+    if (nStatus != MS_DONE)
+      return nStatus;
+    nStatus = MS_FAILURE;
+
+    /* the document is read in memory, the response headers tell for */
+    /* how long it may be reused */
+    pasReqInfo = (httpRequestObj*)calloc(2, sizeof(httpRequestObj));
+    MS_CHECK_ALLOC(pasReqInfo, 2*sizeof(httpRequestObj), MS_FAILURE);
+    msHTTPInitRequestObj(pasReqInfo, 2);
+    pasReqInfo[0].pszGetUrl = msStrdup(szURL);
+    pasReqInfo[0].nTimeout = -1;
+    pasReqInfo[0].nMaxBytes = nMaxRemoteSLDBytes;
+
+    if (msHTTPExecuteRequests(pasReqInfo, 1, MS_FALSE) == MS_SUCCESS) {
+      pszSLDbuf = (char*)msSmallMalloc(pasReqInfo[0].result_size + 1);
+      if (pasReqInfo[0].result_size > 0)
+        memcpy(pszSLDbuf, pasReqInfo[0].result_data, pasReqInfo[0].result_size);
+      pszSLDbuf[pasReqInfo[0].result_size] = '\0';
+      nMaxAge = pasReqInfo[0].nMaxAge;
     } else {
-      int nMaxRemoteSLDBytes;
-      const char *pszMaxRemoteSLDBytes = msOWSLookupMetadata(&(map->web.metadata), "MO", "remote_sld_max_bytes");
-      if(!pszMaxRemoteSLDBytes) {
-    	  nMaxRemoteSLDBytes = 1024*1024; /* 1 megaByte */
-      } else {
-    	  nMaxRemoteSLDBytes = atoi(pszMaxRemoteSLDBytes);
-      }
-      if (msHTTPGetFile(szURL, pszSLDTmpFile, &status,-1, 0, 0, nMaxRemoteSLDBytes) ==  MS_SUCCESS) {
-        if ((fp = fopen(pszSLDTmpFile, "rb")) != NULL) {
-          int   nBufsize=0;
-          fseek(fp, 0, SEEK_END);
-          nBufsize = ftell(fp);
-          rewind(fp);
-          pszSLDbuf = (char*)malloc((nBufsize+1)*sizeof(char));
-          fread(pszSLDbuf, 1, nBufsize, fp);
-          fclose(fp);
-          pszSLDbuf[nBufsize] = '\0';
-          unlink(pszSLDTmpFile);
-        }
-      } else {
-        unlink(pszSLDTmpFile);
-        msSetError(MS_WMSERR, "Could not open SLD %s and save it in a temporary file. Please make sure that the sld url is valid and that the temporary path is set. The temporary path can be defined for example by setting TMPPATH in the map file. Please check the MapServer documentation on temporary path settings.", "msSLDApplySLDURL", szURL);
+      msSetError(MS_WMSERR, "Could not open SLD %s. Please make sure that the sld url is valid.", "msSLDApplySLDURL", szURL);
+    }
+    msHTTPFreeRequestObj(pasReqInfo, 2);
+    free(pasReqInfo);
+
+    if (pszSLDbuf) {
+      /* without caching headers, sld_cache_ttl tells how long to keep it */
+      if (nMaxAge < 0) {
+        const char *pszTTL = msOWSLookupMetadata(&(map->web.metadata), "MO", "sld_cache_ttl");
+        nMaxAge = pszTTL ? atoi(pszTTL) : 0;
       }
-      if (pszSLDbuf)
-        nStatus = msSLDApplySLD(map, pszSLDbuf, iLayer, pszStyleLayerName, ppszLayerNames);
+      nStatus = sldApply(map, pszSLDbuf, szURL, nMaxAge, iLayer, pszStyleLayerName, ppszLayerNames);
+      free(pszSLDbuf);
     }
   }
 
@@ -137,6 +380,22 @@ int msSLDApplySLDURL(mapObj *map, char *szURL, int iLayer,
 /************************************************************************/
 int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
                   char *pszStyleLayerName, char **ppszLayerNames)
+{
+  return sldApply(map, psSLDXML, NULL, 0, iLayer, pszStyleLayerName, ppszLayerNames);
+}
+
+/************************************************************************/
+/*                                sldApply                              */
+/*                                                                      */
+/*      msSLDApplySLD() with the SLD cache: pszURL is the location      */
+/*      the document was read from (NULL for SLD_BODY) and nMaxAge      */
+/*      the number of seconds it may be used for. The layers of a       */
+/*      cached document are used instead of parsing psSLDXML. With a    */
+/*      NULL psSLDXML, only the cache is looked at and MS_DONE is       */
+/*      returned if pszURL is not in it.                                */
+/************************************************************************/
+static int sldApply(mapObj *map, char *psSLDXML, const char *pszURL, int nMaxAge,
+                    int iLayer, char *pszStyleLayerName, char **ppszLayerNames)
 {
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR)
 
@@ -162,7 +421,28 @@ int msSLDApplySLD(mapObj *map, char *psSLDXML, int iLayer,
   FilterEncodingNode *psExpressionNode =NULL;
   int bFailedExpression=0;
 
-  pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+  if (pszURL)
+    pasLayers = sldCacheLookup(map, pszURL, MS_TRUE, &nLayers);
+  if (pasLayers == NULL && psSLDXML)
+    pasLayers = sldCacheLookup(map, psSLDXML, MS_FALSE, &nLayers);
+
+  if (pasLayers == NULL) {
+    int nFirstSymbol = map->symbolset.numsymbols;
+
+    if (psSLDXML == NULL)
+      return MS_DONE;
+
+    pasLayers = msSLDParseSLD(map, psSLDXML, &nLayers);
+
+    if (pasLayers) {
+      if (pszURL && nMaxAge > 0)
+        sldCacheStore(map, pszURL, MS_TRUE, time(NULL) + nMaxAge,
+                      pasLayers, nLayers, nFirstSymbol);
+      else
+        sldCacheStore(map, psSLDXML, MS_FALSE, 0, pasLayers, nLayers, nFirstSymbol);
+    }
+  }
+
   /* -------------------------------------------------------------------- */
   /*      If the same layer is given more that once, we need to           */
   /*      duplicate it.                                                   */
@@ -63,6 +63,8 @@ typedef struct ms_ogr_file_info_t {
 
   int         last_record_index_read;
 
+  char        *pszIgnoredFields;        /* set by msOGRFileSetIgnoredFields */
+
 } msOGRFileInfo;
 
 static int msOGRLayerIsOpen(layerObj *layer);
@@ -1138,6 +1140,7 @@ msOGRFileOpen(layerObj *layer, const char *connection )
   psInfo->rect.minx = psInfo->rect.maxx = 0;
   psInfo->rect.miny = psInfo->rect.maxy = 0;
   psInfo->last_record_index_read = -1;
+  psInfo->pszIgnoredFields = NULL;
 
   return psInfo;
 }
@@ -1172,6 +1175,7 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
             psInfo->pszFname, psInfo->nLayerIndex);
 
   CPLFree(psInfo->pszFname);
+  msFree(psInfo->pszIgnoredFields);
 
   ACQUIRE_OGR_LOCK;
   if (psInfo->hLastFeature)
@@ -1198,6 +1202,109 @@ static int msOGRFileClose(layerObj *layer, msOGRFileInfo *psInfo )
   return MS_SUCCESS;
 }
 
+/**********************************************************************
+ *                     msOGRGetItemType()
+ *
+ * Field type callback for msExpressionToSQL(), data is the layer's
+ * OGRFeatureDefnH.  Only fields whose values compare the same way in
+ * OGR and in msEvalExpression() are reported: not OFTReal, MapServer
+ * compares the value printed with "%.15g", OGR the stored double.
+ **********************************************************************/
+static int msOGRGetItemType(layerObj *layer, const char *item, void *data)
+{
+  OGRFeatureDefnH hDefn = (OGRFeatureDefnH) data;
+  OGRFieldDefnH hField;
+  int iField = OGR_FD_GetFieldIndex( hDefn, item );
+
+  if( iField < 0 )
+    return MS_SQL_ITEM_UNKNOWN;
+
+  // Quoted names are case sensitive in some SQL dialects
+  hField = OGR_FD_GetFieldDefn( hDefn, iField );
+  if( strcmp( OGR_Fld_GetNameRef( hField ), item ) != 0 )
+    return MS_SQL_ITEM_UNKNOWN;
+
+  switch( OGR_Fld_GetType( hField ) ) {
+    case OFTInteger:
+#if GDAL_VERSION_NUM >= 2000000
+    case OFTInteger64:
+#endif
+      return MS_SQL_ITEM_NUMBER;
+    case OFTString:
+      return MS_SQL_ITEM_STRING;
+    default:
+      return MS_SQL_ITEM_UNKNOWN;
+  }
+}
+
+/**********************************************************************
+ *                     msOGRFileSetIgnoredFields()
+ *
+ * Tell OGR not to fetch the fields we don't use, nor the style string
+ * unless we need it for STYLEITEM AUTO or the OGR:* label items.
+ *
+ * Returns MS_TRUE if the set of ignored fields changed since the last
+ * call on this file.
+ **********************************************************************/
+static int msOGRFileSetIgnoredFields(layerObj *layer, msOGRFileInfo *psInfo)
+{
+#if GDAL_VERSION_NUM >= 1800
+  OGRFeatureDefnH hDefn = OGR_L_GetLayerDefn( psInfo->hLayer );
+  char **papszIgnored = NULL;
+  char *pszIgnoredFields;
+  int i, j, bNeedStyle, bChanged;
+
+  // The tile index, and raw WHERE filters, may use any field
+  if( hDefn == NULL
+      || (layer->tileindex != NULL && psInfo == layer->layerinfo)
+      || (layer->filter.string && EQUALN(layer->filter.string,"WHERE ",6)) ) {
+    OGR_L_SetIgnoredFields( psInfo->hLayer, NULL );
+    bChanged = (psInfo->pszIgnoredFields != NULL);
+    msFree( psInfo->pszIgnoredFields );
+    psInfo->pszIgnoredFields = NULL;
+    return bChanged;
+  }
+
+  bNeedStyle = (layer->styleitem && EQUAL(layer->styleitem, "AUTO"));
+
+  for( i = 0; i < OGR_FD_GetFieldCount( hDefn ); i++ ) {
+    const char *pszName = OGR_Fld_GetNameRef( OGR_FD_GetFieldDefn( hDefn, i ) );
+
+    for( j = 0; j < layer->numitems; j++ ) {
+      if( EQUAL( layer->items[j], pszName ) )
+        break;
+    }
+    if( j == layer->numitems )
+      papszIgnored = CSLAddString( papszIgnored, pszName );
+  }
+
+  for( j = 0; j < layer->numitems; j++ ) {
+    if( EQUALN( layer->items[j], "OGR:", 4 ) )
+      bNeedStyle = MS_TRUE;
+  }
+  if( !bNeedStyle )
+    papszIgnored = CSLAddString( papszIgnored, "OGR_STYLE" );
+
+  OGR_L_SetIgnoredFields( psInfo->hLayer, (const char **) papszIgnored );
+
+  pszIgnoredFields = msStrdup("");
+  for( i = 0; papszIgnored != NULL && papszIgnored[i] != NULL; i++ ) {
+    pszIgnoredFields = msStringConcatenate( pszIgnoredFields, papszIgnored[i] );
+    pszIgnoredFields = msStringConcatenate( pszIgnoredFields, "," );
+  }
+  CSLDestroy( papszIgnored );
+
+  bChanged = (psInfo->pszIgnoredFields == NULL
+              || strcmp( psInfo->pszIgnoredFields, pszIgnoredFields ) != 0);
+  msFree( psInfo->pszIgnoredFields );
+  psInfo->pszIgnoredFields = pszIgnoredFields;
+
+  return bChanged;
+#else
+  return MS_FALSE;
+#endif /* GDAL_VERSION_NUM >= 1800 */
+}
+
 /**********************************************************************
  *                     msOGRFileWhichShapes()
  *
@@ -1272,8 +1379,9 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
 
   /* ------------------------------------------------------------------
    * Apply an attribute filter if we have one prefixed with a WHERE
-   * keyword in the filter string.  Otherwise, ensure the attribute
-   * filter is clear.
+   * keyword in the filter string.  Otherwise, translate what we can of
+   * the FILTER expression to OGR SQL, so that drivers with SQL support
+   * filter natively.  The expression is still evaluated in NextShape.
    * ------------------------------------------------------------------ */
   if( layer->filter.string && EQUALN(layer->filter.string,"WHERE ",6) ) {
     CPLErrorReset();
@@ -1287,8 +1395,36 @@ static int msOGRFileWhichShapes(layerObj *layer, rectObj rect,
       RELEASE_OGR_LOCK;
       return MS_FAILURE;
     }
-  } else
-    OGR_L_SetAttributeFilter( psInfo->hLayer, NULL );
+  } else {
+    char *pszSQLFilter = NULL;
+
+    if( layer->filter.string
+        && !(layer->tileindex != NULL && psInfo == layer->layerinfo) ) {
+      sqlDialectObj sDialect;
+
+      sDialect.identifier_open = sDialect.identifier_close = '"';
+      sDialect.itemtype = msOGRGetItemType;
+      sDialect.data = OGR_L_GetLayerDefn( psInfo->hLayer );
+      pszSQLFilter = msExpressionToSQL( layer, &(layer->filter),
+                                        layer->filteritem, &sDialect );
+    }
+
+    CPLErrorReset();
+    if( pszSQLFilter
+        && OGR_L_SetAttributeFilter( psInfo->hLayer, pszSQLFilter ) == OGRERR_NONE ) {
+      if (layer->debug >= MS_DEBUGLEVEL_VV)
+        msDebug("msOGRFileWhichShapes: Setting attribute filter to %s\n",
+                pszSQLFilter );
+    } else {
+      if( pszSQLFilter && layer->debug )
+        msDebug("msOGRFileWhichShapes: Attribute filter %s rejected by OGR: %s\n",
+                pszSQLFilter, CPLGetLastErrorMsg() );
+      OGR_L_SetAttributeFilter( psInfo->hLayer, NULL );
+    }
+    msFree( pszSQLFilter );
+  }
+
+  msOGRFileSetIgnoredFields( layer, psInfo );
 
   /* ------------------------------------------------------------------
    * Reset current feature pointer
@@ -1588,6 +1724,7 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /* -------------------------------------------------------------------- */
   if( record_is_fid ) {
     ACQUIRE_OGR_LOCK;
+    msOGRFileSetIgnoredFields( layer, psInfo );
     if( (hFeature = OGR_L_GetFeature( psInfo->hLayer, record )) == NULL ) {
       RELEASE_OGR_LOCK;
       return MS_FAILURE;
@@ -1600,7 +1737,10 @@ msOGRFileGetShape(layerObj *layer, shapeObj *shape, long record,
   /* -------------------------------------------------------------------- */
   else if( !record_is_fid ) {
     ACQUIRE_OGR_LOCK;
-    if( record <= psInfo->last_record_index_read
+    // The items may have changed since WhichShapes(), restart reading if
+    // this changes the fields OGR returns.
+    if( msOGRFileSetIgnoredFields( layer, psInfo )
+        || record <= psInfo->last_record_index_read
         || psInfo->last_record_index_read == -1 ) {
       OGR_L_ResetReading( psInfo->hLayer );
       psInfo->last_record_index_read = -1;
@@ -478,6 +478,962 @@ static int msOGRWriteShape( layerObj *map_layer, OGRLayerH hOGRLayer,
     return MS_FAILURE;
 }
 
+/************************************************************************/
+/*                     msOGRGetLayerGeometryType()                      */
+/************************************************************************/
+
+static OGRwkbGeometryType msOGRGetLayerGeometryType( layerObj *layer )
+
+{
+  OGRwkbGeometryType eGeomType;
+  const char *value;
+
+  /* -------------------------------------------------------------------- */
+  /*      Establish the geometry type to use for the created layer.       */
+  /*      First we consult the wfs_geomtype field and fallback to         */
+  /*      deriving something from the type of the mapserver layer.        */
+  /* -------------------------------------------------------------------- */
+  value = msOWSLookupMetadata(&(layer->metadata), "FOG", "geomtype");
+  if( value == NULL ) {
+    if( layer->type == MS_LAYER_POINT )
+      value = "Point";
+    else if( layer->type == MS_LAYER_LINE )
+      value = "LineString";
+    else if( layer->type == MS_LAYER_POLYGON )
+      value = "Polygon";
+    else
+      value = "Geometry";
+  }
+
+  if( strcasecmp(value,"Point") == 0 )
+    eGeomType = wkbPoint;
+  else if( strcasecmp(value,"LineString") == 0 )
+    eGeomType = wkbLineString;
+  else if( strcasecmp(value,"Polygon") == 0 )
+    eGeomType = wkbPolygon;
+  else if( strcasecmp(value,"MultiPoint") == 0 )
+    eGeomType = wkbMultiPoint;
+  else if( strcasecmp(value,"MultiLineString") == 0 )
+    eGeomType = wkbMultiLineString;
+  else if( strcasecmp(value,"MultiPolygon") == 0 )
+    eGeomType = wkbMultiPolygon;
+  else if( strcasecmp(value,"GeometryCollection") == 0 )
+    eGeomType = wkbGeometryCollection;
+  else if( strcasecmp(value,"Point25D") == 0 )
+    eGeomType = wkbPoint25D;
+  else if( strcasecmp(value,"LineString25D") == 0 )
+    eGeomType = wkbLineString25D;
+  else if( strcasecmp(value,"Polygon25D") == 0 )
+    eGeomType = wkbPolygon25D;
+  else if( strcasecmp(value,"MultiPoint25D") == 0 )
+    eGeomType = wkbMultiPoint25D;
+  else if( strcasecmp(value,"MultiLineString25D") == 0 )
+    eGeomType = wkbMultiLineString25D;
+  else if( strcasecmp(value,"MultiPolygon25D") == 0 )
+    eGeomType = wkbMultiPolygon25D;
+  else if( strcasecmp(value,"GeometryCollection25D") == 0 )
+    eGeomType = wkbGeometryCollection25D;
+  else if( strcasecmp(value,"Unknown") == 0
+           || strcasecmp(value,"Geometry") == 0 )
+    eGeomType = wkbUnknown;
+  else if( strcasecmp(value,"None") == 0 )
+    eGeomType = wkbNone;
+  else
+    eGeomType = wkbUnknown;
+
+  return eGeomType;
+}
+
+/************************************************************************/
+/*                        msOGRGetResultShape()                         */
+/*                                                                      */
+/*      Read result i of the layer's resultcache, classified, with      */
+/*      its annotation and joins prepared, in map projection.           */
+/************************************************************************/
+
+static int msOGRGetResultShape( mapObj *map, layerObj *layer, shapeObj *shape,
+                                int i, int reproject )
+
+{
+  int status;
+
+  /*
+  ** Read the shape.
+  */
+  status = msLayerGetShape(layer, shape, &(layer->resultcache->results[i]));
+  if(status != MS_SUCCESS)
+    return status;
+
+  /*
+  ** Perform classification, and some annotation related magic.
+  */
+  shape->classindex =
+    msShapeGetClass(layer, map, shape, NULL, -1);
+
+  if( shape->classindex >= 0
+      && (layer->class[shape->classindex]->text.string
+          || layer->labelitem)
+      && layer->class[shape->classindex]->numlabels > 0
+      && layer->class[shape->classindex]->labels[0]->size != -1 ) {
+    msShapeGetAnnotation(layer, shape); /* TODO RFC77: check return value */
+    shape->text = msStrdup(layer->class[shape->classindex]->labels[0]->annotext);
+  }
+
+  /*
+  ** prepare any necessary JOINs here (one-to-one only)
+  */
+  if( layer->numjoins > 0) {
+    int j;
+
+    for(j=0; j < layer->numjoins; j++) {
+      if(layer->joins[j].type == MS_JOIN_ONE_TO_ONE) {
+        msJoinPrepare(&(layer->joins[j]), shape);
+        msJoinNext(&(layer->joins[j])); /* fetch the first row */
+      }
+    }
+  }
+
+  if( reproject ) {
+    status =
+      msProjectShape(&layer->projection, &layer->map->projection,
+                     shape);
+  }
+
+  return status;
+}
+
+/************************************************************************/
+/* ==================================================================== */
+/*      Native GeoJSON and CSV writers.                                 */
+/*                                                                      */
+/*      The two most requested WFS output formats are simple enough     */
+/*      to be written directly to the client as the features are        */
+/*      read, instead of going through an OGR datasource in /vsimem     */
+/*      that is copied out once complete. The output follows what       */
+/*      the OGR GeoJSON and CSV drivers write. Other formats, and       */
+/*      requests these writers can't honour (zip or multipart forms,    */
+/*      several layers, unknown creation options), use OGR. The         */
+/*      FORMATOPTION "WRITER=OGR" forces the OGR path.                  */
+/* ==================================================================== */
+/************************************************************************/
+
+#define MS_OGR_NATIVE_NONE    0
+#define MS_OGR_NATIVE_GEOJSON 1
+#define MS_OGR_NATIVE_CSV     2
+
+#define MS_OGR_CSV_GEOM_NONE 0
+#define MS_OGR_CSV_GEOM_WKT  1
+#define MS_OGR_CSV_GEOM_XY   2
+#define MS_OGR_CSV_GEOM_YX   3
+
+typedef struct {
+  int driver;
+  int precision; /* GeoJSON COORDINATE_PRECISION, -1 for 15 significant digits */
+  int csv_geometry;
+  char csv_separator;
+  const char *eol;
+  int want3D;
+  OGRwkbGeometryType eLayerGType;
+  char buffer[8192]; /* output not yet handed to msIO */
+  int length;
+} nativeWriterObj;
+
+static void msOGRNativeFlush( nativeWriterObj *writer )
+
+{
+  if( writer->length > 0 )
+    msIO_fwrite( writer->buffer, 1, writer->length, stdout );
+  writer->length = 0;
+}
+
+static void msOGRNativeWrite( nativeWriterObj *writer, const char *data, int length )
+
+{
+  if( writer->length + length > (int) sizeof(writer->buffer) ) {
+    msOGRNativeFlush( writer );
+    if( length > (int) sizeof(writer->buffer) ) {
+      msIO_fwrite( data, 1, length, stdout );
+      return;
+    }
+  }
+  memcpy( writer->buffer + writer->length, data, length );
+  writer->length += length;
+}
+
+static void msOGRNativeWriteString( nativeWriterObj *writer, const char *data )
+
+{
+  msOGRNativeWrite( writer, data, strlen(data) );
+}
+
+/************************************************************************/
+/*                         msOGRFormatDouble()                          */
+/*                                                                      */
+/*      Format a number with the given number of decimals, or with      */
+/*      15 significant digits like "%.15g" when precision is -1.        */
+/*      Usual magnitudes are formatted with integer arithmetic, the     */
+/*      others (and NaN/Inf) go through snprintf(). With                */
+/*      force_decimal integral values get a ".0" as OGR writes them     */
+/*      in GeoJSON. Returns the length written into buffer (at          */
+/*      least 64 bytes).                                                */
+/************************************************************************/
+
+static const double ms_ogr_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+  1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+static int msOGRFormatDouble( char *buffer, double value, int precision,
+                              int force_decimal )
+
+{
+  double absvalue = fabs(value), scaledvalue;
+  int decimals, length = 0, i;
+  GUIntBig scaled, intpart, fracpart;
+  char digits[32];
+
+  if( precision < 0 ) {
+    int magnitude;
+
+    if( absvalue == 0.0 ) {
+      strcpy( buffer, force_decimal ? "0.0" : "0" );
+      return strlen(buffer);
+    }
+
+    /* "%.15g" switches to exponents outside of 1e-4..1e15 */
+    if( !(absvalue >= 1e-4 && absvalue < 1e15) )
+      goto fallback;
+
+    magnitude = (int) floor(log10(absvalue));
+    decimals = 14 - magnitude;
+    /* log10() may be one off next to powers of ten */
+    if( decimals < 18 && absvalue * ms_ogr_pow10[decimals] < 1e14 )
+      decimals++;
+  } else
+    decimals = precision;
+
+  if( decimals < 0 || decimals > 18
+      || !(absvalue * ms_ogr_pow10[decimals] < 4e15) )
+    goto fallback;
+
+  /* the product is only exact to an ulp, let printf settle near-ties */
+  scaledvalue = absvalue * ms_ogr_pow10[decimals];
+  if( fabs(scaledvalue - floor(scaledvalue) - 0.5) <= scaledvalue * 4e-16 )
+    goto fallback;
+
+  scaled = (GUIntBig) (scaledvalue + 0.5);
+  intpart = scaled / (GUIntBig) ms_ogr_pow10[decimals];
+  fracpart = scaled % (GUIntBig) ms_ogr_pow10[decimals];
+
+  if( value < 0 )
+    buffer[length++] = '-';
+
+  i = 0;
+  do {
+    digits[i++] = (char) ('0' + intpart % 10);
+    intpart /= 10;
+  } while( intpart > 0 );
+  while( i > 0 )
+    buffer[length++] = digits[--i];
+
+  if( decimals > 0 ) {
+    int last = decimals;
+
+    for( i = decimals - 1; i >= 0; i-- ) {
+      digits[i] = (char) ('0' + fracpart % 10);
+      fracpart /= 10;
+    }
+    if( precision < 0 ) { /* drop trailing zeros as %g does */
+      while( last > 0 && digits[last-1] == '0' )
+        last--;
+    }
+    if( last > 0 ) {
+      buffer[length++] = '.';
+      memcpy( buffer + length, digits, last );
+      length += last;
+    } else if( force_decimal ) {
+      buffer[length++] = '.';
+      buffer[length++] = '0';
+    }
+  } else if( force_decimal ) {
+    buffer[length++] = '.';
+    buffer[length++] = '0';
+  }
+
+  buffer[length] = '\0';
+  return length;
+
+fallback:
+  if( precision < 0 )
+    length = snprintf( buffer, 64, "%.15g", value );
+  else
+    length = snprintf( buffer, 64, "%.*f", precision, value );
+  if( force_decimal && strspn( buffer, "-0123456789" ) == (size_t) length ) {
+    strcpy( buffer + length, ".0" );
+    length += 2;
+  }
+  return length;
+}
+
+static void msOGRNativeWriteDouble( nativeWriterObj *writer, double value )
+
+{
+  char number[64];
+  int geojson = (writer->driver == MS_OGR_NATIVE_GEOJSON);
+
+  msOGRNativeWrite( writer, number,
+                    msOGRFormatDouble( number, value,
+                                       geojson ? writer->precision : -1,
+                                       geojson ) );
+}
+
+/************************************************************************/
+/*                    msOGRNativeWriteJSONString()                      */
+/************************************************************************/
+
+static void msOGRNativeWriteJSONString( nativeWriterObj *writer, const char *value )
+
+{
+  const char *start = value;
+
+  msOGRNativeWrite( writer, "\"", 1 );
+  for( ; *value; value++ ) {
+    char escape[8];
+
+    if( *value != '"' && *value != '\\' && (unsigned char) *value >= 0x20 )
+      continue;
+
+    msOGRNativeWrite( writer, start, value - start );
+    start = value + 1;
+
+    if( *value == '"' || *value == '\\' ) {
+      escape[0] = '\\';
+      escape[1] = *value;
+      escape[2] = '\0';
+    } else if( *value == '\n' )
+      strcpy( escape, "\\n" );
+    else if( *value == '\r' )
+      strcpy( escape, "\\r" );
+    else if( *value == '\t' )
+      strcpy( escape, "\\t" );
+    else
+      snprintf( escape, sizeof(escape), "\\u%04x", (unsigned char) *value );
+    msOGRNativeWriteString( writer, escape );
+  }
+  msOGRNativeWrite( writer, start, value - start );
+  msOGRNativeWrite( writer, "\"", 1 );
+}
+
+/************************************************************************/
+/*                     msOGRNativeWriteCSVString()                      */
+/*                                                                      */
+/*      Quoted (with doubled quotes) when it holds the separator, a     */
+/*      quote or a line break, or when always_quote is set.             */
+/************************************************************************/
+
+static void msOGRNativeWriteCSVString( nativeWriterObj *writer, const char *value,
+                                       int always_quote )
+
+{
+  char special[5] = "_\"\n\r";
+  const char *quote;
+
+  special[0] = writer->csv_separator;
+  if( !always_quote && strpbrk( value, special ) == NULL ) {
+    msOGRNativeWriteString( writer, value );
+    return;
+  }
+
+  msOGRNativeWrite( writer, "\"", 1 );
+  while( (quote = strchr( value, '"' )) != NULL ) {
+    msOGRNativeWrite( writer, value, quote - value + 1 );
+    msOGRNativeWrite( writer, "\"", 1 );
+    value = quote + 1;
+  }
+  msOGRNativeWriteString( writer, value );
+  msOGRNativeWrite( writer, "\"", 1 );
+}
+
+/************************************************************************/
+/*                      msOGRNativeWritePoint()                         */
+/************************************************************************/
+
+static void msOGRNativeWritePoint( nativeWriterObj *writer, pointObj *point )
+
+{
+  int geojson = (writer->driver == MS_OGR_NATIVE_GEOJSON);
+
+  if( geojson )
+    msOGRNativeWrite( writer, "[ ", 2 );
+  msOGRNativeWriteDouble( writer, point->x );
+  msOGRNativeWrite( writer, geojson ? ", " : " ", geojson ? 2 : 1 );
+  msOGRNativeWriteDouble( writer, point->y );
+  if( writer->want3D ) {
+    msOGRNativeWrite( writer, geojson ? ", " : " ", geojson ? 2 : 1 );
+#ifdef USE_POINT_Z_M
+    msOGRNativeWriteDouble( writer, point->z );
+#else
+    msOGRNativeWriteDouble( writer, 0.0 );
+#endif
+  }
+  if( geojson )
+    msOGRNativeWrite( writer, " ]", 2 );
+}
+
+/* "[ a, b ]" in GeoJSON, "(a,b)" in WKT */
+static void msOGRNativeOpenList( nativeWriterObj *writer )
+{
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+    msOGRNativeWrite( writer, "[ ", 2 );
+  else
+    msOGRNativeWrite( writer, "(", 1 );
+}
+
+static void msOGRNativeListSeparator( nativeWriterObj *writer )
+{
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+    msOGRNativeWrite( writer, ", ", 2 );
+  else
+    msOGRNativeWrite( writer, ",", 1 );
+}
+
+static void msOGRNativeCloseList( nativeWriterObj *writer )
+{
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+    msOGRNativeWrite( writer, " ]", 2 );
+  else
+    msOGRNativeWrite( writer, ")", 1 );
+}
+
+static void msOGRNativeWriteLine( nativeWriterObj *writer, lineObj *line )
+
+{
+  int i;
+
+  msOGRNativeOpenList( writer );
+  for( i = 0; i < line->numpoints; i++ ) {
+    if( i > 0 )
+      msOGRNativeListSeparator( writer );
+    msOGRNativeWritePoint( writer, &(line->point[i]) );
+  }
+  msOGRNativeCloseList( writer );
+}
+
+/* "{ "type": "Point", "coordinates": " in GeoJSON, "POINT " in WKT */
+static void msOGRNativeOpenGeometry( nativeWriterObj *writer, const char *type )
+
+{
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON ) {
+    msOGRNativeWriteString( writer, "{ \"type\": \"" );
+    msOGRNativeWriteString( writer, type );
+    msOGRNativeWriteString( writer, "\", \"coordinates\": " );
+  } else {
+    char wkt_type[32];
+
+    strlcpy( wkt_type, type, sizeof(wkt_type) - 1 );
+    msStringToUpper( wkt_type );
+    strlcat( wkt_type, " ", sizeof(wkt_type) );
+    msOGRNativeWriteString( writer, wkt_type );
+  }
+}
+
+static void msOGRNativeCloseGeometry( nativeWriterObj *writer )
+
+{
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+    msOGRNativeWrite( writer, " }", 2 );
+}
+
+/************************************************************************/
+/*                     msOGRNativeWriteGeometry()                       */
+/*                                                                      */
+/*      Same geometries as msOGRWriteShape() builds, including the      */
+/*      promotion to the multi type (or the merge of polygons) when     */
+/*      the layer geometry type asks for it.                            */
+/************************************************************************/
+
+static int msOGRNativeWriteGeometry( nativeWriterObj *writer, shapeObj *shape )
+
+{
+  OGRwkbGeometryType eFlattenLayerGType = wkbFlatten(writer->eLayerGType);
+  int j;
+
+  if( shape->type == MS_SHAPE_POINT ) {
+    if( shape->numlines < 1 ) {
+      msSetError(MS_MISCERR, "Failed on odd point geometry.",
+                 "msOGRNativeWriteGeometry()");
+      return MS_FAILURE;
+    }
+    for( j = 0; j < shape->numlines; j++ ) {
+      if( shape->line[j].numpoints != 1 ) {
+        msSetError(MS_MISCERR, "Failed on odd point geometry.",
+                   "msOGRNativeWriteGeometry()");
+        return MS_FAILURE;
+      }
+    }
+
+    if( shape->numlines == 1 && eFlattenLayerGType != wkbMultiPoint ) {
+      msOGRNativeOpenGeometry( writer, "Point" );
+      if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+        msOGRNativeWritePoint( writer, &(shape->line[0].point[0]) );
+      else
+        msOGRNativeWriteLine( writer, &(shape->line[0]) );
+    } else {
+      msOGRNativeOpenGeometry( writer, "MultiPoint" );
+      msOGRNativeOpenList( writer );
+      for( j = 0; j < shape->numlines; j++ ) {
+        if( j > 0 )
+          msOGRNativeListSeparator( writer );
+        msOGRNativeWritePoint( writer, &(shape->line[j].point[0]) );
+      }
+      msOGRNativeCloseList( writer );
+    }
+  }
+
+  else if( shape->type == MS_SHAPE_LINE ) {
+    if( shape->numlines < 1 || shape->line[0].numpoints < 2 ) {
+      msSetError(MS_MISCERR, "Failed on odd line geometry.",
+                 "msOGRNativeWriteGeometry()");
+      return MS_FAILURE;
+    }
+
+    if( shape->numlines == 1 && eFlattenLayerGType != wkbMultiLineString ) {
+      msOGRNativeOpenGeometry( writer, "LineString" );
+      msOGRNativeWriteLine( writer, &(shape->line[0]) );
+    } else {
+      msOGRNativeOpenGeometry( writer, "MultiLineString" );
+      msOGRNativeOpenList( writer );
+      for( j = 0; j < shape->numlines; j++ ) {
+        if( j > 0 )
+          msOGRNativeListSeparator( writer );
+        msOGRNativeWriteLine( writer, &(shape->line[j]) );
+      }
+      msOGRNativeCloseList( writer );
+    }
+  }
+
+  else if( shape->type == MS_SHAPE_POLYGON ) {
+    int *outer_flags, numouters = 0, iOuter, iRing, n;
+    int merge, single;
+
+    if( shape->numlines < 1 ) {
+      msSetError(MS_MISCERR, "Failed on odd polygon geometry.",
+                 "msOGRNativeWriteGeometry()");
+      return MS_FAILURE;
+    }
+
+    outer_flags = msGetOuterList( shape );
+    for( iOuter = 0; iOuter < shape->numlines; iOuter++ )
+      numouters += outer_flags[iOuter];
+
+    /* OGR_G_ForceToPolygon() puts all rings in a single polygon */
+    merge = (numouters > 1 && eFlattenLayerGType == wkbPolygon);
+    single = merge || (numouters == 1 && eFlattenLayerGType != wkbMultiPolygon);
+
+    msOGRNativeOpenGeometry( writer, single ? "Polygon" : "MultiPolygon" );
+    if( numouters == 0 && writer->driver != MS_OGR_NATIVE_GEOJSON ) {
+      free( outer_flags );
+      msOGRNativeWriteString( writer, "EMPTY" );
+      return MS_SUCCESS;
+    }
+    if( !single || merge )
+      msOGRNativeOpenList( writer );
+
+    for( iOuter = 0, n = 0; iOuter < shape->numlines; iOuter++ ) {
+      int *inner_flags;
+
+      if( !outer_flags[iOuter] )
+        continue;
+
+      if( n++ > 0 )
+        msOGRNativeListSeparator( writer );
+      if( !merge )
+        msOGRNativeOpenList( writer );
+
+      msOGRNativeWriteLine( writer, &(shape->line[iOuter]) );
+
+      inner_flags = msGetInnerList( shape, iOuter, outer_flags );
+      for( iRing = 0; iRing < shape->numlines; iRing++ ) {
+        if( !inner_flags[iRing] )
+          continue;
+        msOGRNativeListSeparator( writer );
+        msOGRNativeWriteLine( writer, &(shape->line[iRing]) );
+      }
+      free( inner_flags );
+
+      if( !merge )
+        msOGRNativeCloseList( writer );
+    }
+    free( outer_flags );
+
+    if( !single || merge )
+      msOGRNativeCloseList( writer );
+  }
+
+  else { /* no geometry */
+    if( writer->driver == MS_OGR_NATIVE_GEOJSON )
+      msOGRNativeWriteString( writer, "null" );
+    return MS_SUCCESS;
+  }
+
+  msOGRNativeCloseGeometry( writer );
+  return MS_SUCCESS;
+}
+
+/************************************************************************/
+/*                       msOGRNativeWriteValue()                        */
+/*                                                                      */
+/*      Attribute value, typed as the OGR field msOGRWriteFromQuery()   */
+/*      would create for it: Integer and Boolean items as integers,     */
+/*      Real items as reals, others as strings. Empty numbers are       */
+/*      left unset (#4633).                                             */
+/************************************************************************/
+
+static void msOGRNativeWriteValue( nativeWriterObj *writer, gmlItemObj *item,
+                                   const char *value )
+
+{
+  int geojson = (writer->driver == MS_OGR_NATIVE_GEOJSON);
+  char number[64];
+
+  if( item->type != NULL
+      && (EQUAL(item->type,"Integer") || EQUAL(item->type,"Boolean")) ) {
+    if( value[0] == '\0' ) {
+      if( geojson )
+        msOGRNativeWriteString( writer, "null" );
+      return;
+    }
+    snprintf( number, sizeof(number), "%d", atoi(value) );
+    msOGRNativeWriteString( writer, number );
+  }
+
+  else if( item->type != NULL && EQUAL(item->type,"Real") ) {
+    double dfValue;
+
+    if( value[0] == '\0' ) {
+      if( geojson )
+        msOGRNativeWriteString( writer, "null" );
+      return;
+    }
+    dfValue = CPLAtof( value );
+    if( geojson && (msIsNan(dfValue) || dfValue - dfValue != 0.0) ) {
+      msOGRNativeWriteString( writer, "null" ); /* not representable in JSON */
+      return;
+    }
+    msOGRNativeWrite( writer, number,
+                      msOGRFormatDouble( number, dfValue, -1, MS_FALSE ) );
+  }
+
+  else if( geojson )
+    msOGRNativeWriteJSONString( writer, value );
+  else
+    msOGRNativeWriteCSVString( writer, value, MS_FALSE );
+}
+
+/************************************************************************/
+/*                      msOGRNativeWriteFeature()                       */
+/************************************************************************/
+
+static int msOGRNativeWriteFeature( nativeWriterObj *writer, shapeObj *shape,
+                                    gmlItemListObj *item_list, int first )
+
+{
+  int i, n = 0, status = MS_SUCCESS;
+
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON ) {
+    if( !first )
+      msOGRNativeWriteString( writer, ",\n" );
+    msOGRNativeWriteString( writer, "{ \"type\": \"Feature\", \"properties\": { " );
+
+    for( i = 0; i < item_list->numitems; i++ ) {
+      gmlItemObj *item = item_list->items + i;
+
+      if( !item->visible )
+        continue;
+
+      if( n++ > 0 )
+        msOGRNativeWrite( writer, ", ", 2 );
+      msOGRNativeWriteJSONString( writer, item->alias ? item->alias : item->name );
+      msOGRNativeWrite( writer, ": ", 2 );
+      msOGRNativeWriteValue( writer, item, shape->values[i] );
+    }
+
+    msOGRNativeWriteString( writer, " }, \"geometry\": " );
+    if( writer->eLayerGType == wkbNone )
+      msOGRNativeWriteString( writer, "null" );
+    else
+      status = msOGRNativeWriteGeometry( writer, shape );
+    msOGRNativeWriteString( writer, " }" );
+
+    return status;
+  }
+
+  /* CSV: geometry columns first, then the attributes */
+  if( writer->csv_geometry == MS_OGR_CSV_GEOM_WKT ) {
+    msOGRNativeWrite( writer, "\"", 1 );
+    status = msOGRNativeWriteGeometry( writer, shape );
+    msOGRNativeWrite( writer, "\"", 1 );
+    n++;
+  } else if( writer->csv_geometry != MS_OGR_CSV_GEOM_NONE ) {
+    /* only single points have X and Y */
+    if( shape->type == MS_SHAPE_POINT && shape->numlines == 1
+        && shape->line[0].numpoints == 1 ) {
+      pointObj *point = &(shape->line[0].point[0]);
+
+      msOGRNativeWriteDouble( writer, writer->csv_geometry == MS_OGR_CSV_GEOM_XY ? point->x : point->y );
+      msOGRNativeWrite( writer, &(writer->csv_separator), 1 );
+      msOGRNativeWriteDouble( writer, writer->csv_geometry == MS_OGR_CSV_GEOM_XY ? point->y : point->x );
+    } else
+      msOGRNativeWrite( writer, &(writer->csv_separator), 1 );
+    n++;
+  }
+
+  for( i = 0; i < item_list->numitems; i++ ) {
+    gmlItemObj *item = item_list->items + i;
+
+    if( !item->visible )
+      continue;
+
+    if( n++ > 0 )
+      msOGRNativeWrite( writer, &(writer->csv_separator), 1 );
+    msOGRNativeWriteValue( writer, item, shape->values[i] );
+  }
+  msOGRNativeWriteString( writer, writer->eol );
+
+  return status;
+}
+
+/************************************************************************/
+/*                        msOGRNativeSetup()                            */
+/*                                                                      */
+/*      Can this request be written by a native writer? Returns the     */
+/*      layer to write, with writer set up for it, or NULL to use       */
+/*      OGR.                                                            */
+/************************************************************************/
+
+static layerObj *msOGRNativeSetup( mapObj *map, outputFormatObj *format,
+                                   nativeWriterObj *writer )
+
+{
+  const char *storage, *form, *fo_filename;
+  layerObj *layer = NULL;
+  int i;
+
+  writer->driver = MS_OGR_NATIVE_NONE;
+  writer->precision = -1;
+  writer->csv_geometry = MS_OGR_CSV_GEOM_NONE;
+  writer->csv_separator = ',';
+#ifdef _WIN32
+  writer->eol = "\r\n";
+#else
+  writer->eol = "\n";
+#endif
+  writer->length = 0;
+
+  if( EQUAL(format->driver+4, "GeoJSON") )
+    writer->driver = MS_OGR_NATIVE_GEOJSON;
+  else if( EQUAL(format->driver+4, "CSV") )
+    writer->driver = MS_OGR_NATIVE_CSV;
+  else
+    return NULL;
+
+  if( EQUAL(msGetOutputFormatOption( format, "WRITER", "NATIVE" ), "OGR") )
+    return NULL;
+
+  /* a single file sent as is, no zip or multipart packaging */
+  storage = msGetOutputFormatOption( format, "STORAGE", "filesystem" );
+#if !defined(CPL_ZIP_API_OFFERED)
+  form = msGetOutputFormatOption( format, "FORM", "multipart" );
+#else
+  form = msGetOutputFormatOption( format, "FORM", "zip" );
+#endif
+  if( !EQUAL(storage,"stream")
+      && !((EQUAL(storage,"filesystem") || EQUAL(storage,"memory")) && EQUAL(form,"simple")) )
+    return NULL;
+
+  /* let the OGR path report invalid file names */
+  fo_filename = msGetOutputFormatOption( format, "FILENAME", "result.dat" );
+  if( strchr(fo_filename, '/') != NULL || strchr(fo_filename, ':') != NULL ||
+      strchr(fo_filename, '\\') != NULL )
+    return NULL;
+
+  /* creation options we know how to honour */
+  for( i = 0; i < format->numformatoptions; i++ ) {
+    const char *option = format->formatoptions[i];
+
+    if( strncasecmp(option,"DSCO:",5) == 0 )
+      return NULL;
+    if( strncasecmp(option,"LCO:",4) != 0 )
+      continue;
+    option += 4;
+
+    if( writer->driver == MS_OGR_NATIVE_GEOJSON
+        && strncasecmp(option,"COORDINATE_PRECISION=",21) == 0 ) {
+      writer->precision = atoi(option+21);
+      if( writer->precision < 0 || writer->precision > 15 )
+        return NULL;
+    } else if( writer->driver == MS_OGR_NATIVE_CSV
+               && strncasecmp(option,"GEOMETRY=",9) == 0 ) {
+      if( EQUAL(option+9,"AS_WKT") )
+        writer->csv_geometry = MS_OGR_CSV_GEOM_WKT;
+      else if( EQUAL(option+9,"AS_XY") )
+        writer->csv_geometry = MS_OGR_CSV_GEOM_XY;
+      else if( EQUAL(option+9,"AS_YX") )
+        writer->csv_geometry = MS_OGR_CSV_GEOM_YX;
+      else
+        return NULL;
+    } else if( writer->driver == MS_OGR_NATIVE_CSV
+               && strncasecmp(option,"SEPARATOR=",10) == 0 ) {
+      if( EQUAL(option+10,"COMMA") )
+        writer->csv_separator = ',';
+      else if( EQUAL(option+10,"SEMICOLON") )
+        writer->csv_separator = ';';
+      else if( EQUAL(option+10,"TAB") )
+        writer->csv_separator = '\t';
+      else
+        return NULL;
+    } else if( writer->driver == MS_OGR_NATIVE_CSV
+               && strncasecmp(option,"LINEFORMAT=",11) == 0 ) {
+      if( EQUAL(option+11,"CRLF") )
+        writer->eol = "\r\n";
+      else if( EQUAL(option+11,"LF") )
+        writer->eol = "\n";
+      else
+        return NULL;
+    } else
+      return NULL;
+  }
+
+  /* the drivers write one layer per file */
+  for( i = 0; i < map->numlayers; i++ ) {
+    layerObj *lp = GET_LAYER(map, i);
+
+    if( !lp->resultcache || lp->resultcache->numresults == 0 )
+      continue;
+    if( layer != NULL )
+      return NULL;
+    layer = lp;
+  }
+
+  return layer;
+}
+
+/************************************************************************/
+/*                        msOGRNativeWriteLayer()                       */
+/************************************************************************/
+
+static int msOGRNativeWriteLayer( mapObj *map, outputFormatObj *format,
+                                  nativeWriterObj *writer, layerObj *layer,
+                                  int sendheaders )
+
+{
+  const char *storage, *fo_filename;
+  gmlItemListObj *item_list;
+  shapeObj resultshape;
+  int i, n, status = MS_SUCCESS;
+  int reproject = MS_FALSE;
+
+  if(layer->transform == MS_TRUE
+      && layer->project
+      && msProjectionsDiffer(&(layer->projection),
+                             &(layer->map->projection)) )
+    reproject = MS_TRUE;
+
+  writer->eLayerGType = msOGRGetLayerGeometryType( layer );
+  writer->want3D = (writer->eLayerGType != wkbFlatten(writer->eLayerGType));
+
+  item_list = msGMLGetItems( layer, "G" );
+  assert( item_list->numitems == layer->numitems );
+
+  if(layer->numjoins > 0) {
+    for(i=0; i<layer->numjoins; i++) {
+      status = msJoinConnect(layer, &(layer->joins[i]));
+      if(status != MS_SUCCESS) {
+        msGMLFreeItems(item_list);
+        return status;
+      }
+    }
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Headers, as the OGR path sends them for a single file.          */
+  /* -------------------------------------------------------------------- */
+  storage = msGetOutputFormatOption( format, "STORAGE", "filesystem" );
+  fo_filename = msGetOutputFormatOption( format, "FILENAME", "result.dat" );
+
+  if( sendheaders && EQUAL(storage,"stream") && format->mimetype ) {
+    msIO_setHeader("Content-Type","%s",format->mimetype);
+    msIO_sendHeaders();
+  } else if( sendheaders && !EQUAL(storage,"stream") ) {
+    msIO_setHeader("Content-Disposition","attachment; filename=%s",
+                   fo_filename );
+    if( format->mimetype )
+      msIO_setHeader("Content-Type","%s",format->mimetype);
+    msIO_sendHeaders();
+  } else
+    msIO_fprintf( stdout, "%c", 10 );
+
+  /* -------------------------------------------------------------------- */
+  /*      File header.                                                    */
+  /* -------------------------------------------------------------------- */
+  if( writer->driver == MS_OGR_NATIVE_GEOJSON ) {
+    const char *epsg = msOWSGetEPSGProj( &(map->projection), NULL, "FO", MS_TRUE );
+
+    msOGRNativeWriteString( writer, "{\n\"type\": \"FeatureCollection\",\n" );
+    if( epsg != NULL && strncasecmp(epsg, "EPSG:", 5) == 0 ) {
+      msOGRNativeWriteString( writer, "\"crs\": { \"type\": \"name\", \"properties\": { \"name\": \"urn:ogc:def:crs:EPSG::" );
+      msOGRNativeWriteString( writer, epsg+5 );
+      msOGRNativeWriteString( writer, "\" } },\n" );
+    }
+    msOGRNativeWriteString( writer, "\"features\": [\n" );
+  } else {
+    n = 0;
+    if( writer->csv_geometry == MS_OGR_CSV_GEOM_WKT ) {
+      msOGRNativeWriteString( writer, "WKT" );
+      n++;
+    } else if( writer->csv_geometry != MS_OGR_CSV_GEOM_NONE ) {
+      msOGRNativeWriteString( writer, writer->csv_geometry == MS_OGR_CSV_GEOM_XY ? "X" : "Y" );
+      msOGRNativeWrite( writer, &(writer->csv_separator), 1 );
+      msOGRNativeWriteString( writer, writer->csv_geometry == MS_OGR_CSV_GEOM_XY ? "Y" : "X" );
+      n++;
+    }
+    for( i = 0; i < item_list->numitems; i++ ) {
+      gmlItemObj *item = item_list->items + i;
+
+      if( !item->visible )
+        continue;
+      if( n++ > 0 )
+        msOGRNativeWrite( writer, &(writer->csv_separator), 1 );
+      msOGRNativeWriteCSVString( writer, item->alias ? item->alias : item->name, MS_FALSE );
+    }
+    msOGRNativeWriteString( writer, writer->eol );
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Features, written out as they are read.                         */
+  /* -------------------------------------------------------------------- */
+  msInitShape( &resultshape );
+
+  for(i=0; i < layer->resultcache->numresults; i++) {
+    msFreeShape(&resultshape); /* init too */
+
+    status = msOGRGetResultShape( map, layer, &resultshape, i, reproject );
+    if( status == MS_SUCCESS )
+      status = msOGRNativeWriteFeature( writer, &resultshape, item_list, i == 0 );
+    if( status != MS_SUCCESS )
+      break;
+  }
+
+  if( status == MS_SUCCESS && writer->driver == MS_OGR_NATIVE_GEOJSON )
+    msOGRNativeWriteString( writer, "\n]\n}\n" );
+  msOGRNativeFlush( writer );
+
+  msGMLFreeItems(item_list);
+  msFreeShape(&resultshape); /* init too */
+
+  return status;
+}
+
 #endif /* def USE_OGR */
 
 /************************************************************************/
@@ -507,6 +1463,16 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
   char **layer_options = NULL;
   char **file_list = NULL;
   int iLayer, i;
+  nativeWriterObj native_writer;
+  layerObj *native_layer;
+
+  /* -------------------------------------------------------------------- */
+  /*      GeoJSON and CSV are written directly when possible.             */
+  /* -------------------------------------------------------------------- */
+  native_layer = msOGRNativeSetup( map, format, &native_writer );
+  if( native_layer != NULL )
+    return msOGRNativeWriteLayer( map, format, &native_writer, native_layer,
+                                  sendheaders );
 
   /* -------------------------------------------------------------------- */
   /*      Fetch the output format driver.                                 */
@@ -638,7 +1604,6 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
     OGRwkbGeometryType eGeomType;
     OGRSpatialReferenceH srs = NULL;
     gmlItemListObj *item_list = NULL;
-    const char *value;
     char *pszWKT;
     int  reproject = MS_FALSE;
 
@@ -654,58 +1619,7 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
                                &(layer->map->projection)) )
       reproject = MS_TRUE;
 
-    /* -------------------------------------------------------------------- */
-    /*      Establish the geometry type to use for the created layer.       */
-    /*      First we consult the wfs_geomtype field and fallback to         */
-    /*      deriving something from the type of the mapserver layer.        */
-    /* -------------------------------------------------------------------- */
-    value = msOWSLookupMetadata(&(layer->metadata), "FOG", "geomtype");
-    if( value == NULL ) {
-      if( layer->type == MS_LAYER_POINT )
-        value = "Point";
-      else if( layer->type == MS_LAYER_LINE )
-        value = "LineString";
-      else if( layer->type == MS_LAYER_POLYGON )
-        value = "Polygon";
-      else
-        value = "Geometry";
-    }
-
-    if( strcasecmp(value,"Point") == 0 )
-      eGeomType = wkbPoint;
-    else if( strcasecmp(value,"LineString") == 0 )
-      eGeomType = wkbLineString;
-    else if( strcasecmp(value,"Polygon") == 0 )
-      eGeomType = wkbPolygon;
-    else if( strcasecmp(value,"MultiPoint") == 0 )
-      eGeomType = wkbMultiPoint;
-    else if( strcasecmp(value,"MultiLineString") == 0 )
-      eGeomType = wkbMultiLineString;
-    else if( strcasecmp(value,"MultiPolygon") == 0 )
-      eGeomType = wkbMultiPolygon;
-    else if( strcasecmp(value,"GeometryCollection") == 0 )
-      eGeomType = wkbGeometryCollection;
-    else if( strcasecmp(value,"Point25D") == 0 )
-      eGeomType = wkbPoint25D;
-    else if( strcasecmp(value,"LineString25D") == 0 )
-      eGeomType = wkbLineString25D;
-    else if( strcasecmp(value,"Polygon25D") == 0 )
-      eGeomType = wkbPolygon25D;
-    else if( strcasecmp(value,"MultiPoint25D") == 0 )
-      eGeomType = wkbMultiPoint25D;
-    else if( strcasecmp(value,"MultiLineString25D") == 0 )
-      eGeomType = wkbMultiLineString25D;
-    else if( strcasecmp(value,"MultiPolygon25D") == 0 )
-      eGeomType = wkbMultiPolygon25D;
-    else if( strcasecmp(value,"GeometryCollection25D") == 0 )
-      eGeomType = wkbGeometryCollection25D;
-    else if( strcasecmp(value,"Unknown") == 0
-             || strcasecmp(value,"Geometry") == 0 )
-      eGeomType = wkbUnknown;
-    else if( strcasecmp(value,"None") == 0 )
-      eGeomType = wkbNone;
-    else
-      eGeomType = wkbUnknown;
+    eGeomType = msOGRGetLayerGeometryType( layer );
 
     /* -------------------------------------------------------------------- */
     /*      Create a spatial reference.                                     */
@@ -818,58 +1732,18 @@ int msOGRWriteFromQuery( mapObj *map, outputFormatObj *format, int sendheaders )
 
       msFreeShape(&resultshape); /* init too */
 
-      /*
-      ** Read the shape.
-      */
-      status = msLayerGetShape(layer, &resultshape, &(layer->resultcache->results[i]));
+      status = msOGRGetResultShape( map, layer, &resultshape, i, reproject );
       if(status != MS_SUCCESS) {
         OGR_DS_Destroy( hDS );
         msOGRCleanupDS( datasource_name );
         return status;
       }
 
-      /*
-      ** Perform classification, and some annotation related magic.
-      */
-      resultshape.classindex =
-        msShapeGetClass(layer, map, &resultshape, NULL, -1);
-
-      if( resultshape.classindex >= 0
-          && (layer->class[resultshape.classindex]->text.string
-              || layer->labelitem)
-          && layer->class[resultshape.classindex]->numlabels > 0
-          && layer->class[resultshape.classindex]->labels[0]->size != -1 ) {
-        msShapeGetAnnotation(layer, &resultshape); /* TODO RFC77: check return value */
-        resultshape.text = msStrdup(layer->class[resultshape.classindex]->labels[0]->annotext);
-      }
-
-      /*
-      ** prepare any necessary JOINs here (one-to-one only)
-      */
-      if( layer->numjoins > 0) {
-        int j;
-
-        for(j=0; j < layer->numjoins; j++) {
-          if(layer->joins[j].type == MS_JOIN_ONE_TO_ONE) {
-            msJoinPrepare(&(layer->joins[j]), &resultshape);
-            msJoinNext(&(layer->joins[j])); /* fetch the first row */
-          }
-        }
-      }
-
-      if( reproject ) {
-        status =
-          msProjectShape(&layer->projection, &layer->map->projection,
-                         &resultshape);
-      }
-
       /*
       ** Write out the feature to OGR.
       */
-
-      if( status == MS_SUCCESS )
-        status = msOGRWriteShape( layer, hOGRLayer, &resultshape,
-                                  item_list );
+      status = msOGRWriteShape( layer, hOGRLayer, &resultshape,
+                                item_list );
 
       if(status != MS_SUCCESS) {
         OGR_DS_Destroy( hDS );
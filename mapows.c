@@ -212,6 +212,7 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
 {
   int status = MS_DONE, force_ows_mode = 0;
   owsRequestObj ows_request;
+  traceSpanObj span;
 
   if (!request) {
     return status;
@@ -229,6 +230,9 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
       status = MS_DONE;
   }
 
+  /* the span is labelled with the REQUEST name (GetMap, GetCapabilities...) */
+  msTraceStart(&span, "ows.dispatch", ows_request.request);
+
   if (ows_request.service == NULL) {
     /* exit if service is not set */
     if(force_ows_mode) {
@@ -278,6 +282,7 @@ int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode)
     status = MS_FAILURE;
   }
 
+  msTraceEnd(&span, -1, -1);
   msOWSClearRequestObj(&ows_request);
   return status;
 }
@@ -781,41 +786,29 @@ const char *msOWSLookupMetadata(hashTableObj *metadata,
   if (namespaces == NULL) {
     value = msLookupHashTable(metadata, (char*)name);
   } else {
-    char buf[100] = "ows_";
-
-    strlcpy(buf+4, name, 96);
+    const char *prefixes[16];
+    int numprefixes = 0;
 
-    while (value == NULL && *namespaces != '\0') {
+    /* all namespace variants are resolved with a single hash of name */
+    for ( ; *namespaces != '\0' && numprefixes < 16; namespaces++) {
       switch (*namespaces) {
         case 'O':         /* ows_... */
-          buf[0] = 'o';
-          buf[1] = 'w';
-          buf[2] = 's';
+          prefixes[numprefixes++] = "ows_";
           break;
         case 'M':         /* wms_... */
-          buf[0] = 'w';
-          buf[1] = 'm';
-          buf[2] = 's';
+          prefixes[numprefixes++] = "wms_";
           break;
         case 'F':         /* wfs_... */
-          buf[0] = 'w';
-          buf[1] = 'f';
-          buf[2] = 's';
+          prefixes[numprefixes++] = "wfs_";
           break;
         case 'C':         /* wcs_... */
-          buf[0] = 'w';
-          buf[1] = 'c';
-          buf[2] = 's';
+          prefixes[numprefixes++] = "wcs_";
           break;
         case 'G':         /* gml_... */
-          buf[0] = 'g';
-          buf[1] = 'm';
-          buf[2] = 'l';
+          prefixes[numprefixes++] = "gml_";
           break;
         case 'S':         /* sos_... */
-          buf[0] = 's';
-          buf[1] = 'o';
-          buf[2] = 's';
+          prefixes[numprefixes++] = "sos_";
           break;
         default:
           /* We should never get here unless an invalid code (typo) is */
@@ -826,10 +819,9 @@ const char *msOWSLookupMetadata(hashTableObj *metadata,
           assert(MS_FALSE);
           return NULL;
       }
-
-      value = msLookupHashTable(metadata, buf);
-      namespaces++;
     }
+
+    value = msLookupHashTablePrefixed(metadata, prefixes, numprefixes, name);
   }
 
   return value;
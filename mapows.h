@@ -115,6 +115,19 @@ typedef struct {
 
 MS_DLL_EXPORT int msOWSDispatch(mapObj *map, cgiRequestObj *request, int ows_mode);
 
+/* owsCacheObj: a response being served through the OWS response cache */
+typedef struct {
+  char *key;
+  char *mapfile;
+  long mapfile_mtime;
+  long maxsize;   /* memory cache size, 0 for none */
+  char *dir;      /* on-disk store or NULL */
+  msIOContext stdout_context; /* stdout while the response is captured */
+} owsCacheObj;
+
+MS_DLL_EXPORT void msOWSCacheInvalidate(const char *mapfile);
+MS_DLL_EXPORT void msOWSCacheCleanup(void);
+
 MS_DLL_EXPORT const char * msOWSLookupMetadata(hashTableObj *metadata,
     const char *namespaces, const char *name);
 MS_DLL_EXPORT const char * msOWSLookupMetadataWithLanguage(hashTableObj *metadata,
@@ -156,6 +169,9 @@ MS_DLL_EXPORT const char *msOWSGetVersionString(int nVersion, char *pszBuffer);
 #if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR) || defined(USE_SOS_SVR) || defined(USE_WMS_LYR) || defined(USE_WFS_LYR)
 
 MS_DLL_EXPORT int msOWSMakeAllLayersUnique(mapObj *map);
+MS_DLL_EXPORT int msOWSCacheStart(mapObj *map, cgiRequestObj *req, const char *namespaces,
+                                  const char *request, owsCacheObj *cache);
+MS_DLL_EXPORT int msOWSCacheEnd(owsCacheObj *cache, int status);
 MS_DLL_EXPORT int msOWSNegotiateVersion(int requested_version, int supported_versions[], int num_supported_versions);
 MS_DLL_EXPORT char *msOWSTerminateOnlineResource(const char *src_url);
 MS_DLL_EXPORT char *msOWSGetOnlineResource(mapObj *map, const char *namespaces, const char *metadata_name, cgiRequestObj *req);
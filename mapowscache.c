@@ -0,0 +1,417 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Cache of OWS capabilities and description documents.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** GetCapabilities, DescribeFeatureType and DescribeCoverage responses depend
+** only on the mapfile and on the request, so they can be served again as
+** long as neither changed. Caching is enabled per mapfile with the metadata:
+**
+**   "ows_cache_size" "4000000"    - bytes of responses kept in memory, shared
+**                                  by all maps of the process (FastCGI)
+**   "ows_cache_dir"  "/tmp/ows/"  - also keep the responses in this directory
+**
+** (wms_, wfs_ and wcs_ variants are honoured as well). A response is keyed
+** by the mapfile path and modification time, the request, every request
+** parameter (service, version, language, updatesequence, ...), the
+** onlineresource and the updatesequence metadata. When a mapfile is
+** modified the entries of its previous version are dropped from memory the
+** next time it is served; files of previous versions in ows_cache_dir are
+** no longer used and can be purged by age.
+**
+** Only maps loaded from a file are cached, and changes made to INCLUDEd
+** files are seen once the main mapfile is touched or updatesequence bumped.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "mapserver.h"
+#include "mapows.h"
+#include "mapthread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+
+#define MS_OWS_CACHE_MAGIC "MSOWSCACHE 1"
+
+typedef struct owsCacheEntryObj {
+  char *key;
+  char *mapfile;
+  long mapfile_mtime;
+  unsigned char *data;
+  int size;
+  struct owsCacheEntryObj *next;
+} owsCacheEntryObj;
+
+static owsCacheEntryObj *ows_cache = NULL; /* most recently used first */
+static long ows_cache_size = 0;
+
+static void owsCacheFreeEntry(owsCacheEntryObj *entry)
+{
+  msFree(entry->key);
+  msFree(entry->mapfile);
+  msFree(entry->data);
+  msFree(entry);
+}
+
+/*
+** Drop the cached responses of mapfile, or of all mapfiles when NULL.
+** Call with the lock held.
+*/
+static void owsCacheDrop(const char *mapfile, long keep_mtime)
+{
+  owsCacheEntryObj **link = &ows_cache, *entry;
+
+  while ((entry = *link) != NULL) {
+    if (mapfile == NULL ||
+        (strcmp(entry->mapfile, mapfile) == 0 && entry->mapfile_mtime != keep_mtime)) {
+      *link = entry->next;
+      ows_cache_size -= entry->size;
+      owsCacheFreeEntry(entry);
+    } else
+      link = &entry->next;
+  }
+}
+
+/* msOWSCacheInvalidate()
+**
+** Forget the responses cached in memory for mapfile (all when NULL), for
+** applications that modify a map after loading it.
+*/
+void msOWSCacheInvalidate(const char *mapfile)
+{
+  msAcquireLock(TLOCK_OWSCACHE);
+  owsCacheDrop(mapfile, -1);
+  msReleaseLock(TLOCK_OWSCACHE);
+}
+
+void msOWSCacheCleanup(void)
+{
+  msOWSCacheInvalidate(NULL);
+}
+
+#if defined(USE_WMS_SVR) || defined (USE_WFS_SVR) || defined (USE_WCS_SVR)
+
+static char *owsCacheAppend(char *key, const char *name, const char *value)
+{
+  key = msStringConcatenate(key, (char *) name);
+  key = msStringConcatenate(key, "=");
+  key = msStringConcatenate(key, (char *) (value ? value : ""));
+  key = msStringConcatenate(key, "\n");
+  return key;
+}
+
+static char *owsCacheBuildKey(mapObj *map, cgiRequestObj *req, const char *namespaces, const char *request)
+{
+  char *key = NULL, *name, mtime[32];
+  const char *value;
+  int i;
+
+  snprintf(mtime, sizeof(mtime), "%ld", map->mapfile_mtime);
+  key = owsCacheAppend(key, "mapfile", map->mapfile);
+  key = owsCacheAppend(key, "mtime", mtime);
+  key = owsCacheAppend(key, "request", request);
+  key = owsCacheAppend(key, "updatesequence",
+                       msOWSLookupMetadata(&(map->web.metadata), namespaces, "updatesequence"));
+
+  /* what msOWSGetOnlineResource() builds the service URL from */
+  if ((value = msOWSLookupMetadata(&(map->web.metadata), namespaces, "onlineresource")) != NULL)
+    key = owsCacheAppend(key, "onlineresource", value);
+  else {
+    key = owsCacheAppend(key, "SERVER_NAME", getenv("SERVER_NAME"));
+    key = owsCacheAppend(key, "SERVER_PORT", getenv("SERVER_PORT"));
+    key = owsCacheAppend(key, "SCRIPT_NAME", getenv("SCRIPT_NAME"));
+    key = owsCacheAppend(key, "HTTPS", getenv("HTTPS"));
+  }
+
+  /* parameter names are case insensitive, values are not */
+  for (i=0; i<req->NumParams; i++) {
+    name = msStrdup(req->ParamNames[i]);
+    msStringToLower(name);
+    key = owsCacheAppend(key, name, req->ParamValues[i]);
+    msFree(name);
+  }
+  if (req->postrequest)
+    key = owsCacheAppend(key, "POST", req->postrequest);
+
+  return key;
+}
+
+static unsigned owsCacheHash(const char *s, unsigned hashval)
+{
+  for ( ; *s; s++)
+    hashval = (hashval ^ (unsigned char) *s) * 16777619U;
+  return hashval;
+}
+
+static char *owsCacheFilename(owsCacheObj *cache)
+{
+  char filename[64], szPath[MS_MAXPATHLEN];
+
+  snprintf(filename, sizeof(filename), "%08x-%08x%08x.owscache",
+           owsCacheHash(cache->mapfile, 2166136261U),
+           owsCacheHash(cache->key, 2166136261U), owsCacheHash(cache->key, 5381U));
+
+  return msStrdup(msBuildPath(szPath, cache->dir, filename));
+}
+
+/*
+** Read a response from the disk store, NULL when there is none for this key.
+*/
+static unsigned char *owsCacheReadFile(owsCacheObj *cache, int *size)
+{
+  char *filename, header[64];
+  unsigned char *data = NULL;
+  char *key = NULL;
+  int keylen, datalen;
+  FILE *fp;
+
+  filename = owsCacheFilename(cache);
+  fp = fopen(filename, "rb");
+  msFree(filename);
+  if (fp == NULL)
+    return NULL;
+
+  if (fgets(header, sizeof(header), fp) != NULL &&
+      sscanf(header, MS_OWS_CACHE_MAGIC " %d %d", &keylen, &datalen) == 2 &&
+      keylen == (int) strlen(cache->key) && datalen >= 0) {
+    key = (char *) msSmallMalloc(keylen + 1);
+    data = (unsigned char *) msSmallMalloc(datalen > 0 ? datalen : 1);
+    if (fread(key, 1, keylen, fp) != (size_t) keylen || memcmp(key, cache->key, keylen) != 0 ||
+        fread(data, 1, datalen, fp) != (size_t) datalen) {
+      msFree(data);
+      data = NULL;
+    } else
+      *size = datalen;
+    msFree(key);
+  }
+
+  fclose(fp);
+  return data;
+}
+
+static void owsCacheWriteFile(owsCacheObj *cache, const unsigned char *data, int size)
+{
+  char *filename, *tmpfilename, pid[32];
+  int keylen = strlen(cache->key);
+  FILE *fp;
+
+  filename = owsCacheFilename(cache);
+
+  /* written aside and renamed, readers never see a partial file */
+  snprintf(pid, sizeof(pid), ".%ld", (long) getpid());
+  tmpfilename = msStringConcatenate(msStrdup(filename), pid);
+
+  fp = fopen(tmpfilename, "wb");
+  if (fp == NULL) {
+    if (msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_DEBUG)
+      msDebug("msOWSCacheEnd(): failed to write %s\n", tmpfilename);
+  } else {
+    int status = (fprintf(fp, MS_OWS_CACHE_MAGIC " %d %d\n", keylen, size) > 0 &&
+                  fwrite(cache->key, 1, keylen, fp) == (size_t) keylen &&
+                  fwrite(data, 1, size, fp) == (size_t) size);
+    if (fclose(fp) != 0 || !status || rename(tmpfilename, filename) != 0)
+      remove(tmpfilename);
+  }
+
+  msFree(tmpfilename);
+  msFree(filename);
+}
+
+static void owsCacheStore(owsCacheObj *cache, const unsigned char *data, int size)
+{
+  owsCacheEntryObj *entry, **link;
+  long total;
+
+  if (size > cache->maxsize)
+    return;
+
+  entry = (owsCacheEntryObj *) msSmallMalloc(sizeof(owsCacheEntryObj));
+  entry->key = msStrdup(cache->key);
+  entry->mapfile = msStrdup(cache->mapfile);
+  entry->mapfile_mtime = cache->mapfile_mtime;
+  entry->data = (unsigned char *) msSmallMalloc(size > 0 ? size : 1);
+  memcpy(entry->data, data, size);
+  entry->size = size;
+
+  msAcquireLock(TLOCK_OWSCACHE);
+
+  entry->next = ows_cache;
+  ows_cache = entry;
+  ows_cache_size += size;
+
+  /* evict the least recently used responses */
+  for (link = &ows_cache, total = 0; *link; ) {
+    total += (*link)->size;
+    if (total > cache->maxsize) {
+      entry = *link;
+      *link = entry->next;
+      ows_cache_size -= entry->size;
+      total -= entry->size;
+      owsCacheFreeEntry(entry);
+    } else
+      link = &(*link)->next;
+  }
+
+  msReleaseLock(TLOCK_OWSCACHE);
+}
+
+/* msOWSCacheStart()
+**
+** To be called before generating a cacheable response (request is the
+** request name, namespaces the metadata namespaces of the service).
+** Returns MS_DONE when the response was found in the cache and written
+** out, there is nothing left to do but return MS_SUCCESS. Otherwise returns
+** MS_SUCCESS: the response must be generated as usual and msOWSCacheEnd()
+** be called with its status.
+*/
+int msOWSCacheStart(mapObj *map, cgiRequestObj *req, const char *namespaces,
+                    const char *request, owsCacheObj *cache)
+{
+  const char *value;
+  msIOContext *context;
+  owsCacheEntryObj **link, *entry;
+  unsigned char *data = NULL;
+  int size = 0;
+
+  cache->key = NULL;
+  cache->mapfile = NULL;
+  cache->dir = NULL;
+  cache->maxsize = 0;
+
+  if (map->mapfile == NULL || req == NULL)
+    return MS_SUCCESS;
+
+  if ((value = msOWSLookupMetadata(&(map->web.metadata), namespaces, "cache_size")) != NULL)
+    cache->maxsize = atol(value);
+  if ((value = msOWSLookupMetadata(&(map->web.metadata), namespaces, "cache_dir")) != NULL)
+    cache->dir = msStrdup(value);
+  if (cache->maxsize <= 0 && cache->dir == NULL)
+    return MS_SUCCESS;
+
+  /* headers don't go through the stdout stream under mod_mapserver */
+  context = msIO_getHandler(stdout);
+  if (context == NULL || strcmp(context->label, "apache") == 0) {
+    msFree(cache->dir);
+    cache->dir = NULL;
+    return MS_SUCCESS;
+  }
+
+  cache->key = owsCacheBuildKey(map, req, namespaces, request);
+  cache->mapfile = msStrdup(map->mapfile);
+  cache->mapfile_mtime = map->mapfile_mtime;
+
+  if (cache->maxsize > 0) {
+    msAcquireLock(TLOCK_OWSCACHE);
+    owsCacheDrop(map->mapfile, map->mapfile_mtime);
+    for (link = &ows_cache; (entry = *link) != NULL; link = &entry->next) {
+      if (strcmp(entry->key, cache->key) == 0) {
+        /* move to front */
+        *link = entry->next;
+        entry->next = ows_cache;
+        ows_cache = entry;
+        data = (unsigned char *) msSmallMalloc(entry->size > 0 ? entry->size : 1);
+        memcpy(data, entry->data, entry->size);
+        size = entry->size;
+        break;
+      }
+    }
+    msReleaseLock(TLOCK_OWSCACHE);
+  }
+
+  if (data == NULL && cache->dir) {
+    data = owsCacheReadFile(cache, &size);
+    if (data && cache->maxsize > 0)
+      owsCacheStore(cache, data, size);
+  }
+
+  if (data) {
+    if (map->debug >= MS_DEBUGLEVEL_V)
+      msDebug("msOWSCacheStart(): %s response served from cache.\n", request);
+    msIO_fwrite(data, 1, size, stdout);
+    msFree(data);
+    msFree(cache->key);
+    msFree(cache->mapfile);
+    msFree(cache->dir);
+    cache->key = NULL;
+    return MS_DONE;
+  }
+
+  /* capture the response while it is generated */
+  cache->stdout_context = *context;
+  msIO_installStdoutToBuffer();
+
+  return MS_SUCCESS;
+}
+
+/* msOWSCacheEnd()
+**
+** Stores the response generated since msOWSCacheStart() when status is
+** MS_SUCCESS and writes it out. Returns status.
+*/
+int msOWSCacheEnd(owsCacheObj *cache, int status)
+{
+  msIOContext *context;
+  msIOBuffer *buffer;
+
+  if (cache->key == NULL)
+    return status;
+
+  context = msIO_getHandler(stdout);
+  buffer = (msIOBuffer *) context->cbData;
+
+  /* back to the original stdout */
+  msIO_installHandlers(msIO_getHandler(stdin), &cache->stdout_context,
+                       msIO_getHandler(stderr));
+
+  if (status == MS_SUCCESS && buffer->data_offset > 0) {
+    if (cache->maxsize > 0)
+      owsCacheStore(cache, buffer->data, buffer->data_offset);
+    if (cache->dir)
+      owsCacheWriteFile(cache, buffer->data, buffer->data_offset);
+  }
+
+  if (buffer->data_offset > 0)
+    msIO_fwrite(buffer->data, 1, buffer->data_offset, stdout);
+
+  msFree(buffer->data);
+  msFree(buffer);
+
+  msFree(cache->key);
+  msFree(cache->mapfile);
+  msFree(cache->dir);
+  cache->key = NULL;
+
+  return status;
+}
+
+#endif /* USE_WMS_SVR || USE_WFS_SVR || USE_WCS_SVR */
@@ -129,6 +129,14 @@ o The connection pooling API will let a connection be used/referenced multiple
   between different threads concurrently.  But if a connection is released
   by one thread, it is available for use by another thread.
 
+o Drivers can also keep small strings describing a connection or one of its
+  tables (server version, primary key, column list, ...) in the pool with
+  msConnPoolSetMetadata() / msConnPoolGetMetadata(), so that long running
+  processes don't query the catalog again for every map.  Entries are keyed
+  by connection type, connection string, source (table, DATA, ...) and name,
+  and expire after METADATA_CACHE_TTL seconds (PROCESSING option, or the
+  MS_METADATA_CACHE_TTL config option, default 300, 0 disables the cache).
+
  ****************************************************************************/
 
 #include "mapserver.h"
@@ -167,6 +175,37 @@ static int connectionCount = 0;
 static int connectionMax = 0;
 static connectionObj *connections = NULL;
 
+#define MS_METADATA_CACHE_TTL  300
+#define MS_METADATA_CACHE_SIZE 256
+
+typedef struct metadataObj {
+  enum MS_CONNECTION_TYPE connectiontype;
+  char *connection;
+  char *source;
+  char *name;
+  char *value;
+
+  time_t expires;
+
+  struct metadataObj *next;
+} metadataObj;
+
+/*
+** Most recently used first, also protected by TLOCK_POOL.
+*/
+
+static metadataObj *metadataCache = NULL;
+
+static void msConnPoolFreeMetadata( metadataObj *entry )
+
+{
+  msFree( entry->connection );
+  msFree( entry->source );
+  msFree( entry->name );
+  msFree( entry->value );
+  msFree( entry );
+}
+
 /************************************************************************/
 /*                         msConnPoolRegister()                         */
 /*                                                                      */
@@ -457,8 +496,9 @@ void msConnPoolCloseUnreferenced()
 /************************************************************************/
 /*                       msConnPoolFinalCleanup()                       */
 /*                                                                      */
-/*      Close any remaining open connections.   This is normally        */
-/*      called just before (voluntary) application termination.         */
+/*      Close any remaining open connections and forget the cached      */
+/*      metadata.  This is normally called just before (voluntary)     */
+/*      application termination.                                        */
 /************************************************************************/
 
 void msConnPoolFinalCleanup()
@@ -470,5 +510,140 @@ void msConnPoolFinalCleanup()
   msAcquireLock( TLOCK_POOL );
   while( connectionCount > 0 )
     msConnPoolClose( 0 );
+
+  while( metadataCache != NULL ) {
+    metadataObj *next = metadataCache->next;
+    msConnPoolFreeMetadata( metadataCache );
+    metadataCache = next;
+  }
+  msReleaseLock( TLOCK_POOL );
+}
+
+/************************************************************************/
+/*                        msConnPoolMetadataTTL()                       */
+/*                                                                      */
+/*      Lifetime in seconds of the metadata cached for this layer's     */
+/*      connection, 0 when caching is disabled.                         */
+/************************************************************************/
+
+static int msConnPoolMetadataTTL( layerObj *layer )
+
+{
+  const char *value;
+
+  value = msLayerGetProcessingKey( layer, "METADATA_CACHE_TTL" );
+  if( value == NULL )
+    value = msGetConfigOption( layer->map, "MS_METADATA_CACHE_TTL" );
+  if( value == NULL )
+    return MS_METADATA_CACHE_TTL;
+
+  return MS_MAX( atoi(value), 0 );
+}
+
+static int msConnPoolMetadataMatch( metadataObj *entry, layerObj *layer,
+                                    const char *source, const char *name )
+
+{
+  return entry->connectiontype == layer->connectiontype
+         && strcmp( entry->connection, layer->connection ) == 0
+         && strcmp( entry->source, source ? source : "" ) == 0
+         && strcmp( entry->name, name ) == 0;
+}
+
+/************************************************************************/
+/*                        msConnPoolGetMetadata()                       */
+/*                                                                      */
+/*      Return a copy (to be freed by the caller) of the value          */
+/*      cached for name on the layer's connection and source, or        */
+/*      NULL if there is none or it expired.  source may be NULL for    */
+/*      values that belong to the connection itself.                    */
+/************************************************************************/
+
+char *msConnPoolGetMetadata( layerObj *layer, const char *source,
+                             const char *name )
+
+{
+  metadataObj *entry, *prev = NULL;
+  char *value = NULL;
+
+  if( layer->connection == NULL || msConnPoolMetadataTTL( layer ) == 0 )
+    return NULL;
+
+  msAcquireLock( TLOCK_POOL );
+  for( entry = metadataCache; entry != NULL; prev = entry, entry = entry->next ) {
+    if( !msConnPoolMetadataMatch( entry, layer, source, name ) )
+      continue;
+
+    if( entry->expires < time(NULL) ) {
+      if( prev ) prev->next = entry->next;
+      else metadataCache = entry->next;
+      msConnPoolFreeMetadata( entry );
+      break;
+    }
+
+    /* move to front */
+    if( prev ) {
+      prev->next = entry->next;
+      entry->next = metadataCache;
+      metadataCache = entry;
+    }
+    value = msStrdup( entry->value );
+    break;
+  }
+  msReleaseLock( TLOCK_POOL );
+
+  if( layer->debug >= MS_DEBUGLEVEL_VV && value )
+    msDebug( "msConnPoolGetMetadata(): using cached %s of %s.\n",
+             name, source ? source : "connection" );
+
+  return value;
+}
+
+/************************************************************************/
+/*                        msConnPoolSetMetadata()                       */
+/*                                                                      */
+/*      Cache value for name on the layer's connection and source,      */
+/*      replacing any previous value.                                   */
+/************************************************************************/
+
+void msConnPoolSetMetadata( layerObj *layer, const char *source,
+                            const char *name, const char *value )
+
+{
+  metadataObj *entry, *prev = NULL;
+  int ttl, count = 0;
+
+  ttl = msConnPoolMetadataTTL( layer );
+  if( layer->connection == NULL || value == NULL || ttl == 0 )
+    return;
+
+  msAcquireLock( TLOCK_POOL );
+
+  /* drop the previous value, and the least recently used entry when full */
+  entry = metadataCache;
+  while( entry != NULL ) {
+    metadataObj *next = entry->next;
+    count++;
+    if( msConnPoolMetadataMatch( entry, layer, source, name )
+        || count >= MS_METADATA_CACHE_SIZE ) {
+      if( prev ) prev->next = next;
+      else metadataCache = next;
+      msConnPoolFreeMetadata( entry );
+      count--;
+    } else
+      prev = entry;
+    entry = next;
+  }
+
+  entry = (metadataObj *) msSmallMalloc( sizeof(metadataObj) );
+  entry->connectiontype = layer->connectiontype;
+  entry->connection = msStrdup( layer->connection );
+  entry->source = msStrdup( source ? source : "" );
+  entry->name = msStrdup( name );
+  entry->value = msStrdup( value );
+  entry->expires = time(NULL) + ttl;
+  entry->next = metadataCache;
+  metadataCache = entry;
+
   msReleaseLock( TLOCK_POOL );
 }
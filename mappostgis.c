@@ -41,8 +41,10 @@
 ** So the geometry always resides at layer->numitems and the uid always
 ** resides at layer->numitems + 1
 **
-** Geometry is requested as Hex encoded WKB. The endian is always requested
-** as the client endianness.
+** Geometry is requested as Hex encoded WKB, or raw WKB in a binary result
+** with PROCESSING "TRANSFER_ENCODING=BINARY". The endian is always requested
+** as the client endianness. When drawing, PROCESSING "GENERALIZE" has the
+** server generalize the geometry to the map resolution first.
 **
 ** msPostGISLayerWhichShapes creates SQL based on DATA and LAYER state,
 ** executes it, and places the un-read PGresult handle in the layerinfo->pgresult,
@@ -106,6 +108,12 @@ msPostGISLayerInfo *msPostGISCreateLayerInfo(void)
   layerinfo->rownum = 0;
   layerinfo->version = 0;
   layerinfo->paging = MS_TRUE;
+  layerinfo->classfilter = NULL;
+  layerinfo->columntypes = NULL;
+  layerinfo->typesource = NULL;
+  layerinfo->generalize = MS_POSTGIS_GENERALIZE_NONE;
+  layerinfo->tolerance = 0.0;
+  layerinfo->binary = MS_FALSE;
   return layerinfo;
 }
 
@@ -121,6 +129,9 @@ void msPostGISFreeLayerInfo(layerObj *layer)
   if ( layerinfo->srid ) free(layerinfo->srid);
   if ( layerinfo->geomcolumn ) free(layerinfo->geomcolumn);
   if ( layerinfo->fromsource ) free(layerinfo->fromsource);
+  if ( layerinfo->classfilter ) free(layerinfo->classfilter);
+  if ( layerinfo->columntypes ) free(layerinfo->columntypes);
+  if ( layerinfo->typesource ) free(layerinfo->typesource);
   if ( layerinfo->pgresult ) PQclear(layerinfo->pgresult);
   if ( layerinfo->pgconn ) msConnPoolRelease(layer, layerinfo->pgconn);
   free(layerinfo);
@@ -1385,10 +1396,14 @@ int msPostGISParseData(layerObj *layer)
       msSetError(MS_QUERYERR, "Error parsing PostGIS DATA variable.  You must specify 'using unique' when supplying a subselect in the data definition.", "msPostGISParseData()");
       return MS_FAILURE;
     }
-    if ( msPostGISRetrievePK(layer) != MS_SUCCESS ) {
-      /* No user specified unique id so we will use the PostgreSQL oid */
-      /* TODO: Deprecate this, oids are deprecated in PostgreSQL */
-      layerinfo->uid = msStrdup("oid");
+    layerinfo->uid = msConnPoolGetMetadata(layer, layerinfo->fromsource, "uid");
+    if ( ! (layerinfo->uid) ) {
+      if ( msPostGISRetrievePK(layer) != MS_SUCCESS ) {
+        /* No user specified unique id so we will use the PostgreSQL oid */
+        /* TODO: Deprecate this, oids are deprecated in PostgreSQL */
+        layerinfo->uid = msStrdup("oid");
+      }
+      msConnPoolSetMetadata(layer, layerinfo->fromsource, "uid", layerinfo->uid);
     }
   }
 
@@ -1607,6 +1622,106 @@ char *msPostGISBuildSQLBox(layerObj *layer, rectObj *rect, char *strSRID)
 }
 
 
+/*
+** msPostGISSetTransfer()
+**
+** Set up layerinfo for the geometry transfer of the next query. With
+** PROCESSING "TRANSFER_ENCODING=BINARY" the result comes in binary format,
+** so the WKB needs neither encoding nor decoding and is half the size of
+** the hex encoding. When generalize is true (drawing) and the layer has
+** PROCESSING "GENERALIZE=SNAPTOGRID|SIMPLIFY", the server snaps the vertices
+** to a grid of GENERALIZE_TOLERANCE pixels (default 1), or simplifies the
+** geometry with a tolerance of GENERALIZE_TOLERANCE pixels (default 0.5).
+** Either way vertices move by at most half a pixel by default.
+*/
+static void msPostGISSetTransfer(layerObj *layer, int generalize)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  mapObj *map = layer->map;
+  const char *value;
+  double pixels, cellsize;
+
+  value = msLayerGetProcessingKey(layer, "TRANSFER_ENCODING");
+  layerinfo->binary = (value && strcasecmp(value, "BINARY") == 0);
+
+  layerinfo->generalize = MS_POSTGIS_GENERALIZE_NONE;
+  layerinfo->tolerance = 0.0;
+
+  /* points have nothing to generalize */
+  if ( ! generalize || ! map || map->width <= 0 || map->height <= 0 || map->cellsize <= 0 ||
+       layer->transform != MS_TRUE || (layer->type != MS_LAYER_LINE && layer->type != MS_LAYER_POLYGON) )
+    return;
+
+  value = msLayerGetProcessingKey(layer, "GENERALIZE");
+  if ( ! value )
+    return;
+  if ( strcasecmp(value, "SNAPTOGRID") == 0 ) {
+    layerinfo->generalize = MS_POSTGIS_GENERALIZE_SNAPTOGRID;
+    pixels = 1.0;
+  } else if ( strcasecmp(value, "SIMPLIFY") == 0 ) {
+    layerinfo->generalize = MS_POSTGIS_GENERALIZE_SIMPLIFY;
+    pixels = 0.5;
+  } else {
+    if ( layer->debug ) {
+      msDebug("msPostGISSetTransfer(): Unknown GENERALIZE value '%s', ignored.\n", value);
+    }
+    return;
+  }
+
+  value = msLayerGetProcessingKey(layer, "GENERALIZE_TOLERANCE");
+  if ( value )
+    pixels = atof(value);
+
+  /* the size of a pixel in layer units */
+  cellsize = map->cellsize;
+#ifdef USE_PROJ
+  if ( map->projection.numargs > 0 && layer->projection.numargs > 0 &&
+       msProjectionsDiffer(&(map->projection), &(layer->projection)) ) {
+    rectObj rect = map->extent;
+
+    if ( msProjectRect(&(map->projection), &(layer->projection), &rect) != MS_SUCCESS ||
+         rect.maxx <= rect.minx || rect.maxy <= rect.miny ) {
+      layerinfo->generalize = MS_POSTGIS_GENERALIZE_NONE;
+      return;
+    }
+    cellsize = MS_MIN((rect.maxx - rect.minx) / map->width, (rect.maxy - rect.miny) / map->height);
+  }
+#endif
+
+  layerinfo->tolerance = pixels * cellsize;
+  if ( layerinfo->tolerance <= 0 )
+    layerinfo->generalize = MS_POSTGIS_GENERALIZE_NONE;
+}
+
+/*
+** msPostGISBuildSQLGeometry()
+**
+** The 2D geometry column, generalized to the resolution of the map when
+** drawing with PROCESSING "GENERALIZE=SNAPTOGRID|SIMPLIFY".
+** Returns malloc'ed char* that must be freed by caller.
+*/
+static char *msPostGISBuildSQLGeometry(layerObj *layer)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo *)layer->layerinfo;
+  static char *strGeomTemplate = "ST_Force_2D(\"%s\")";
+  static char *strSnapTemplate = "ST_SnapToGrid(ST_Force_2D(\"%s\"),%.17g)";
+  static char *strSimplifyTemplate = "ST_Simplify(ST_Force_2D(\"%s\"),%.17g)";
+  char *strTemplate = strGeomTemplate;
+  char *strGeom;
+
+  if ( layerinfo->generalize == MS_POSTGIS_GENERALIZE_SNAPTOGRID )
+    strTemplate = strSnapTemplate;
+  else if ( layerinfo->generalize == MS_POSTGIS_GENERALIZE_SIMPLIFY )
+    strTemplate = strSimplifyTemplate;
+
+  strGeom = (char*)msSmallMalloc(strlen(strTemplate) + strlen(layerinfo->geomcolumn) + 32);
+  if ( strTemplate == strGeomTemplate )
+    sprintf(strGeom, strTemplate, layerinfo->geomcolumn);
+  else
+    sprintf(strGeom, strTemplate, layerinfo->geomcolumn, layerinfo->tolerance);
+  return strGeom;
+}
+
 /*
 ** msPostGISBuildSQLItems()
 **
@@ -1649,15 +1764,21 @@ char *msPostGISBuildSQLItems(layerObj *layer)
     ** hex or base64 encoded WKB byte-array. We will have to decode this
     ** data once we get it. Forcing to 2D (via the AsBinary function
     ** which includes a 2D force in it) removes ordinates we don't
-    ** need, saving transfer and encode/decode time.
+    ** need, saving transfer and encode/decode time. With a binary
+    ** result the WKB comes as is, and everything else as text.
     */
 #if TRANSFER_ENCODING == 64
-    static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'base64') as geom,\"%s\"";
+    static char *strGeomTemplate = "encode(ST_AsBinary(%s,'%s'),'base64') as geom,\"%s\"";
 #else
-    static char *strGeomTemplate = "encode(ST_AsBinary(ST_Force_2D(\"%s\"),'%s'),'hex') as geom,\"%s\"";
+    static char *strGeomTemplate = "encode(ST_AsBinary(%s,'%s'),'hex') as geom,\"%s\"";
 #endif
-    strGeom = (char*)msSmallMalloc(strlen(strGeomTemplate) + strlen(strEndian) + strlen(layerinfo->geomcolumn) + strlen(layerinfo->uid));
-    sprintf(strGeom, strGeomTemplate, layerinfo->geomcolumn, strEndian, layerinfo->uid);
+    static char *strBinaryGeomTemplate = "ST_AsBinary(%s,'%s') as geom,\"%s\"::text";
+    char *strGeomColumn = msPostGISBuildSQLGeometry(layer);
+    char *strTemplate = layerinfo->binary ? strBinaryGeomTemplate : strGeomTemplate;
+
+    strGeom = (char*)msSmallMalloc(strlen(strTemplate) + strlen(strEndian) + strlen(strGeomColumn) + strlen(layerinfo->uid));
+    sprintf(strGeom, strTemplate, strGeomColumn, strEndian, layerinfo->uid);
+    free(strGeomColumn);
   }
 
   if( layer->debug > 1 ) {
@@ -1677,14 +1798,21 @@ char *msPostGISBuildSQLItems(layerObj *layer)
     int length = strlen(strGeom) + 2;
     int t;
     for ( t = 0; t < layer->numitems; t++ ) {
-      length += strlen(layer->items[t]) + 3; /* itemname + "", */
+      length += strlen(layer->items[t]) + 14; /* itemname + ROW("")::text, */
     }
     strItems = (char*)msSmallMalloc(length);
     strItems[0] = '\0';
     for ( t = 0; t < layer->numitems; t++ ) {
-      strlcat(strItems, "\"", length);
+      /*
+      ** In a binary result the items are requested as text. A plain ::text
+      ** cast differs from the text output for some types (booleans become
+      ** true/false instead of t/f), the text of a one column record is made
+      ** by the output function of the column type, as in a text result.
+      ** See msPostGISRecordValue().
+      */
+      strlcat(strItems, layerinfo->binary ? "ROW(\"" : "\"", length);
       strlcat(strItems, layer->items[t], length);
-      strlcat(strItems, "\",", length);
+      strlcat(strItems, layerinfo->binary ? "\")::text," : "\",", length);
     }
     strlcat(strItems, strGeom, length);
   }
@@ -1869,12 +1997,14 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
   char *strRect = 0;
   char *strFilter = 0;
   char *strUid = 0;
+  char *strClasses = 0;
   char *strWhere = 0;
   char *strLimit = 0;
   char *strOffset = 0;
   size_t strRectLength = 0;
   size_t strFilterLength = 0;
   size_t strUidLength = 0;
+  size_t strClassesLength = 0;
   size_t strLimitLength = 0;
   size_t strOffsetLength = 0;
   size_t bufferSize = 0;
@@ -1946,6 +2076,12 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     strFilterLength = strlen(strFilter);
   }
 
+  /* Populate strClasses, if necessary. */
+  if ( layerinfo->classfilter ) {
+    strClasses = msStrdup(layerinfo->classfilter);
+    strClassesLength = strlen(strClasses);
+  }
+
   /* Populate strUid, if necessary. */
   if ( uid ) {
     static char *strUidTemplate = "\"%s\" = %ld";
@@ -1954,8 +2090,8 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     strUidLength = strlen(strUid);
   }
 
-  bufferSize = strRectLength + 5 + strFilterLength + 5 + strUidLength
-               + strLimitLength + strOffsetLength;
+  bufferSize = strRectLength + 5 + strFilterLength + 5 + strClassesLength + 5
+               + strUidLength + strLimitLength + strOffsetLength;
   strWhere = (char*)msSmallMalloc(bufferSize);
   *strWhere = '\0';
   if ( strRect ) {
@@ -1971,6 +2107,14 @@ char *msPostGISBuildSQLWhere(layerObj *layer, rectObj *rect, long *uid)
     free(strFilter);
     insert_and++;
   }
+  if ( strClasses ) {
+    if ( insert_and ) {
+      strlcat(strWhere, " and ", bufferSize);
+    }
+    strlcat(strWhere, strClasses, bufferSize);
+    free(strClasses);
+    insert_and++;
+  }
   if ( strUid ) {
     if ( insert_and ) {
       strlcat(strWhere, " and ", bufferSize);
@@ -2054,6 +2198,47 @@ char *msPostGISBuildSQL(layerObj *layer, rectObj *rect, long *uid)
 
 }
 
+/*
+** msPostGISRecordValue()
+**
+** Returns the malloc'ed value of the text output of a one column record,
+** "(value)", as a text result would have it. The value is double quoted
+** when needed, with quotes and backslashes escaped, and missing for null.
+*/
+static char *msPostGISRecordValue(const char *record, int size)
+{
+  char *value = (char*) msSmallMalloc(size + 1);
+  const char *p = record + 1, *end = record + size - 1;
+  int n = 0;
+
+  if ( size < 2 || record[0] != '(' || *end != ')' ) {
+    /* not a record, use as is */
+    memcpy(value, record, size);
+    value[size] = '\0';
+    return value;
+  }
+
+  if ( *p == '"' ) {
+    for ( p++; p < end; p++ ) {
+      if ( *p == '\\' && p + 1 < end ) {
+        value[n++] = *(++p);
+      } else if ( *p == '"' ) {
+        if ( p + 1 < end && p[1] == '"' )
+          value[n++] = *(++p);
+        else
+          break;
+      } else {
+        value[n++] = *p;
+      }
+    }
+  } else {
+    memcpy(value, p, end - p);
+    n = end - p;
+  }
+  value[n] = '\0';
+  return value;
+}
+
 #define wkbstaticsize 4096
 int msPostGISReadShape(layerObj *layer, shapeObj *shape)
 {
@@ -2082,26 +2267,35 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
     return MS_FAILURE;
   }
 
-  if(wkbstrlen > wkbstaticsize) {
-    wkb = calloc(wkbstrlen, sizeof(char));
+  if ( layerinfo->binary ) {
+    /* Raw WKB, read in place. A null geometry (collapsed by the generalization) is skipped. */
+    if ( wkbstrlen == 0 ) {
+      return MS_FAILURE;
+    }
+    wkb = (unsigned char*)wkbstr;
+    w.size = wkbstrlen;
   } else {
-    wkb = wkbstatic;
-  }
+    if(wkbstrlen > wkbstaticsize) {
+      wkb = calloc(wkbstrlen, sizeof(char));
+    } else {
+      wkb = wkbstatic;
+    }
 #if TRANSFER_ENCODING == 64
-  result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
+    result = msPostGISBase64Decode(wkb, wkbstr, wkbstrlen - 1);
 #else
-  result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
+    result = msPostGISHexDecode(wkb, wkbstr, wkbstrlen);
 #endif
 
-  if( ! result ) {
-    if(wkb!=wkbstatic) free(wkb);
-    return MS_FAILURE;
+    if( ! result ) {
+      if(wkb!=wkbstatic) free(wkb);
+      return MS_FAILURE;
+    }
+    w.size = (wkbstrlen - 1)/2;
   }
 
   /* Initialize our wkbObj */
   w.wkb = (char*)wkb;
   w.ptr = w.wkb;
-  w.size = (wkbstrlen - 1)/2;
 
   /* Set the type map according to what version of PostGIS we are dealing with */
   if( layerinfo->version >= 20000 ) /* PostGIS 2.0+ */
@@ -2146,7 +2340,7 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
   }
 
   /* All done with WKB geometry, free it! */
-  if(wkb!=wkbstatic) free(wkb);
+  if(wkb!=wkbstatic && wkb!=(unsigned char*)wkbstr) free(wkb);
 
   if (result != MS_FAILURE) {
     int t;
@@ -2161,6 +2355,9 @@ int msPostGISReadShape(layerObj *layer, shapeObj *shape)
       int isnull = PQgetisnull(layerinfo->pgresult, layerinfo->rownum, t);
       if ( isnull ) {
         shape->values[t] = msStrdup("");
+      } else if ( layerinfo->binary ) {
+        shape->values[t] = msPostGISRecordValue(val, size);
+        msStringTrimBlanks(shape->values[t]);
       } else {
         shape->values[t] = (char*) msSmallMalloc(size + 1);
         memcpy(shape->values[t], val, size);
@@ -2219,6 +2416,7 @@ int msPostGISLayerOpen(layerObj *layer)
 {
 #ifdef USE_POSTGIS
   msPostGISLayerInfo  *layerinfo;
+  char *value;
   int order_test = 1;
 
   assert(layer != NULL);
@@ -2322,9 +2520,18 @@ int msPostGISLayerOpen(layerObj *layer)
     }
   }
 
-  /* Get the PostGIS version number from the database */
-  layerinfo->version = msPostGISRetrieveVersion(layerinfo->pgconn);
-  if( layerinfo->version == MS_FAILURE ) return MS_FAILURE;
+  /* Get the PostGIS version number from the database, once per connection */
+  value = msConnPoolGetMetadata(layer, NULL, "postgis_version");
+  if( value ) {
+    layerinfo->version = atoi(value);
+    free(value);
+  } else {
+    char version[32];
+    layerinfo->version = msPostGISRetrieveVersion(layerinfo->pgconn);
+    if( layerinfo->version == MS_FAILURE ) return MS_FAILURE;
+    snprintf(version, sizeof(version), "%d", layerinfo->version);
+    msConnPoolSetMetadata(layer, NULL, "postgis_version", version);
+  }
   if (layer->debug)
     msDebug("msPostGISLayerOpen: Got PostGIS version %d.\n", layerinfo->version);
 
@@ -2456,6 +2663,10 @@ int msPostGISLayerInitItemInfo(layerObj *layer)
 #endif
 }
 
+#ifdef USE_POSTGIS
+static char *msPostGISBuildSQLClasses(layerObj *layer);
+#endif
+
 /*
 ** msPostGISLayerWhichShapes()
 **
@@ -2470,6 +2681,7 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   char** layer_bind_values = (char**)msSmallMalloc(sizeof(char*) * 1000);
   char* bind_value;
   char* bind_key = (char*)msSmallMalloc(3);
+  traceSpanObj span;
 
   int num_bind_values = 0;
 
@@ -2504,8 +2716,22 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
   */
   layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
+  /* Queries need the geometry as stored, drawing is done at the map resolution. */
+  msPostGISSetTransfer(layer, !isQuery);
+
+  /* When drawing, only ask for the features one of the classes will draw. */
+  if ( ! isQuery ) {
+    layerinfo->classfilter = msPostGISBuildSQLClasses(layer);
+    if ( layer->debug && layerinfo->classfilter ) {
+      msDebug("msPostGISLayerWhichShapes class filter: %s\n", layerinfo->classfilter);
+    }
+  }
+
   /* Build a SQL query based on our current state. */
   strSQL = msPostGISBuildSQL(layer, &rect, NULL);
+  msFree(layerinfo->classfilter);
+  layerinfo->classfilter = NULL;
+  layerinfo->generalize = MS_POSTGIS_GENERALIZE_NONE;
   if ( ! strSQL ) {
     msSetError(MS_QUERYERR, "Failed to build query SQL.", "msPostGISLayerWhichShapes()");
     return MS_FAILURE;
@@ -2515,10 +2741,21 @@ int msPostGISLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     msDebug("msPostGISLayerWhichShapes query: %s\n", strSQL);
   }
 
+  /* the span records the geometry bytes received, to compare the transfer settings */
+  msTraceStart(&span, "postgis.query", layer->name);
   if(num_bind_values > 0) {
     pgresult = PQexecParams(layerinfo->pgconn, strSQL, num_bind_values, NULL, (const char**)layer_bind_values, NULL, NULL, 1);
   } else {
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
+    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, layerinfo->binary ? 1 : 0);
+  }
+  if ( span.active && pgresult && PQresultStatus(pgresult) == PGRES_TUPLES_OK ) {
+    long bytes = 0;
+    int t;
+    for ( t = 0; t < PQntuples(pgresult); t++ )
+      bytes += PQgetlength(pgresult, t, layer->numitems);
+    msTraceEnd(&span, PQntuples(pgresult), bytes);
+  } else {
+    msTraceEnd(&span, -1, -1);
   }
 
   /* free bind values */
@@ -2698,6 +2935,7 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
 
     /* Build a SQL query based on our current state. */
+    msPostGISSetTransfer(layer, MS_FALSE);
     strSQL = msPostGISBuildSQL(layer, 0, &shapeindex);
     if ( ! strSQL ) {
       msSetError(MS_QUERYERR, "Failed to build query SQL.", "msPostGISLayerGetShape()");
@@ -2708,7 +2946,7 @@ int msPostGISLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
       msDebug("msPostGISLayerGetShape query: %s\n", strSQL);
     }
 
-    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, 0);
+    pgresult = PQexecParams(layerinfo->pgconn, strSQL,0, NULL, NULL, NULL, NULL, layerinfo->binary ? 1 : 0);
 
     /* Something went wrong. */
     if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
@@ -2875,6 +3113,132 @@ msPostGISPassThroughFieldDefinitions( layerObj *layer,
       msInsertHashTable(&(layer->metadata), md_item_name, gml_precision );
   }
 }
+
+/*
+** msPostGISSetColumnTypes()
+**
+** Remember the columns of pgresult, read from the record source strFrom, as
+** "name<tab>type" lines where type is 'n' (number), 's' (string) or '-'
+** (anything else, not used in SQL filters).
+*/
+static void msPostGISSetColumnTypes(layerObj *layer, const char *strFrom, PGresult *pgresult)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  char *columntypes = NULL;
+  int t;
+
+  for (t = 0; t < PQnfields(pgresult); t++) {
+    const char *type;
+
+    /* floating point columns are left out: MapServer compares the text the
+       server sends (rounded unless extra_float_digits is set), the server
+       compares the stored value */
+    switch( PQftype(pgresult, t) ) {
+      case INT2OID:
+      case INT4OID:
+      case INT8OID:
+        type = "\tn\n";
+        break;
+      case TEXTOID:
+      case VARCHAROID: /* not bpchar, its comparisons ignore trailing blanks */
+        type = "\ts\n";
+        break;
+      default:
+        type = "\t-\n";
+    }
+    columntypes = msStringConcatenate(columntypes, PQfname(pgresult, t));
+    columntypes = msStringConcatenate(columntypes, (char*)type);
+  }
+  if ( ! columntypes ) columntypes = msStrdup("");
+
+  msConnPoolSetMetadata(layer, strFrom, "columntypes", columntypes);
+
+  msFree(layerinfo->columntypes);
+  msFree(layerinfo->typesource);
+  layerinfo->columntypes = columntypes;
+  layerinfo->typesource = msStrdup(strFrom);
+}
+
+/*
+** msPostGISGetItemType()
+**
+** sqlDialectObj item type callback, data is the layerinfo->columntypes.
+*/
+static int msPostGISGetItemType(layerObj *layer, const char *item, void *data)
+{
+  const char *line = (const char *) data;
+  size_t length = strlen(item);
+
+  while ( line && *line ) {
+    if ( strncmp(line, item, length) == 0 && line[length] == '\t' ) {
+      if ( line[length+1] == 'n' ) return MS_SQL_ITEM_NUMBER;
+      if ( line[length+1] == 's' ) return MS_SQL_ITEM_STRING;
+      return MS_SQL_ITEM_UNKNOWN;
+    }
+    line = strchr(line, '\n');
+    if ( line ) line++;
+  }
+  return MS_SQL_ITEM_UNKNOWN;
+}
+
+/*
+** msPostGISBuildSQLClasses()
+**
+** Returns malloc'ed SQL selecting the features the layer classes would draw,
+** or NULL if all features may be drawn (see msLayerClassesToSQL()).
+*/
+static char *msPostGISBuildSQLClasses(layerObj *layer)
+{
+  msPostGISLayerInfo *layerinfo = (msPostGISLayerInfo*) layer->layerinfo;
+  static char *strSQLTemplate = "select * from %s where false limit 0";
+  sqlDialectObj dialect;
+  char *strFrom;
+  rectObj rect;
+
+  if ( layer->numclasses <= 0 )
+    return NULL;
+
+  /* Same key as the columns of msPostGISLayerGetItems() */
+  rect.minx = rect.miny = rect.maxx = rect.maxy = 0.0;
+  strFrom = msPostGISReplaceBoxToken(layer, &rect, layerinfo->fromsource);
+
+  if ( ! layerinfo->typesource || strcmp(layerinfo->typesource, strFrom) != 0 ) {
+    char *columntypes = msConnPoolGetMetadata(layer, strFrom, "columntypes");
+
+    if ( columntypes ) {
+      msFree(layerinfo->columntypes);
+      msFree(layerinfo->typesource);
+      layerinfo->columntypes = columntypes;
+      layerinfo->typesource = msStrdup(strFrom);
+    } else {
+      PGresult *pgresult;
+      char *sql = (char*) msSmallMalloc(strlen(strSQLTemplate) + strlen(strFrom));
+
+      sprintf(sql, strSQLTemplate, strFrom);
+      pgresult = PQexecParams(layerinfo->pgconn, sql, 0, NULL, NULL, NULL, NULL, 0);
+      if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
+        /* not fatal, the classes are evaluated by MapServer anyway */
+        if ( layer->debug ) {
+          msDebug("msPostGISBuildSQLClasses(): Error (%s) executing SQL: %s\n", PQerrorMessage(layerinfo->pgconn), sql);
+        }
+        if (pgresult) PQclear(pgresult);
+        free(sql);
+        free(strFrom);
+        return NULL;
+      }
+      msPostGISSetColumnTypes(layer, strFrom, pgresult);
+      PQclear(pgresult);
+      free(sql);
+    }
+  }
+  free(strFrom);
+
+  dialect.identifier_open = dialect.identifier_close = '"';
+  dialect.itemtype = msPostGISGetItemType;
+  dialect.data = layerinfo->columntypes;
+
+  return msLayerClassesToSQL(layer, &dialect);
+}
 #endif /* defined(USE_POSTGIS) */
 
 /*
@@ -2894,9 +3258,11 @@ int msPostGISLayerGetItems(layerObj *layer)
   char *col = NULL;
   char *sql = NULL;
   char *strFrom = NULL;
+  char *columns = NULL;
+  char **names = NULL;
   char found_geom = 0;
   const char *value;
-  int t, item_num;
+  int t, item_num, numnames = 0, passthrough;
   rectObj rect;
 
   /* A useless rectangle for our useless query */
@@ -2924,61 +3290,83 @@ int msPostGISLayerGetItems(layerObj *layer)
   strFrom = msPostGISReplaceBoxToken(layer, &rect, layerinfo->fromsource);
 
   /*
-  ** Both the "table" and "(select ...) as sub" cases can be handled with the
-  ** same SQL.
+  ** The column names are kept with the connection, unless the field
+  ** definitions have to be read from the result as well.
   */
-  sql = (char*) msSmallMalloc(strlen(strSQLTemplate) + strlen(strFrom));
-  sprintf(sql, strSQLTemplate, strFrom);
-  free(strFrom);
+  value = msOWSLookupMetadata(&(layer->metadata), "G", "types");
+  passthrough = (value != NULL && strcasecmp(value,"auto") == 0);
+  if ( ! passthrough )
+    columns = msConnPoolGetMetadata(layer, strFrom, "columns");
 
-  if (layer->debug) {
-    msDebug("msPostGISLayerGetItems executing SQL: %s\n", sql);
-  }
-
-  pgresult = PQexecParams(layerinfo->pgconn, sql,0, NULL, NULL, NULL, NULL, 0);
+  if ( ! columns ) {
+    /*
+    ** Both the "table" and "(select ...) as sub" cases can be handled with the
+    ** same SQL.
+    */
+    sql = (char*) msSmallMalloc(strlen(strSQLTemplate) + strlen(strFrom));
+    sprintf(sql, strSQLTemplate, strFrom);
 
-  if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
-    if ( layer->debug ) {
-      msDebug("msPostGISLayerGetItems(): Error (%s) executing SQL: %s\n", PQerrorMessage(layerinfo->pgconn), sql);
+    if (layer->debug) {
+      msDebug("msPostGISLayerGetItems executing SQL: %s\n", sql);
     }
-    msSetError(MS_QUERYERR, "Error executing SQL: %s", "msPostGISLayerGetItems()", PQerrorMessage(layerinfo->pgconn));
-    if (pgresult) {
-      PQclear(pgresult);
+
+    pgresult = PQexecParams(layerinfo->pgconn, sql,0, NULL, NULL, NULL, NULL, 0);
+
+    if ( (!pgresult) || (PQresultStatus(pgresult) != PGRES_TUPLES_OK) ) {
+      if ( layer->debug ) {
+        msDebug("msPostGISLayerGetItems(): Error (%s) executing SQL: %s\n", PQerrorMessage(layerinfo->pgconn), sql);
+      }
+      msSetError(MS_QUERYERR, "Error executing SQL: %s", "msPostGISLayerGetItems()", PQerrorMessage(layerinfo->pgconn));
+      if (pgresult) {
+        PQclear(pgresult);
+      }
+      free(sql);
+      free(strFrom);
+      return MS_FAILURE;
     }
+
     free(sql);
-    return MS_FAILURE;
+
+    for (t = 0; t < PQnfields(pgresult); t++) {
+      if (t > 0) columns = msStringConcatenate(columns, "\n");
+      columns = msStringConcatenate(columns, PQfname(pgresult, t));
+    }
+    msConnPoolSetMetadata(layer, strFrom, "columns", columns);
+    msPostGISSetColumnTypes(layer, strFrom, pgresult);
+
+    /*
+    ** consider populating the field definitions in metadata.
+    */
+    if ( passthrough )
+      msPostGISPassThroughFieldDefinitions( layer, pgresult );
+
+    /*
+    ** Cleanup
+    */
+    PQclear(pgresult);
   }
+  free(strFrom);
 
-  free(sql);
+  names = msStringSplit(columns ? columns : "", '\n', &numnames);
+  free(columns);
 
-  layer->numitems = PQnfields(pgresult) - 1; /* dont include the geometry column (last entry)*/
+  layer->numitems = numnames - 1; /* dont include the geometry column (last entry)*/
   layer->items = msSmallMalloc(sizeof(char*) * (layer->numitems + 1)); /* +1 in case there is a problem finding geometry column */
 
   found_geom = 0; /* havent found the geom field */
   item_num = 0;
 
-  for (t = 0; t < PQnfields(pgresult); t++) {
-    col = PQfname(pgresult, t);
+  for (t = 0; t < numnames; t++) {
+    col = names[t];
     if ( strcmp(col, layerinfo->geomcolumn) != 0 ) {
       /* this isnt the geometry column */
-      layer->items[item_num] = msStrdup(col);
-      item_num++;
+      if ( item_num < layer->numitems + 1 )
+        layer->items[item_num++] = msStrdup(col);
     } else {
       found_geom = 1;
     }
   }
-
-  /*
-  ** consider populating the field definitions in metadata.
-  */
-  if((value = msOWSLookupMetadata(&(layer->metadata), "G", "types")) != NULL
-      && strcasecmp(value,"auto") == 0 )
-    msPostGISPassThroughFieldDefinitions( layer, pgresult );
-
-  /*
-  ** Cleanup
-  */
-  PQclear(pgresult);
+  msFreeCharArray(names, numnames);
 
   if (!found_geom) {
     msSetError(MS_QUERYERR, "Tried to find the geometry column in the database, but couldn't find it.  Is it mis-capitalized? '%s'", "msPostGISLayerGetItems()", layerinfo->geomcolumn);
@@ -43,6 +43,11 @@
 /* HEX = 16 or BASE64 = 64*/
 #define TRANSFER_ENCODING 16
 
+/* Server side generalization of the geometry (PROCESSING "GENERALIZE") */
+#define MS_POSTGIS_GENERALIZE_NONE 0
+#define MS_POSTGIS_GENERALIZE_SNAPTOGRID 1
+#define MS_POSTGIS_GENERALIZE_SIMPLIFY 2
+
 /* Substitution token for box hackery */
 #define BOXTOKEN "!BOX!"
 #define BOXTOKENLENGTH 5
@@ -64,6 +69,12 @@ typedef struct {
   int         endian;      /* Endianness of the mapserver host */
   int         version;     /* PostGIS version of the database */
   int         paging;      /* Driver handling of pagination, enabled by default */
+  char        *classfilter; /* SQL for the layer classes, set while drawing */
+  char        *columntypes; /* "name\ttype" lines of the columns of typesource */
+  char        *typesource;  /* record source columntypes was read for */
+  int         generalize;  /* MS_POSTGIS_GENERALIZE_* of the geometry, set while drawing */
+  double      tolerance;   /* of generalize, in layer units */
+  int         binary;      /* pgresult holds raw WKB in binary format */
 }
 msPostGISLayerInfo;
 
@@ -82,6 +82,9 @@ void msFreeQuery(queryObj *query)
 int msExecuteQuery(mapObj *map)
 {
   int tmp=-1, status;
+  traceSpanObj span;
+
+  msTraceStart(&span, "query", NULL);
 
   /* handle slayer/qlayer management for feature queries */
   if(map->query.slayer >= 0) {
@@ -110,6 +113,7 @@ int msExecuteQuery(mapObj *map)
       break;
     default:
       msSetError(MS_QUERYERR, "Malformed queryObj.", "msExecuteQuery()");
+      msTraceEnd(&span, -1, -1);
       return(MS_FAILURE);
   }
 
@@ -118,6 +122,8 @@ int msExecuteQuery(mapObj *map)
     if(status == MS_SUCCESS) status = msQueryByFeatures(map);
   }
 
+  msTraceEnd(&span, -1, -1);
+
   return status;
 }
 
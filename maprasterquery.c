@@ -82,12 +82,28 @@ typedef struct {
 
   double   shape_tolerance;
 
+  /* RQM_STATISTICS accumulators, per band */
+  double  *st_count;
+  double  *st_min;
+  double  *st_max;
+  double  *st_sum;
+  double  *st_sum2;
+  int      st_hist_bins;
+  double  *st_hist_min;
+  double  *st_hist_max;
+  double  *st_hist;  /* band_count * st_hist_bins */
+  rectObj  st_rect;  /* query rectangle, in the layer projection */
+
 } rasterLayerInfo;
 
 #define RQM_UNKNOWN               0
 #define RQM_ENTRY_PER_PIXEL       1
 #define RQM_HIST_ON_CLASS         2
 #define RQM_HIST_ON_VALUE         3
+#define RQM_STATISTICS            4
+
+/* number of values read at once by statistics queries */
+#define RQM_STATISTICS_STRIP_SIZE 1048576
 
 extern int InvGeoTransform( double *gt_in, double *gt_out );
 #define GEO_TRANS(tr,x,y)  ((tr)[0]+(tr)[1]*(x)+(tr)[2]*(y))
@@ -126,6 +142,27 @@ static int addResult(resultCacheObj *cache, int classindex, int shapeindex, int
   return(MS_SUCCESS);
 }
 
+/************************************************************************/
+/*                     msRasterQueryStatisticsFree()                    */
+/************************************************************************/
+
+static void msRasterQueryStatisticsFree( rasterLayerInfo *rlinfo )
+
+{
+  msFree( rlinfo->st_count );
+  msFree( rlinfo->st_min );
+  msFree( rlinfo->st_max );
+  msFree( rlinfo->st_sum );
+  msFree( rlinfo->st_sum2 );
+  msFree( rlinfo->st_hist_min );
+  msFree( rlinfo->st_hist_max );
+  msFree( rlinfo->st_hist );
+
+  rlinfo->st_count = rlinfo->st_min = rlinfo->st_max = NULL;
+  rlinfo->st_sum = rlinfo->st_sum2 = NULL;
+  rlinfo->st_hist_min = rlinfo->st_hist_max = rlinfo->st_hist = NULL;
+}
+
 /************************************************************************/
 /*                       msRasterLayerInfoFree()                        */
 /************************************************************************/
@@ -164,6 +201,8 @@ static void msRasterLayerInfoFree( layerObj *layer )
   if( rlinfo->qc_tileindex != NULL )
     free( rlinfo->qc_tileindex );
 
+  msRasterQueryStatisticsFree( rlinfo );
+
   free( rlinfo );
 
   layer->layerinfo = NULL;
@@ -203,6 +242,21 @@ static void msRasterLayerInfoInitialize( layerObj *layer )
     rlinfo->query_result_hard_max =
       atoi(CSLFetchNameValue( layer->processing, "RASTER_QUERY_MAX_RESULT" ));
   }
+
+  /* -------------------------------------------------------------------- */
+  /*      RASTER_QUERY_MODE=STATISTICS returns one summary record per     */
+  /*      query instead of one record per pixel.                          */
+  /* -------------------------------------------------------------------- */
+  if( CSLFetchNameValue( layer->processing, "RASTER_QUERY_MODE" ) != NULL
+      && EQUAL(CSLFetchNameValue( layer->processing, "RASTER_QUERY_MODE" ),
+               "STATISTICS") ) {
+    rlinfo->raster_query_mode = RQM_STATISTICS;
+
+    if( CSLFetchNameValue( layer->processing, "RASTER_QUERY_HISTOGRAM_BINS" )
+        != NULL )
+      rlinfo->st_hist_bins = MAX(0, atoi(CSLFetchNameValue( layer->processing,
+                                         "RASTER_QUERY_HISTOGRAM_BINS" )));
+  }
 }
 
 /************************************************************************/
@@ -398,6 +452,388 @@ static void msRasterQueryAddPixel( layerObj *layer, pointObj *location,
   }
 }
 
+/************************************************************************/
+/*                   msRasterQueryStatisticsInitialize()                */
+/*                                                                      */
+/*      Allocate the accumulators on the first file of a statistics     */
+/*      query.  The histogram range is RASTER_QUERY_HISTOGRAM_RANGE     */
+/*      ("min,max") if set, 0 to 256 for byte bands and the (approx)    */
+/*      range of the band otherwise.                                    */
+/************************************************************************/
+
+static void msRasterQueryStatisticsInitialize( layerObj *layer,
+    GDALDatasetH hDS,
+    int *panBandMap )
+
+{
+  rasterLayerInfo *rlinfo = (rasterLayerInfo *) layer->layerinfo;
+  int iBand;
+
+  if( rlinfo->st_count != NULL )
+    return;
+
+  rlinfo->st_count = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_min = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_max = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_sum = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_sum2 = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+
+  if( rlinfo->st_hist_bins == 0 )
+    return;
+
+  rlinfo->st_hist_min = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_hist_max = (double *) msSmallCalloc(sizeof(double), rlinfo->band_count);
+  rlinfo->st_hist = (double *)
+                    msSmallCalloc(sizeof(double), rlinfo->band_count * rlinfo->st_hist_bins);
+
+  for( iBand = 0; iBand < rlinfo->band_count; iBand++ ) {
+    GDALRasterBandH hBand = GDALGetRasterBand( hDS, panBandMap[iBand] );
+    const char *range = CSLFetchNameValue( layer->processing,
+                                           "RASTER_QUERY_HISTOGRAM_RANGE" );
+
+    if( range != NULL && strchr(range, ',') != NULL ) {
+      rlinfo->st_hist_min[iBand] = atof(range);
+      rlinfo->st_hist_max[iBand] = atof(strchr(range, ',') + 1);
+    } else if( GDALGetRasterDataType( hBand ) == GDT_Byte ) {
+      rlinfo->st_hist_min[iBand] = 0.0;
+      rlinfo->st_hist_max[iBand] = 256.0;
+    } else {
+      double adfMinMax[2];
+
+      GDALComputeRasterMinMax( hBand, TRUE, adfMinMax );
+      rlinfo->st_hist_min[iBand] = adfMinMax[0];
+      rlinfo->st_hist_max[iBand] = adfMinMax[1];
+    }
+  }
+}
+
+/************************************************************************/
+/*                   msRasterQueryStatisticsAccumulate()                */
+/*                                                                      */
+/*      Add one line of values of a band to its accumulators.  Values   */
+/*      outside the mask (if any), nodata and NaN values are skipped.   */
+/************************************************************************/
+
+static void msRasterQueryStatisticsAccumulate( rasterLayerInfo *rlinfo,
+    int iBand,
+    const float *pafValues,
+    const unsigned char *pabyMask,
+    int nValues,
+    int bHasNoData, float fNoData )
+
+{
+  double dfCount = 0.0, dfSum = 0.0, dfSum2 = 0.0;
+  float fMin = 0.0, fMax = 0.0;
+  int i;
+
+  for( i = 0; i < nValues; i++ ) {
+    float fValue = pafValues[i];
+
+    if( (pabyMask != NULL && !pabyMask[i])
+        || fValue != fValue
+        || (bHasNoData && fValue == fNoData) )
+      continue;
+
+    if( dfCount == 0.0 )
+      fMin = fMax = fValue;
+    else if( fValue < fMin )
+      fMin = fValue;
+    else if( fValue > fMax )
+      fMax = fValue;
+
+    dfCount += 1.0;
+    dfSum += fValue;
+    dfSum2 += (double) fValue * fValue;
+  }
+
+  if( dfCount == 0.0 )
+    return;
+
+  if( rlinfo->st_count[iBand] == 0.0 || fMin < rlinfo->st_min[iBand] )
+    rlinfo->st_min[iBand] = fMin;
+  if( rlinfo->st_count[iBand] == 0.0 || fMax > rlinfo->st_max[iBand] )
+    rlinfo->st_max[iBand] = fMax;
+  rlinfo->st_count[iBand] += dfCount;
+  rlinfo->st_sum[iBand] += dfSum;
+  rlinfo->st_sum2[iBand] += dfSum2;
+
+  /* -------------------------------------------------------------------- */
+  /*      Histogram, values outside of the range are not counted.         */
+  /* -------------------------------------------------------------------- */
+  if( rlinfo->st_hist != NULL
+      && rlinfo->st_hist_max[iBand] > rlinfo->st_hist_min[iBand] ) {
+    double *padfHist = rlinfo->st_hist + iBand * rlinfo->st_hist_bins;
+    double dfMin = rlinfo->st_hist_min[iBand];
+    double dfScale = rlinfo->st_hist_bins
+                     / (rlinfo->st_hist_max[iBand] - dfMin);
+
+    for( i = 0; i < nValues; i++ ) {
+      float fValue = pafValues[i];
+      int iBin;
+
+      if( (pabyMask != NULL && !pabyMask[i])
+          || fValue != fValue
+          || (bHasNoData && fValue == fNoData) )
+        continue;
+
+      iBin = (int) floor((fValue - dfMin) * dfScale);
+      if( iBin == rlinfo->st_hist_bins && fValue == rlinfo->st_hist_max[iBand] )
+        iBin--; /* the maximum goes in the last bin */
+      if( iBin >= 0 && iBin < rlinfo->st_hist_bins )
+        padfHist[iBin] += 1.0;
+    }
+  }
+}
+
+/************************************************************************/
+/*                       msRasterQueryScanline()                        */
+/*                                                                      */
+/*      Set pabyMask[i] for the pixels of a line whose center is        */
+/*      inside the polygon (even-odd rule, as msIntersectPointPolygon). */
+/*      The polygon is in pixel/line coordinates of the file, dfY is    */
+/*      the line of the pixel centers and dfXOff the file column of     */
+/*      the first pixel of the mask.                                    */
+/************************************************************************/
+
+static int msRasterQueryCompareDouble( const void *a, const void *b )
+{
+  double da = *((const double *) a), db = *((const double *) b);
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static void msRasterQueryScanline( shapeObj *psPolygon, double dfY,
+                                   double dfXOff, int nXSize,
+                                   double *padfCrossings,
+                                   unsigned char *pabyMask )
+
+{
+  int i, j, nCrossings = 0;
+
+  memset( pabyMask, 0, nXSize );
+
+  for( i = 0; i < psPolygon->numlines; i++ ) {
+    lineObj *line = psPolygon->line + i;
+
+    for( j = 0; j < line->numpoints; j++ ) {
+      pointObj *p1 = line->point + j;
+      pointObj *p2 = line->point + (j+1) % line->numpoints;
+
+      if( (p1->y <= dfY && p2->y > dfY) || (p2->y <= dfY && p1->y > dfY) )
+        padfCrossings[nCrossings++] =
+          p1->x + (dfY - p1->y) * (p2->x - p1->x) / (p2->y - p1->y);
+    }
+  }
+
+  qsort( padfCrossings, nCrossings, sizeof(double), msRasterQueryCompareDouble );
+
+  for( i = 0; i + 1 < nCrossings; i += 2 ) {
+    int nStart = (int) ceil(padfCrossings[i] - 0.5 - dfXOff);
+    int nEnd = (int) ceil(padfCrossings[i+1] - 0.5 - dfXOff);
+
+    nStart = MAX(0, nStart);
+    nEnd = MIN(nXSize, nEnd);
+    if( nEnd > nStart )
+      memset( pabyMask + nStart, 1, nEnd - nStart );
+  }
+}
+
+/************************************************************************/
+/*                     msRasterQueryStatisticsLow()                     */
+/*                                                                      */
+/*      Accumulate statistics over the pixels of the window that are    */
+/*      in the query, reading it a strip of lines at a time.  Plain     */
+/*      rectangle queries take every pixel, polygon queries use a       */
+/*      scanline mask and the other cases (points, lines, tolerances)   */
+/*      test each pixel as msRasterQueryByRectLow() does.               */
+/************************************************************************/
+
+static int
+msRasterQueryStatisticsLow( mapObj *map, layerObj *layer, GDALDatasetH hDS,
+                            int nWinXOff, int nWinYOff,
+                            int nWinXSize, int nWinYSize,
+                            int *panBandMap, int nBandCount,
+                            double *adfGeoTransform,
+                            double *adfInvGeoTransform,
+                            double dfAdjustedRange, int needReproject )
+
+{
+  rasterLayerInfo *rlinfo = (rasterLayerInfo *) layer->layerinfo;
+  float       *pafRaster;
+  float       *pafNoData;
+  int         *pabHasNoData;
+  unsigned char *pabyMask = NULL;
+  double      *padfCrossings = NULL;
+  shapeObj    sPolygon;
+  int         bScanline = MS_FALSE;
+  int         nBlockXSize, nBlockYSize, nStripLines, iStrip, iBand, i, j;
+  int         status = MS_SUCCESS;
+
+  msRasterQueryStatisticsInitialize( layer, hDS, panBandMap );
+
+  if( nWinXSize <= 0 || nWinYSize <= 0 )
+    return MS_SUCCESS;
+
+  /* -------------------------------------------------------------------- */
+  /*      Nodata values of the bands.                                     */
+  /* -------------------------------------------------------------------- */
+  pafNoData = (float *) msSmallCalloc(sizeof(float), nBandCount);
+  pabHasNoData = (int *) msSmallCalloc(sizeof(int), nBandCount);
+  for( iBand = 0; iBand < nBandCount; iBand++ ) {
+    pafNoData[iBand] = (float)
+                       GDALGetRasterNoDataValue( GDALGetRasterBand( hDS, panBandMap[iBand] ),
+                           pabHasNoData + iBand );
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Polygon searches: bring the polygon into pixel/line space.      */
+  /* -------------------------------------------------------------------- */
+  msInitShape( &sPolygon );
+  if( rlinfo->searchshape != NULL || rlinfo->range_mode >= 0 )
+    pabyMask = (unsigned char *) msSmallMalloc(nWinXSize);
+
+  if( rlinfo->searchshape != NULL && rlinfo->shape_tolerance == 0.0
+      && rlinfo->searchshape->type == MS_SHAPE_POLYGON
+      && rlinfo->range_mode < 0 ) {
+    int nPoints = 0;
+
+    bScanline = MS_TRUE;
+    msCopyShape( rlinfo->searchshape, &sPolygon );
+#ifdef USE_PROJ
+    if( needReproject )
+      msProjectShape( &(map->projection), &(layer->projection), &sPolygon );
+#endif
+    for( i = 0; i < sPolygon.numlines; i++ ) {
+      for( j = 0; j < sPolygon.line[i].numpoints; j++ ) {
+        pointObj *point = sPolygon.line[i].point + j;
+        double x = point->x, y = point->y;
+
+        point->x = GEO_TRANS(adfInvGeoTransform, x, y);
+        point->y = GEO_TRANS(adfInvGeoTransform+3, x, y);
+      }
+      nPoints += sPolygon.line[i].numpoints;
+    }
+    padfCrossings = (double *) msSmallMalloc(sizeof(double) * MAX(nPoints,1));
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Read the window by strips of whole blocks.                      */
+  /* -------------------------------------------------------------------- */
+  GDALGetBlockSize( GDALGetRasterBand( hDS, panBandMap[0] ),
+                    &nBlockXSize, &nBlockYSize );
+  nStripLines = MAX(1, RQM_STATISTICS_STRIP_SIZE / (nWinXSize * nBandCount));
+  if( nBlockYSize > 1 )
+    nStripLines = MAX(1, nStripLines / nBlockYSize) * nBlockYSize;
+  nStripLines = MIN(nStripLines, nWinYSize);
+
+  pafRaster = (float *) malloc(sizeof(float) * nWinXSize * nStripLines * nBandCount);
+  if( pafRaster == NULL ) {
+    msSetError( MS_MEMERR, "Out of memory allocating %d lines.",
+                "msRasterQueryStatisticsLow()", nStripLines );
+    status = MS_FAILURE;
+  }
+
+  for( iStrip = 0; iStrip < nWinYSize && status == MS_SUCCESS; iStrip += nStripLines ) {
+    int nLines = MIN(nStripLines, nWinYSize - iStrip);
+    int iLine;
+
+    if( GDALDatasetRasterIO( hDS, GF_Read,
+                             nWinXOff, nWinYOff + iStrip, nWinXSize, nLines,
+                             pafRaster, nWinXSize, nLines, GDT_Float32,
+                             nBandCount, panBandMap,
+                             4, 4 * nWinXSize, 4 * nWinXSize * nLines ) != CE_None ) {
+      msSetError( MS_IOERR, "GDALDatasetRasterIO() failed: %s",
+                  "msRasterQueryStatisticsLow()", CPLGetLastErrorMsg() );
+      status = MS_FAILURE;
+      break;
+    }
+
+    for( iLine = iStrip; iLine < iStrip + nLines; iLine++ ) {
+
+      /* -------------------------------------------------------------------- */
+      /*      Which pixels of the line are in the query?                      */
+      /* -------------------------------------------------------------------- */
+      if( bScanline ) {
+        msRasterQueryScanline( &sPolygon, nWinYOff + iLine + 0.5, nWinXOff,
+                               nWinXSize, padfCrossings, pabyMask );
+      } else if( pabyMask != NULL ) {
+        int iPixel;
+
+        for( iPixel = 0; iPixel < nWinXSize; iPixel++ ) {
+          pointObj  sPixelLocation;
+
+          pabyMask[iPixel] = 0;
+
+          sPixelLocation.x =
+            GEO_TRANS(adfGeoTransform,
+                      iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
+          sPixelLocation.y =
+            GEO_TRANS(adfGeoTransform+3,
+                      iPixel + nWinXOff + 0.5, iLine + nWinYOff + 0.5 );
+
+          if( needReproject )
+            msProjectPoint( &(layer->projection), &(map->projection),
+                            &sPixelLocation);
+
+          if( rlinfo->searchshape != NULL ) {
+            if( rlinfo->shape_tolerance == 0.0
+                && rlinfo->searchshape->type == MS_SHAPE_POLYGON ) {
+              if( msIntersectPointPolygon(
+                    &sPixelLocation, rlinfo->searchshape ) == MS_FALSE )
+                continue;
+            } else {
+              shapeObj  tempShape;
+              lineObj   tempLine;
+
+              memset( &tempShape, 0, sizeof(shapeObj) );
+              tempShape.type = MS_SHAPE_POINT;
+              tempShape.numlines = 1;
+              tempShape.line = &tempLine;
+              tempLine.numpoints = 1;
+              tempLine.point = &sPixelLocation;
+
+              if( msDistanceShapeToShape(rlinfo->searchshape, &tempShape)
+                  > rlinfo->shape_tolerance )
+                continue;
+            }
+          }
+
+          if( rlinfo->range_mode >= 0 ) {
+            double dist;
+
+            dist = (rlinfo->target_point.x - sPixelLocation.x)
+                   * (rlinfo->target_point.x - sPixelLocation.x)
+                   + (rlinfo->target_point.y - sPixelLocation.y)
+                   * (rlinfo->target_point.y - sPixelLocation.y);
+
+            if( dist >= dfAdjustedRange )
+              continue;
+          }
+
+          pabyMask[iPixel] = 1;
+        }
+      }
+
+      for( iBand = 0; iBand < nBandCount; iBand++ )
+        msRasterQueryStatisticsAccumulate(
+          rlinfo, iBand,
+          pafRaster + ((size_t) iBand * nLines + (iLine - iStrip)) * nWinXSize,
+          pabyMask, nWinXSize, pabHasNoData[iBand], pafNoData[iBand] );
+    }
+  }
+
+  /* -------------------------------------------------------------------- */
+  /*      Cleanup.                                                        */
+  /* -------------------------------------------------------------------- */
+  msFree( pafRaster );
+  msFree( pafNoData );
+  msFree( pabHasNoData );
+  msFree( pabyMask );
+  msFree( padfCrossings );
+  msFreeShape( &sPolygon );
+
+  return status;
+}
+
 /************************************************************************/
 /*                       msRasterQueryByRectLow()                       */
 /************************************************************************/
@@ -509,6 +945,41 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
     return -1;
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      When computing whether pixels are within range we do it         */
+  /*      based on the center of the pixel to the target point but        */
+  /*      really it ought to be the nearest point on the pixel.  It       */
+  /*      would be too much trouble to do this rigerously, so we just     */
+  /*      add a fudge factor so that a range of zero will find the        */
+  /*      pixel the target falls in at least.                             */
+  /* -------------------------------------------------------------------- */
+  dfAdjustedRange =
+    sqrt(adfGeoTransform[1] * adfGeoTransform[1]
+         + adfGeoTransform[2] * adfGeoTransform[2]
+         + adfGeoTransform[4] * adfGeoTransform[4]
+         + adfGeoTransform[5] * adfGeoTransform[5]) * 0.5 * 1.41421356237
+    + sqrt( rlinfo->range_dist );
+  dfAdjustedRange = dfAdjustedRange * dfAdjustedRange;
+
+  /* -------------------------------------------------------------------- */
+  /*      Statistics are accumulated as the window is read.               */
+  /* -------------------------------------------------------------------- */
+  if( rlinfo->raster_query_mode == RQM_STATISTICS ) {
+    int status;
+
+    if( rlinfo->st_count == NULL )
+      rlinfo->st_rect = searchrect;
+
+    status = msRasterQueryStatisticsLow( map, layer, hDS,
+                                         nWinXOff, nWinYOff,
+                                         nWinXSize, nWinYSize,
+                                         panBandMap, nBandCount,
+                                         adfGeoTransform, adfInvGeoTransform,
+                                         dfAdjustedRange, needReproject );
+    free( panBandMap );
+    return status;
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Try to load the raster data.  For now we just load the first    */
   /*      band in the file.  Later we will deal with the various band     */
@@ -542,22 +1013,6 @@ msRasterQueryByRectLow(mapObj *map, layerObj *layer, GDALDatasetH hDS,
 
   free( panBandMap );
 
-  /* -------------------------------------------------------------------- */
-  /*      When computing whether pixels are within range we do it         */
-  /*      based on the center of the pixel to the target point but        */
-  /*      really it ought to be the nearest point on the pixel.  It       */
-  /*      would be too much trouble to do this rigerously, so we just     */
-  /*      add a fudge factor so that a range of zero will find the        */
-  /*      pixel the target falls in at least.                             */
-  /* -------------------------------------------------------------------- */
-  dfAdjustedRange =
-    sqrt(adfGeoTransform[1] * adfGeoTransform[1]
-         + adfGeoTransform[2] * adfGeoTransform[2]
-         + adfGeoTransform[4] * adfGeoTransform[4]
-         + adfGeoTransform[5] * adfGeoTransform[5]) * 0.5 * 1.41421356237
-    + sqrt( rlinfo->range_dist );
-  dfAdjustedRange = dfAdjustedRange * dfAdjustedRange;
-
   /* -------------------------------------------------------------------- */
   /*      Loop over all pixels determining which are "in".                */
   /* -------------------------------------------------------------------- */
@@ -678,6 +1133,11 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
   msRasterLayerInfoInitialize( layer );
   rlinfo = (rasterLayerInfo *) layer->layerinfo;
 
+  if( rlinfo->raster_query_mode == RQM_STATISTICS ) {
+    msRasterQueryStatisticsFree( rlinfo );
+    rlinfo->query_results = 0;
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Clear old results cache.                                        */
   /* -------------------------------------------------------------------- */
@@ -835,6 +1295,22 @@ int msRasterQueryByRect(mapObj *map, layerObj *layer, rectObj queryRect)
 
   } /* next tile */
 
+  /* -------------------------------------------------------------------- */
+  /*      In statistics mode the whole query is a single result.          */
+  /* -------------------------------------------------------------------- */
+  if( status != MS_FAILURE && rlinfo->raster_query_mode == RQM_STATISTICS
+      && rlinfo->st_count != NULL ) {
+    int iBand;
+
+    for( iBand = 0; iBand < rlinfo->band_count; iBand++ ) {
+      if( rlinfo->st_count[iBand] > 0 ) {
+        addResult( layer->resultcache, -1, 0, 0 );
+        rlinfo->query_results = 1;
+        break;
+      }
+    }
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Cleanup tileindex if it is open.                                */
   /* -------------------------------------------------------------------- */
@@ -982,7 +1458,8 @@ int msRasterQueryByPoint(mapObj *map, layerObj *layer, int mode, pointObj p,
   /*      point.  This will potentially be must more efficient than       */
   /*      processing all pixels within the tolerance.                     */
   /* -------------------------------------------------------------------- */
-  if( mode == MS_QUERY_SINGLE ) {
+  if( mode == MS_QUERY_SINGLE
+      && rlinfo->raster_query_mode != RQM_STATISTICS ) {
     rectObj pointRect;
 
     pointRect.minx = p.x;
@@ -1188,6 +1665,66 @@ int msRASTERLayerGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
     return MS_FAILURE;
   }
 
+  /* -------------------------------------------------------------------- */
+  /*      Statistics: the query rectangle with one value per item.        */
+  /* -------------------------------------------------------------------- */
+  if( rlinfo->raster_query_mode == RQM_STATISTICS ) {
+    msRectToPolygon( rlinfo->st_rect, shape );
+
+    shape->values = (char **) msSmallCalloc(sizeof(char *), MAX(layer->numitems,1));
+    shape->numvalues = layer->numitems;
+
+    for( i = 0; i < layer->numitems; i++ ) {
+      const char *item = layer->items[i];
+      const char *sep = strrchr(item, '_');
+      int iBand = sep ? atoi(sep+1) : -1;
+      double dfCount, dfMean = 0.0;
+      char szWork[100];
+
+      if( iBand < 0 || iBand >= rlinfo->band_count || rlinfo->st_count == NULL ) {
+        shape->values[i] = msStrdup("");
+        continue;
+      }
+
+      dfCount = rlinfo->st_count[iBand];
+      if( dfCount > 0 )
+        dfMean = rlinfo->st_sum[iBand] / dfCount;
+
+      szWork[0] = '\0';
+      if( EQUALN(item,"count_",6) )
+        snprintf( szWork, sizeof(szWork), "%.0f", dfCount );
+      else if( dfCount == 0 )
+        ; /* no value for empty statistics */
+      else if( EQUALN(item,"min_",4) )
+        snprintf( szWork, sizeof(szWork), "%.8g", rlinfo->st_min[iBand] );
+      else if( EQUALN(item,"max_",4) )
+        snprintf( szWork, sizeof(szWork), "%.8g", rlinfo->st_max[iBand] );
+      else if( EQUALN(item,"mean_",5) )
+        snprintf( szWork, sizeof(szWork), "%.8g", dfMean );
+      else if( EQUALN(item,"stddev_",7) )
+        snprintf( szWork, sizeof(szWork), "%.8g",
+                  sqrt(MAX(0.0, rlinfo->st_sum2[iBand] / dfCount - dfMean * dfMean)) );
+      else if( EQUALN(item,"sum_",4) )
+        snprintf( szWork, sizeof(szWork), "%.8g", rlinfo->st_sum[iBand] );
+      else if( EQUALN(item,"histogram_",10) && rlinfo->st_hist ) {
+        char *pszHist = NULL;
+        int iBin;
+
+        for( iBin = 0; iBin < rlinfo->st_hist_bins; iBin++ ) {
+          snprintf( szWork, sizeof(szWork), iBin ? ",%.0f" : "%.0f",
+                    rlinfo->st_hist[iBand * rlinfo->st_hist_bins + iBin] );
+          pszHist = msStringConcatenate( pszHist, szWork );
+        }
+        shape->values[i] = pszHist ? pszHist : msStrdup("");
+        continue;
+      }
+
+      shape->values[i] = msStrdup(szWork);
+    }
+
+    return MS_SUCCESS;
+  }
+
   /* -------------------------------------------------------------------- */
   /*      Apply the geometry.                                             */
   /* -------------------------------------------------------------------- */
@@ -1284,6 +1821,31 @@ int msRASTERLayerGetItems(layerObj *layer)
   if( rlinfo == NULL )
     return MS_FAILURE;
 
+  /* -------------------------------------------------------------------- */
+  /*      Statistics: count_<band>, min_<band>, ... for every band.       */
+  /* -------------------------------------------------------------------- */
+  if( rlinfo->raster_query_mode == RQM_STATISTICS ) {
+    static const char *apszNames[] = { "count", "min", "max", "mean",
+                                       "stddev", "sum", "histogram"
+                                     };
+    int i, iName;
+
+    layer->items = (char **) msSmallCalloc(sizeof(char *), rlinfo->band_count * 7 + 1);
+    layer->numitems = 0;
+    for( i = 0; i < rlinfo->band_count; i++ ) {
+      for( iName = 0; iName < 7; iName++ ) {
+        char szName[100];
+
+        if( iName == 6 && rlinfo->st_hist_bins == 0 )
+          continue;
+        snprintf( szName, sizeof(szName), "%s_%d", apszNames[iName], i );
+        layer->items[layer->numitems++] = msStrdup(szName);
+      }
+    }
+
+    return msRASTERLayerInitItemInfo(layer);
+  }
+
   layer->items = (char **) msSmallCalloc(sizeof(char *),10);
 
   layer->numitems = 0;
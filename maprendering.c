@@ -29,6 +29,7 @@
 
 #include "mapserver.h"
 #include "mapcopy.h"
+#include "mapthread.h"
 
 int computeLabelStyle(labelStyleObj *s, labelObj *l, fontSetObj *fontset,
                       double scalefactor, double resolutionfactor)
@@ -221,6 +222,181 @@ tileCacheObj *addTileCache(imageObj *img,
   return(cachep);
 }
 
+/*
+** Process wide cache of rendered fill tiles, used as a second level behind the
+** per-image tilecache so that tiles survive from one image (and request, in
+** FastCGI or mapscript) to the next. Entries are keyed on the symbol and style
+** definition instead of the symbolObj pointer, and hold a copy of the tile's
+** pixels. Only symbols whose look is entirely defined by the mapfile (vector,
+** ellipse and truetype) are shared, pixmaps and SVGs can change on disk.
+**
+** The cache is bounded by MS_SHARED_TILECACHE_SIZE bytes (environment
+** variable, defaults to MS_SHARED_TILECACHE_DEFAULT_SIZE, 0 disables it) and
+** evicts the least recently used tiles first.
+*/
+#define MS_SHARED_TILECACHE_DEFAULT_SIZE (8*1024*1024)
+
+typedef struct sharedTileCacheObj {
+  char *key;
+  rasterBufferObj buffer;
+  size_t size;
+  struct sharedTileCacheObj *next;
+} sharedTileCacheObj;
+
+static sharedTileCacheObj *shared_tilecache = NULL; /* most recently used first */
+static size_t shared_tilecache_size = 0;
+static long shared_tilecache_maxsize = -1;
+
+static unsigned int hashBytes(unsigned int hash, const unsigned char *data, size_t len)
+{
+  size_t i;
+  for(i=0; i<len; i++) {
+    hash ^= data[i];
+    hash *= 16777619U; /* FNV-1a */
+  }
+  return hash;
+}
+
+static void appendColorKey(char *key, size_t keysize, colorObj *color)
+{
+  size_t len = strlen(key);
+  if(color)
+    snprintf(key+len, keysize-len, "|%d,%d,%d,%d", color->red, color->green, color->blue, color->alpha);
+  else
+    snprintf(key+len, keysize-len, "|-");
+}
+
+/*
+** Builds the shared cache key for a tile, returns MS_FALSE if the tile
+** cannot be shared.
+*/
+static int buildSharedTileKey(char *key, size_t keysize, imageObj *img, symbolObj *symbol,
+                              symbolStyleObj *s, int width, int height, int seamlessmode)
+{
+  const char *font = "";
+  unsigned int pointhash = 2166136261U;
+
+  if(!img->format->vtable->supports_pixel_buffer)
+    return MS_FALSE;
+
+  switch(symbol->type) {
+    case MS_SYMBOL_VECTOR:
+    case MS_SYMBOL_ELLIPSE:
+      pointhash = hashBytes(pointhash, (unsigned char*)symbol->points, symbol->numpoints*sizeof(pointObj));
+      break;
+    case MS_SYMBOL_TRUETYPE:
+      if(!symbol->full_font_path || !symbol->character)
+        return MS_FALSE;
+      font = symbol->full_font_path;
+      pointhash = hashBytes(pointhash, (unsigned char*)symbol->character, strlen(symbol->character));
+      break;
+    default:
+      return MS_FALSE;
+  }
+
+  snprintf(key, keysize, "%s|%d|%s|%d|%d|%x|%.10g|%.10g|%d|%.10g|%.10g|%d|%d|%d|%s|%d|%.10g|%s|%.10g|%.10g|%.10g",
+           symbol->name ? symbol->name : "", symbol->type, font, symbol->numpoints, symbol->filled, pointhash,
+           symbol->sizex, symbol->sizey, symbol->antialias, symbol->anchorpoint_x, symbol->anchorpoint_y,
+           width, height, seamlessmode,
+           img->format->driver, img->format->imagemode, img->resolution,
+           msGetOutputFormatOption(img->format, "GAMMA", ""),
+           s->scale, s->rotation, s->outlinewidth);
+  appendColorKey(key, keysize, s->color);
+  appendColorKey(key, keysize, s->outlinecolor);
+  appendColorKey(key, keysize, s->backgroundcolor);
+
+  return MS_TRUE;
+}
+
+static void freeSharedTile(sharedTileCacheObj *tile)
+{
+  msFree(tile->key);
+  msFree(tile->buffer.data.rgba.pixels);
+  msFree(tile);
+}
+
+/*
+** Creates a new tile image for key from the shared cache, NULL on a miss.
+*/
+static imageObj *getSharedTile(imageObj *img, const char *key, int width, int height)
+{
+  sharedTileCacheObj *cur, *prev = NULL;
+  imageObj *tileimg = NULL;
+
+  msAcquireLock(TLOCK_TILECACHE);
+  for(cur = shared_tilecache; cur; prev = cur, cur = cur->next) {
+    if(strcmp(cur->key, key) == 0) {
+      /* move to the front of the list */
+      if(prev) {
+        prev->next = cur->next;
+        cur->next = shared_tilecache;
+        shared_tilecache = cur;
+      }
+      tileimg = msImageCreate(width,height,img->format,NULL,NULL,img->resolution, img->resolution, NULL);
+      if(tileimg)
+        img->format->vtable->mergeRasterBuffer(tileimg, &cur->buffer, 1.0, 0, 0, 0, 0, width, height);
+      break;
+    }
+  }
+  msReleaseLock(TLOCK_TILECACHE);
+
+  return tileimg;
+}
+
+static void addSharedTile(imageObj *tileimg, const char *key)
+{
+  rasterBufferObj rb;
+  sharedTileCacheObj *tile, *cur;
+  size_t size;
+
+  if(tileimg->format->vtable->getRasterBufferHandle(tileimg, &rb) != MS_SUCCESS ||
+      rb.type != MS_BUFFER_BYTE_RGBA)
+    return;
+
+  size = rb.data.rgba.row_step * rb.height;
+  if((long)size > shared_tilecache_maxsize)
+    return;
+
+  tile = (sharedTileCacheObj*) msSmallMalloc(sizeof(sharedTileCacheObj));
+  tile->key = msStrdup(key);
+  tile->size = size;
+  tile->buffer = rb;
+  tile->buffer.data.rgba.pixels = (unsigned char*) msSmallMalloc(size);
+  memcpy(tile->buffer.data.rgba.pixels, rb.data.rgba.pixels, size);
+  /* keep the channel layout of the renderer */
+  tile->buffer.data.rgba.r = tile->buffer.data.rgba.pixels + (rb.data.rgba.r - rb.data.rgba.pixels);
+  tile->buffer.data.rgba.g = tile->buffer.data.rgba.pixels + (rb.data.rgba.g - rb.data.rgba.pixels);
+  tile->buffer.data.rgba.b = tile->buffer.data.rgba.pixels + (rb.data.rgba.b - rb.data.rgba.pixels);
+  tile->buffer.data.rgba.a = rb.data.rgba.a ? tile->buffer.data.rgba.pixels + (rb.data.rgba.a - rb.data.rgba.pixels) : NULL;
+
+  msAcquireLock(TLOCK_TILECACHE);
+  tile->next = shared_tilecache;
+  shared_tilecache = tile;
+  shared_tilecache_size += size;
+
+  /* evict from the tail until we fit */
+  while(shared_tilecache_size > (size_t)shared_tilecache_maxsize && shared_tilecache->next) {
+    sharedTileCacheObj *prev = shared_tilecache;
+    for(cur = shared_tilecache->next; cur->next; prev = cur, cur = cur->next) {}
+    prev->next = NULL;
+    shared_tilecache_size -= cur->size;
+    freeSharedTile(cur);
+  }
+  msReleaseLock(TLOCK_TILECACHE);
+}
+
+void msSharedTileCacheCleanup(void)
+{
+  msAcquireLock(TLOCK_TILECACHE);
+  while(shared_tilecache) {
+    sharedTileCacheObj *next = shared_tilecache->next;
+    freeSharedTile(shared_tilecache);
+    shared_tilecache = next;
+  }
+  shared_tilecache_size = 0;
+  msReleaseLock(TLOCK_TILECACHE);
+}
+
 imageObj *getTile(imageObj *img, symbolObj *symbol,  symbolStyleObj *s, int width, int height,
                   int seamlessmode)
 {
@@ -234,6 +410,21 @@ imageObj *getTile(imageObj *img, symbolObj *symbol,  symbolStyleObj *s, int widt
   if(tile==NULL) {
     imageObj *tileimg;
     double p_x,p_y;
+    char sharedkey[MS_MAXPATHLEN*2];
+    int shared = MS_FALSE;
+
+    if(shared_tilecache_maxsize < 0) {
+      const char *maxsize = getenv("MS_SHARED_TILECACHE_SIZE");
+      shared_tilecache_maxsize = maxsize ? atol(maxsize) : MS_SHARED_TILECACHE_DEFAULT_SIZE;
+    }
+    if(shared_tilecache_maxsize > 0)
+      shared = buildSharedTileKey(sharedkey, sizeof(sharedkey), img, symbol, s, width, height, seamlessmode);
+
+    if(shared && (tileimg = getSharedTile(img, sharedkey, width, height)) != NULL) {
+      tile = addTileCache(img,tileimg,symbol,s,width,height);
+      return tile->image;
+    }
+
     tileimg = msImageCreate(width,height,img->format,NULL,NULL,img->resolution, img->resolution, NULL);
     if(!seamlessmode) {
       p_x = width/2.0;
@@ -302,6 +493,8 @@ imageObj *getTile(imageObj *img, symbolObj *symbol,  symbolStyleObj *s, int widt
                                  );
       msFreeImage(tile3img);
     }
+    if(shared)
+      addSharedTile(tileimg, sharedkey);
     tile = addTileCache(img,tileimg,symbol,s,width,height);
   }
   return tile->image;
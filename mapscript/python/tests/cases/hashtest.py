@@ -85,6 +85,29 @@ class HashTableBaseTestCase:
         key = self.table.nextKey(key)
         assert key == None, key
 
+    def testRemoveWhileIterating(self):
+        "iteration goes on from a key removed on the way"
+        seen = []
+        key = self.table.nextKey()
+        while key is not None:
+            seen.append(key)
+            if key == self.keys[1]:
+                self.table.remove(key)
+            key = self.table.nextKey(key)
+        assert seen == self.keys, seen
+        assert self.table.get(self.keys[1]) == None
+
+    def testSetAfterRemove(self):
+        "a removed key can be set again, also past the initial table size"
+        key = self.keys[0]
+        value = self.table.get(key)
+        self.table.remove(key)
+        self.table.set(key, value)
+        for i in range(20):
+            self.table.set('extra%d' % i, 'value%d' % i)
+        assert self.table.get(key) == self.values[0]
+        assert self.table.get('extra19') == 'value19'
+
 # TODO
 #    def testKeys(self):
 #        "get sequence of keys"
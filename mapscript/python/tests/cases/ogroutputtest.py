@@ -0,0 +1,209 @@
+# $Id$
+#
+# Project:  MapServer
+# Purpose:  xUnit style Python mapscript tests of WFS GeoJSON and CSV output
+# Author:   MapServer Team
+#
+# ===========================================================================
+# Copyright (c) 2013, Regents of the University of Minnesota.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+# ===========================================================================
+#
+#
+# Execute this module as a script from mapserver/mapscript/python
+#
+#     python tests/cases/ogroutputtest.py -v
+#
+# ===========================================================================
+
+import os, sys, re
+import csv, json
+import unittest
+from StringIO import StringIO
+
+# the testing module helps us import the pre-installed mapscript
+from testing import mapscript
+from testing import MapTestCase
+
+# ===========================================================================
+# Test begins now
+
+QUOTED_NAME = 'with "quotes", a \\ backslash'
+CONTROL_NAME = 'line\nbreak and\ttab'
+
+class OGROutputTestCase(MapTestCase):
+    """WFS GetFeature output of tests/ogroutput.csv (a polygon, a two part
+    multipolygon and a polygon, with quotes, a backslash, a line break, a
+    tab and empty numbers in the attributes) with the native GeoJSON and
+    CSV writers, and with the OGR drivers (FORMATOPTION "WRITER=OGR")"""
+
+    def setUp(self):
+        MapTestCase.setUp(self)
+        self.layer = mapscript.layerObj(self.map)
+        self.layer.name = 'ogroutput'
+        self.layer.type = mapscript.MS_LAYER_POLYGON
+        self.layer.status = mapscript.MS_ON
+        self.layer.setConnectionType(mapscript.MS_OGR, '')
+        self.layer.connection = 'ogroutput.csv'
+        self.layer.template = 'foo'
+        self.layer.metadata.set('wfs_title', 'ogroutput')
+        # Polygon or MultiPolygon, as each feature has it
+        self.layer.metadata.set('wfs_geomtype', 'Geometry')
+        # the OGR CSV driver also keeps the WKT column as an attribute
+        self.layer.metadata.set('gml_include_items', 'ivalue,rvalue,name')
+        self.layer.metadata.set('gml_ivalue_type', 'Integer')
+        self.layer.metadata.set('gml_rvalue_type', 'Real')
+
+        formats = []
+        for name, driver, mimetype, options in [
+            ('geojson', 'OGR/GEOJSON', 'application/json', []),
+            ('geojson3', 'OGR/GEOJSON', 'application/json',
+             [('LCO:COORDINATE_PRECISION', '3')]),
+            ('csv', 'OGR/CSV', 'text/csv', [('LCO:GEOMETRY', 'AS_WKT')])]:
+            for writer in ['', 'OGR']:
+                format = mapscript.outputFormatObj(driver, name + writer.lower())
+                format.mimetype = mimetype
+                format.setOption('STORAGE', 'stream')
+                format.setOption('FORM', 'simple')
+                for key, value in options:
+                    format.setOption(key, value)
+                if writer:
+                    format.setOption('WRITER', writer)
+                self.map.appendOutputFormat(format)
+                formats.append(name + writer.lower())
+        self.map.web.metadata.set('wfs_getfeature_formatlist', ','.join(formats))
+
+    def tearDown(self):
+        self.layer = None
+        MapTestCase.tearDown(self)
+
+    def getFeature(self, outputformat):
+        request = mapscript.OWSRequest()
+        request.setParameter('SERVICE', 'WFS')
+        request.setParameter('VERSION', '1.0.0')
+        request.setParameter('REQUEST', 'GetFeature')
+        request.setParameter('TYPENAME', 'ogroutput')
+        request.setParameter('OUTPUTFORMAT', outputformat)
+        mapscript.msIO_installStdoutToBuffer()
+        status = self.map.OWSDispatch(request)
+        mapscript.msIO_stripStdoutBufferContentHeaders()
+        result = mapscript.msIO_getStdoutBufferString()
+        mapscript.msIO_resetHandlers()
+        assert status == mapscript.MS_SUCCESS, status
+        return result
+
+    def getGeoJSON(self, outputformat):
+        return json.loads(self.getFeature(outputformat))['features']
+
+    def getCSV(self, outputformat):
+        return list(csv.reader(StringIO(self.getFeature(outputformat))))
+
+    def flatten(self, coordinates):
+        if isinstance(coordinates, (int, float)):
+            return [coordinates]
+        values = []
+        for c in coordinates:
+            values += self.flatten(c)
+        return values
+
+    def wktNumbers(self, wkt):
+        return [float(n) for n in re.findall(r'-?[0-9.]+(?:[eE][-+]?[0-9]+)?', wkt)]
+
+    def assertSameNumbers(self, first, second):
+        assert len(first) == len(second), (first, second)
+        for a, b in zip(first, second):
+            self.assertAlmostEqual(a, b, 12)
+
+    def checkGeoJSON(self, features):
+        assert len(features) == 3, features
+        assert [f['geometry']['type'] for f in features] == \
+            ['Polygon', 'MultiPolygon', 'Polygon'], features
+        assert len(features[1]['geometry']['coordinates']) == 2
+        assert features[0]['properties'] == \
+            {'ivalue': 1, 'rvalue': 0.25, 'name': 'plain'}, features[0]
+        # empty numbers are null, not 0 or ""
+        assert features[1]['properties'] == \
+            {'ivalue': None, 'rvalue': None, 'name': QUOTED_NAME}, features[1]
+        assert features[2]['properties'] == \
+            {'ivalue': 3, 'rvalue': -1.5, 'name': CONTROL_NAME}, features[2]
+
+    def checkCSV(self, rows):
+        assert len(rows) == 4, rows
+        assert rows[0] == ['WKT', 'ivalue', 'rvalue', 'name'], rows[0]
+        assert [r[0].split(' ')[0] for r in rows[1:]] == \
+            ['POLYGON', 'MULTIPOLYGON', 'POLYGON'], rows
+        assert rows[1][1:] == ['1', '0.25', 'plain'], rows[1]
+        # empty numbers are empty fields
+        assert rows[2][1:] == ['', '', QUOTED_NAME], rows[2]
+        assert rows[3][1:] == ['3', '-1.5', CONTROL_NAME], rows[3]
+
+    def testGeoJSON(self):
+        """native GeoJSON escapes strings, writes empty numbers as null and keeps multi geometries"""
+        features = self.getGeoJSON('geojson')
+        self.checkGeoJSON(features)
+        self.assertSameNumbers(self.flatten(features[0]['geometry']['coordinates'])[:2],
+                               [0.1234567, 51.2])
+
+    def testGeoJSONOGR(self):
+        """OGR GeoJSON writes the same features as the native writer"""
+        features = self.getGeoJSON('geojsonogr')
+        self.checkGeoJSON(features)
+        native = self.getGeoJSON('geojson')
+        for f, n in zip(features, native):
+            assert f['properties'] == n['properties'], (f, n)
+            assert f['geometry']['type'] == n['geometry']['type'], (f, n)
+            self.assertSameNumbers(self.flatten(f['geometry']['coordinates']),
+                                   self.flatten(n['geometry']['coordinates']))
+
+    def testGeoJSONPrecision(self):
+        """native GeoJSON honours LCO:COORDINATE_PRECISION as OGR does"""
+        for outputformat in ['geojson3', 'geojson3ogr']:
+            text = self.getFeature(outputformat)
+            features = json.loads(text)['features']
+            self.checkGeoJSON(features)
+            self.assertSameNumbers(self.flatten(features[0]['geometry']['coordinates'])[:2],
+                                   [0.123, 51.2])
+            # no coordinate has more than 3 decimals
+            coordinates = text[text.index('"coordinates"'):]
+            assert re.search(r'[0-9]\.[0-9]{4}', coordinates) is None, coordinates
+        self.assertEqual(self.getGeoJSON('geojson3'), self.getGeoJSON('geojson3ogr'))
+
+    def testCSV(self):
+        """native CSV quotes strings as needed, leaves empty numbers empty and keeps multi geometries"""
+        rows = self.getCSV('csv')
+        self.checkCSV(rows)
+        self.assertSameNumbers(self.wktNumbers(rows[1][0])[:2], [0.1234567, 51.2])
+
+    def testCSVOGR(self):
+        """OGR CSV writes the same rows as the native writer"""
+        rows = self.getCSV('csvogr')
+        self.checkCSV(rows)
+        native = self.getCSV('csv')
+        for r, n in zip(rows, native):
+            assert r[1:] == n[1:], (r, n)
+            assert r[0].split(' ')[0] == n[0].split(' ')[0], (r, n)
+            self.assertSameNumbers(self.wktNumbers(r[0]), self.wktNumbers(n[0]))
+
+# ===========================================================================
+# Run the tests outside of the main suite
+
+if __name__ == '__main__':
+    unittest.main()
+
@@ -0,0 +1,90 @@
+# $Id$
+#
+# Project:  MapServer
+# Purpose:  xUnit style Python mapscript tests of OGR layers
+# Author:   MapServer Team
+#
+# ===========================================================================
+# Copyright (c) 2013, Regents of the University of Minnesota.
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included
+# in all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+# OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+# ===========================================================================
+#
+#
+# Execute this module as a script from mapserver/mapscript/python
+#
+#     python tests/cases/ogrtest.py -v
+#
+# ===========================================================================
+
+import os, sys
+import unittest
+
+# the testing module helps us import the pre-installed mapscript
+from testing import mapscript
+from testing import MapTestCase
+
+# ===========================================================================
+# Test begins now
+
+class OGRFilterTestCase(MapTestCase):
+    """FILTERs given to OGR as an attribute filter select the same features
+    as msEvalExpression() (tests/ogrvalues.csv)"""
+
+    def setUp(self):
+        MapTestCase.setUp(self)
+        self.layer = mapscript.layerObj(self.map)
+        self.layer.name = 'ogrvalues'
+        self.layer.type = mapscript.MS_LAYER_POINT
+        self.layer.status = mapscript.MS_ON
+        self.layer.setConnectionType(mapscript.MS_OGR, '')
+        self.layer.connection = 'ogrvalues.csv'
+        self.layer.template = 'foo'
+
+    def tearDown(self):
+        self.layer = None
+        MapTestCase.tearDown(self)
+
+    def getCount(self, expression):
+        self.layer.setFilter(expression)
+        self.layer.queryByRect(self.map, mapscript.rectObj(-1.0, 50.0, 1.0, 52.0))
+        return self.layer.getNumResults()
+
+    def testIntegerEquality(self):
+        assert self.getCount('([ivalue] = 2)') == 1
+
+    def testIntegerRange(self):
+        assert self.getCount('([ivalue] > 1 AND [ivalue] <= 3)') == 2
+
+    def testRealEquality(self):
+        # 0.30000000000000004 reads as 0.3, and so matches in MapServer
+        assert self.getCount('([rvalue] = 0.3)') == 2
+
+    def testRealRange(self):
+        assert self.getCount('([rvalue] <= 0.3)') == 2
+
+    def testStringEquality(self):
+        assert self.getCount('("[name]" = "plain")') == 1
+
+# ===========================================================================
+# Run the tests outside of the main suite
+
+if __name__ == '__main__':
+    unittest.main()
+    
@@ -32,10 +32,12 @@
 #
 # ===========================================================================
 
+import os, shutil, tempfile, time
 import unittest
 
 # the testing module helps us import the pre-installed mapscript
 from testing import mapscript
+from testing import TESTS_PATH
 
 class AddShapeTestCase(unittest.TestCase):
 
@@ -54,6 +56,58 @@ class AddShapeTestCase(unittest.TestCase):
 	assert sf.getDBF().getFieldName(0) == 'FID', sf.getDBF().getFieldName(0)
 	assert sf.getDBF().getFieldName(1) == 'FNAME', sf.getDBF().getFieldName(1)
     
+
+class TileHandleCacheTestCase(unittest.TestCase):
+
+    def setUp(self):
+        # tileindex.shp has a single tile, 'tiletest', found in the shapepath
+        self.tmpdir = tempfile.mkdtemp()
+        for ext in ('shp', 'shx', 'dbf'):
+            shutil.copy(os.path.join(TESTS_PATH, 'polygon.' + ext),
+                        os.path.join(self.tmpdir, 'tiletest.' + ext))
+        self.map = mapscript.mapObj()
+        self.map.setConfigOption('MS_SHAPEFILE_HANDLE_CACHE', '4')
+        self.map.shapepath = self.tmpdir + os.sep
+        self.layer = mapscript.layerObj(self.map)
+        self.layer.type = mapscript.MS_LAYER_POLYGON
+        self.layer.status = mapscript.MS_ON
+        self.layer.tileindex = os.path.abspath(os.path.join(TESTS_PATH, 'tileindex.shp'))
+        self.layer.tileitem = 'LOCATION'
+
+    def tearDown(self):
+        self.map = None
+        self.layer = None
+        shutil.rmtree(self.tmpdir)
+
+    def readName(self, replace=False):
+        self.layer.open()
+        self.layer.whichShapes(mapscript.rectObj(-1.0, 50.0, 1.0, 53.0))
+        if replace:
+            self.replaceDBF()
+        shape = self.layer.nextShape()
+        self.layer.close()
+        return shape.getValue(1)
+
+    def replaceDBF(self):
+        # replace only the .dbf, keeping its size, the .shp is untouched
+        dbf = os.path.join(self.tmpdir, 'tiletest.dbf')
+        data = open(dbf, 'rb').read().replace('A Polygon', 'B Polygon')
+        open(dbf + '.new', 'wb').write(data)
+        os.rename(dbf + '.new', dbf)
+        later = time.time() + 10
+        os.utime(dbf, (later, later))
+
+    def testReplacedDBF(self):
+        """a cached tile handle is not reused once its .dbf was replaced"""
+        assert self.readName() == 'A Polygon'
+        self.replaceDBF()
+        assert self.readName() == 'B Polygon'
+
+    def testReplacedWhileOpen(self):
+        """a tile replaced while its handle is open is not cached as the new one"""
+        assert self.readName(replace=True) == 'A Polygon'
+        assert self.readName() == 'B Polygon'
+
     
 if __name__ == '__main__':
     unittest.main()
@@ -151,6 +151,9 @@ int main(int argc, char *argv[])
     exit(0);
   }
 
+  /* the response goes to stdout once, renderers may stream it */
+  msIO_setStdoutStreaming(MS_TRUE);
+
   if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_TUNING)
     msGettimeofday(&execstarttime, NULL);
 
@@ -1757,6 +1757,9 @@ extern "C" {
     unsigned char encryption_key[MS_ENCRYPTION_KEY_SIZE]; /* 128bits encryption key */
 
     queryObj query;
+
+    char *mapfile; /* absolute path of the file the map was loaded from, if any */
+    long mapfile_mtime; /* its modification time at load, identifies cached responses */
 #endif
   };
 
@@ -1946,6 +1949,43 @@ extern "C" {
   MS_DLL_EXPORT int msCheckConnection(layerObj * layer); /* connection pooling functions (mapfile.c) */
   MS_DLL_EXPORT void msCloseConnections(mapObj *map);
 
+  /* mapbatch.c */
+  MS_DLL_EXPORT imageObj **msDrawMapBatch(mapObj *map, rectObj *extents, int numextents, int numworkers);
+
+  /* mapoccupancy.c */
+  MS_DLL_EXPORT char *msLayerGetOccupancyFile(mapObj *map, layerObj *layer, char *path);
+  MS_DLL_EXPORT int msLayerBuildOccupancy(mapObj *map, layerObj *layer, int levels);
+  MS_DLL_EXPORT int msLayerIsOccupied(mapObj *map, layerObj *layer);
+  MS_DLL_EXPORT void msOccupancyCacheCleanup(void);
+
+  /* mapsnapshot.c */
+
+#define MS_SNAPSHOT_EXTENSION ".snapshot"
+
+  MS_DLL_EXPORT char *msGetMapSnapshotFilename(const char *mapfile);
+  MS_DLL_EXPORT int msSaveMapSnapshot(mapObj *map, char *mapfile, char *snapshotfile);
+  MS_DLL_EXPORT mapObj *msLoadMapSnapshot(char *snapshotfile, char *new_mappath);
+  MS_DLL_EXPORT mapObj *msLoadMapSnapshotIfFresh(char *mapfile, char *new_mappath);
+
+  /* maptrace.c */
+
+#ifndef SWIG
+  typedef struct {
+    const char *name; /* stage, e.g. "layer.draw" */
+    const char *layer; /* layer name or NULL */
+    double start; /* in microseconds, see msTraceNow() */
+    int active;
+  } traceSpanObj;
+
+  MS_DLL_EXPORT int msTraceSetFile(const char *pszTraceFile, const char *pszRelToPath);
+  MS_DLL_EXPORT void msTraceClose(void);
+  MS_DLL_EXPORT int msTraceIsEnabled(void);
+  MS_DLL_EXPORT double msTraceNow(void);
+  MS_DLL_EXPORT void msTraceStart(traceSpanObj *span, const char *name, const char *layer);
+  MS_DLL_EXPORT void msTraceEnd(traceSpanObj *span, long features, long bytes);
+  MS_DLL_EXPORT void msTraceEndAggregate(traceSpanObj *span, double duration, long features, long bytes);
+#endif
+
   MS_DLL_EXPORT void msOGRInitialize(void);
   MS_DLL_EXPORT void msOGRCleanup(void);
   MS_DLL_EXPORT void msGDALCleanup(void);
@@ -2229,6 +2269,17 @@ extern "C" {
   MS_DLL_EXPORT int msLayerSupportsCommonFilters(layerObj *layer);
   MS_DLL_EXPORT int msTokenizeExpression(expressionObj *expression, char **list, int *listsize);
 
+  /* item types and dialect for msExpressionToSQL() */
+  enum MS_SQL_ITEM_TYPE_ENUM { MS_SQL_ITEM_UNKNOWN, MS_SQL_ITEM_NUMBER, MS_SQL_ITEM_STRING };
+  typedef struct {
+    char identifier_open; /* identifier quotes, '"' or '[' */
+    char identifier_close;
+    int (*itemtype)(layerObj *layer, const char *item, void *data); /* one of MS_SQL_ITEM_* */
+    void *data; /* passed to itemtype */
+  } sqlDialectObj;
+  MS_DLL_EXPORT char *msExpressionToSQL(layerObj *layer, expressionObj *expression, const char *item, sqlDialectObj *dialect);
+  MS_DLL_EXPORT char *msLayerClassesToSQL(layerObj *layer, sqlDialectObj *dialect);
+
   MS_DLL_EXPORT int msLayerSetTimeFilter(layerObj *lp, const char *timestring,
                                          const char *timefield);
   /* Helper functions for layers */
@@ -2277,6 +2328,8 @@ extern "C" {
   MS_DLL_EXPORT int msINLINELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msSHPLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msTiledSHPLayerInitializeVirtualTable(layerObj *layer);
+  MS_DLL_EXPORT void msTiledSHPHandleCacheCleanup(void);
+  MS_DLL_EXPORT void msShapefileBoundsCacheCleanup(void);
   MS_DLL_EXPORT int msSDELayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msOGRLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msPostGISLayerInitializeVirtualTable(layerObj *layer);
@@ -2286,6 +2339,7 @@ extern "C" {
   MS_DLL_EXPORT int msRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUVRASTERLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msContourLayerInitializeVirtualTable(layerObj *layer);  
+  MS_DLL_EXPORT void msContourCacheCleanup(void);
   MS_DLL_EXPORT int msPluginLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT int msUnionLayerInitializeVirtualTable(layerObj *layer);
   MS_DLL_EXPORT void msPluginFreeVirtualTableFactory(void);
@@ -2388,6 +2442,10 @@ extern "C" {
   MS_DLL_EXPORT int msJoinPrepare(joinObj *join, shapeObj *shape);
   MS_DLL_EXPORT int msJoinNext(joinObj *join);
   MS_DLL_EXPORT int msJoinClose(joinObj *join);
+  MS_DLL_EXPORT void msJoinIndexCleanup(void);
+
+  /* template file cache (in maptemplate.c) */
+  MS_DLL_EXPORT void msTemplateCacheCleanup(void);
 
   /*in mapraster.c */
   MS_DLL_EXPORT int msDrawRasterLayerLow(mapObj *map, layerObj *layer, imageObj *image, rasterBufferObj *rb );
@@ -2539,6 +2597,9 @@ extern "C" {
   /*      prototypes for functions in mapgdal.c                           */
   /* ==================================================================== */
   MS_DLL_EXPORT int msSaveImageGDAL( mapObj *map, imageObj *image, char *filename );
+  MS_DLL_EXPORT int msGetRasterWindowLinesGDAL( mapObj *map, layerObj *layer );
+  MS_DLL_EXPORT int msSaveRasterLayerGDAL( mapObj *map, layerObj *layer, char *filename,
+      int nWindowLines );
   MS_DLL_EXPORT int msInitDefaultGDALOutputFormat( outputFormatObj *format );
 
   /* ==================================================================== */
@@ -2592,6 +2653,10 @@ extern "C" {
                                          void (*close)( void * ) );
   MS_DLL_EXPORT void msConnPoolCloseUnreferenced( void );
   MS_DLL_EXPORT void msConnPoolFinalCleanup( void );
+  MS_DLL_EXPORT char *msConnPoolGetMetadata( layerObj *layer, const char *source,
+      const char *name );
+  MS_DLL_EXPORT void msConnPoolSetMetadata( layerObj *layer, const char *source,
+      const char *name, const char *value );
 
   /* ==================================================================== */
   /*      prototypes for functions in mapcpl.c                            */
@@ -2652,6 +2717,7 @@ extern "C" {
   MS_DLL_EXPORT char *msDecryptStringTokens(mapObj *map, const char *in);
   MS_DLL_EXPORT void msHexEncode(const unsigned char *in, char *out, int numbytes);
   MS_DLL_EXPORT int msHexDecode(const char *in, unsigned char *out, int numchars);
+  MS_DLL_EXPORT void msEncryptionKeyCacheCleanup(void);
 
   /* ==================================================================== */
   /*      prototypes for functions in mapxmp.c                            */
@@ -2933,6 +2999,7 @@ extern "C" {
     int (*cleanup)(void *renderer_data);
   } ;
   MS_DLL_EXPORT int msRenderRasterizedSVGSymbol(imageObj* img, double x, double y, symbolObj* symbol, symbolStyleObj* style);
+  MS_DLL_EXPORT void msSharedTileCacheCleanup(void);
 
 #define MS_IMAGE_RENDERER(im) ((im)->format->vtable)
 #define MS_RENDERER_CACHE(renderer) ((renderer)->renderer_data)
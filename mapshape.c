@@ -36,7 +36,9 @@
 
 #include <limits.h>
 #include <assert.h>
+#include <sys/stat.h>
 #include "mapserver.h"
+#include "mapthread.h"
 
 #if defined(USE_GDAL) || defined(USE_OGR)
 #include <cpl_conv.h>
@@ -1626,6 +1628,268 @@ int msSHPReadBounds( SHPHandle psSHP, int hEntity, rectObj *padBounds)
   return MS_SUCCESS;
 }
 
+/*
+** Record bounds cache. Without a usable .qix msShapefileWhichShapes() has to
+** test the bounds of every record, at the cost of one fseek()/fread() each.
+** Instead the bounds of a shapefile are read once into four coordinate arrays,
+** shared process wide by all users of the file (FastCGI, mapscript), and
+** tested in a branch free loop the compiler can vectorize that fills the
+** status bit array a word (32 records) at a time. The MS_SHAPEFILE_BOUNDS_CACHE
+** config option sets the memory allowed for all cached files in megabytes
+** (0 disables the cache). Entries are dropped when the .shp changes on disk,
+** the least recently used ones being evicted first when the cache is full.
+*/
+#define MS_SHAPEFILE_BOUNDS_CACHE_DEFAULT 64
+
+typedef struct shapeBoundsObj {
+  char *filename;
+  long mtime, size;
+  int numshapes;
+  double *minx, *miny, *maxx, *maxy; /* minx=HUGE_VAL, maxx=-HUGE_VAL for null shapes */
+  int refcount; /* shapefileObjs using it */
+  int cached; /* still in the cache list */
+  struct shapeBoundsObj *next;
+} shapeBoundsObj;
+
+static shapeBoundsObj *shape_bounds_cache = NULL; /* most recently used first */
+static size_t shape_bounds_bytes = 0;
+
+/* mtime and size of the .shp, .shx or .dbf (ext), the source may be given without extension */
+static int msShapefileStat(const char *source, const char *ext, long *mtime, long *size)
+{
+  struct stat sb;
+  char path[MS_MAXPATHLEN];
+  int i, n;
+
+  strlcpy(path, source, sizeof(path) - 4);
+  for(i = strlen(path) - 1; i > 0 && path[i] != '.' && path[i] != '/' && path[i] != '\\'; i--) {}
+  if(path[i] == '.')
+    path[i] = '\0';
+
+  n = strlen(path);
+  strlcat(path, ext, sizeof(path));
+  if(stat(path, &sb) != 0) {
+    msStringToUpper(path + n);
+    if(stat(path, &sb) != 0)
+      return MS_FAILURE;
+  }
+  *mtime = (long) sb.st_mtime;
+  *size = (long) sb.st_size;
+  return MS_SUCCESS;
+}
+
+static int msShapefileBoundsCacheSize(mapObj *map)
+{
+  const char *value = msGetConfigOption(map, "MS_SHAPEFILE_BOUNDS_CACHE");
+
+  return value ? MS_MAX(atoi(value), 0) : MS_SHAPEFILE_BOUNDS_CACHE_DEFAULT;
+}
+
+static size_t msShapefileBoundsSize(int numshapes)
+{
+  return (size_t) numshapes * 4 * sizeof(double);
+}
+
+static void msShapefileFreeBounds(shapeBoundsObj *bounds)
+{
+  free(bounds->filename);
+  free(bounds->minx);
+  free(bounds->miny);
+  free(bounds->maxx);
+  free(bounds->maxy);
+  free(bounds);
+}
+
+/* Read the bounds of all records, NULL if they don't fit in memory */
+static shapeBoundsObj *msShapefileLoadBounds(shapefileObj *shpfile, long mtime, long size)
+{
+  shapeBoundsObj *bounds;
+  rectObj rect;
+  int i, n = MS_MAX(shpfile->numshapes, 1);
+
+  bounds = (shapeBoundsObj *) calloc(1, sizeof(shapeBoundsObj));
+  if(!bounds)
+    return NULL;
+
+  bounds->minx = (double *) malloc(n * sizeof(double));
+  bounds->miny = (double *) malloc(n * sizeof(double));
+  bounds->maxx = (double *) malloc(n * sizeof(double));
+  bounds->maxy = (double *) malloc(n * sizeof(double));
+  if(!bounds->minx || !bounds->miny || !bounds->maxx || !bounds->maxy) {
+    msShapefileFreeBounds(bounds);
+    return NULL;
+  }
+
+  for(i=0; i<shpfile->numshapes; i++) {
+    if(msSHPReadBounds(shpfile->hSHP, i, &rect) == MS_SUCCESS) {
+      bounds->minx[i] = rect.minx;
+      bounds->miny[i] = rect.miny;
+      bounds->maxx[i] = rect.maxx;
+      bounds->maxy[i] = rect.maxy;
+    } else { /* null shape, never overlaps */
+      bounds->minx[i] = bounds->miny[i] = HUGE_VAL;
+      bounds->maxx[i] = bounds->maxy[i] = -HUGE_VAL;
+    }
+  }
+
+  bounds->filename = msStrdup(shpfile->source);
+  bounds->mtime = mtime;
+  bounds->size = size;
+  bounds->numshapes = shpfile->numshapes;
+  bounds->refcount = 1;
+
+  return bounds;
+}
+
+/*
+** Attach the shared bounds of shpfile to it, reading them from disk if load
+** is set and they aren't cached yet. Returns NULL when the bounds can't be
+** held in memory, the caller then reads them from disk as it goes.
+*/
+static shapeBoundsObj *msShapefileGetBounds(shapefileObj *shpfile, int load)
+{
+  shapeBoundsObj **link, *bounds, *evict;
+  size_t limit = (size_t) shpfile->boundscachesize * 1024 * 1024;
+  size_t need = msShapefileBoundsSize(shpfile->numshapes);
+  long mtime, size;
+  int pass;
+
+  if(shpfile->boundscache)
+    return shpfile->boundscache;
+
+  if(need > limit || msShapefileStat(shpfile->source, ".shp", &mtime, &size) != MS_SUCCESS)
+    return NULL;
+
+  /* look up the cache, then load and look again in case another thread did it meanwhile */
+  bounds = NULL;
+  for(pass=0; pass<2; pass++) {
+    msAcquireLock(TLOCK_SHPBOUNDS);
+    for(link=&shape_bounds_cache; *link; link=&((*link)->next)) {
+      if(strcmp((*link)->filename, shpfile->source) == 0)
+        break;
+    }
+    if(*link) {
+      shapeBoundsObj *found = *link;
+      *link = found->next;
+      if(found->mtime == mtime && found->size == size && found->numshapes == shpfile->numshapes) {
+        found->next = shape_bounds_cache;
+        shape_bounds_cache = found;
+        found->refcount++;
+        msReleaseLock(TLOCK_SHPBOUNDS);
+        if(bounds) msShapefileFreeBounds(bounds);
+        shpfile->boundscache = found;
+        return found;
+      }
+      /* the file changed, the stale entry goes when its last user lets go of it */
+      found->cached = MS_FALSE;
+      shape_bounds_bytes -= msShapefileBoundsSize(found->numshapes);
+      if(found->refcount == 0)
+        msShapefileFreeBounds(found);
+    }
+    if(pass == 1) break; /* keep the lock */
+    msReleaseLock(TLOCK_SHPBOUNDS);
+
+    if(!load)
+      return NULL;
+    bounds = msShapefileLoadBounds(shpfile, mtime, size);
+    if(!bounds)
+      return NULL;
+  }
+
+  /* make room, unused entries only */
+  while(shape_bounds_bytes + need > limit) {
+    evict = NULL;
+    for(link=&shape_bounds_cache; *link; link=&((*link)->next)) {
+      if((*link)->refcount == 0)
+        evict = *link;
+    }
+    if(!evict) break;
+    for(link=&shape_bounds_cache; *link != evict; link=&((*link)->next)) {}
+    *link = evict->next;
+    shape_bounds_bytes -= msShapefileBoundsSize(evict->numshapes);
+    msShapefileFreeBounds(evict);
+  }
+
+  /* kept for this shapefile only if the cache is full of bounds in use */
+  if(shape_bounds_bytes + need <= limit) {
+    bounds->cached = MS_TRUE;
+    bounds->next = shape_bounds_cache;
+    shape_bounds_cache = bounds;
+    shape_bounds_bytes += need;
+  }
+  msReleaseLock(TLOCK_SHPBOUNDS);
+
+  shpfile->boundscache = bounds;
+  return bounds;
+}
+
+static void msShapefileReleaseBounds(shapefileObj *shpfile)
+{
+  shapeBoundsObj *bounds = shpfile->boundscache;
+  int unused;
+
+  if(!bounds)
+    return;
+  shpfile->boundscache = NULL;
+
+  msAcquireLock(TLOCK_SHPBOUNDS);
+  bounds->refcount--;
+  unused = (bounds->refcount == 0 && !bounds->cached);
+  msReleaseLock(TLOCK_SHPBOUNDS);
+
+  if(unused)
+    msShapefileFreeBounds(bounds);
+}
+
+/*
+** Set the status bits of the records overlapping rect, or with filter set
+** clear those of the records not overlapping it (null shapes are kept, as
+** msFilterTreeSearch() does).
+*/
+static void msShapefileFilterBounds(shapefileObj *shpfile, shapeBoundsObj *bounds, rectObj rect, int filter)
+{
+  int i, b, n;
+
+  for(i=0; i<bounds->numshapes; i+=MS_ARRAY_BIT) {
+    const double *minx = bounds->minx + i, *miny = bounds->miny + i;
+    const double *maxx = bounds->maxx + i, *maxy = bounds->maxy + i;
+    ms_uint32 *word = shpfile->status + i/MS_ARRAY_BIT;
+    ms_uint32 mask = 0;
+
+    if(filter && *word == 0)
+      continue;
+
+    n = MS_MIN(MS_ARRAY_BIT, bounds->numshapes - i);
+    if(filter) {
+      for(b=0; b<n; b++)
+        mask |= (ms_uint32) (((minx[b] <= rect.maxx) & (maxx[b] >= rect.minx) &
+                              (miny[b] <= rect.maxy) & (maxy[b] >= rect.miny)) | (minx[b] == HUGE_VAL)) << b;
+      *word &= mask;
+    } else {
+      for(b=0; b<n; b++)
+        mask |= (ms_uint32) ((minx[b] <= rect.maxx) & (maxx[b] >= rect.minx) &
+                             (miny[b] <= rect.maxy) & (maxy[b] >= rect.miny)) << b;
+      *word = mask;
+    }
+  }
+}
+
+void msShapefileBoundsCacheCleanup()
+{
+  shapeBoundsObj *bounds, *next;
+
+  msAcquireLock(TLOCK_SHPBOUNDS);
+  for(bounds=shape_bounds_cache; bounds; bounds=next) {
+    next = bounds->next;
+    bounds->cached = MS_FALSE;
+    if(bounds->refcount == 0)
+      msShapefileFreeBounds(bounds);
+  }
+  shape_bounds_cache = NULL;
+  shape_bounds_bytes = 0;
+  msReleaseLock(TLOCK_SHPBOUNDS);
+}
+
 int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_failures)
 {
   int i;
@@ -1642,6 +1906,9 @@ int msShapefileOpen(shapefileObj *shpfile, char *mode, char *filename, int log_f
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_FALSE;
+  shpfile->boundscache = NULL;
+  shpfile->boundscachesize = 0;
+  shpfile->stamp.mtime[0] = -1;
 
   /* open the shapefile file (appending ok) and get basic info */
   if(!mode)
@@ -1718,6 +1985,8 @@ int msShapefileCreate(shapefileObj *shpfile, char *filename, int type)
   shpfile->status = NULL;
   shpfile->lastshape = -1;
   shpfile->isopen = MS_TRUE;
+  shpfile->boundscache = NULL;
+  shpfile->boundscachesize = 0;
 
   shpfile->hDBF = NULL; /* XBase file is NOT created here... */
   return(0);
@@ -1729,6 +1998,7 @@ void msShapefileClose(shapefileObj *shpfile)
     if(shpfile->hSHP) msSHPClose(shpfile->hSHP);
     if(shpfile->hDBF) msDBFClose(shpfile->hDBF);
     if(shpfile->status) free(shpfile->status);
+    msShapefileReleaseBounds(shpfile);
     shpfile->isopen = MS_FALSE;
   }
 }
@@ -1738,6 +2008,7 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
 {
   int i;
   rectObj shaperect;
+  shapeBoundsObj *bounds;
   char *filename;
   char *sourcename = 0; /* shape file source string from map file */
   char *s = 0; /* pointer to start of '.shp' in source string */
@@ -1783,7 +2054,11 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
     free(sourcename);
 
     if(shpfile->status) { /* index  */
-      msFilterTreeSearch(shpfile, shpfile->status, rect);
+      /* the index narrowed the search, don't read all bounds just for this */
+      if((bounds = msShapefileGetBounds(shpfile, MS_FALSE)) != NULL)
+        msShapefileFilterBounds(shpfile, bounds, rect, MS_TRUE);
+      else
+        msFilterTreeSearch(shpfile, shpfile->status, rect);
     } else { /* no index  */
       shpfile->status = msAllocBitArray(shpfile->numshapes);
       if(!shpfile->status) {
@@ -1791,9 +2066,13 @@ int msShapefileWhichShapes(shapefileObj *shpfile, rectObj rect, int debug)
         return(MS_FAILURE);
       }
 
-      for(i=0; i<shpfile->numshapes; i++) {
-        if(msSHPReadBounds(shpfile->hSHP, i, &shaperect) == MS_SUCCESS)
-          if(msRectOverlap(&shaperect, &rect) == MS_TRUE) msSetBit(shpfile->status, i, 1);
+      if((bounds = msShapefileGetBounds(shpfile, MS_TRUE)) != NULL)
+        msShapefileFilterBounds(shpfile, bounds, rect, MS_FALSE);
+      else {
+        for(i=0; i<shpfile->numshapes; i++) {
+          if(msSHPReadBounds(shpfile->hSHP, i, &shaperect) == MS_SUCCESS)
+            if(msRectOverlap(&shaperect, &rect) == MS_TRUE) msSetBit(shpfile->status, i, 1);
+        }
       }
     }
   }
@@ -1815,6 +2094,155 @@ void msTileIndexAbsoluteDir(char *tiFileAbsDir, layerObj *layer)
   free(tiFileAbsDirTmp);
 }
 
+/*
+** Tile handle cache. Opening a tile reads the .shp/.shx/.dbf headers, which
+** for tile indexes of many small tiles costs more than reading the shapes.
+** With the MS_SHAPEFILE_HANDLE_CACHE config option set to n, up to n tiles
+** that are no longer used are kept open process wide (FastCGI, mapscript)
+** and handed out again when the same file is opened, unless it changed on
+** disk. A cached handle belongs to a single user at a time, it is taken out
+** of the cache while open and put back, as the most recently used, on close.
+** The files are stamped just before a tile is opened, so a tile replaced
+** while its handle is open is not mistaken for the one the handle reads.
+*/
+typedef struct tileHandleObj {
+  shapefileObj shpfile;
+  struct tileHandleObj *next;
+} tileHandleObj;
+
+static tileHandleObj *tile_handle_cache = NULL;
+static int tile_handle_count = 0;
+
+static int msTiledSHPHandleCacheSize(layerObj *layer)
+{
+  const char *value = msGetConfigOption(layer->map, "MS_SHAPEFILE_HANDLE_CACHE");
+
+  return value ? MS_MAX(atoi(value), 0) : 0;
+}
+
+/* a handle is only reused while none of the three files of the tile changed */
+static int msTiledSHPStamp(const char *source, shapefileStampObj *stamp)
+{
+  static const char *exts[3] = { ".shp", ".shx", ".dbf" };
+  int i;
+
+  for(i=0; i<3; i++) {
+    if(msShapefileStat(source, exts[i], &stamp->mtime[i], &stamp->size[i]) != MS_SUCCESS) {
+      stamp->mtime[0] = -1;
+      return MS_FAILURE;
+    }
+  }
+  return MS_SUCCESS;
+}
+
+/* msShapefileOpen() for tiles, using a cached handle when there is one */
+static int msTiledSHPOpenTile(shapefileObj *shpfile, char *filename, int log_failures)
+{
+  tileHandleObj **link, *handle = NULL;
+  shapefileStampObj stamp;
+  int status;
+
+  if(tile_handle_cache && filename) {
+    msAcquireLock(TLOCK_SHPHANDLES);
+    for(link=&tile_handle_cache; *link; link=&((*link)->next)) {
+      if(strcmp((*link)->shpfile.source, filename) == 0) {
+        handle = *link;
+        *link = handle->next;
+        tile_handle_count--;
+        break;
+      }
+    }
+    msReleaseLock(TLOCK_SHPHANDLES);
+  }
+
+  if(msTiledSHPStamp(filename, &stamp) != MS_SUCCESS)
+    stamp.mtime[0] = -1;
+
+  if(handle) {
+    if(stamp.mtime[0] != -1 && memcmp(&stamp, &handle->shpfile.stamp, sizeof(stamp)) == 0) {
+      *shpfile = handle->shpfile;
+      shpfile->status = NULL;
+      shpfile->lastshape = -1;
+      shpfile->isopen = MS_TRUE;
+      free(handle);
+      return 0;
+    }
+    /* one of the files was replaced */
+    handle->shpfile.isopen = MS_TRUE;
+    msShapefileClose(&handle->shpfile);
+    free(handle);
+  }
+
+  status = msShapefileOpen(shpfile, "rb", filename, log_failures);
+  if(status == 0)
+    shpfile->stamp = stamp;
+  return status;
+}
+
+/* msShapefileClose() for tiles, keeping the handle in the cache if enabled */
+static void msTiledSHPCloseTile(layerObj *layer, shapefileObj *shpfile)
+{
+  tileHandleObj *handle, *evicted = NULL;
+  int maxhandles;
+
+  if(!shpfile || shpfile->isopen != MS_TRUE)
+    return;
+
+  maxhandles = msTiledSHPHandleCacheSize(layer);
+  if(maxhandles == 0 || !shpfile->hSHP || !shpfile->hDBF || shpfile->stamp.mtime[0] == -1) {
+    msShapefileClose(shpfile);
+    return;
+  }
+
+  handle = (tileHandleObj *) msSmallMalloc(sizeof(tileHandleObj));
+  if(shpfile->status) {
+    free(shpfile->status);
+    shpfile->status = NULL;
+  }
+  handle->shpfile = *shpfile;
+  shpfile->isopen = MS_FALSE;
+
+  msAcquireLock(TLOCK_SHPHANDLES);
+  handle->next = tile_handle_cache;
+  tile_handle_cache = handle;
+  tile_handle_count++;
+
+  /* drop the least recently used handles */
+  if(tile_handle_count > maxhandles) {
+    tileHandleObj **link = &tile_handle_cache;
+    int i;
+
+    for(i=0; i<maxhandles; i++)
+      link = &((*link)->next);
+    evicted = *link;
+    *link = NULL;
+    tile_handle_count = maxhandles;
+  }
+  msReleaseLock(TLOCK_SHPHANDLES);
+
+  while(evicted) {
+    handle = evicted->next;
+    msShapefileClose(&evicted->shpfile);
+    free(evicted);
+    evicted = handle;
+  }
+}
+
+void msTiledSHPHandleCacheCleanup(void)
+{
+  tileHandleObj *handle;
+
+  msAcquireLock(TLOCK_SHPHANDLES);
+  while(tile_handle_cache) {
+    handle = tile_handle_cache->next;
+    msShapefileClose(&tile_handle_cache->shpfile);
+    free(tile_handle_cache);
+    tile_handle_cache = handle;
+  }
+  tile_handle_count = 0;
+  msReleaseLock(TLOCK_SHPHANDLES);
+}
+
 /*
 ** Build possible paths we might find the tile file at:
 **   map dir + shape path + filename?
@@ -1835,9 +2263,9 @@ int msTiledSHPTryOpen(shapefileObj *shpfile, layerObj *layer, char *tiFileAbsDir
   if( ignore_missing == MS_MISSING_DATA_IGNORE )
     log_failures = MS_FALSE;
 
-  if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures) == -1) {
-    if(msShapefileOpen(shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures) == -1) {
-      if(msShapefileOpen(shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), log_failures) == -1) {
+  if(msTiledSHPOpenTile(shpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), log_failures) == -1) {
+    if(msTiledSHPOpenTile(shpfile, msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), log_failures) == -1) {
+      if(msTiledSHPOpenTile(shpfile, msBuildPath(szPath, layer->map->mappath, filename), log_failures) == -1) {
         if(ignore_missing == MS_MISSING_DATA_FAIL) {
           msSetError(MS_IOERR, "Unable to open shapefile '%s' for layer '%s' ... fatal error.", "msTiledSHPTryOpen()", filename, layer->name);
           return(MS_FAILURE);
@@ -1856,6 +2284,7 @@ int msTiledSHPTryOpen(shapefileObj *shpfile, layerObj *layer, char *tiFileAbsDir
       }
     }
   }
+  shpfile->boundscachesize = msShapefileBoundsCacheSize(layer->map);
   return(MS_SUCCESS);
 }
 
@@ -1884,8 +2313,23 @@ int msTiledSHPOpenFile(layerObj *layer)
   
   tSHP->shpfile->isopen = MS_FALSE; /* in case of error: do not try to close the shpfile */
   tSHP->tileshpfile = NULL; /* may need this if not using a tile layer, look for malloc later */
+  tSHP->numthreads = 1;
+  tSHP->tiles = NULL;
+  tSHP->tilenames = NULL;
+  tSHP->numtiles = tSHP->nexttile = 0;
+  tSHP->scanned = NULL;
+  tSHP->scannedtiles = NULL;
+  tSHP->numscanned = tSHP->nextscanned = 0;
   layer->layerinfo = tSHP;
 
+#ifdef USE_THREAD
+  {
+    const char *value = msLayerGetProcessingKey(layer, "TILE_THREADS");
+    if(value)
+      tSHP->numthreads = MS_MAX(1, atoi(value));
+  }
+#endif
+
   tSHP->tilelayerindex = msGetLayerIndex(layer->map, layer->tileindex);
   if(tSHP->tilelayerindex != -1) { /* does the tileindex reference another layer */
     int status;
@@ -1924,6 +2368,7 @@ int msTiledSHPOpenFile(layerObj *layer)
     if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, layer->tileindex), MS_TRUE) == -1)
       if(msShapefileOpen(tSHP->tileshpfile, "rb", msBuildPath(szPath, layer->map->mappath, layer->tileindex), MS_TRUE) == -1)
         return(MS_FAILURE);
+    tSHP->tileshpfile->boundscachesize = msShapefileBoundsCacheSize(layer->map);
   }
 
   if((layer->tileitemindex = msDBFGetItemIndex(tSHP->tileshpfile->hDBF, layer->tileitem)) == -1) return(MS_FAILURE);
@@ -1964,6 +2409,230 @@ int msTiledSHPOpenFile(layerObj *layer)
 }
 
 
+/*
+** With PROCESSING "TILE_THREADS=n", WhichShapes lists the tiles of the
+** tile index in the search rect, and the tiles are then opened and searched
+** (msShapefileWhichShapes()) n at a time ahead of NextShape, each on its own
+** thread. The shapes still come out in tile order.
+*/
+typedef struct {
+  layerObj *layer;
+  char *tiFileAbsDir;
+  shapefileObj *shpfiles;
+  char **names;
+  int *status;
+  int first, step, count;
+} tiledSHPScanObj;
+
+static void msTiledSHPFreeScan(layerObj *layer)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+  int i;
+
+  for(i=tSHP->nextscanned; i<tSHP->numscanned; i++)
+    msTiledSHPCloseTile(layer, &(tSHP->scanned[i]));
+  msFree(tSHP->scanned);
+  msFree(tSHP->scannedtiles);
+  tSHP->scanned = NULL;
+  tSHP->scannedtiles = NULL;
+  tSHP->numscanned = tSHP->nextscanned = 0;
+
+  if(tSHP->tilenames)
+    msFreeCharArray(tSHP->tilenames, tSHP->numtiles);
+  msFree(tSHP->tiles);
+  tSHP->tilenames = NULL;
+  tSHP->tiles = NULL;
+  tSHP->numtiles = tSHP->nexttile = 0;
+}
+
+/*
+** Append tile index shape i to the tile list, with its file name. The tile
+** index DBF is read here, on the listing thread only.
+*/
+static void msTiledSHPAddTile(layerObj *layer, int i, int *maxtiles)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+  char tilename[MS_MAXPATHLEN];
+  const char *value;
+
+  if(tSHP->numtiles == *maxtiles) {
+    *maxtiles = *maxtiles*2 + 16;
+    tSHP->tiles = (int *) msSmallRealloc(tSHP->tiles, sizeof(int)*(*maxtiles));
+    tSHP->tilenames = (char **) msSmallRealloc(tSHP->tilenames, sizeof(char *)*(*maxtiles));
+  }
+
+  value = msDBFReadStringAttribute(tSHP->tileshpfile->hDBF, i, layer->tileitemindex);
+  if(!layer->data) /* assume whole filename is in attribute field */
+    tSHP->tilenames[tSHP->numtiles] = msStrdup(value ? value : "");
+  else {
+    snprintf(tilename, sizeof(tilename), "%s/%s", value ? value : "", layer->data);
+    tSHP->tilenames[tSHP->numtiles] = msStrdup(tilename);
+  }
+  tSHP->tiles[tSHP->numtiles++] = i;
+}
+
+/* list the tiles in rect, returns MS_DONE if there are none */
+static int msTiledSHPListTiles(layerObj *layer, rectObj rect, int isQuery)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+  int i, status, maxtiles = 0;
+
+  tSHP->rect = rect;
+  tSHP->tiles = (int *) msSmallMalloc(sizeof(int));
+  tSHP->tilenames = (char **) msSmallMalloc(sizeof(char *));
+
+  if(tSHP->tilelayerindex != -1) { /* does the tileindex reference another layer */
+    layerObj *tlp = (GET_LAYER(layer->map, tSHP->tilelayerindex));
+    shapeObj tshape;
+
+    status = msLayerWhichShapes(tlp, rect, isQuery);
+    if(status != MS_SUCCESS) return(status); /* could be MS_DONE or MS_FAILURE */
+
+    msInitShape(&tshape);
+    while((status = msLayerNextShape(tlp, &tshape)) == MS_SUCCESS) {
+      i = tshape.index;
+      msFreeShape(&tshape);
+      msTiledSHPAddTile(layer, i, &maxtiles);
+    }
+    if(status == MS_FAILURE) return(MS_FAILURE);
+  } else { /* or reference a shapefile directly */
+    status = msShapefileWhichShapes(tSHP->tileshpfile, rect, layer->debug);
+    if(status != MS_SUCCESS) return(status); /* could be MS_DONE or MS_FAILURE */
+
+    for(i=0; i<tSHP->tileshpfile->numshapes; i++) {
+      if(!msGetBit(tSHP->tileshpfile->status,i)) continue;
+      msTiledSHPAddTile(layer, i, &maxtiles);
+    }
+  }
+
+  return (tSHP->numtiles > 0) ? MS_SUCCESS : MS_DONE;
+}
+
+static void msTiledSHPScanWorker(void *arg)
+{
+  tiledSHPScanObj *scan = (tiledSHPScanObj *) arg;
+  msTiledSHPLayerInfo *tSHP = scan->layer->layerinfo;
+  int i;
+
+  for(i=scan->first; i<scan->count; i+=scan->step) {
+    shapefileObj *shpfile = &(scan->shpfiles[i]);
+
+    shpfile->isopen = MS_FALSE;
+    if(strlen(scan->names[i]) == 0) {
+      scan->status[i] = MS_DONE;
+      continue;
+    }
+
+    scan->status[i] = msTiledSHPTryOpen(shpfile, scan->layer, scan->tiFileAbsDir, scan->names[i]);
+    if(scan->status[i] != MS_SUCCESS)
+      continue; /* MS_DONE for a missing tile, or MS_FAILURE */
+
+    scan->status[i] = msShapefileWhichShapes(shpfile, tSHP->rect, scan->layer->debug);
+    if(scan->status[i] != MS_SUCCESS)
+      msTiledSHPCloseTile(scan->layer, shpfile);
+  }
+}
+
+/* scan the next batch of tiles, returns MS_DONE when all of them were scanned */
+static int msTiledSHPScanTiles(layerObj *layer)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+  char tiFileAbsDir[MS_MAXPATHLEN];
+  tiledSHPScanObj *workers;
+  void **args;
+  int *status;
+  int i, count, numworkers, failed = -1;
+
+  msTileIndexAbsoluteDir(tiFileAbsDir, layer);
+
+  msFree(tSHP->scanned);
+  msFree(tSHP->scannedtiles);
+  tSHP->scanned = NULL;
+  tSHP->scannedtiles = NULL;
+  tSHP->numscanned = tSHP->nextscanned = 0;
+
+  while(tSHP->numscanned == 0 && tSHP->nexttile < tSHP->numtiles) {
+    /* a couple of tiles per thread, to bound the number of open files */
+    count = MS_MIN(tSHP->numthreads*2, tSHP->numtiles - tSHP->nexttile);
+    numworkers = MS_MIN(tSHP->numthreads, count);
+
+    tSHP->scanned = (shapefileObj *) msSmallRealloc(tSHP->scanned, sizeof(shapefileObj)*count);
+    tSHP->scannedtiles = (int *) msSmallRealloc(tSHP->scannedtiles, sizeof(int)*count);
+    status = (int *) msSmallMalloc(sizeof(int)*count);
+    workers = (tiledSHPScanObj *) msSmallMalloc(sizeof(tiledSHPScanObj)*numworkers);
+    args = (void **) msSmallMalloc(sizeof(void *)*numworkers);
+
+    for(i=0; i<numworkers; i++) {
+      workers[i].layer = layer;
+      workers[i].tiFileAbsDir = tiFileAbsDir;
+      workers[i].shpfiles = tSHP->scanned;
+      workers[i].names = tSHP->tilenames + tSHP->nexttile;
+      workers[i].status = status;
+      workers[i].first = i;
+      workers[i].step = numworkers;
+      workers[i].count = count;
+      args[i] = workers + i;
+    }
+
+    if(numworkers == 1)
+      msTiledSHPScanWorker(args[0]);
+    else
+      msRunThreads(msTiledSHPScanWorker, args, numworkers);
+
+    /* keep the tiles with shapes, in tile index order */
+    for(i=0; i<count; i++) {
+      if(status[i] == MS_SUCCESS) {
+        if(failed >= 0) {
+          msTiledSHPCloseTile(layer, &(tSHP->scanned[i]));
+          continue;
+        }
+        tSHP->scanned[tSHP->numscanned] = tSHP->scanned[i];
+        tSHP->scannedtiles[tSHP->numscanned] = tSHP->tiles[tSHP->nexttile + i];
+        tSHP->numscanned++;
+      } else if(status[i] == MS_FAILURE && failed < 0)
+        failed = tSHP->nexttile + i;
+    }
+    tSHP->nexttile += count;
+
+    msFree(status);
+    msFree(workers);
+    msFree(args);
+
+    if(failed >= 0) {
+      /* the error was recorded on the worker thread */
+      for(i=0; i<tSHP->numscanned; i++)
+        msTiledSHPCloseTile(layer, &(tSHP->scanned[i]));
+      tSHP->numscanned = 0;
+      msSetError(MS_SHPERR, "Failed to read tile '%s' of layer %s.", "msTiledSHPScanTiles()", tSHP->tilenames[failed], layer->name?layer->name:"(null)");
+      return(MS_FAILURE);
+    }
+  }
+
+  if(layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msTiledSHPScanTiles(): %d of %d tiles scanned with %d threads.\n", tSHP->nexttile, tSHP->numtiles, tSHP->numthreads);
+
+  return (tSHP->numscanned > 0) ? MS_SUCCESS : MS_DONE;
+}
+
+/* make the next scanned tile the current one */
+static int msTiledSHPNextScannedTile(layerObj *layer)
+{
+  msTiledSHPLayerInfo *tSHP = layer->layerinfo;
+
+  msTiledSHPCloseTile(layer, tSHP->shpfile);
+
+  if(tSHP->nextscanned == tSHP->numscanned) {
+    int status = msTiledSHPScanTiles(layer);
+    if(status != MS_SUCCESS) return(status);
+  }
+
+  *(tSHP->shpfile) = tSHP->scanned[tSHP->nextscanned];
+  tSHP->tileshpfile->lastshape = tSHP->scannedtiles[tSHP->nextscanned];
+  tSHP->nextscanned++;
+
+  return(MS_SUCCESS);
+}
+
 int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
   int i, status;
@@ -1981,7 +2650,14 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
     return(MS_FAILURE);
   }
 
-  msShapefileClose(tSHP->shpfile); /* close previously opened files */
+  msTiledSHPFreeScan(layer);
+  msTiledSHPCloseTile(layer, tSHP->shpfile); /* close previously opened files */
+
+  if(tSHP->numthreads > 1) {
+    status = msTiledSHPListTiles(layer, rect, isQuery);
+    if(status != MS_SUCCESS) return(status); /* could be MS_DONE or MS_FAILURE */
+    return msTiledSHPNextScannedTile(layer);
+  }
 
   if(tSHP->tilelayerindex != -1) {  /* does the tileindex reference another layer */
     layerObj *tlp;
@@ -2016,10 +2692,10 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
       status = msShapefileWhichShapes(tSHP->shpfile, rect, layer->debug);
       if(status == MS_DONE) {
         /* Close and continue to next tile */
-        msShapefileClose(tSHP->shpfile);
+        msTiledSHPCloseTile(layer, tSHP->shpfile);
         continue;
       } else if(status != MS_SUCCESS) {
-        msShapefileClose(tSHP->shpfile);
+        msTiledSHPCloseTile(layer, tSHP->shpfile);
         return(MS_FAILURE);
       }
 
@@ -2058,10 +2734,10 @@ int msTiledSHPWhichShapes(layerObj *layer, rectObj rect, int isQuery)
         status = msShapefileWhichShapes(tSHP->shpfile, rect, layer->debug);
         if(status == MS_DONE) {
           /* Close and continue to next tile */
-          msShapefileClose(tSHP->shpfile);
+          msTiledSHPCloseTile(layer, tSHP->shpfile);
           continue;
         } else if(status != MS_SUCCESS) {
-          msShapefileClose(tSHP->shpfile);
+          msTiledSHPCloseTile(layer, tSHP->shpfile);
           return(MS_FAILURE);
         }
 
@@ -2103,7 +2779,13 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
     while(i<tSHP->shpfile->numshapes && !msGetBit(tSHP->shpfile->status,i)) i++; /* next "in" shape */
 
     if(i == tSHP->shpfile->numshapes) { /* done with this tile, need a new one */
-      msShapefileClose(tSHP->shpfile); /* clean up */
+      if(tSHP->tiles) { /* scanned ahead */
+        status = msTiledSHPNextScannedTile(layer);
+        if(status != MS_SUCCESS) return(status);
+        continue;
+      }
+
+      msTiledSHPCloseTile(layer, tSHP->shpfile); /* clean up */
 
       /* position the source to the NEXT shapefile based on the tileindex */
       if(tSHP->tilelayerindex != -1) { /* does the tileindex reference another layer */
@@ -2135,10 +2817,10 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
           status = msShapefileWhichShapes(tSHP->shpfile, tSHP->tileshpfile->statusbounds, layer->debug);
           if(status == MS_DONE) {
             /* Close and continue to next tile */
-            msShapefileClose(tSHP->shpfile);
+            msTiledSHPCloseTile(layer, tSHP->shpfile);
             continue;
           } else if(status != MS_SUCCESS) {
-            msShapefileClose(tSHP->shpfile);
+            msTiledSHPCloseTile(layer, tSHP->shpfile);
             return(MS_FAILURE);
           }
 
@@ -2177,10 +2859,10 @@ int msTiledSHPNextShape(layerObj *layer, shapeObj *shape)
             status = msShapefileWhichShapes(tSHP->shpfile, tSHP->tileshpfile->statusbounds, layer->debug);
             if(status == MS_DONE) {
               /* Close and continue to next tile */
-              msShapefileClose(tSHP->shpfile);
+              msTiledSHPCloseTile(layer, tSHP->shpfile);
               continue;
             } else if(status != MS_SUCCESS) {
-              msShapefileClose(tSHP->shpfile);
+              msTiledSHPCloseTile(layer, tSHP->shpfile);
               return(MS_FAILURE);
             }
 
@@ -2240,7 +2922,8 @@ int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
   if((tileindex < 0) || (tileindex >= tSHP->tileshpfile->numshapes)) return(MS_FAILURE); /* invalid tile id */
 
   if(tileindex != tSHP->tileshpfile->lastshape) { /* correct tile is not currenly open so open the correct tile */
-    msShapefileClose(tSHP->shpfile); /* close current tile */
+    msTiledSHPCloseTile(layer, tSHP->shpfile); /* close current tile */
+    msTileIndexAbsoluteDir(tiFileAbsDir, layer);
 
     if(!layer->data) /* assume whole filename is in attribute field */
       filename = (char*) msDBFReadStringAttribute(tSHP->tileshpfile->hDBF, tileindex, layer->tileitemindex);
@@ -2251,9 +2934,9 @@ int msTiledSHPGetShape(layerObj *layer, shapeObj *shape, resultObj *record)
 
     /* open the shapefile, since a specific tile was request an error should be generated if that tile does not exist */
     if(strlen(filename) == 0) return(MS_FAILURE);
-    if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE) == -1) {
-      if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE) == -1) {
-        if(msShapefileOpen(tSHP->shpfile, "rb", msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE) == -1) {
+    if(msTiledSHPOpenTile(tSHP->shpfile, msBuildPath3(szPath, tiFileAbsDir, layer->map->shapepath, filename), MS_TRUE) == -1) {
+      if(msTiledSHPOpenTile(tSHP->shpfile, msBuildPath3(szPath, layer->map->mappath, layer->map->shapepath, filename), MS_TRUE) == -1) {
+        if(msTiledSHPOpenTile(tSHP->shpfile, msBuildPath(szPath, layer->map->mappath, filename), MS_TRUE) == -1) {
           return(MS_FAILURE);
         }
       }
@@ -2283,7 +2966,8 @@ void msTiledSHPClose(layerObj *layer)
 
   tSHP = layer->layerinfo;
   if(tSHP) {
-    msShapefileClose(tSHP->shpfile);
+    msTiledSHPFreeScan(layer);
+    msTiledSHPCloseTile(layer, tSHP->shpfile);
     free(tSHP->shpfile);
 
     if(tSHP->tilelayerindex != -1) {
@@ -2523,6 +3207,7 @@ int msSHPLayerOpen(layerObj *layer)
       return MS_FAILURE;
     }
   }
+  shpfile->boundscachesize = msShapefileBoundsCacheSize(layer->map);
   
   if (layer->projection.numargs > 0 &&
       EQUAL(layer->projection.args[0], "auto"))
@@ -135,6 +135,10 @@ extern "C" {
 
     char  *pszStringField;
     int   nStringFieldLen;
+
+    char  *pszRecordBlock; /* read-ahead buffer for ascending record access */
+    int   nBlockStart;
+    int   nBlockRecords;
 #ifdef SWIG
     %mutable;
 #endif
@@ -143,6 +147,13 @@ extern "C" {
 
   typedef enum {FTString, FTInteger, FTDouble, FTInvalid} DBFFieldType;
 
+#ifndef SWIG
+  /* modification times and sizes of the .shp, .shx and .dbf of a shapefile */
+  typedef struct {
+    long mtime[3], size[3]; /* mtime[0] is -1 if unknown */
+  } shapefileStampObj;
+#endif
+
   /* Shapefile object, no write access via scripts */
   typedef struct {
 #ifdef SWIG
@@ -168,6 +179,12 @@ extern "C" {
     rectObj statusbounds; /* holds extent associated with the status vector */
 
     int isopen;
+
+#ifndef SWIG
+    struct shapeBoundsObj *boundscache; /* shared in-memory record bounds, see msShapefileWhichShapes() */
+    int boundscachesize; /* megabytes of record bounds allowed in memory, 0 to always read them from disk */
+    shapefileStampObj stamp; /* files as they were when a tile was opened, see msTiledSHPOpenTile() */
+#endif
 #ifdef SWIG
     %mutable;
 #endif
@@ -179,6 +196,16 @@ extern "C" {
     shapefileObj *shpfile;
     shapefileObj *tileshpfile;
     int tilelayerindex;
+
+    /* with TILE_THREADS the tiles are scanned ahead on worker threads */
+    int numthreads;
+    rectObj rect;           /* search rect of the scan */
+    int *tiles;             /* candidate tiles (tile index shapes), NULL when not scanning ahead */
+    char **tilenames;       /* their file names */
+    int numtiles, nexttile; /* nexttile is the first one not scanned yet */
+    shapefileObj *scanned;  /* scanned tiles having shapes in rect, opened */
+    int *scannedtiles;
+    int numscanned, nextscanned;
   } msTiledSHPLayerInfo;
 
   /* shapefileObj function prototypes  */
@@ -0,0 +1,408 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Mapfile snapshots: pre-flattened, versioned copies of a loaded
+ *           mapfile that applications can load instead of the sources.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *****************************************************************************/
+
+/*
+** A snapshot file looks like:
+**
+**   MSMAPSNAPSHOT <format version> <MS_VERSION_NUM>
+**   WRITTEN <time>
+**   SOURCE <mtime sec>.<nsec> <size> <absolute path>  (one per mapfile/include/symbolset/fontset)
+**   MAPPATH <absolute path>
+**   BODY <length>
+**   <flattened mapfile, as produced by msWriteMapToString()>
+**
+** The body is plain mapfile text with all INCLUDEs resolved and all
+** defaults made explicit: loading a snapshot reads one file instead of the
+** mapfile and its includes, but it still goes through the lexer and the
+** load* functions, and the symbolset and fontset are still read. It is not
+** a binary image of the mapObj.
+**
+** The body is only as faithful as msWriteMap(), which does not reproduce
+** every mapfile construct, so msLoadMap() never uses snapshots: they are
+** loaded explicitly, with msLoadMapSnapshot() or msLoadMapSnapshotIfFresh(),
+** by applications whose mapfiles are known to round trip.
+**
+** A snapshot is only used if it was written by the same MapServer version
+** and none of the recorded sources changed (modification time, to the
+** nanosecond where the platform has it, and size) since it was written.
+** On file systems that only keep whole seconds, a source modified in the
+** second the snapshot was written could be modified again unnoticed, such
+** a snapshot is never used.
+*/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+
+#include "mapserver.h"
+
+
+
+#define MS_SNAPSHOT_MAGIC "MSMAPSNAPSHOT"
+#define MS_SNAPSHOT_FORMAT_VERSION 2
+#define MS_SNAPSHOT_MAX_SOURCES 256
+
+typedef struct {
+  long sec;
+  long nsec; /* 0 where the platform doesn't have it */
+  long size;
+} snapshotStampObj;
+
+typedef struct {
+  char *paths[MS_SNAPSHOT_MAX_SOURCES];
+  snapshotStampObj stamps[MS_SNAPSHOT_MAX_SOURCES];
+  int numsources;
+} snapshotSourcesObj;
+
+static int snapshotStat(const char *path, snapshotStampObj *stamp)
+{
+  struct stat sb;
+
+  if(stat(path, &sb) != 0)
+    return MS_FAILURE;
+
+  stamp->sec = (long) sb.st_mtime;
+#if defined(__APPLE__)
+  stamp->nsec = (long) sb.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  stamp->nsec = 0;
+#else
+  stamp->nsec = (long) sb.st_mtim.tv_nsec;
+#endif
+  stamp->size = (long) sb.st_size;
+
+  return MS_SUCCESS;
+}
+
+static void snapshotFreeSources(snapshotSourcesObj *sources)
+{
+  int i;
+  for(i=0; i<sources->numsources; i++)
+    msFree(sources->paths[i]);
+  sources->numsources = 0;
+}
+
+static int snapshotAddSource(snapshotSourcesObj *sources, const char *path)
+{
+  int i;
+
+  for(i=0; i<sources->numsources; i++)
+    if(strcmp(sources->paths[i], path) == 0) return MS_SUCCESS; /* already there */
+
+  if(sources->numsources == MS_SNAPSHOT_MAX_SOURCES) {
+    msSetError(MS_MISCERR, "Too many source files (max %d).", "msSaveMapSnapshot()", MS_SNAPSHOT_MAX_SOURCES);
+    return MS_FAILURE;
+  }
+
+  if(snapshotStat(path, &(sources->stamps[sources->numsources])) != MS_SUCCESS) {
+    msSetError(MS_IOERR, "Unable to stat source file (%s).", "msSaveMapSnapshot()", path);
+    return MS_FAILURE;
+  }
+  sources->paths[sources->numsources++] = msStrdup(path);
+
+  return MS_SUCCESS;
+}
+
+static char *snapshotReadFile(const char *filename, long *length)
+{
+  FILE *stream;
+  char *buffer;
+  long size;
+
+  if((stream = fopen(filename, "rb")) == NULL)
+    return NULL;
+
+  fseek(stream, 0, SEEK_END);
+  size = ftell(stream);
+  fseek(stream, 0, SEEK_SET);
+
+  buffer = (char *) msSmallMalloc(size+1);
+  if(size > 0 && fread(buffer, 1, size, stream) != (size_t) size) {
+    msFree(buffer);
+    fclose(stream);
+    return NULL;
+  }
+  buffer[size] = '\0';
+  fclose(stream);
+
+  if(length) *length = size;
+  return buffer;
+}
+
+/*
+** Collects a mapfile and everything it INCLUDEs. This is a lightweight scan
+** that mirrors the lexer's rules: comments run to end of line, INCLUDE paths
+** are quoted and resolved relative to the map path.
+*/
+static int snapshotCollectIncludes(snapshotSourcesObj *sources, const char *filename, const char *mappath, int depth)
+{
+  char *text, *p;
+  char szPath[MS_MAXPATHLEN];
+
+  if(depth > 5) {
+    msSetError(MS_IOERR, "Includes nested to deeply.", "msSaveMapSnapshot()");
+    return MS_FAILURE;
+  }
+
+  if(snapshotAddSource(sources, filename) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  if((text = snapshotReadFile(filename, NULL)) == NULL) {
+    msSetError(MS_IOERR, "(%s)", "msSaveMapSnapshot()", filename);
+    return MS_FAILURE;
+  }
+
+  p = text;
+  while(*p) {
+    if(*p == '#') { /* comment */
+      while(*p && *p != '\n') p++;
+    } else if(*p == '"' || *p == '\'') { /* skip over quoted strings */
+      char quote = *p++;
+      while(*p && *p != quote) {
+        if(*p == '\\' && p[1]) p++;
+        p++;
+      }
+      if(*p) p++;
+    } else if(strncasecmp(p, "include", 7) == 0 && (p == text || !isalnum((unsigned char)p[-1])) && !isalnum((unsigned char)p[7])) {
+      char quote, *start;
+
+      p += 7;
+      while(*p && isspace((unsigned char)*p)) p++;
+      if(*p != '"' && *p != '\'') continue;
+      quote = *p++;
+      start = p;
+      while(*p && *p != quote) p++;
+      if(*p) {
+        *p++ = '\0';
+        if(snapshotCollectIncludes(sources, msBuildPath(szPath, mappath, start), mappath, depth+1) != MS_SUCCESS) {
+          msFree(text);
+          return MS_FAILURE;
+        }
+      }
+    } else {
+      p++;
+    }
+  }
+
+  msFree(text);
+  return MS_SUCCESS;
+}
+
+/*
+** Returns the default name of the snapshot of a mapfile, next to it.
+*/
+char *msGetMapSnapshotFilename(const char *mapfile)
+{
+  char *snapshotfile = (char *) msSmallMalloc(strlen(mapfile)+strlen(MS_SNAPSHOT_EXTENSION)+1);
+  sprintf(snapshotfile, "%s%s", mapfile, MS_SNAPSHOT_EXTENSION);
+  return snapshotfile;
+}
+
+/*
+** Writes a snapshot of map, which must have been loaded from mapfile, to
+** snapshotfile (or to the default location if snapshotfile is NULL).
+*/
+int msSaveMapSnapshot(mapObj *map, char *mapfile, char *snapshotfile)
+{
+  snapshotSourcesObj sources;
+  char szPath[MS_MAXPATHLEN], szCWDPath[MS_MAXPATHLEN];
+  char *body, *defaultfile = NULL;
+  FILE *stream;
+  int i, status = MS_FAILURE;
+
+  if(!map || !mapfile) {
+    msSetError(MS_MISCERR, "Map or mapfile is undefined.", "msSaveMapSnapshot()");
+    return MS_FAILURE;
+  }
+
+  if(NULL == getcwd(szCWDPath, MS_MAXPATHLEN)) {
+    msSetError(MS_MISCERR, "getcwd() returned a too long path", "msSaveMapSnapshot()");
+    return MS_FAILURE;
+  }
+
+  sources.numsources = 0;
+  if(snapshotCollectIncludes(&sources, msBuildPath(szPath, szCWDPath, mapfile), map->mappath, 0) != MS_SUCCESS)
+    goto cleanup;
+  if(map->symbolset.filename &&
+      snapshotAddSource(&sources, msBuildPath(szPath, map->mappath, map->symbolset.filename)) != MS_SUCCESS)
+    goto cleanup;
+  if(map->fontset.filename &&
+      snapshotAddSource(&sources, msBuildPath(szPath, map->mappath, map->fontset.filename)) != MS_SUCCESS)
+    goto cleanup;
+
+  if((body = msWriteMapToString(map)) == NULL)
+    goto cleanup;
+
+  if(!snapshotfile)
+    snapshotfile = defaultfile = msGetMapSnapshotFilename(mapfile);
+
+  if((stream = fopen(snapshotfile, "wb")) == NULL) {
+    msSetError(MS_IOERR, "(%s)", "msSaveMapSnapshot()", snapshotfile);
+    msFree(body);
+    goto cleanup;
+  }
+
+  fprintf(stream, "%s %d %d\n", MS_SNAPSHOT_MAGIC, MS_SNAPSHOT_FORMAT_VERSION, MS_VERSION_NUM);
+  fprintf(stream, "WRITTEN %ld\n", (long) time(NULL));
+  for(i=0; i<sources.numsources; i++)
+    fprintf(stream, "SOURCE %ld.%09ld %ld %s\n", sources.stamps[i].sec, sources.stamps[i].nsec,
+            sources.stamps[i].size, sources.paths[i]);
+  fprintf(stream, "MAPPATH %s\n", map->mappath);
+  fprintf(stream, "BODY %ld\n", (long) strlen(body));
+  fwrite(body, 1, strlen(body), stream);
+  if(fclose(stream) != 0) {
+    msSetError(MS_IOERR, "Error writing snapshot (%s).", "msSaveMapSnapshot()", snapshotfile);
+    msFree(body);
+    goto cleanup;
+  }
+
+  msFree(body);
+  status = MS_SUCCESS;
+
+cleanup:
+  snapshotFreeSources(&sources);
+  msFree(defaultfile);
+  return status;
+}
+
+/*
+** Reads the next header line, returns a pointer past it or NULL.
+*/
+static char *snapshotNextLine(char *p, char **line)
+{
+  char *eol = strchr(p, '\n');
+  if(!eol) return NULL;
+  *eol = '\0';
+  *line = p;
+  return eol+1;
+}
+
+static void snapshotError(int report, const char *message, const char *snapshotfile, const char *detail)
+{
+  char buffer[MS_MAXPATHLEN*3];
+
+  snprintf(buffer, sizeof(buffer), message, snapshotfile, detail);
+  if(report)
+    msSetError(MS_IOERR, "%s", "msLoadMapSnapshot()", buffer);
+  else if(msGetGlobalDebugLevel() >= MS_DEBUGLEVEL_DEBUG)
+    msDebug("msLoadMapSnapshot(): %s Using the mapfile.\n", buffer);
+}
+
+static mapObj *loadMapSnapshot(char *snapshotfile, char *new_mappath, int report)
+{
+  char *buffer, *p, *line, *body = NULL, *mappath = NULL;
+  int version, msversion;
+  long length, bodylength = -1, written = -1;
+  mapObj *map;
+
+  if((buffer = snapshotReadFile(snapshotfile, &length)) == NULL) {
+    snapshotError(report, "Unable to read snapshot (%s).%s", snapshotfile, "");
+    return NULL;
+  }
+
+  p = snapshotNextLine(buffer, &line);
+  if(!p || sscanf(line, MS_SNAPSHOT_MAGIC " %d %d", &version, &msversion) != 2 ||
+      version != MS_SNAPSHOT_FORMAT_VERSION || msversion != MS_VERSION_NUM) {
+    snapshotError(report, "Snapshot (%s) has an unsupported format or version.%s", snapshotfile, "");
+    msFree(buffer);
+    return NULL;
+  }
+
+  while(p && (p = snapshotNextLine(p, &line)) != NULL) {
+    if(strncmp(line, "WRITTEN ", 8) == 0) {
+      written = atol(line+8);
+    } else if(strncmp(line, "SOURCE ", 7) == 0) {
+      snapshotStampObj recorded, current;
+      int pathoffset = 0;
+
+      if(sscanf(line+7, "%ld.%ld %ld %n", &recorded.sec, &recorded.nsec, &recorded.size, &pathoffset) != 3 ||
+          pathoffset == 0 || written < 0) {
+        snapshotError(report, "Snapshot (%s) is corrupted.%s", snapshotfile, "");
+        msFree(buffer);
+        return NULL;
+      }
+      if(snapshotStat(line+7+pathoffset, &current) != MS_SUCCESS ||
+          current.sec != recorded.sec || current.nsec != recorded.nsec || current.size != recorded.size ||
+          (recorded.nsec == 0 && recorded.sec >= written)) {
+        snapshotError(report, "Snapshot (%s) is out of date with %s.", snapshotfile, line+7+pathoffset);
+        msFree(buffer);
+        return NULL;
+      }
+    } else if(strncmp(line, "MAPPATH ", 8) == 0) {
+      mappath = line+8;
+    } else if(strncmp(line, "BODY ", 5) == 0) {
+      bodylength = atol(line+5);
+      body = p;
+      break;
+    }
+  }
+
+  if(!body || bodylength < 0 || body + bodylength > buffer + length) {
+    snapshotError(report, "Snapshot (%s) is truncated.%s", snapshotfile, "");
+    msFree(buffer);
+    return NULL;
+  }
+  body[bodylength] = '\0';
+
+  map = msLoadMapFromString(body, new_mappath ? new_mappath : mappath);
+  msFree(buffer);
+
+  return map;
+}
+
+/*
+** Loads a snapshot, failing if it is missing, stale or was written by
+** another MapServer version.
+*/
+mapObj *msLoadMapSnapshot(char *snapshotfile, char *new_mappath)
+{
+  return loadMapSnapshot(snapshotfile, new_mappath, MS_TRUE);
+}
+
+/*
+** Returns the map from the snapshot next to mapfile if there is a usable
+** one, NULL (without setting an error) otherwise, so that the caller can
+** fall back to msLoadMap().
+*/
+mapObj *msLoadMapSnapshotIfFresh(char *mapfile, char *new_mappath)
+{
+  mapObj *map;
+  struct stat sb;
+  char *snapshotfile = msGetMapSnapshotFilename(mapfile);
+
+  if(stat(snapshotfile, &sb) != 0) {
+    msFree(snapshotfile);
+    return NULL;
+  }
+
+  map = loadMapSnapshot(snapshotfile, new_mappath, MS_FALSE);
+  msFree(snapshotfile);
+  return map;
+}
@@ -31,6 +31,7 @@
 #include "maphash.h"
 #include "mapserver.h"
 #include "maptile.h"
+#include "mapthread.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -74,18 +75,279 @@ static char *olLayerWMSTag = \
                              "                                   width: [mapwidth], height: [mapheight], version: '[VERSION]', format:'[openlayers_format]'},"
                              "                                   {singleTile: \"true\", ratio:1, projection: '[openlayers_projection]'});\n";
 
-static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mode);
+/*
+** Template files are kept in memory once read, keyed by path and
+** modification time, so a query template used for every result of a query
+** (and by the next request of a FastCGI process) is read, split into lines
+** and compiled only once. Lines without a '[' hold no tag and are copied to
+** the output as they are. The others are compiled into a list of literal
+** and tag nodes, see templateCompile(), which query results are rendered
+** from without scanning the line again. Lines holding a tag the nodes don't
+** cover (e.g. [include], [mapext] or a join) still go through processLine().
+*/
+#define MS_TEMPLATE_CACHE_SIZE 32
+
+/*
+** A tagged template line (or the body of a [feature] tag) compiled into
+** literal text and the tags it holds. Texts point into the compiled
+** string, the tag names and the [item] arguments belong to the node.
+*/
+enum templateNodeTypes {TEMPLATE_LITERAL, TEMPLATE_ID, TEMPLATE_NR, TEMPLATE_NL, TEMPLATE_NLR, TEMPLATE_RN, TEMPLATE_LRN, TEMPLATE_CL,
+                        TEMPLATE_SHPMID, TEMPLATE_SHPMIDX, TEMPLATE_SHPMIDY, TEMPLATE_SHPCLASS, TEMPLATE_SHPXY,
+                        TEMPLATE_SHPMINX, TEMPLATE_SHPMINY, TEMPLATE_SHPMAXX, TEMPLATE_SHPMAXY, TEMPLATE_SHPIDX, TEMPLATE_TILEIDX,
+                        TEMPLATE_VALUES, TEMPLATE_ATTRIBUTE, TEMPLATE_ITEM
+                       };
+
+typedef struct {
+  int type;
+  const char *text; /* the literal or the whole tag */
+  int length;
+  char *name; /* text between the brackets */
+  hashTableObj *args; /* [item] arguments */
+} templateNodeObj;
+
+typedef struct {
+  templateNodeObj *nodes;
+  int numnodes;
+} templateNodeListObj;
+
+typedef struct templateFileObj {
+  char *path;
+  long mtime;
+  long size;
+  int valid; /* first line holds the magic string */
+  char *text; /* the whole file */
+  char *body; /* text after the magic string line */
+  char **lines; /* lines of the body, newline included */
+  int *lengths;
+  int *tagged; /* line holds a '[' */
+  templateNodeListObj **compiled; /* tagged lines as nodes, NULL if a line can't be */
+  int numlines;
+  int refcount;
+  int stale; /* out of the cache, freed with its last reference */
+  struct templateFileObj *next;
+} templateFileObj;
+
+/*
+** Reads the body of a template line by line, multi-line tags (e.g.
+** [resultset]...[/resultset]) use it to look ahead.
+*/
+typedef struct {
+  templateFileObj *file;
+  int line;
+} templateReaderObj;
+
+static templateFileObj *templateCache = NULL; /* most recently used first */
+static int templateCacheSize = 0;
+
+static char *processLine(mapservObj *mapserv, char *instr, templateReaderObj *reader, int mode);
+static templateNodeListObj *templateCompile(char *text);
+static void templateFreeNodes(templateNodeListObj *list);
+static int templateRenderNodes(mapservObj *mapserv, templateNodeListObj *list, bufferObj *output);
+
+static void templateFileFree(templateFileObj *file)
+{
+  int i;
+
+  if(file->compiled) {
+    for(i=0; i<file->numlines; i++)
+      templateFreeNodes(file->compiled[i]);
+  }
+  msFree(file->compiled);
+  if(file->lines) msFree(file->lines[0]);
+  msFree(file->lines);
+  msFree(file->lengths);
+  msFree(file->tagged);
+  msFree(file->text);
+  msFree(file->path);
+  msFree(file);
+}
+
+static templateFileObj *templateFileRead(const char *path, long mtime, long size)
+{
+  FILE *stream;
+  templateFileObj *file;
+  char *p, *eol, *dst;
+  size_t length;
+  int i;
+
+  if((stream = fopen(path, "r")) == NULL)
+    return NULL;
+
+  file = (templateFileObj *) msSmallCalloc(1, sizeof(templateFileObj));
+  file->path = msStrdup(path);
+  file->mtime = mtime;
+  file->size = size;
+
+  file->text = (char *) msSmallMalloc(size + 1);
+  length = fread(file->text, 1, size, stream); /* may be less than size in text mode */
+  file->text[length] = '\0';
+  fclose(stream);
+
+  /* the magic string must be on the first line, an empty file is fine */
+  file->valid = MS_TRUE;
+  if((eol = strchr(file->text, '\n')) != NULL) {
+    *eol = '\0';
+    file->valid = (strcasestr(file->text, MS_TEMPLATE_MAGIC_STRING) != NULL);
+    *eol = '\n';
+    file->body = eol + 1;
+  } else {
+    if(length > 0)
+      file->valid = (strcasestr(file->text, MS_TEMPLATE_MAGIC_STRING) != NULL);
+    file->body = file->text + length;
+  }
+
+  for(p=file->body; *p; p++)
+    if(*p == '\n') file->numlines++;
+  if(p > file->body && *(p-1) != '\n')
+    file->numlines++;
+
+  if(file->numlines > 0) {
+    file->lines = (char **) msSmallMalloc(file->numlines * sizeof(char *));
+    file->lengths = (int *) msSmallMalloc(file->numlines * sizeof(int));
+    file->tagged = (int *) msSmallMalloc(file->numlines * sizeof(int));
+    file->compiled = (templateNodeListObj **) msSmallCalloc(file->numlines, sizeof(templateNodeListObj *));
+
+    /* one block for all lines, each with its own terminator */
+    dst = (char *) msSmallMalloc((p - file->body) + file->numlines + 1);
+    p = file->body;
+    for(i=0; i<file->numlines; i++) {
+      eol = strchr(p, '\n');
+      length = eol ? (size_t)(eol - p + 1) : strlen(p);
+      memcpy(dst, p, length);
+      dst[length] = '\0';
+      file->lines[i] = dst;
+      file->lengths[i] = length;
+      file->tagged[i] = (memchr(p, '[', length) != NULL);
+      if(file->tagged[i])
+        file->compiled[i] = templateCompile(dst);
+      dst += length + 1;
+      p += length;
+    }
+  }
+
+  return file;
+}
 
-static int isValidTemplate(FILE *stream, const char *filename)
+/*
+** Returns the template at path, read from disk only when not cached or
+** modified since, or NULL if the file can't be read (no error is set).
+** The file must be given back with templateReleaseFile().
+*/
+static templateFileObj *templateGetFile(const char *path)
 {
-  char buffer[MS_BUFFER_LENGTH];
+  struct stat sb;
+  templateFileObj *file, *prev, *next;
+
+  if(stat(path, &sb) != 0)
+    return NULL;
 
-  if(fgets(buffer, MS_BUFFER_LENGTH, stream) != NULL) {
-    if(!strcasestr(buffer, MS_TEMPLATE_MAGIC_STRING)) {
-      msSetError(MS_WEBERR, "Missing magic string, %s doesn't look like a MapServer template.", "isValidTemplate()", filename);
-      return MS_FALSE;
+  msAcquireLock( TLOCK_TEMPLATECACHE );
+  for(prev=NULL, file=templateCache; file; prev=file, file=file->next) {
+    if(strcmp(file->path, path) == 0 && file->mtime == (long) sb.st_mtime && file->size == (long) sb.st_size) {
+      if(prev) { /* move to the front */
+        prev->next = file->next;
+        file->next = templateCache;
+        templateCache = file;
+      }
+      file->refcount++;
+      msReleaseLock( TLOCK_TEMPLATECACHE );
+      return file;
     }
   }
+  msReleaseLock( TLOCK_TEMPLATECACHE );
+
+  if((file = templateFileRead(path, (long) sb.st_mtime, (long) sb.st_size)) == NULL)
+    return NULL;
+  file->refcount = 1;
+
+  msAcquireLock( TLOCK_TEMPLATECACHE );
+
+  /* older versions of the file go, as do the least recently used files */
+  file->next = templateCache;
+  templateCache = file;
+  templateCacheSize++;
+  for(prev=file, next=file->next; next; next=prev->next) {
+    if(strcmp(next->path, path) == 0) {
+      prev->next = next->next;
+      templateCacheSize--;
+      next->stale = MS_TRUE;
+      if(next->refcount == 0) templateFileFree(next);
+    } else
+      prev = next;
+  }
+
+  while(templateCacheSize > MS_TEMPLATE_CACHE_SIZE) {
+    templateFileObj *last = NULL, *lastprev = NULL;
+
+    for(prev=NULL, next=templateCache; next; prev=next, next=next->next) {
+      if(next->refcount == 0) {
+        last = next;
+        lastprev = prev;
+      }
+    }
+    if(!last) break; /* all in use */
+
+    if(lastprev) lastprev->next = last->next;
+    else templateCache = last->next;
+    templateCacheSize--;
+    templateFileFree(last);
+  }
+
+  msReleaseLock( TLOCK_TEMPLATECACHE );
+
+  return file;
+}
+
+static void templateReleaseFile(templateFileObj *file)
+{
+  msAcquireLock( TLOCK_TEMPLATECACHE );
+  file->refcount--;
+  if(file->stale && file->refcount == 0)
+    templateFileFree(file);
+  msReleaseLock( TLOCK_TEMPLATECACHE );
+}
+
+/*
+** Free all cached template files, called from msCleanup().
+*/
+void msTemplateCacheCleanup(void)
+{
+  templateFileObj *next;
+
+  msAcquireLock( TLOCK_TEMPLATECACHE );
+  while(templateCache) {
+    next = templateCache->next;
+    templateFileFree(templateCache);
+    templateCache = next;
+  }
+  templateCacheSize = 0;
+  msReleaseLock( TLOCK_TEMPLATECACHE );
+}
+
+static char *templateReadLine(templateReaderObj *reader)
+{
+  if(!reader || reader->line >= reader->file->numlines)
+    return NULL;
+  return reader->file->lines[reader->line++];
+}
+
+/*
+** Terminate an output buffer and return its data as a string.
+*/
+static char *templateBufferString(bufferObj *output)
+{
+  msBufferAppend(output, "", 1);
+  output->size--;
+  return (char *) output->data;
+}
+
+static int isValidTemplate(templateFileObj *file, const char *filename)
+{
+  if(!file->valid) {
+    msSetError(MS_WEBERR, "Missing magic string, %s doesn't look like a MapServer template.", "isValidTemplate()", filename);
+    return MS_FALSE;
+  }
 
   return MS_TRUE;
 }
@@ -587,6 +849,70 @@ int getTagArgs(char* pszTag, char* pszInstr, hashTableObj **ppoHashTable)
   return MS_SUCCESS;
 }
 
+#define MS_TEMPLATE_MAXTAGS 64 /* parsed tags kept per request */
+
+static void freeCachedTagArgs(mapservObj *mapserv)
+{
+  int i;
+
+  for(i=0; i<mapserv->numtags; i++) {
+    msFree(mapserv->tags[i].tag);
+    msFreeHashTable(mapserv->tags[i].args);
+  }
+  msFree(mapserv->tags);
+  mapserv->tags = NULL;
+  mapserv->numtags = 0;
+}
+
+/*
+** Same as getTagArgs() for the first pszTag of pszInstr, but a tag is only
+** parsed once per request: the arguments are kept by mapserv, keyed by the
+** complete tag text. The table belongs to mapserv and stays valid until the
+** next call, it must not be freed by the caller.
+*/
+static int getCachedTagArgs(mapservObj *mapserv, char *pszTag, char *pszInstr, hashTableObj **ppoHashTable)
+{
+  char *pszStart, *pszEnd;
+  hashTableObj *args=NULL;
+  int i, nLength;
+
+  *ppoHashTable = NULL;
+
+  if(!pszTag || !pszInstr) {
+    msSetError(MS_WEBERR, "Invalid pointer.", "getCachedTagArgs()");
+    return MS_FAILURE;
+  }
+
+  pszStart = findTag(pszInstr, pszTag);
+  if(!pszStart || (pszEnd = findTagEnd(pszStart)) == NULL)
+    return MS_SUCCESS; /* as getTagArgs(), no arguments */
+  nLength = pszEnd - pszStart + 1;
+
+  for(i=0; i<mapserv->numtags; i++) {
+    if(strncmp(mapserv->tags[i].tag, pszStart, nLength) == 0 && mapserv->tags[i].tag[nLength] == '\0') {
+      *ppoHashTable = mapserv->tags[i].args;
+      return MS_SUCCESS;
+    }
+  }
+
+  if(getTagArgs(pszTag, pszStart, &args) != MS_SUCCESS)
+    return MS_FAILURE;
+
+  /* tags that differ for every result (e.g. built from attributes) would fill the list */
+  if(mapserv->numtags == MS_TEMPLATE_MAXTAGS)
+    freeCachedTagArgs(mapserv);
+  if(mapserv->numtags == 0)
+    mapserv->tags = (templateTagObj *) msSmallMalloc(MS_TEMPLATE_MAXTAGS * sizeof(templateTagObj));
+
+  mapserv->tags[mapserv->numtags].tag = (char *) msSmallMalloc(nLength + 1);
+  strlcpy(mapserv->tags[mapserv->numtags].tag, pszStart, nLength + 1);
+  mapserv->tags[mapserv->numtags].args = args;
+  mapserv->numtags++;
+
+  *ppoHashTable = args;
+  return MS_SUCCESS;
+}
+
 /*
 ** Return a substring from instr between [tag] and [/tag]
 ** char * returned must be freed by caller.
@@ -850,6 +1176,8 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   char *argValue;
   char *tag, *tagInstance, *tagStart;
   hashTableObj *tagArgs=NULL;
+  templateNodeListObj *nodes;
+  bufferObj output;
 
   int limit=-1;
   char *trimLast=NULL;
@@ -889,9 +1217,12 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   preTag = getPreTagText(*line, "[feature");
   postTag = getPostTagText(*line, "[/feature]");
 
-  /* start rebuilding **line */
+  /* start rebuilding **line, results are appended to a buffer rather than to the line */
   free(*line);
-  *line = preTag;
+  *line = NULL;
+  msBufferInit(&output);
+  msBufferAppend(&output, preTag, strlen(preTag));
+  free(preTag);
 
   /* we know the layer has query results or we wouldn't be in this code */
 
@@ -906,6 +1237,7 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
     for(j=0; j<layer->numjoins; j++) {
       status = msJoinConnect(layer, &(layer->joins[j]));
       if(status != MS_SUCCESS) {
+        *line = templateBufferString(&output);
         msFreeHashTable(tagArgs);
         return status;
       }
@@ -921,9 +1253,13 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   else
     limit = MS_MIN(limit, layer->resultcache->numresults);
 
+  nodes = templateCompile(tag); /* once for all the features */
+
   for(i=0; i<limit; i++) {
     status = msLayerGetShape(layer, &(mapserv->resultshape), &(layer->resultcache->results[i]));
     if(status != MS_SUCCESS) {
+      *line = templateBufferString(&output);
+      templateFreeNodes(nodes);
       msFreeHashTable(tagArgs);
       return status;
     }
@@ -949,15 +1285,22 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
     */
     if(trimLast && (i == limit-1)) {
       char *ptr;
-      if((ptr = strrstr(tag, trimLast)) != NULL)
+      if((ptr = strrstr(tag, trimLast)) != NULL) {
         *ptr = '\0';
+        templateFreeNodes(nodes);
+        nodes = templateCompile(tag);
+      }
     }
 
     /* process the tag */
-    tagInstance = processLine(mapserv, tag, NULL, QUERY); /* do substitutions */
-    *line = msStringConcatenate(*line, tagInstance); /* grow the line */
+    if(templateRenderNodes(mapserv, nodes, &output) == MS_DONE) {
+      tagInstance = processLine(mapserv, tag, NULL, QUERY); /* do substitutions */
+      if(tagInstance) {
+        msBufferAppend(&output, tagInstance, strlen(tagInstance)); /* grow the line */
+        free(tagInstance);
+      }
+    }
 
-    free(tagInstance);
     msFreeShape(&(mapserv->resultshape)); /* init too */
 
     mapserv->RN++; /* increment counters */
@@ -967,13 +1310,15 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
   /* msLayerClose(layer); */
   mapserv->resultlayer = NULL; /* necessary? */
 
-  *line = msStringConcatenate(*line, postTag);
+  msBufferAppend(&output, postTag, strlen(postTag));
+  *line = templateBufferString(&output);
 
   /*
   ** clean up
   */
   free(postTag);
   free(tag);
+  templateFreeNodes(nodes);
   msFreeHashTable(tagArgs);
 
   return(MS_SUCCESS);
@@ -982,9 +1327,9 @@ static int processFeatureTag(mapservObj *mapserv, char **line, layerObj *layer)
 /*
 ** Function to process a [resultset ...] tag.
 */
-static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
+static int processResultSetTag(mapservObj *mapserv, char **line, templateReaderObj *reader)
 {
-  char lineBuffer[MS_BUFFER_LENGTH];
+  char *nextLine;
   int foundTagEnd;
 
   char *preTag, *postTag; /* text before and after the tag */
@@ -1033,7 +1378,7 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
     lp = GET_LAYER(mapserv->map, layerIndex);
 
     if(strstr(*line, "[/resultset]") == NULL) { /* read ahead */
-      if(!stream) {
+      if(!reader) {
         msSetError(MS_WEBERR, "Invalid file pointer.", "processResultSetTag()");
         msFreeHashTable(tagArgs);
         return(MS_FAILURE);
@@ -1041,8 +1386,8 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
 
       foundTagEnd = MS_FALSE;
       while(!foundTagEnd) {
-        if(fgets(lineBuffer, MS_BUFFER_LENGTH, stream) != NULL) {
-          *line = msStringConcatenate(*line, lineBuffer);
+        if((nextLine = templateReadLine(reader)) != NULL) {
+          *line = msStringConcatenate(*line, nextLine);
           if(strstr(*line, "[/resultset]") != NULL)
             foundTagEnd = MS_TRUE;
         } else
@@ -1098,16 +1443,16 @@ static int processResultSetTag(mapservObj *mapserv, char **line, FILE *stream)
 ** TODO's:
 **   - allow URLs
 */
-static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int mode)
+static int processIncludeTag(mapservObj *mapserv, char **line, templateReaderObj *reader, int mode)
 {
   char *tag, *tagStart, *tagEnd;
   hashTableObj *tagArgs=NULL;
   int tagOffset, tagLength;
 
-  char *content=NULL, *processedContent=NULL, *src=NULL;
+  char *processedContent=NULL, *src=NULL;
 
-  FILE *includeStream;
-  char buffer[MS_BUFFER_LENGTH], path[MS_MAXPATHLEN];
+  templateFileObj *includeFile;
+  char path[MS_MAXPATHLEN];
 
   if(!*line) {
     msSetError(MS_WEBERR, "Invalid line pointer.", "processIncludeTag()");
@@ -1130,22 +1475,16 @@ static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int
 
     if(!src) return(MS_SUCCESS); /* don't process the tag, could be something else so return MS_SUCCESS */
 
-    if((includeStream = fopen(msBuildPath(path, mapserv->map->mappath, src), "r")) == NULL) {
+    if((includeFile = templateGetFile(msBuildPath(path, mapserv->map->mappath, src))) == NULL) {
       msSetError(MS_IOERR, "%s", "processIncludeTag()", src);
       return MS_FAILURE;
     }
 
-    if(isValidTemplate(includeStream, src) != MS_TRUE) {
-      fclose(includeStream);
+    if(isValidTemplate(includeFile, src) != MS_TRUE) {
+      templateReleaseFile(includeFile);
       return MS_FAILURE;
     }
 
-    while(fgets(buffer, MS_BUFFER_LENGTH, includeStream) != NULL)
-      content = msStringConcatenate(content, buffer);
-
-    /* done with included file handle */
-    fclose(includeStream);
-
     /* find the end of the tag */
     tagEnd = findTagEnd(tagStart);
     tagEnd++;
@@ -1156,7 +1495,10 @@ static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int
     strlcpy(tag, tagStart, tagLength+1);
 
     /* process any other tags in the content */
-    processedContent = processLine(mapserv, content, stream, mode);
+    processedContent = processLine(mapserv, includeFile->body, reader, mode);
+
+    /* done with the included file */
+    templateReleaseFile(includeFile);
 
     /* do the replacement */
     *line = msReplaceSubstring(*line, tag, processedContent);
@@ -1166,7 +1508,6 @@ static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int
     tag = NULL;
     msFreeHashTable(tagArgs);
     tagArgs=NULL;
-    free(content);
     free(processedContent);
 
     if((*line)[tagOffset] != '\0')
@@ -1183,13 +1524,15 @@ static int processIncludeTag(mapservObj *mapserv, char **line, FILE *stream, int
 */
 enum ITEM_ESCAPING {ESCAPE_HTML, ESCAPE_URL, ESCAPE_NONE};
 
-static int processItemTag(layerObj *layer, char **line, shapeObj *shape)
+/*
+** Returns the value of an [item ...] tag with the given arguments for shape,
+** escaped as the tag asks, or NULL on error. The value must be freed by the
+** caller.
+*/
+static char *getItemTagValue(layerObj *layer, hashTableObj *tagArgs, shapeObj *shape)
 {
   int i, j;
 
-  char *tag, *tagStart, *tagEnd;
-  hashTableObj *tagArgs=NULL;
-  int tagLength;
   char *encodedTagValue=NULL, *tagValue=NULL;
 
   char *argValue=NULL;
@@ -1200,110 +1543,135 @@ static int processItemTag(layerObj *layer, char **line, shapeObj *shape)
   int uc, lc, commify;
   int escape;
 
-  if(!*line) {
-    msSetError(MS_WEBERR, "Invalid line pointer.", "processItemTag()");
-    return(MS_FAILURE);
-  }
+  format = "$value"; /* initialize the tag arguments */
+  nullFormat = "";
+  precision=-1;
+  name = pattern = NULL;
+  uc = lc = commify = MS_FALSE;
+  escape=ESCAPE_HTML;
 
-  tagStart = findTag(*line, "item");
+  if(tagArgs) {
+    argValue = msLookupHashTable(tagArgs, "name");
+    if(argValue) name = argValue;
 
-  if(!tagStart) return(MS_SUCCESS); /* OK, just return; */
+    argValue = msLookupHashTable(tagArgs, "pattern");
+    if(argValue) pattern = argValue;
 
-  while (tagStart) {
-    format = "$value"; /* initialize the tag arguments */
-    nullFormat = "";
-    precision=-1;
-    name = pattern = NULL;
-    uc = lc = commify = MS_FALSE;
-    escape=ESCAPE_HTML;
+    argValue = msLookupHashTable(tagArgs, "precision");
+    if(argValue) precision = atoi(argValue);
 
-    /* check for any tag arguments */
-    if(getTagArgs("item", tagStart, &tagArgs) != MS_SUCCESS) return(MS_FAILURE);
-    if(tagArgs) {
-      argValue = msLookupHashTable(tagArgs, "name");
-      if(argValue) name = argValue;
+    argValue = msLookupHashTable(tagArgs, "format");
+    if(argValue) format = argValue;
 
-      argValue = msLookupHashTable(tagArgs, "pattern");
-      if(argValue) pattern = argValue;
+    argValue = msLookupHashTable(tagArgs, "nullformat");
+    if(argValue) nullFormat = argValue;
 
-      argValue = msLookupHashTable(tagArgs, "precision");
-      if(argValue) precision = atoi(argValue);
+    argValue = msLookupHashTable(tagArgs, "uc");
+    if(argValue && strcasecmp(argValue, "true") == 0) uc = MS_TRUE;
 
-      argValue = msLookupHashTable(tagArgs, "format");
-      if(argValue) format = argValue;
+    argValue = msLookupHashTable(tagArgs, "lc");
+    if(argValue && strcasecmp(argValue, "true") == 0) lc = MS_TRUE;
 
-      argValue = msLookupHashTable(tagArgs, "nullformat");
-      if(argValue) nullFormat = argValue;
+    argValue = msLookupHashTable(tagArgs, "commify");
+    if(argValue && strcasecmp(argValue, "true") == 0) commify = MS_TRUE;
 
-      argValue = msLookupHashTable(tagArgs, "uc");
-      if(argValue && strcasecmp(argValue, "true") == 0) uc = MS_TRUE;
+    argValue = msLookupHashTable(tagArgs, "escape");
+    if(argValue && strcasecmp(argValue, "url") == 0) escape = ESCAPE_URL;
+    else if(argValue && strcasecmp(argValue, "none") == 0) escape = ESCAPE_NONE;
 
-      argValue = msLookupHashTable(tagArgs, "lc");
-      if(argValue && strcasecmp(argValue, "true") == 0) lc = MS_TRUE;
+    /* TODO: deal with sub strings */
+  }
 
-      argValue = msLookupHashTable(tagArgs, "commify");
-      if(argValue && strcasecmp(argValue, "true") == 0) commify = MS_TRUE;
+  if(!name) {
+    msSetError(MS_WEBERR, "Item tag contains no name attribute.", "processItemTag()");
+    return(NULL);
+  }
 
-      argValue = msLookupHashTable(tagArgs, "escape");
-      if(argValue && strcasecmp(argValue, "url") == 0) escape = ESCAPE_URL;
-      else if(argValue && strcasecmp(argValue, "none") == 0) escape = ESCAPE_NONE;
+  for(i=0; i<layer->numitems; i++)
+    if(strcasecmp(name, layer->items[i]) == 0) break;
 
-      /* TODO: deal with sub strings */
-    }
+  if(i == layer->numitems) {
+    msSetError(MS_WEBERR, "Item name (%s) not found in layer item list.", "processItemTag()", name);
+    return(NULL);
+  }
 
-    if(!name) {
-      msSetError(MS_WEBERR, "Item tag contains no name attribute.", "processItemTag()");
-      return(MS_FAILURE);
-    }
+  /*
+  ** now we know which item so build the tagValue
+  */
+  if(shape->values[i] && strlen(shape->values[i]) > 0) {
+    char *itemValue=NULL;
 
-    for(i=0; i<layer->numitems; i++)
-      if(strcasecmp(name, layer->items[i]) == 0) break;
+    /* set tag text depending on pattern (if necessary), nullFormat can contain $value (#3637) */
+    if(pattern && msEvalRegex(pattern, shape->values[i]) != MS_TRUE)
+      tagValue = msStrdup(nullFormat);
+    else
+      tagValue = msStrdup(format);
 
-    if(i == layer->numitems) {
-      msSetError(MS_WEBERR, "Item name (%s) not found in layer item list.", "processItemTag()", name);
-      return(MS_FAILURE);
-    }
+    if(precision != -1) {
+      char numberFormat[16];
 
-    /*
-    ** now we know which item so build the tagValue
-    */
-    if(shape->values[i] && strlen(shape->values[i]) > 0) {
-      char *itemValue=NULL;
+      itemValue = (char *) msSmallMalloc(64); /* plenty big */
+      snprintf(numberFormat, sizeof(numberFormat), "%%.%dlf", precision);
+      snprintf(itemValue, 64, numberFormat, atof(shape->values[i]));
+    } else
+      itemValue = msStrdup(shape->values[i]);
 
-      /* set tag text depending on pattern (if necessary), nullFormat can contain $value (#3637) */
-      if(pattern && msEvalRegex(pattern, shape->values[i]) != MS_TRUE)
-        tagValue = msStrdup(nullFormat);
-      else
-        tagValue = msStrdup(format);
+    if(commify == MS_TRUE)
+      itemValue = msCommifyString(itemValue);
 
-      if(precision != -1) {
-        char numberFormat[16];
+    /* apply other effects */
+    if(uc == MS_TRUE)
+      for(j=0; j<strlen(itemValue); j++) itemValue[j] = toupper(itemValue[j]);
+    if(lc == MS_TRUE)
+      for(j=0; j<strlen(itemValue); j++) itemValue[j] = tolower(itemValue[j]);
 
-        itemValue = (char *) msSmallMalloc(64); /* plenty big */
-        snprintf(numberFormat, sizeof(numberFormat), "%%.%dlf", precision);
-        snprintf(itemValue, 64, numberFormat, atof(shape->values[i]));
-      } else
-        itemValue = msStrdup(shape->values[i]);
+    tagValue = msReplaceSubstring(tagValue, "$value", itemValue);
+    msFree(itemValue);
 
-      if(commify == MS_TRUE)
-        itemValue = msCommifyString(itemValue);
+    if(!tagValue) {
+      msSetError(MS_WEBERR, "Error applying item format.", "processItemTag()");
+      return(NULL); /* todo leaking... */
+    }
+  } else {
+    tagValue = msStrdup(nullFormat); /* attribute value is NULL or empty */
+  }
 
-      /* apply other effects */
-      if(uc == MS_TRUE)
-        for(j=0; j<strlen(itemValue); j++) itemValue[j] = toupper(itemValue[j]);
-      if(lc == MS_TRUE)
-        for(j=0; j<strlen(itemValue); j++) itemValue[j] = tolower(itemValue[j]);
+  switch(escape) {
+    case ESCAPE_HTML:
+      encodedTagValue = msEncodeHTMLEntities(tagValue);
+      msFree(tagValue);
+      return encodedTagValue;
+    case ESCAPE_URL:
+      encodedTagValue = msEncodeUrl(tagValue);
+      msFree(tagValue);
+      return encodedTagValue;
+    default: /* ESCAPE_NONE */
+      return tagValue;
+  }
+}
 
-      tagValue = msReplaceSubstring(tagValue, "$value", itemValue);
-      msFree(itemValue);
+static int processItemTag(mapservObj *mapserv, layerObj *layer, char **line, shapeObj *shape)
+{
+  char *tag, *tagStart, *tagEnd;
+  hashTableObj *tagArgs=NULL;
+  int tagLength;
+  char *tagValue=NULL;
 
-      if(!tagValue) {
-        msSetError(MS_WEBERR, "Error applying item format.", "processItemTag()");
-        return(MS_FAILURE); /* todo leaking... */
-      }
-    } else {
-      tagValue = msStrdup(nullFormat); /* attribute value is NULL or empty */
-    }
+  if(!*line) {
+    msSetError(MS_WEBERR, "Invalid line pointer.", "processItemTag()");
+    return(MS_FAILURE);
+  }
+
+  tagStart = findTag(*line, "item");
+
+  if(!tagStart) return(MS_SUCCESS); /* OK, just return; */
+
+  while (tagStart) {
+    /* check for any tag arguments, parsed once per request */
+    if(getCachedTagArgs(mapserv, "item", tagStart, &tagArgs) != MS_SUCCESS) return(MS_FAILURE);
+
+    if((tagValue = getItemTagValue(layer, tagArgs, shape)) == NULL)
+      return(MS_FAILURE);
 
     /* find the end of the tag */
     tagEnd = findTagEnd(tagStart);
@@ -1315,31 +1683,14 @@ static int processItemTag(layerObj *layer, char **line, shapeObj *shape)
     strlcpy(tag, tagStart, tagLength+1);
 
     /* do the replacement */
-    switch(escape) {
-      case ESCAPE_HTML:
-        encodedTagValue = msEncodeHTMLEntities(tagValue);
-        *line = msReplaceSubstring(*line, tag, encodedTagValue);
-        break;
-      case ESCAPE_URL:
-        encodedTagValue = msEncodeUrl(tagValue);
-        *line = msReplaceSubstring(*line, tag, encodedTagValue);
-        break;
-      case ESCAPE_NONE:
-        *line = msReplaceSubstring(*line, tag, tagValue);
-        break;
-      default:
-        break;
-    }
+    *line = msReplaceSubstring(*line, tag, tagValue);
 
     /* clean up */
     free(tag);
     tag = NULL;
-    msFreeHashTable(tagArgs);
-    tagArgs=NULL;
+    tagArgs=NULL; /* belongs to mapserv */
     msFree(tagValue);
     tagValue=NULL;
-    msFree(encodedTagValue);
-    encodedTagValue=NULL;
 
     tagStart = findTag(*line, "item");
   }
@@ -1914,7 +2265,7 @@ static int processDateTag(char **line)
 **   - Need generalization routines (not here, but in mapprimative.c).
 **   - Try to avoid all the realloc calls.
 */
-static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
+static int processShpxyTag(mapservObj *mapserv, layerObj *layer, char **line, shapeObj *shape)
 {
   int i,j,p;
   int status;
@@ -1948,7 +2299,8 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
   char *projectionString=NULL;
 
   shapeObj tShape;
-  char *coords=NULL, point[128];
+  bufferObj coords;
+  char point[128];
 
 
   if(!*line) {
@@ -1988,7 +2340,7 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     tagOffset = tagStart - *line;
 
     /* check for any tag arguments */
-    if(getTagArgs("shpxy", tagStart, &tagArgs) != MS_SUCCESS) return(MS_FAILURE);
+    if(getCachedTagArgs(mapserv, "shpxy", tagStart, &tagArgs) != MS_SUCCESS) return(MS_FAILURE);
     if(tagArgs) {
       argValue = msLookupHashTable(tagArgs, "xh");
       if(argValue) xh = argValue;
@@ -2155,8 +2507,9 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     /*
     ** build the coordinate string
     */
+    msBufferInit(&coords);
 
-    if(strlen(sh) > 0) coords = msStringConcatenate(coords, sh);
+    if(strlen(sh) > 0) msBufferAppend(&coords, sh, strlen(sh));
 
     /* do we need to handle inner/outer rings */
     if(tShape.type == MS_SHAPE_POLYGON && strlen(orh) > 0 && strlen(irh) > 0) {
@@ -2169,34 +2522,34 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
         int *inners;
         if( outers[i] ) {
           /* this is an outer ring */
-          if((!firstPart) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+          if((!firstPart) && (strlen(ps) > 0)) msBufferAppend(&coords, ps, strlen(ps));
           firstPart = 0;
-          if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
-          coords = msStringConcatenate(coords, orh);
+          if(strlen(ph) > 0) msBufferAppend(&coords, ph, strlen(ph));
+          msBufferAppend(&coords, orh, strlen(orh));
           for(p=0; p<tShape.line[i].numpoints-1; p++) {
             snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-            coords = msStringConcatenate(coords, point);
+            msBufferAppend(&coords, point, strlen(point));
           }
           snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
-          coords = msStringConcatenate(coords, orf);
+          msBufferAppend(&coords, point, strlen(point));
+          msBufferAppend(&coords, orf, strlen(orf));
 
           inners = msGetInnerList(&tShape, i, outers);
           /* loop over rings looking for inners to this outer */
           for(j=0; j<tShape.numlines; j++) {
             if( inners[j] ) {
               /* j is an inner ring of i */
-              coords = msStringConcatenate(coords, irh);
+              msBufferAppend(&coords, irh, strlen(irh));
               for(p=0; p<tShape.line[j].numpoints-1; p++) {
                 snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-                coords = msStringConcatenate(coords, point);
+                msBufferAppend(&coords, point, strlen(point));
               }
               snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[j].point[p].x, scale_y*tShape.line[j].point[p].y);
-              coords = msStringConcatenate(coords, irf);
+              msBufferAppend(&coords, irf, strlen(irf));
             }
           }
           free( inners );
-          if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+          if(strlen(pf) > 0) msBufferAppend(&coords, pf, strlen(pf));
         }
       } /* end of loop over outer rings */
       free( outers );
@@ -2209,21 +2562,21 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
             (tShape.type == MS_SHAPE_POLYGON && tShape.line[i].numpoints < 3))
           continue;
 
-        if(strlen(ph) > 0) coords = msStringConcatenate(coords, ph);
+        if(strlen(ph) > 0) msBufferAppend(&coords, ph, strlen(ph));
 
         for(p=0; p<tShape.line[i].numpoints-1; p++) {
           snprintf(point, sizeof(point), pointFormat1, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-          coords = msStringConcatenate(coords, point);
+          msBufferAppend(&coords, point, strlen(point));
         }
         snprintf(point, sizeof(point), pointFormat2, scale_x*tShape.line[i].point[p].x, scale_y*tShape.line[i].point[p].y);
-        coords = msStringConcatenate(coords, point);
+        msBufferAppend(&coords, point, strlen(point));
 
-        if(strlen(pf) > 0) coords = msStringConcatenate(coords, pf);
+        if(strlen(pf) > 0) msBufferAppend(&coords, pf, strlen(pf));
 
-        if((i < tShape.numlines-1) && (strlen(ps) > 0)) coords = msStringConcatenate(coords, ps);
+        if((i < tShape.numlines-1) && (strlen(ps) > 0)) msBufferAppend(&coords, ps, strlen(ps));
       }
     }
-    if(strlen(sf) > 0) coords = msStringConcatenate(coords, sf);
+    if(strlen(sf) > 0) msBufferAppend(&coords, sf, strlen(sf));
 
     msFreeShape(&tShape);
 
@@ -2237,19 +2590,17 @@ static int processShpxyTag(layerObj *layer, char **line, shapeObj *shape)
     strlcpy(tag, tagStart, tagLength+1);
 
     /* do the replacement */
-    *line = msReplaceSubstring(*line, tag, coords);
+    *line = msReplaceSubstring(*line, tag, templateBufferString(&coords));
 
     /* clean up */
     free(tag);
     tag = NULL;
-    msFreeHashTable(tagArgs);
-    tagArgs=NULL;
+    tagArgs=NULL; /* belongs to mapserv */
     free(pointFormat1);
     pointFormat1 = NULL;
     free(pointFormat2);
     pointFormat2 = NULL;
-    free(coords);
-    coords = NULL;
+    msBufferFree(&coords);
 
     if((*line)[tagOffset] != '\0')
       tagStart = findTag(*line+tagOffset+1, "shpxy");
@@ -2924,9 +3275,8 @@ int generateClassTemplate(char* pszClassTemplate, mapObj *map, int nIdxLayer, in
 
 char *generateLegendTemplate(mapservObj *mapserv)
 {
-  FILE *stream;
+  templateFileObj *templateFile;
   char *file = NULL;
-  int length;
   char *pszResult = NULL;
   char *legGroupHtml = NULL;
   char *legLayerHtml = NULL;
@@ -3033,37 +3383,14 @@ char *generateLegendTemplate(mapservObj *mapserv)
     pszPrefix = msStringConcatenate(pszPrefix, pszTime);
   }
 
-  /* open template */
-  if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, mapserv->map->legend.template), "r")) == NULL) {
+  /* get the template, read from disk only once */
+  if((templateFile = templateGetFile(msBuildPath(szPath, mapserv->map->mappath, mapserv->map->legend.template))) == NULL) {
     msSetError(MS_IOERR, "Error while opening template file.", "generateLegendTemplate()");
     return NULL;
   }
 
-  fseek(stream, 0, SEEK_END);
-  length = ftell(stream);
-  rewind(stream);
-
-  file = (char*)msSmallMalloc(length + 1);
-
-  if(!file) {
-    msSetError(MS_IOERR, "Error while allocating memory for template file.", "generateLegendTemplate()");
-    fclose(stream);
-    return NULL;
-  }
-
-  /*
-   * Read all the template file
-   */
-  fread(file, length, 1, stream);
-  /* Disabled for now due to Windows issue, see ticket #3814
-     if( 1 != fread(file, length, 1, stream)) {
-       msSetError(MS_IOERR, "Error while reading template file.", "generateLegendTemplate()");
-       free(file);
-       fclose(stream);
-       return NULL;
-     }
-  */
-  file[length] = '\0';
+  file = msStrdup(templateFile->text);
+  templateReleaseFile(templateFile);
 
   if(msValidateContexts(mapserv->map) != MS_SUCCESS) return NULL; /* make sure there are no recursive REQUIRES or LABELREQUIRES expressions */
 
@@ -3429,8 +3756,6 @@ error:
   msFree(legClassHtml);
   msFree(pszPrefix);
 
-  fclose(stream);
-
   /* -------------------------------------------------------------------- */
   /*      Reset the layerdrawing order.                                   */
   /* -------------------------------------------------------------------- */
@@ -3446,97 +3771,368 @@ error:
 
 char *processOneToManyJoin(mapservObj* mapserv, joinObj *join)
 {
-  int records=MS_FALSE;
-  FILE *stream=NULL;
-  char *outbuf;
-  char line[MS_BUFFER_LENGTH], *tmpline;
+  int i, status, records=MS_FALSE;
+  templateFileObj *file=NULL;
+  bufferObj outbuf;
+  char *tmpline;
   char szPath[MS_MAXPATHLEN];
 
-  if((outbuf = msStrdup("")) == NULL) return(NULL); /* empty at first */
+  msBufferInit(&outbuf); /* empty at first */
 
   msJoinPrepare(join, &(mapserv->resultshape)); /* execute the join */
   while(msJoinNext(join) == MS_SUCCESS) {
-    /* First time through, deal with the header (if necessary) and open the main template. We only */
+    /* First time through, deal with the header (if necessary) and get the main template. We only */
     /* want to do this if there are joined records. */
     if(records == MS_FALSE) {
       if(join->header != NULL) {
-        if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->header), "r")) == NULL) {
+        if((file = templateGetFile(msBuildPath(szPath, mapserv->map->mappath, join->header))) == NULL) {
           msSetError(MS_IOERR, "Error while opening join header file %s.", "processOneToManyJoin()", join->header);
+          msBufferFree(&outbuf);
           return(NULL);
         }
 
-        if(isValidTemplate(stream, join->header) != MS_TRUE) {
-          fclose(stream);
+        if(isValidTemplate(file, join->header) != MS_TRUE) {
+          templateReleaseFile(file);
+          msBufferFree(&outbuf);
           return NULL;
         }
 
         /* echo file to the output buffer, no substitutions */
-        while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) outbuf = msStringConcatenate(outbuf, line);
+        msBufferAppend(&outbuf, file->body, strlen(file->body));
 
-        fclose(stream);
+        templateReleaseFile(file);
       }
 
-      if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->template), "r")) == NULL) {
+      if((file = templateGetFile(msBuildPath(szPath, mapserv->map->mappath, join->template))) == NULL) {
         msSetError(MS_IOERR, "Error while opening join template file %s.", "processOneToManyJoin()", join->template);
+        msBufferFree(&outbuf);
         return(NULL);
       }
 
-      if(isValidTemplate(stream, join->template) != MS_TRUE) {
-        fclose(stream);
+      if(isValidTemplate(file, join->template) != MS_TRUE) {
+        templateReleaseFile(file);
+        msBufferFree(&outbuf);
         return NULL;
       }
 
       records = MS_TRUE;
     }
 
-    while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) { /* now on to the end of the template */
-      if(strchr(line, '[') != NULL) {
-        tmpline = processLine(mapserv, line, NULL, QUERY); /* no multiline tags are allowed in a join */
-        if(!tmpline) return NULL;
-        outbuf = msStringConcatenate(outbuf, tmpline);
+    for(i=0; i<file->numlines; i++) { /* now on to the end of the template */
+      if(file->tagged[i]) {
+        if((status = templateRenderNodes(mapserv, file->compiled[i], &outbuf)) != MS_DONE) {
+          if(status != MS_SUCCESS) {
+            templateReleaseFile(file);
+            msBufferFree(&outbuf);
+            return NULL;
+          }
+          continue;
+        }
+
+        tmpline = processLine(mapserv, file->lines[i], NULL, QUERY); /* no multiline tags are allowed in a join */
+        if(!tmpline) {
+          templateReleaseFile(file);
+          msBufferFree(&outbuf);
+          return NULL;
+        }
+        msBufferAppend(&outbuf, tmpline, strlen(tmpline));
         free(tmpline);
       } else /* no subs, just echo */
-        outbuf = msStringConcatenate(outbuf, line);
+        msBufferAppend(&outbuf, file->lines[i], file->lengths[i]);
     }
-
-    rewind(stream);
-    fgets(line, MS_BUFFER_LENGTH, stream); /* skip the first line since it's the magic string */
   } /* next record */
 
+  if(records == MS_TRUE)
+    templateReleaseFile(file);
+
   if(records==MS_TRUE && join->footer) {
-    if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, join->footer), "r")) == NULL) {
+    if((file = templateGetFile(msBuildPath(szPath, mapserv->map->mappath, join->footer))) == NULL) {
       msSetError(MS_IOERR, "Error while opening join footer file %s.", "processOneToManyJoin()", join->footer);
+      msBufferFree(&outbuf);
       return(NULL);
     }
 
-    if(isValidTemplate(stream, join->footer) != MS_TRUE) {
-      fclose(stream);
+    if(isValidTemplate(file, join->footer) != MS_TRUE) {
+      templateReleaseFile(file);
+      msBufferFree(&outbuf);
       return NULL;
     }
 
     /* echo file to the output buffer, no substitutions */
-    while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) outbuf = msStringConcatenate(outbuf, line);
+    msBufferAppend(&outbuf, file->body, strlen(file->body));
 
-    fclose(stream);
+    templateReleaseFile(file);
   }
 
   /* clear any data associated with the join */
   msFreeCharArray(join->values, join->numitems);
   join->values = NULL;
 
-  return(outbuf);
+  return(templateBufferString(&outbuf));
+}
+
+/*
+** Tags processLine() replaces in query mode before the attributes, other
+** than the ones the nodes render. A line holding one of them isn't compiled.
+*/
+static const char *templateLineTags[] = {
+  "version", "img", "ref", "errmsg", "errmsg_esc", "legend", "scalebar", "queryfile", "map", "mapserv_onlineresource",
+  "host", "port", "layers", "layers_esc", "toggle_layers", "toggle_layers_esc", "mapx", "mapy", "minx", "maxx", "miny", "maxy",
+  "date", "mapext", "mapext_esc", "dx", "dy", "rawminx", "rawmaxx", "rawminy", "rawmaxy", "rawext", "rawext_esc",
+  "maplon", "maplat", "minlon", "maxlon", "minlat", "maxlat", "mapext_latlon", "mapext_latlon_esc",
+  "refminx", "refmaxx", "refminy", "refmaxy", "refext", "refext_esc", "mapsize", "mapsize_esc", "mapwidth", "mapheight",
+  "scale", "scaledenom", "cellsize", "center", "center_x", "center_y", "items", "shpext", "shpext_esc", "shplabel", "include",
+  NULL
+};
+
+static const struct {
+  const char *name;
+  int type;
+} templateNodeTags[] = {
+  {"id", TEMPLATE_ID}, {"nr", TEMPLATE_NR}, {"nl", TEMPLATE_NL}, {"nlr", TEMPLATE_NLR}, {"rn", TEMPLATE_RN}, {"lrn", TEMPLATE_LRN},
+  {"cl", TEMPLATE_CL}, {"shpmid", TEMPLATE_SHPMID}, {"shpmidx", TEMPLATE_SHPMIDX}, {"shpmidy", TEMPLATE_SHPMIDY},
+  {"shpclass", TEMPLATE_SHPCLASS}, {"shpminx", TEMPLATE_SHPMINX}, {"shpminy", TEMPLATE_SHPMINY}, {"shpmaxx", TEMPLATE_SHPMAXX},
+  {"shpmaxy", TEMPLATE_SHPMAXY}, {"shpidx", TEMPLATE_SHPIDX}, {"tileidx", TEMPLATE_TILEIDX}, {"values", TEMPLATE_VALUES},
+  {NULL, 0}
+};
+
+/*
+** Returns the node type of the tag with the given text between the
+** brackets, or -1 if processLine() must take care of it.
+*/
+static int templateTagType(const char *name)
+{
+  int i, length;
+  const char *args;
+
+  for(i=0; templateNodeTags[i].name; i++)
+    if(strcmp(name, templateNodeTags[i].name) == 0) return templateNodeTags[i].type;
+
+  args = strchr(name, ' ');
+  length = args ? args - name : strlen(name);
+
+  if(length == 5 && strncmp(name, "shpxy", 5) == 0) return TEMPLATE_SHPXY;
+  for(i=0; templateLineTags[i]; i++)
+    if(strlen(templateLineTags[i]) == length && strncmp(name, templateLineTags[i], length) == 0) return -1;
+  if(args) return (length == 4 && strncmp(name, "item", 4) == 0) ? TEMPLATE_ITEM : -1;
+
+  /* web and layer metadata, form widgets */
+  if(strncmp(name, "web_", 4) == 0 || strncmp(name, "metadata_", 9) == 0) return -1;
+  if(length > 7 && strcmp(name + length - 7, "_select") == 0) return -1;
+  if(length > 6 && strcmp(name + length - 6, "_check") == 0) return -1;
+
+  return TEMPLATE_ATTRIBUTE; /* or a join, resolved when rendered */
+}
+
+static void templateFreeNodes(templateNodeListObj *list)
+{
+  int i;
+
+  if(!list) return;
+  for(i=0; i<list->numnodes; i++) {
+    msFree(list->nodes[i].name);
+    msFreeHashTable(list->nodes[i].args);
+  }
+  msFree(list->nodes);
+  msFree(list);
+}
+
+/*
+** Compiles text into literal and tag nodes, returns NULL if the text holds
+** a tag processLine() must take care of, a '[' inside a tag or a tag with
+** no end. The text must outlive the nodes.
+*/
+static templateNodeListObj *templateCompile(char *text)
+{
+  templateNodeListObj *list;
+  templateNodeObj *node;
+  char *p, *end;
+
+  list = (templateNodeListObj *) msSmallCalloc(1, sizeof(templateNodeListObj));
+
+  for(p=text; *p; p=end) {
+    if(list->numnodes % 8 == 0)
+      list->nodes = (templateNodeObj *) msSmallRealloc(list->nodes, (list->numnodes + 8) * sizeof(templateNodeObj));
+    node = &(list->nodes[list->numnodes]);
+    memset(node, 0, sizeof(templateNodeObj));
+    node->text = p;
+
+    if(*p != '[') {
+      if((end = strchr(p, '[')) == NULL) end = p + strlen(p);
+      node->type = TEMPLATE_LITERAL;
+      node->length = end - p;
+      list->numnodes++;
+      continue;
+    }
+
+    if((end = findTagEnd(p)) == NULL || memchr(p+1, '[', end - p - 1) != NULL) {
+      templateFreeNodes(list);
+      return NULL;
+    }
+    end++;
+    node->length = end - p;
+    node->name = msSmallMalloc(node->length - 1);
+    strlcpy(node->name, p+1, node->length - 1);
+    list->numnodes++;
+
+    if((node->type = templateTagType(node->name)) == -1 ||
+        (node->type == TEMPLATE_ITEM && getTagArgs("item", p, &(node->args)) != MS_SUCCESS)) {
+      templateFreeNodes(list);
+      return NULL;
+    }
+  }
+
+  return list;
+}
+
+/*
+** Renders the current query result (mapserv->resultshape of
+** mapserv->resultlayer) from compiled nodes, appending to output. Gives
+** the same text as processLine() in QUERY mode, or returns MS_DONE with
+** output untouched when it can't (e.g. an attribute value holding a '[',
+** which processLine() would go on substituting into).
+*/
+static int templateRenderNodes(mapservObj *mapserv, templateNodeListObj *list, bufferObj *output)
+{
+  int i, j, escape;
+  size_t start = output->size;
+  char repstr[1024], *value;
+  const char *text;
+  layerObj *layer = mapserv->resultlayer;
+  shapeObj *shape = &(mapserv->resultshape);
+  templateNodeObj *node;
+
+  if(!list || !layer) return MS_DONE;
+
+  for(i=0; i<list->numnodes; i++) {
+    node = &(list->nodes[i]);
+    value = NULL;
+    text = repstr;
+
+    switch(node->type) {
+      case TEMPLATE_LITERAL:
+        msBufferAppend(output, (char *) node->text, node->length);
+        continue;
+      case TEMPLATE_ID:
+        text = mapserv->Id;
+        break;
+      case TEMPLATE_NR:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->NR);
+        break;
+      case TEMPLATE_NL:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->NL);
+        break;
+      case TEMPLATE_NLR:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->NLR);
+        break;
+      case TEMPLATE_RN:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->RN);
+        break;
+      case TEMPLATE_LRN:
+        snprintf(repstr, sizeof(repstr), "%d", mapserv->LRN);
+        break;
+      case TEMPLATE_CL:
+        text = layer->name;
+        break;
+      case TEMPLATE_SHPMID:
+        snprintf(repstr, sizeof(repstr), "%f %f", (shape->bounds.maxx + shape->bounds.minx)/2, (shape->bounds.maxy + shape->bounds.miny)/2);
+        break;
+      case TEMPLATE_SHPMIDX:
+        snprintf(repstr, sizeof(repstr), "%f", (shape->bounds.maxx + shape->bounds.minx)/2);
+        break;
+      case TEMPLATE_SHPMIDY:
+        snprintf(repstr, sizeof(repstr), "%f", (shape->bounds.maxy + shape->bounds.miny)/2);
+        break;
+      case TEMPLATE_SHPCLASS:
+        snprintf(repstr, sizeof(repstr), "%d", shape->classindex);
+        break;
+      case TEMPLATE_SHPMINX:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.minx);
+        break;
+      case TEMPLATE_SHPMINY:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.miny);
+        break;
+      case TEMPLATE_SHPMAXX:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.maxx);
+        break;
+      case TEMPLATE_SHPMAXY:
+        snprintf(repstr, sizeof(repstr), "%f", shape->bounds.maxy);
+        break;
+      case TEMPLATE_SHPIDX:
+        snprintf(repstr, sizeof(repstr), "%ld", shape->index);
+        break;
+      case TEMPLATE_TILEIDX:
+        snprintf(repstr, sizeof(repstr), "%d", shape->tileindex);
+        break;
+      case TEMPLATE_VALUES:
+        text = value = msJoinStrings(shape->values, layer->numitems, ",");
+        break;
+      case TEMPLATE_SHPXY:
+        value = (char *) msSmallMalloc(node->length + 1);
+        strlcpy(value, node->text, node->length + 1);
+        if(processShpxyTag(mapserv, layer, &value, shape) != MS_SUCCESS) {
+          msFree(value);
+          output->size = start;
+          return MS_FAILURE;
+        }
+        text = value;
+        break;
+      case TEMPLATE_ITEM:
+        if((text = value = getItemTagValue(layer, node->args, shape)) == NULL) {
+          output->size = start;
+          return MS_FAILURE;
+        }
+        break;
+      case TEMPLATE_ATTRIBUTE:
+        text = NULL;
+
+        /* [<layer>_<key>] is layer metadata */
+        for(j=0; j<mapserv->map->numlayers; j++) {
+          const char *name = GET_LAYER(mapserv->map, j)->name;
+          if(name && strncmp(node->name, name, strlen(name)) == 0 && node->name[strlen(name)] == '_') break;
+        }
+        if(j < mapserv->map->numlayers) break;
+
+        for(j=0; j<layer->numitems; j++) {
+          size_t length = strlen(layer->items[j]);
+
+          if(strncmp(node->name, layer->items[j], length) != 0) continue;
+          if(node->name[length] == '\0') escape = ESCAPE_HTML;
+          else if(strcmp(node->name + length, "_esc") == 0) escape = ESCAPE_URL;
+          else if(strcmp(node->name + length, "_raw") == 0) escape = ESCAPE_NONE;
+          else continue;
+
+          if(!shape->values[j]) break;
+          if(escape == ESCAPE_HTML) text = value = msEncodeHTMLEntities(shape->values[j]);
+          else if(escape == ESCAPE_URL) text = value = msEncodeUrl(shape->values[j]);
+          else text = shape->values[j];
+          break;
+        }
+        break;
+    }
+
+    if(!text || strchr(text, '[')) {
+      msFree(value);
+      output->size = start;
+      return MS_DONE;
+    }
+    msBufferAppend(output, (char *) text, strlen(text));
+    msFree(value);
+  }
+
+  return MS_SUCCESS;
 }
 
 /*
 ** Process a single line in the template. A few tags (e.g. [resultset]...[/resultset]) can be multi-line so
-** we pass the filehandle to look ahead if necessary.
+** we pass the template reader to look ahead if necessary.
 */
-static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mode)
+static char *processLine(mapservObj *mapserv, char *instr, templateReaderObj *reader, int mode)
 {
   int i, j;
 #define PROCESSLINE_BUFLEN 5120
   char repstr[PROCESSLINE_BUFLEN], substr[PROCESSLINE_BUFLEN], *outstr; /* repstr = replace string, substr = sub string */
-  struct hashObj *tp=NULL;
+  const char *key, *value;
   char *encodedstr;
 
 #ifdef USE_PROJ
@@ -3709,41 +4305,37 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
    */
 
   if(&(mapserv->map->web.metadata) && strstr(outstr, "web_")) {
-    for (j=0; j<MS_HASHSIZE; j++) {
-      if(mapserv->map->web.metadata.items[j] != NULL) {
-        for(tp=mapserv->map->web.metadata.items[j]; tp!=NULL; tp=tp->next) {
-          snprintf(substr, PROCESSLINE_BUFLEN, "[web_%s]", tp->key);
-          outstr = msReplaceSubstring(outstr, substr, tp->data);
-          snprintf(substr, PROCESSLINE_BUFLEN, "[web_%s_esc]", tp->key);
-
-          encodedstr = msEncodeUrl(tp->data);
-          outstr = msReplaceSubstring(outstr, substr, encodedstr);
-          free(encodedstr);
-        }
-      }
+    hashTableObj *metadata = &(mapserv->map->web.metadata);
+    for(key=msFirstKeyFromHashTable(metadata); key!=NULL; key=msNextKeyFromHashTable(metadata, key)) {
+      value = msLookupHashTable(metadata, key);
+      snprintf(substr, PROCESSLINE_BUFLEN, "[web_%s]", key);
+      outstr = msReplaceSubstring(outstr, substr, value);
+      snprintf(substr, PROCESSLINE_BUFLEN, "[web_%s_esc]", key);
+
+      encodedstr = msEncodeUrl(value);
+      outstr = msReplaceSubstring(outstr, substr, encodedstr);
+      free(encodedstr);
     }
   }
 
   /* allow layer metadata access in template */
   for(i=0; i<mapserv->map->numlayers; i++) {
     if(&(GET_LAYER(mapserv->map, i)->metadata) && GET_LAYER(mapserv->map, i)->name && strstr(outstr, GET_LAYER(mapserv->map, i)->name)) {
-      for(j=0; j<MS_HASHSIZE; j++) {
-        if(GET_LAYER(mapserv->map, i)->metadata.items[j] != NULL) {
-          for(tp=GET_LAYER(mapserv->map, i)->metadata.items[j]; tp!=NULL; tp=tp->next) {
-            snprintf(substr, PROCESSLINE_BUFLEN, "[%s_%s]", GET_LAYER(mapserv->map, i)->name, tp->key);
-            if(GET_LAYER(mapserv->map, i)->status == MS_ON)
-              outstr = msReplaceSubstring(outstr, substr, tp->data);
-            else
-              outstr = msReplaceSubstring(outstr, substr, "");
-            snprintf(substr, PROCESSLINE_BUFLEN, "[%s_%s_esc]", GET_LAYER(mapserv->map, i)->name, tp->key);
-            if(GET_LAYER(mapserv->map, i)->status == MS_ON) {
-              encodedstr = msEncodeUrl(tp->data);
-              outstr = msReplaceSubstring(outstr, substr, encodedstr);
-              free(encodedstr);
-            } else
-              outstr = msReplaceSubstring(outstr, substr, "");
-          }
-        }
+      hashTableObj *metadata = &(GET_LAYER(mapserv->map, i)->metadata);
+      for(key=msFirstKeyFromHashTable(metadata); key!=NULL; key=msNextKeyFromHashTable(metadata, key)) {
+        value = msLookupHashTable(metadata, key);
+        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_%s]", GET_LAYER(mapserv->map, i)->name, key);
+        if(GET_LAYER(mapserv->map, i)->status == MS_ON)
+          outstr = msReplaceSubstring(outstr, substr, value);
+        else
+          outstr = msReplaceSubstring(outstr, substr, "");
+        snprintf(substr, PROCESSLINE_BUFLEN, "[%s_%s_esc]", GET_LAYER(mapserv->map, i)->name, key);
+        if(GET_LAYER(mapserv->map, i)->status == MS_ON) {
+          encodedstr = msEncodeUrl(value);
+          outstr = msReplaceSubstring(outstr, substr, encodedstr);
+          free(encodedstr);
+        } else
+          outstr = msReplaceSubstring(outstr, substr, "");
       }
     }
   }
@@ -3887,25 +4479,23 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
   }
 
   if(mode != QUERY) {
-    if(processResultSetTag(mapserv, &outstr, stream) != MS_SUCCESS) return(NULL);
+    if(processResultSetTag(mapserv, &outstr, reader) != MS_SUCCESS) return(NULL);
   }
 
   if(mode == QUERY) { /* return shape and/or values  */
 
     /* allow layer metadata access in a query template, within the context of a query no layer name is necessary */
     if(&(mapserv->resultlayer->metadata) && strstr(outstr, "[metadata_")) {
-      for(i=0; i<MS_HASHSIZE; i++) {
-        if(mapserv->resultlayer->metadata.items[i] != NULL) {
-          for(tp=mapserv->resultlayer->metadata.items[i]; tp!=NULL; tp=tp->next) {
-            snprintf(substr, PROCESSLINE_BUFLEN, "[metadata_%s]", tp->key);
-            outstr = msReplaceSubstring(outstr, substr, tp->data);
-
-            snprintf(substr, PROCESSLINE_BUFLEN, "[metadata_%s_esc]", tp->key);
-            encodedstr = msEncodeUrl(tp->data);
-            outstr = msReplaceSubstring(outstr, substr, encodedstr);
-            free(encodedstr);
-          }
-        }
+      hashTableObj *metadata = &(mapserv->resultlayer->metadata);
+      for(key=msFirstKeyFromHashTable(metadata); key!=NULL; key=msNextKeyFromHashTable(metadata, key)) {
+        value = msLookupHashTable(metadata, key);
+        snprintf(substr, PROCESSLINE_BUFLEN, "[metadata_%s]", key);
+        outstr = msReplaceSubstring(outstr, substr, value);
+
+        snprintf(substr, PROCESSLINE_BUFLEN, "[metadata_%s_esc]", key);
+        encodedstr = msEncodeUrl(value);
+        outstr = msReplaceSubstring(outstr, substr, encodedstr);
+        free(encodedstr);
       }
     }
 
@@ -3924,7 +4514,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
     snprintf(repstr, sizeof(repstr), "%d", mapserv->resultshape.classindex);
     outstr = msReplaceSubstring(outstr, "[shpclass]", repstr);
 
-    if(processShpxyTag(mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
+    if(processShpxyTag(mapserv, mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
       return(NULL);
 
     if(processShplabelTag(mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
@@ -3976,7 +4566,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
         outstr = msReplaceSubstring(outstr, substr, mapserv->resultshape.values[i]);
     }
 
-    if(processItemTag(mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
+    if(processItemTag(mapserv, mapserv->resultlayer, &outstr, &mapserv->resultshape) != MS_SUCCESS)
       return(NULL);
 
     /* handle joins in this next section */
@@ -4021,7 +4611,7 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
 
   } /* end query mode specific substitutions */
 
-  if(processIncludeTag(mapserv, &outstr, stream, mode) != MS_SUCCESS)
+  if(processIncludeTag(mapserv, &outstr, reader, mode) != MS_SUCCESS)
     return(NULL);
 
   for(i=0; i<mapserv->request->NumParams; i++) {
@@ -4044,15 +4634,17 @@ static char *processLine(mapservObj *mapserv, char *instr, FILE *stream, int mod
   return(outstr);
 }
 
-#define MS_TEMPLATE_BUFFER 1024 /* 1k */
-
-int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
+/*
+** Process the template html, appending to output or writing to stdout when
+** output is NULL.
+*/
+static int returnPage(mapservObj *mapserv, char *html, int mode, bufferObj *output)
 {
-  FILE *stream;
-  char line[MS_BUFFER_LENGTH], *tmpline;
-  int   nBufferSize = 0;
-  int   nCurrentSize = 0;
-  int   nExpandBuffer = 0;
+  templateFileObj *file;
+  templateReaderObj reader;
+  bufferObj line; /* a query result line when writing to stdout */
+  char *tmpline;
+  int i, status;
 
   ms_regex_t re; /* compiled regular expression to be matched */
   char szPath[MS_MAXPATHLEN];
@@ -4074,70 +4666,89 @@ int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
   }
   ms_regfree(&re);
 
-  if((stream = fopen(msBuildPath(szPath, mapserv->map->mappath, html), "r")) == NULL) {
+  if((file = templateGetFile(msBuildPath(szPath, mapserv->map->mappath, html))) == NULL) {
     msSetError(MS_IOERR, "%s", "msReturnPage()", html);
     return MS_FAILURE;
   }
 
-  if(isValidTemplate(stream, html) != MS_TRUE) {
-    fclose(stream);
+  if(isValidTemplate(file, html) != MS_TRUE) {
+    templateReleaseFile(file);
     return MS_FAILURE;
   }
 
-  if(papszBuffer) {
-    if((*papszBuffer) == NULL) {
-      (*papszBuffer) = (char *)msSmallMalloc(MS_TEMPLATE_BUFFER);
-      (*papszBuffer)[0] = '\0';
-      nBufferSize = MS_TEMPLATE_BUFFER;
-      nCurrentSize = 0;
-      nExpandBuffer = 1;
-    } else {
-      nCurrentSize = strlen((*papszBuffer));
-      nBufferSize = nCurrentSize;
-      nExpandBuffer = (nCurrentSize/MS_TEMPLATE_BUFFER) + 1;
-    }
-  }
-
-  while(fgets(line, MS_BUFFER_LENGTH, stream) != NULL) { /* now on to the end of the file */
+  msBufferInit(&line);
+  reader.file = file;
+  reader.line = 0;
+  while(reader.line < file->numlines) { /* now on to the end of the file */
+    i = reader.line++;
+
+    if(file->tagged[i]) {
+      if(mode == QUERY && (status = templateRenderNodes(mapserv, file->compiled[i], output ? output : &line)) != MS_DONE) {
+        if(status != MS_SUCCESS) {
+          msBufferFree(&line);
+          templateReleaseFile(file);
+          return MS_FAILURE;
+        }
+        if(!output) {
+          msIO_fwrite(line.data, line.size, 1, stdout);
+          line.size = 0;
+        }
+        continue;
+      }
 
-    if(strchr(line, '[') != NULL) {
-      tmpline = processLine(mapserv, line, stream, mode);
-      if(!tmpline)
+      tmpline = processLine(mapserv, file->lines[i], &reader, mode); /* may read ahead */
+      if(!tmpline) {
+        msBufferFree(&line);
+        templateReleaseFile(file);
         return MS_FAILURE;
+      }
 
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(tmpline) + 1)) {
-          nExpandBuffer = (strlen(tmpline) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *) msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), tmpline);
-        nCurrentSize += strlen(tmpline);
-      } else
+      if(output)
+        msBufferAppend(output, tmpline, strlen(tmpline));
+      else
         msIO_fwrite(tmpline, strlen(tmpline), 1, stdout);
 
       free(tmpline);
     } else {
-      if(papszBuffer) {
-        if(nBufferSize <= (int)(nCurrentSize + strlen(line))) {
-          nExpandBuffer = (strlen(line) /  MS_TEMPLATE_BUFFER) + 1;
-          nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer + strlen((*papszBuffer));
-          (*papszBuffer) = (char *)msSmallRealloc((*papszBuffer),sizeof(char)*nBufferSize);
-        }
-        strcat((*papszBuffer), line);
-        nCurrentSize += strlen(line);
-      } else
-        msIO_fwrite(line, strlen(line), 1, stdout);
+      if(output)
+        msBufferAppend(output, file->lines[i], file->lengths[i]);
+      else
+        msIO_fwrite(file->lines[i], file->lengths[i], 1, stdout);
     }
-    if(!papszBuffer)
-      fflush(stdout);
   } /* next line */
 
-  fclose(stream);
+  if(!output)
+    fflush(stdout);
+
+  msBufferFree(&line);
+  templateReleaseFile(file);
 
   return MS_SUCCESS;
 }
 
+int msReturnPage(mapservObj *mapserv, char *html, int mode, char **papszBuffer)
+{
+  bufferObj output;
+  int status;
+
+  if(!papszBuffer)
+    return returnPage(mapserv, html, mode, NULL);
+
+  /* append to the caller's string, it is taken over as is */
+  msBufferInit(&output);
+  if(*papszBuffer) {
+    output.data = (unsigned char *) *papszBuffer;
+    output.size = strlen(*papszBuffer);
+    output.available = output.size + 1;
+  }
+
+  status = returnPage(mapserv, html, mode, &output);
+
+  *papszBuffer = templateBufferString(&output);
+
+  return status;
+}
+
 int msReturnURL(mapservObj* ms, char* url, int mode)
 {
   char *tmpurl;
@@ -4159,29 +4770,19 @@ int msReturnURL(mapservObj* ms, char* url, int mode)
 }
 
 /*
-** Legacy query template parsing where you use headers, footers and such...
+** msReturnNestedTemplateQuery() appending to output, or writing to stdout
+** when output is NULL.
 */
-int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **papszBuffer)
+static int returnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, bufferObj *output)
 {
   int status;
   int i,j,k;
   char buffer[1024];
-  int nBufferSize =0;
-  int nCurrentSize = 0;
-  int nExpandBuffer = 0;
 
   char *template;
 
   layerObj *lp=NULL;
 
-  if(papszBuffer) {
-    (*papszBuffer) = (char *)msSmallMalloc(MS_TEMPLATE_BUFFER);
-    (*papszBuffer)[0] = '\0';
-    nBufferSize = MS_TEMPLATE_BUFFER;
-    nCurrentSize = 0;
-    nExpandBuffer = 1;
-  }
-
   msInitShape(&(mapserv->resultshape));
 
   if((mapserv->Mode == ITEMQUERY) || (mapserv->Mode == QUERY)) { /* may need to handle a URL result set since these modes return exactly 1 result */
@@ -4229,7 +4830,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
           }
         }
 
-        if(papszBuffer == NULL) {
+        if(output == NULL) {
           if(msReturnURL(mapserv, template, QUERY) != MS_SUCCESS) return MS_FAILURE;
         }
 
@@ -4261,22 +4862,16 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
   ** Is this step really necessary for buffered output? Legend and browse templates don't deal with mime-types
   ** so why should this. Note that new-style templates don't buffer the mime-type either.
   */
-  if(papszBuffer && mapserv->sendheaders) {
+  if(output && mapserv->sendheaders) {
     snprintf(buffer, sizeof(buffer), "Content-Type: %s%c%c", pszMimeType, 10, 10);
-    if(nBufferSize <= (int)(nCurrentSize + strlen(buffer) + 1)) {
-      nExpandBuffer++;
-      (*papszBuffer) = (char *)msSmallRealloc((*papszBuffer), MS_TEMPLATE_BUFFER*nExpandBuffer);
-      nBufferSize = MS_TEMPLATE_BUFFER*nExpandBuffer;
-    }
-    strcat((*papszBuffer), buffer);
-    nCurrentSize += strlen(buffer);
+    msBufferAppend(output, buffer, strlen(buffer));
   } else if(mapserv->sendheaders) {
     msIO_setHeader("Content-Type","%s",pszMimeType);
     msIO_sendHeaders();
   }
 
   if(mapserv->map->web.header) {
-    if(msReturnPage(mapserv, mapserv->map->web.header, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+    if(returnPage(mapserv, mapserv->map->web.header, BROWSE, output) != MS_SUCCESS) return MS_FAILURE;
   }
 
   mapserv->RN = 1; /* overall result number */
@@ -4304,7 +4899,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
     }
 
     if(lp->header) {
-      if(msReturnPage(mapserv, lp->header, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+      if(returnPage(mapserv, lp->header, BROWSE, output) != MS_SUCCESS) return MS_FAILURE;
     }
 
     mapserv->LRN = 1; /* layer result number */
@@ -4327,7 +4922,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
       else
         template = lp->template;
 
-      if(msReturnPage(mapserv, template, QUERY, papszBuffer) != MS_SUCCESS) {
+      if(returnPage(mapserv, template, QUERY, output) != MS_SUCCESS) {
         msFreeShape(&(mapserv->resultshape));
         return MS_FAILURE;
       }
@@ -4339,7 +4934,7 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
     }
 
     if(lp->footer) {
-      if(msReturnPage(mapserv, lp->footer, BROWSE, papszBuffer) != MS_SUCCESS) return MS_FAILURE;
+      if(returnPage(mapserv, lp->footer, BROWSE, output) != MS_SUCCESS) return MS_FAILURE;
     }
 
     /* msLayerClose(lp); */
@@ -4347,11 +4942,30 @@ int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **p
   }
 
   if(mapserv->map->web.footer)
-    return msReturnPage(mapserv, mapserv->map->web.footer, BROWSE, papszBuffer);
+    return returnPage(mapserv, mapserv->map->web.footer, BROWSE, output);
 
   return MS_SUCCESS;
 }
 
+/*
+** Legacy query template parsing where you use headers, footers and such...
+** The whole result goes to one growing buffer when papszBuffer is set.
+*/
+int msReturnNestedTemplateQuery(mapservObj* mapserv, char* pszMimeType, char **papszBuffer)
+{
+  bufferObj output;
+  int status;
+
+  if(!papszBuffer)
+    return returnNestedTemplateQuery(mapserv, pszMimeType, NULL);
+
+  msBufferInit(&output);
+  status = returnNestedTemplateQuery(mapserv, pszMimeType, &output);
+  *papszBuffer = templateBufferString(&output);
+
+  return status;
+}
+
 int msReturnOpenLayersPage(mapservObj *mapserv)
 {
   int i;
@@ -4499,6 +5113,9 @@ mapservObj *msAllocMapServObj()
 
   mapserv->hittest = NULL;
 
+  mapserv->tags = NULL;
+  mapserv->numtags = 0;
+
   return mapserv;
 }
 
@@ -4533,6 +5150,8 @@ void msFreeMapServObj(mapservObj* mapserv)
     msFree(mapserv->SelectLayer);
     msFree(mapserv->QueryFile);
 
+    freeCachedTagArgs(mapserv);
+
     msFree(mapserv);
   }
 }
@@ -49,6 +49,16 @@ enum modes {BROWSE, ZOOMIN, ZOOMOUT, MAP, LEGEND, LEGENDICON, REFERENCE, SCALEBA
            };
 
 
+/* struct templateTagObj
+ * A template tag (e.g. [item name=foo format=...]) and its parsed
+ * arguments. Kept by mapservObj so that a tag repeated for every query
+ * result is only parsed once per request.
+*/
+typedef struct {
+  char *tag;
+  hashTableObj *args;
+} templateTagObj;
+
 /* struct mapservObj
  * Global structure used by templates and mapserver CGI interface.
  *
@@ -134,6 +144,9 @@ typedef struct {
   int NLR; /* number of results in a layer */
 
   map_hittest *hittest;
+
+  templateTagObj *tags; /* parsed tag arguments, see getCachedTagArgs() */
+  int numtags;
 } mapservObj;
 
 
@@ -144,7 +144,8 @@ static int thread_debug = 0;
 
 static char *lock_names[] = {
   NULL, "PARSER", "GDAL", "ERROROBJ", "PROJ", "TTF", "POOL", "SDE",
-  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", NULL
+  "ORACLE", "OWS", "LAYER_VTABLE", "IOCONTEXT", "TMPFILE", "DEBUGOBJ", "OGR",
+  "TIME", "FRIBIDI", "TRACE", "TILECACHE", "JOININDEX", "OWSCACHE", "SLDCACHE", "CONTOURCACHE", "TEMPLATECACHE", "CRYPTOCACHE", "SHPHANDLES", "SHPBOUNDS", "OCCUPANCY", NULL
 };
 #endif
 
@@ -227,6 +228,59 @@ void msReleaseLock( int nLockId )
   pthread_mutex_unlock( mutex_locks + nLockId );
 }
 
+/************************************************************************/
+/*                            msRunThreads()                            */
+/************************************************************************/
+
+typedef struct {
+  msThreadFunc func;
+  void *arg;
+} threadStartObj;
+
+static void *threadStart( void *start )
+
+{
+  threadStartObj *psStart = (threadStartObj *) start;
+  psStart->func( psStart->arg );
+  return NULL;
+}
+
+int msRunThreads( msThreadFunc func, void **args, int numthreads )
+
+{
+  pthread_t *threads;
+  threadStartObj *starts;
+  int *started;
+  int i;
+
+  if( mutexes_initialized == 0 )
+    msThreadInit();
+
+  threads = (pthread_t *) msSmallMalloc( sizeof(pthread_t) * numthreads );
+  starts = (threadStartObj *) msSmallMalloc( sizeof(threadStartObj) * numthreads );
+  started = (int *) msSmallCalloc( numthreads, sizeof(int) );
+
+  for( i = 0; i < numthreads; i++ ) {
+    starts[i].func = func;
+    starts[i].arg = args[i];
+    if( pthread_create( threads + i, NULL, threadStart, starts + i ) == 0 )
+      started[i] = MS_TRUE;
+    else
+      func( args[i] ); /* could not start a thread, do it ourselves */
+  }
+
+  for( i = 0; i < numthreads; i++ ) {
+    if( started[i] )
+      pthread_join( threads[i], NULL );
+  }
+
+  free( threads );
+  free( starts );
+  free( started );
+
+  return MS_SUCCESS;
+}
+
 #endif /* defined(USE_THREAD) && !defined(_WIN32) */
 
 /************************************************************************/
@@ -315,4 +369,76 @@ void msReleaseLock( int nLockId )
   ReleaseMutex( mutex_locks[nLockId] );
 }
 
+/************************************************************************/
+/*                            msRunThreads()                            */
+/************************************************************************/
+
+typedef struct {
+  msThreadFunc func;
+  void *arg;
+} threadStartObj;
+
+static DWORD WINAPI threadStart( LPVOID start )
+
+{
+  threadStartObj *psStart = (threadStartObj *) start;
+  psStart->func( psStart->arg );
+  return 0;
+}
+
+int msRunThreads( msThreadFunc func, void **args, int numthreads )
+
+{
+  HANDLE *threads;
+  threadStartObj *starts;
+  int i;
+
+  if( mutexes_initialized == 0 )
+    msThreadInit();
+
+  threads = (HANDLE *) msSmallMalloc( sizeof(HANDLE) * numthreads );
+  starts = (threadStartObj *) msSmallMalloc( sizeof(threadStartObj) * numthreads );
+
+  for( i = 0; i < numthreads; i++ ) {
+    starts[i].func = func;
+    starts[i].arg = args[i];
+    threads[i] = CreateThread( NULL, 0, threadStart, starts + i, 0, NULL );
+    if( threads[i] == NULL )
+      func( args[i] ); /* could not start a thread, do it ourselves */
+  }
+
+  for( i = 0; i < numthreads; i++ ) {
+    if( threads[i] != NULL ) {
+      WaitForSingleObject( threads[i], INFINITE );
+      CloseHandle( threads[i] );
+    }
+  }
+
+  free( threads );
+  free( starts );
+
+  return MS_SUCCESS;
+}
+
 #endif /* defined(USE_THREAD) && defined(_WIN32) */
+
+/************************************************************************/
+/* ==================================================================== */
+/*                          NO THREAD SUPPORT                           */
+/* ==================================================================== */
+/************************************************************************/
+
+#if !defined(USE_THREAD)
+
+int msRunThreads( msThreadFunc func, void **args, int numthreads )
+
+{
+  int i;
+
+  for( i = 0; i < numthreads; i++ )
+    func( args[i] );
+
+  return MS_SUCCESS;
+}
+
+#endif /* !defined(USE_THREAD) */
@@ -46,6 +46,14 @@ extern "C" {
 #define msReleaseLock(x)
 #endif
 
+  /*
+  ** msRunThreads() calls func(args[i]) for each of the numthreads args, each
+  ** on its own thread, and returns once all of them have finished. Without
+  ** thread support the calls are simply made in turn.
+  */
+  typedef void (*msThreadFunc)(void *arg);
+  int msRunThreads(msThreadFunc func, void **args, int numthreads);
+
   /*
   ** lock ids - note there is a corresponding lock_names[] array in
   ** mapthread.c that needs to be extended when new ids are added.
@@ -67,8 +75,19 @@ extern "C" {
 #define TLOCK_OGR       14
 #define TLOCK_TIME      15
 #define TLOCK_FRIBIDI   16
-
-#define TLOCK_STATIC_MAX 20
+#define TLOCK_TRACE     17
+#define TLOCK_TILECACHE 18
+#define TLOCK_JOININDEX 19
+#define TLOCK_OWSCACHE  20
+#define TLOCK_SLDCACHE  21
+#define TLOCK_CONTOURCACHE 22
+#define TLOCK_TEMPLATECACHE 23
+#define TLOCK_CRYPTOCACHE 24
+#define TLOCK_SHPHANDLES 25
+#define TLOCK_SHPBOUNDS 26
+#define TLOCK_OCCUPANCY 27
+
+#define TLOCK_STATIC_MAX 28
 #define TLOCK_MAX       100
 
 #ifdef __cplusplus
@@ -0,0 +1,202 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Request performance tracing: timed spans written as JSON lines.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+/*
+** Tracing is enabled by setting MS_TRACEFILE (environment variable or map
+** CONFIG). Every span ends up as one line in the Chrome trace "complete
+** event" format:
+**
+**   {"name":"layer.draw","cat":"mapserver","ph":"X","ts":...,"dur":...,
+**    "pid":...,"tid":...,"args":{"layer":"roads","features":12,"bytes":0}}
+**
+** ts and dur are in microseconds. The file can be aggregated with
+** mstracesummary, or loaded into chrome://tracing after wrapping the lines
+** in a JSON array. When no trace file is set msTraceStart() is a single test.
+*/
+
+#include "mapserver.h"
+#include "mapthread.h"
+#include "maptime.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+
+static FILE *trace_fp = NULL;
+static char *trace_file = NULL;
+
+/* msTraceSetFile()
+**
+** Set trace output file (appended to). pszRelToPath works as for
+** msSetErrorFile(). A NULL or empty name turns tracing off.
+*/
+int msTraceSetFile(const char *pszTraceFile, const char *pszRelToPath)
+{
+  char extended_path[MS_MAXPATHLEN];
+  int status = MS_SUCCESS;
+
+  if (pszTraceFile && *pszTraceFile && strcmp(pszTraceFile, "stderr") != 0) {
+    if(msBuildPath(extended_path, pszRelToPath, pszTraceFile) == NULL)
+      return MS_FAILURE;
+    pszTraceFile = extended_path;
+  }
+
+  msAcquireLock( TLOCK_TRACE );
+
+  if (trace_file && pszTraceFile && strcmp(trace_file, pszTraceFile) == 0) {
+    /* Nothing to do, already writing to the right place */
+    msReleaseLock( TLOCK_TRACE );
+    return MS_SUCCESS;
+  }
+
+  if (trace_fp && trace_fp != stderr)
+    fclose(trace_fp);
+  trace_fp = NULL;
+  msFree(trace_file);
+  trace_file = NULL;
+
+  if (pszTraceFile && *pszTraceFile) {
+    if (strcmp(pszTraceFile, "stderr") == 0)
+      trace_fp = stderr;
+    else
+      trace_fp = fopen(pszTraceFile, "a");
+
+    if (trace_fp == NULL) {
+      msSetError(MS_MISCERR, "Failed to open MS_TRACEFILE %s", "msTraceSetFile()", pszTraceFile);
+      status = MS_FAILURE;
+    } else
+      trace_file = msStrdup(pszTraceFile);
+  }
+
+  msReleaseLock( TLOCK_TRACE );
+
+  return status;
+}
+
+void msTraceClose()
+{
+  msTraceSetFile(NULL, NULL);
+}
+
+int msTraceIsEnabled()
+{
+  return (trace_fp != NULL);
+}
+
+/* msTraceNow()
+**
+** Current time in microseconds, the time base of all spans.
+*/
+double msTraceNow()
+{
+  struct mstimeval tv;
+  msGettimeofday(&tv, NULL);
+  return tv.tv_sec*1.0e6 + tv.tv_usec;
+}
+
+void msTraceStart(traceSpanObj *span, const char *name, const char *layer)
+{
+  if (trace_fp == NULL) {
+    span->active = MS_FALSE;
+    return;
+  }
+
+  span->active = MS_TRUE;
+  span->name = name;
+  span->layer = layer;
+  span->start = msTraceNow();
+}
+
+static void traceWriteJSONString(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", (unsigned char)*s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+static void traceWrite(traceSpanObj *span, double duration, long features, long bytes)
+{
+  msAcquireLock( TLOCK_TRACE );
+  if (trace_fp) {
+    fprintf(trace_fp, "{\"name\":");
+    traceWriteJSONString(trace_fp, span->name);
+    fprintf(trace_fp, ",\"cat\":\"mapserver\",\"ph\":\"X\",\"ts\":%.0f,\"dur\":%.0f,\"pid\":%ld,\"tid\":%d,\"args\":{",
+            span->start, duration, (long)getpid(), msGetThreadId());
+    if (span->layer) {
+      fprintf(trace_fp, "\"layer\":");
+      traceWriteJSONString(trace_fp, span->layer);
+    } else
+      fprintf(trace_fp, "\"layer\":null");
+    if (features >= 0)
+      fprintf(trace_fp, ",\"features\":%ld", features);
+    if (bytes >= 0)
+      fprintf(trace_fp, ",\"bytes\":%ld", bytes);
+    fprintf(trace_fp, "}}\n");
+    fflush(trace_fp);
+  }
+  msReleaseLock( TLOCK_TRACE );
+}
+
+/* msTraceEnd()
+**
+** Close a span and write it out. features and bytes are optional counters
+** (pass -1 when they do not apply).
+*/
+void msTraceEnd(traceSpanObj *span, long features, long bytes)
+{
+  if (!span->active)
+    return;
+  span->active = MS_FALSE;
+
+  traceWrite(span, msTraceNow() - span->start, features, bytes);
+}
+
+/* msTraceEndAggregate()
+**
+** Close a span whose duration was accumulated by the caller over many short
+** intervals (e.g. all NextShape calls of a layer), rather than measured from
+** its start.
+*/
+void msTraceEndAggregate(traceSpanObj *span, double duration, long features, long bytes)
+{
+  if (!span->active)
+    return;
+  span->active = MS_FALSE;
+
+  traceWrite(span, duration, features, bytes);
+}
@@ -32,6 +32,7 @@
 /* $Id$ */
 #include <assert.h>
 #include "mapserver.h"
+#include "mapthread.h"
 
 
 
@@ -43,6 +44,35 @@
 #define MSUNION_SOURCELAYERVISIBLE        "Union:SourceLayerVisible"
 #define MSUNION_SOURCELAYERVISIBLEINDEX   -102
 
+/* default number of features read ahead per source layer (UNION_THREADS) */
+#define MSUNION_PREFETCH_FEATURES 1000
+
+/*
+** With UNION_THREADS set the source layers are queried (WhichShapes) and
+** their first features read on worker threads, each source into its own
+** queue of at most UNION_PREFETCH_FEATURES shapes. NextShape then delivers
+** the queued shapes and reads the remainder of a source, if any, directly.
+** The features come out in source layer order either way.
+*/
+typedef struct {
+  layerObj *srclayer;
+  int worker;      /* sources sharing a connection are read by one worker */
+  shapeObj *shapes;
+  int numshapes;
+  int maxshapes;
+  int next;        /* next shape to deliver */
+  int status;      /* WhichShapes status */
+  int nextstatus;  /* NextShape status once the queue is drained */
+} msUnionSourceQueue;
+
+typedef struct {
+  msUnionSourceQueue *queues;
+  int numqueues;
+  int worker;
+  rectObj *rects;
+  int isQuery;
+} msUnionWorkerObj;
+
 typedef struct {
   int layerIndex;  /* current source layer index */
   int classIndex;  /* current class index */
@@ -52,8 +82,26 @@ typedef struct {
   int *status;     /* the layer status */
   int *classgroup; /* current array of the valid classes */
   int nclasses;  /* number of the valid classes */
+  msUnionSourceQueue *queues; /* read ahead features, with UNION_THREADS */
 } msUnionLayerInfo;
 
+static void msUnionLayerFreeQueues(msUnionLayerInfo* layerinfo)
+{
+  int i, j;
+
+  if (!layerinfo->queues)
+    return;
+
+  for (i = 0; i < layerinfo->layerCount; i++) {
+    msUnionSourceQueue *queue = &layerinfo->queues[i];
+    for (j = queue->next; j < queue->numshapes; j++)
+      msFreeShape(&queue->shapes[j]);
+    msFree(queue->shapes);
+  }
+  msFree(layerinfo->queues);
+  layerinfo->queues = NULL;
+}
+
 /* Close the the combined layer */
 int msUnionLayerClose(layerObj *layer)
 {
@@ -66,6 +114,8 @@ int msUnionLayerClose(layerObj *layer)
   if (!layer->map)
     return MS_FAILURE;
 
+  msUnionLayerFreeQueues(layerinfo);
+
   for (i = 0; i < layerinfo->layerCount; i++) {
     msLayerClose(&layerinfo->layers[i]);
     freeLayer(&layerinfo->layers[i]);
@@ -157,6 +207,8 @@ int msUnionLayerOpen(layerObj *layer)
 
   layerinfo->classText = NULL;
 
+  layerinfo->queues = NULL;
+
   pkey = msLayerGetProcessingKey(layer, "UNION_STATUS_CHECK");
   if(pkey && strcasecmp(pkey, "true") == 0)
     status_check = MS_TRUE;
@@ -376,16 +428,132 @@ int msUnionLayerInitItemInfo(layerObj *layer)
   return MS_SUCCESS;
 }
 
+/* query the sources of one worker and fill their queues */
+static void msUnionLayerScanSources(void *arg)
+{
+  msUnionWorkerObj *worker = (msUnionWorkerObj *) arg;
+  int i, rv;
+
+  for (i = 0; i < worker->numqueues; i++) {
+    msUnionSourceQueue *queue = &worker->queues[i];
+
+    if (queue->worker != worker->worker || queue->status != MS_SUCCESS)
+      continue;
+
+    queue->status = msLayerWhichShapes(queue->srclayer, worker->rects[i], worker->isQuery);
+    if (queue->status != MS_SUCCESS)
+      continue;
+
+    queue->nextstatus = MS_SUCCESS;
+    while (queue->numshapes < queue->maxshapes) {
+      if (queue->numshapes % 64 == 0)
+        queue->shapes = (shapeObj *) msSmallRealloc(queue->shapes, (queue->numshapes + 64) * sizeof(shapeObj));
+      msInitShape(&queue->shapes[queue->numshapes]);
+      rv = queue->srclayer->vtable->LayerNextShape(queue->srclayer, &queue->shapes[queue->numshapes]);
+      if (rv != MS_SUCCESS) {
+        queue->nextstatus = rv; /* MS_DONE or MS_FAILURE, the source is drained */
+        break;
+      }
+      queue->numshapes++;
+    }
+  }
+}
+
+/*
+** Run WhichShapes on the sources with numworkers threads, reading ahead up
+** to maxshapes features per source. Sources using the same connection may
+** share a pooled connection handle, so they are given to the same worker.
+*/
+static int msUnionLayerScanParallel(layerObj *layer, rectObj *rects, int isQuery, int numworkers, int maxshapes)
+{
+  int i, j, nextworker = 0;
+  msUnionWorkerObj *workers;
+  void **args;
+  msUnionLayerInfo* layerinfo = (msUnionLayerInfo*)layer->layerinfo;
+
+  layerinfo->queues = (msUnionSourceQueue *) msSmallCalloc(layerinfo->layerCount, sizeof(msUnionSourceQueue));
+  for (i = 0; i < layerinfo->layerCount; i++) {
+    msUnionSourceQueue *queue = &layerinfo->queues[i];
+    layerObj* srclayer = &layerinfo->layers[i];
+
+    queue->srclayer = srclayer;
+    queue->maxshapes = maxshapes;
+    queue->status = layerinfo->status[i];
+    queue->nextstatus = MS_DONE;
+    queue->worker = -1;
+    if (queue->status != MS_SUCCESS)
+      continue; /* skip empty layers */
+
+    for (j = 0; j < i && srclayer->connection; j++) {
+      if (layerinfo->queues[j].worker >= 0 && layerinfo->layers[j].connectiontype == srclayer->connectiontype &&
+          layerinfo->layers[j].connection && strcmp(layerinfo->layers[j].connection, srclayer->connection) == 0) {
+        queue->worker = layerinfo->queues[j].worker;
+        break;
+      }
+    }
+    if (queue->worker < 0)
+      queue->worker = (nextworker++) % numworkers;
+  }
+  numworkers = MS_MIN(numworkers, nextworker);
+
+  if (numworkers > 0) {
+    workers = (msUnionWorkerObj *) msSmallMalloc(numworkers * sizeof(msUnionWorkerObj));
+    args = (void **) msSmallMalloc(numworkers * sizeof(void *));
+    for (i = 0; i < numworkers; i++) {
+      workers[i].queues = layerinfo->queues;
+      workers[i].numqueues = layerinfo->layerCount;
+      workers[i].worker = i;
+      workers[i].rects = rects;
+      workers[i].isQuery = isQuery;
+      args[i] = workers + i;
+    }
+
+    if (numworkers == 1)
+      msUnionLayerScanSources(args[0]);
+    else
+      msRunThreads(msUnionLayerScanSources, args, numworkers);
+
+    msFree(workers);
+    msFree(args);
+  }
+
+  for (i = 0; i < layerinfo->layerCount; i++) {
+    layerinfo->status[i] = layerinfo->queues[i].status;
+    if (layerinfo->status[i] == MS_FAILURE) {
+      /* the error was recorded on the worker thread */
+      msSetError(MS_MISCERR, "Failed to query source layer: %s", "msUnionLayerWhichShapes()", layerinfo->layers[i].name);
+      return MS_FAILURE;
+    }
+  }
+
+  if (layer->debug >= MS_DEBUGLEVEL_V)
+    msDebug("msUnionLayerWhichShapes(): %d source layers queried with %d threads.\n", layerinfo->layerCount, numworkers);
+
+  return MS_SUCCESS;
+}
+
 int msUnionLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
 {
   int i;
   layerObj* srclayer;
-  rectObj srcRect;
+  rectObj *srcRects;
+  int numworkers = 1;
+  const char* pkey;
   msUnionLayerInfo* layerinfo = (msUnionLayerInfo*)layer->layerinfo;
 
   if (!layerinfo || !layer->map)
     return MS_FAILURE;
 
+  msUnionLayerFreeQueues(layerinfo);
+
+#ifdef USE_THREAD
+  pkey = msLayerGetProcessingKey(layer, "UNION_THREADS");
+  if (pkey)
+    numworkers = MS_MAX(1, MS_MIN(atoi(pkey), layerinfo->layerCount));
+#endif
+
+  srcRects = (rectObj *) msSmallMalloc(layerinfo->layerCount * sizeof(rectObj));
+
   for (i = 0; i < layerinfo->layerCount; i++) {
     layerObj* srclayer = &layerinfo->layers[i];
 
@@ -397,20 +565,42 @@ int msUnionLayerWhichShapes(layerObj *layer, rectObj rect, int isQuery)
       msUnionLayerFreeExpressionTokens(srclayer);
 
       /* get only the required items */
-      if (msLayerWhichItems(srclayer, MS_FALSE, NULL) != MS_SUCCESS)
+      if (msLayerWhichItems(srclayer, MS_FALSE, NULL) != MS_SUCCESS) {
+        msFree(srcRects);
         return MS_FAILURE;
+      }
     }
 
-    srcRect = rect;
+    srcRects[i] = rect;
 #ifdef USE_PROJ
     if(srclayer->transform == MS_TRUE && srclayer->project && layer->transform == MS_TRUE && layer->project &&msProjectionsDiffer(&(srclayer->projection), &(layer->projection)))
-      msProjectRect(&layer->projection, &srclayer->projection, &srcRect); /* project the searchrect to source coords */
+      msProjectRect(&layer->projection, &srclayer->projection, &srcRects[i]); /* project the searchrect to source coords */
 #endif
-    layerinfo->status[i] = msLayerWhichShapes(srclayer, srcRect, isQuery);
-    if (layerinfo->status[i] == MS_FAILURE)
+    if (numworkers > 1)
+      continue; /* queried below */
+
+    layerinfo->status[i] = msLayerWhichShapes(srclayer, srcRects[i], isQuery);
+    if (layerinfo->status[i] == MS_FAILURE) {
+      msFree(srcRects);
       return MS_FAILURE;
+    }
   }
 
+  if (numworkers > 1) {
+    int maxshapes = MSUNION_PREFETCH_FEATURES;
+
+    pkey = msLayerGetProcessingKey(layer, "UNION_PREFETCH_FEATURES");
+    if (pkey)
+      maxshapes = MS_MAX(0, atoi(pkey));
+
+    if (msUnionLayerScanParallel(layer, srcRects, isQuery, numworkers, maxshapes) != MS_SUCCESS) {
+      msFree(srcRects);
+      return MS_FAILURE;
+    }
+  }
+
+  msFree(srcRects);
+
   layerinfo->layerIndex = 0;
   srclayer = &layerinfo->layers[0];
 
@@ -459,6 +649,27 @@ static int BuildFeatureAttributes(layerObj *layer, layerObj* srclayer, shapeObj
   return MS_SUCCESS;
 }
 
+/* next shape of the current source, from its queue first */
+static int msUnionSourceNextShape(msUnionLayerInfo* layerinfo, layerObj* srclayer, shapeObj *shape)
+{
+  if (layerinfo->queues) {
+    msUnionSourceQueue *queue = &layerinfo->queues[layerinfo->layerIndex];
+
+    if (queue->next < queue->numshapes) {
+      *shape = queue->shapes[queue->next++]; /* the shape is handed over */
+      return MS_SUCCESS;
+    }
+    if (queue->nextstatus == MS_FAILURE) {
+      msSetError(MS_MISCERR, "Failed to read features of source layer: %s", "msUnionLayerNextShape()", srclayer->name);
+      return MS_FAILURE;
+    }
+    if (queue->nextstatus == MS_DONE)
+      return MS_DONE;
+  }
+
+  return srclayer->vtable->LayerNextShape(srclayer, shape);
+}
+
 /* find the next shape with the appropriate shape type */
 /* also, load in the attribute data */
 /* MS_DONE => no more data */
@@ -479,7 +690,7 @@ int msUnionLayerNextShape(layerObj *layer, shapeObj *shape)
   while (layerinfo->layerIndex < layerinfo->layerCount) {
     srclayer = &layerinfo->layers[layerinfo->layerIndex];
     if (layerinfo->status[layerinfo->layerIndex] == MS_SUCCESS) {
-      while ((rv = srclayer->vtable->LayerNextShape(srclayer, shape)) == MS_SUCCESS) {
+      while ((rv = msUnionSourceNextShape(layerinfo, srclayer, shape)) == MS_SUCCESS) {
         if(layer->styleitem) {
           /* need to retrieve the source layer classindex if styleitem AUTO is set */
           layerinfo->classIndex = msShapeGetClass(srclayer, layer->map, shape, layerinfo->classgroup, layerinfo->nclasses);
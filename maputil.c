@@ -37,6 +37,7 @@
 #include "maptime.h"
 #include "mapthread.h"
 #include "mapcopy.h"
+#include "mapogcsld.h"
 
 #if defined(_WIN32) && !defined(__CYGWIN__)
 # include <windows.h>
@@ -835,10 +836,13 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
   int nReturnVal = MS_FAILURE;
   char szPath[MS_MAXPATHLEN];
   struct mstimeval starttime, endtime;
+  traceSpanObj span;
+  long bytes = -1;
 
   if(map && map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&starttime, NULL);
   }
+  msTraceStart(&span, "image.save", NULL);
 
   if (img) {
 #ifdef USE_GDAL
@@ -864,26 +868,33 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
             msSetError(MS_IOERR,
                        "Failed to create output file (%s).",
                        "msSaveImage()", (map?szPath:filename) );
+            msTraceEnd(&span, -1, -1);
             return MS_FAILURE;
           }
 
         } else {
-          if ( msIO_needBinaryStdout() == MS_FAILURE )
+          if ( msIO_needBinaryStdout() == MS_FAILURE ) {
+            msTraceEnd(&span, -1, -1);
             return MS_FAILURE;
+          }
           stream = stdout;
         }
 
         if(renderer->supports_pixel_buffer) {
           rasterBufferObj data;
-          if(renderer->getRasterBufferHandle(img,&data) != MS_SUCCESS)
+          if(renderer->getRasterBufferHandle(img,&data) != MS_SUCCESS) {
+            msTraceEnd(&span, -1, -1);
             return MS_FAILURE;
+          }
 
           nReturnVal = msSaveRasterBuffer(map,&data,stream,img->format );
         } else {
           nReturnVal = renderer->saveImage(img, map, stream, img->format);
         }
-        if( stream != stdout )
+        if( stream != stdout ) {
+          bytes = ftell(stream);
           fclose(stream);
+        }
 
       } else if( MS_DRIVER_IMAGEMAP(img->format) )
         nReturnVal = msSaveImageIM(img, filename, img->format);
@@ -892,6 +903,8 @@ int msSaveImage(mapObj *map, imageObj *img, char *filename)
                    "msSaveImage()");
   }
 
+  msTraceEnd(&span, -1, bytes);
+
   if(map && map->debug >= MS_DEBUGLEVEL_TUNING) {
     msGettimeofday(&endtime, NULL);
     msDebug("msSaveImage(%s) total time: %.3fs\n",
@@ -921,10 +934,13 @@ unsigned char *msSaveImageBuffer(imageObj* image, int *size_ptr, outputFormatObj
     rendererVTableObj *renderer = image->format->vtable;
     if(renderer->supports_pixel_buffer) {
       bufferObj buffer;
+      traceSpanObj span;
+      msTraceStart(&span, "image.save", NULL);
       msBufferInit(&buffer);
       renderer->getRasterBufferHandle(image,&data);
       msSaveRasterBufferToBuffer(&data,&buffer,format);
       *size_ptr = buffer.size;
+      msTraceEnd(&span, -1, buffer.size);
       return buffer.data;
       /* don't free the bufferObj as we don't own the bytes anymore */
     } else {
@@ -1970,10 +1986,31 @@ void msCleanup(int signal)
 
   msTimeCleanup();
 
+  msSharedTileCacheCleanup();
+
+  msJoinIndexCleanup();
+
+  msTiledSHPHandleCacheCleanup();
+  msShapefileBoundsCacheCleanup();
+
+  msOccupancyCacheCleanup();
+
+  msOWSCacheCleanup();
+
+  msSLDCacheCleanup();
+
+  msContourCacheCleanup();
+
+  msTemplateCacheCleanup();
+
+  msEncryptionKeyCacheCleanup();
+
   msIO_Cleanup();
 
   msResetErrorList();
 
+  msTraceClose();
+
   /* Close/cleanup log/debug output. Keep this at the very end. */
   msDebugCleanup();
 
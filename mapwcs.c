@@ -1547,6 +1547,41 @@ static int msWCSGetCoverage_ImageCRSSetup(
   return MS_SUCCESS;
 }
 
+/************************************************************************/
+/*                         msWCSStreamFile()                            */
+/*                                                                      */
+/*      Copy a coverage rendered into a temporary file to stdout, and   */
+/*      remove the file.                                                */
+/************************************************************************/
+
+static int msWCSStreamFile(const char *filename)
+{
+  FILE *fp;
+  unsigned char block[4000];
+  int bytes_read;
+
+  if( msIO_needBinaryStdout() == MS_FAILURE ) {
+    VSIUnlink( filename );
+    return MS_FAILURE;
+  }
+
+  fp = VSIFOpenL( filename, "rb" );
+  if( fp == NULL ) {
+    msSetError( MS_MISCERR, "Failed to open %s for streaming to stdout.",
+                "msWCSGetCoverage()", filename );
+    VSIUnlink( filename );
+    return MS_FAILURE;
+  }
+
+  while( (bytes_read = VSIFReadL(block, 1, sizeof(block), fp)) > 0 )
+    msIO_fwrite( block, 1, bytes_read, stdout );
+
+  VSIFCloseL( fp );
+  VSIUnlink( filename );
+
+  return MS_SUCCESS;
+}
+
 /************************************************************************/
 /*                          msWCSGetCoverage()                          */
 /************************************************************************/
@@ -1556,7 +1591,7 @@ static int msWCSGetCoverage(mapObj *map, cgiRequestObj *request,
 {
   imageObj   *image;
   layerObj   *lp;
-  int         status, i;
+  int         status, i, windowLines = 0;
   const char *value;
   outputFormatObj *format;
   char *bandlist=NULL;
@@ -1927,10 +1962,16 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
   msSetOutputFormatOption(map->outputformat, "BAND_COUNT", numbands);
   free( bandlist );
 
-  /* create the image object  */
+  /* create the image object, WCS 1.0 coverages too large to be held in */
+  /* memory are written by windows instead                              */
   if(!map->outputformat) {
     msSetError(MS_WCSERR, "The map outputformat is missing!", "msWCSGetCoverage()");
     return msWCSException(map, NULL, NULL, params->version );
+  } else if( strncmp(params->version, "1.1",3) != 0
+             && (windowLines = msGetRasterWindowLinesGDAL(map, lp)) > 0 ) {
+    image = NULL;
+    if( lp->debug || map->debug )
+      msDebug("msWCSGetCoverage(): writing the coverage by windows.\n");
   } else if( MS_RENDERER_RAWDATA(map->outputformat) || MS_RENDERER_PLUGIN(map->outputformat) ) {
     image = msImageCreate(map->width, map->height, map->outputformat, map->web.imagepath, map->web.imageurl, map->resolution, map->defresolution, NULL);
   } else {
@@ -2001,9 +2042,11 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
     }
   }
 
-  if( image == NULL )
+  if( image == NULL && windowLines == 0 )
     return msWCSException(map, NULL, NULL, params->version );
-  if( MS_RENDERER_RAWDATA(map->outputformat) ) {
+  if( image == NULL ) {
+    status = MS_SUCCESS; /* drawn while writing */
+  } else if( MS_RENDERER_RAWDATA(map->outputformat) ) {
     status = msDrawRasterLayerLow( map, lp, image, NULL );
   } else {
     MS_IMAGE_RENDERER(image)->getRasterBufferHandle(image,&rb);
@@ -2020,6 +2063,24 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
     msWCSReturnCoverage11( params, map, image );
   } else { /* WCS 1.0.0 - just return the binary data with a content type */
     const char *fo_filename;
+    char *filename = NULL;
+
+    /* a coverage written by windows is rendered into a temporary file */
+    /* before any header is sent, so errors still give an exception    */
+    if( image == NULL ) {
+      const char *pszExtension = map->outputformat->extension;
+      if( pszExtension == NULL )
+        pszExtension = "img.tmp";
+
+      filename = msTmpFile(map, map->mappath, NULL, pszExtension);
+      if( filename == NULL )
+        return msWCSException(map, NULL, NULL, params->version );
+      if( msSaveRasterLayerGDAL(map, lp, filename, windowLines) != MS_SUCCESS ) {
+        VSIUnlink( filename );
+        msFree( filename );
+        return msWCSException(map, NULL, NULL, params->version );
+      }
+    }
 
     /* Do we have a predefined filename? */
     fo_filename = msGetOutputFormatOption( format, "FILENAME", NULL );
@@ -2030,7 +2091,11 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
     /* Emit back to client. */
     msIO_setHeader("Content-Type","%s",MS_IMAGE_MIME_TYPE(map->outputformat));
     msIO_sendHeaders();
-    status = msSaveImage(map, image, NULL);
+    if( image == NULL ) {
+      status = msWCSStreamFile(filename);
+      msFree( filename );
+    } else
+      status = msSaveImage(map, image, NULL);
 
     if( status != MS_SUCCESS ) {
       /* unfortunately, the image content type will have already been sent
@@ -2041,7 +2106,8 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage()", par
   }
 
   /* Cleanup */
-  msFreeImage(image);
+  if( image )
+    msFreeImage(image);
   msApplyOutputFormat(&(map->outputformat), NULL, MS_NOOVERRIDE, MS_NOOVERRIDE, MS_NOOVERRIDE);
   /* msFreeOutputFormat(format); */
 
@@ -2060,6 +2126,7 @@ int msWCSDispatch(mapObj *map, cgiRequestObj *request, owsRequestObj *ows_reques
 #if defined(USE_WCS_SVR)
   void *params = NULL; /* either wcsParamsObj* or wcs20ParamsObj* */
   int status, retVal, operation;
+  owsCacheObj cache;
 
   /* If SERVICE is not set or not WCS exit gracefully. */
   if (ows_request->service == NULL
@@ -2204,9 +2271,15 @@ int msWCSDispatch(mapObj *map, cgiRequestObj *request, owsRequestObj *ows_reques
     }
 
     if (operation == MS_WCS_GET_CAPABILITIES) {
-      retVal = msWCSGetCapabilities(map, params, request, ows_request);
+      if (msOWSCacheStart(map, request, "CO", "GetCapabilities", &cache) == MS_DONE)
+        retVal = MS_SUCCESS;
+      else
+        retVal = msOWSCacheEnd(&cache, msWCSGetCapabilities(map, params, request, ows_request));
     } else if (operation == MS_WCS_DESCRIBE_COVERAGE) {
-      retVal = msWCSDescribeCoverage(map, params, ows_request);
+      if (msOWSCacheStart(map, request, "CO", "DescribeCoverage", &cache) == MS_DONE)
+        retVal = MS_SUCCESS;
+      else
+        retVal = msOWSCacheEnd(&cache, msWCSDescribeCoverage(map, params, ows_request));
     } else if (operation == MS_WCS_GET_COVERAGE) {
       retVal = msWCSGetCoverage(map, request, params, ows_request);
     }
@@ -2244,9 +2317,15 @@ int msWCSDispatch(mapObj *map, cgiRequestObj *request, owsRequestObj *ows_reques
 
     /* Call operation specific functions */
     if (operation == MS_WCS_GET_CAPABILITIES) {
-      retVal = msWCSGetCapabilities20(map, request, params, ows_request);
+      if (msOWSCacheStart(map, request, "CO", "GetCapabilities", &cache) == MS_DONE)
+        retVal = MS_SUCCESS;
+      else
+        retVal = msOWSCacheEnd(&cache, msWCSGetCapabilities20(map, request, params, ows_request));
     } else if (operation == MS_WCS_DESCRIBE_COVERAGE) {
-      retVal = msWCSDescribeCoverage20(map, params, ows_request);
+      if (msOWSCacheStart(map, request, "CO", "DescribeCoverage", &cache) == MS_DONE)
+        retVal = MS_SUCCESS;
+      else
+        retVal = msOWSCacheEnd(&cache, msWCSDescribeCoverage20(map, params, ows_request));
     } else if (operation == MS_WCS_GET_COVERAGE) {
       retVal = msWCSGetCoverage20(map, request, params, ows_request);
     } else {
@@ -1607,10 +1607,12 @@ static int msWCSWriteDocument20(mapObj* map, xmlDocPtr psDoc)
 /*                   msWCSWriteFile20()                                 */
 /*                                                                      */
 /*      Writes an image object to the stream. If multipart is set,      */
-/*      then content sections are inserted.                             */
+/*      then content sections are inserted.  If image is NULL, the      */
+/*      coverage of layer is rendered by windows straight into the      */
+/*      output file (see msSaveRasterLayerGDAL()).                      */
 /************************************************************************/
 
-static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr params, int multipart)
+static int msWCSWriteFile20(mapObj* map, imageObj* image, layerObj *layer, wcs20ParamsObjPtr params, int multipart)
 {
   int status;
   char* filename = NULL;
@@ -1618,24 +1620,24 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
   const char *fo_filename;
   int i;
 
-  fo_filename = msGetOutputFormatOption( image->format, "FILENAME", NULL );
+  fo_filename = msGetOutputFormatOption( map->outputformat, "FILENAME", NULL );
 
   /* -------------------------------------------------------------------- */
   /*      Fetch the driver we will be using and check if it supports      */
   /*      VSIL IO.                                                        */
   /* -------------------------------------------------------------------- */
-  if( EQUALN(image->format->driver,"GDAL/",5) ) {
+  if( EQUALN(map->outputformat->driver,"GDAL/",5) ) {
     GDALDriverH hDriver;
-    const char *pszExtension = image->format->extension;
+    const char *pszExtension = map->outputformat->extension;
 
     msAcquireLock( TLOCK_GDAL );
-    hDriver = GDALGetDriverByName( image->format->driver+5 );
+    hDriver = GDALGetDriverByName( map->outputformat->driver+5 );
     if( hDriver == NULL ) {
       msReleaseLock( TLOCK_GDAL );
       msSetError( MS_MISCERR,
                   "Failed to find %s driver.",
                   "msWCSWriteFile20()",
-                  image->format->driver+5 );
+                  map->outputformat->driver+5 );
       return msWCSException(map, "mapserv", "NoApplicableCode",
                             params->version);
     }
@@ -1643,8 +1645,39 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
     if( pszExtension == NULL )
       pszExtension = "img.tmp";
 
-    if( GDALGetMetadataItem( hDriver, GDAL_DCAP_VIRTUALIO, NULL )
-        != NULL ) {
+    if( image == NULL ) {
+      /* windowed output is kept on disk, not in memory */
+      base_dir = msTmpFile(map, map->mappath, NULL, NULL);
+      if( VSIMkdir( base_dir, 0750 ) != 0 ) {
+        msReleaseLock( TLOCK_GDAL );
+        msSetError( MS_MISCERR, "Failed to create temporary directory %s.",
+                    "msWCSWriteFile20()", base_dir );
+        msFree(base_dir);
+        return msWCSException20(map, "mapserv", "NoApplicableCode",
+                                params->version);
+      }
+      if( fo_filename )
+        filename = msStrdup(CPLFormFilename(base_dir,
+                                            fo_filename,NULL));
+      else
+        filename = msStrdup(CPLFormFilename(base_dir,
+                                            "out", pszExtension ));
+
+      msReleaseLock( TLOCK_GDAL );
+      status = msSaveRasterLayerGDAL(map, layer, filename,
+                                     msGetRasterWindowLinesGDAL(map, layer));
+      if( status != MS_SUCCESS ) {
+        VSIUnlink( filename );
+        VSIRmdir( base_dir );
+        msFree(filename);
+        msFree(base_dir);
+        msSetError(MS_MISCERR, "msSaveRasterLayerGDAL() failed",
+                   "msWCSWriteFile20()");
+        return msWCSException20(map, "mapserv", "NoApplicableCode",
+                                params->version);
+      }
+    } else if( GDALGetMetadataItem( hDriver, GDAL_DCAP_VIRTUALIO, NULL )
+               != NULL ) {
       base_dir = msTmpFile(map, map->mappath, "/vsimem/wcsout", NULL);
       if( fo_filename )
         filename = msStrdup(CPLFormFilename(base_dir,
@@ -1811,6 +1844,9 @@ static int msWCSWriteFile20(mapObj* map, imageObj* image, wcs20ParamsObjPtr para
       VSIUnlink( CPLFormFilename(base_dir, all_files[i], NULL) );
     }
 
+    if( image == NULL )
+      VSIRmdir( base_dir );
+
     msFree(base_dir);
     msFree(filename);
     CSLDestroy( all_files );
@@ -3136,7 +3172,7 @@ int msWCSGetCoverage20(mapObj *map, cgiRequestObj *request,
   rectObj subsets, bbox;
   projectionObj imageProj;
 
-  int status, i;
+  int status, i, windowLines = 0;
   double x_1, x_2, y_1, y_2;
   char *coverageName, *bandlist=NULL, numbands[8];
 
@@ -3480,13 +3516,18 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msLayerSetProcessingKey(layer, "CLOSE_CONNECTION", "NORMAL");
   }
 
-  /* create the image object  */
+  /* create the image object, unless the coverage is too large to be */
+  /* held in memory and gets written by windows instead              */
   if (!map->outputformat) {
     msWCSClearCoverageMetadata20(&cm);
     msFree(bandlist);
     msSetError(MS_WCSERR, "The map outputformat is missing!",
                "msWCSGetCoverage20()");
     return msWCSException(map, NULL, NULL, params->version);
+  } else if ((windowLines = msGetRasterWindowLinesGDAL(map, layer)) > 0) {
+    image = NULL;
+    if (layer->debug || map->debug)
+      msDebug("msWCSGetCoverage20(): writing the coverage by windows.\n");
   } else if (MS_RENDERER_PLUGIN(map->outputformat)) {
     image = msImageCreate(map->width, map->height, map->outputformat,
                           map->web.imagepath, map->web.imageurl, map->resolution,
@@ -3503,7 +3544,7 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     return msWCSException(map, NULL, NULL, params->version);
   }
 
-  if (image == NULL) {
+  if (image == NULL && windowLines == 0) {
     msFree(bandlist);
     msWCSClearCoverageMetadata20(&cm);
     return msWCSException(map, NULL, NULL, params->version);
@@ -3573,7 +3614,9 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
   }
 
   /* Actually produce the "grid". */
-  if( MS_RENDERER_RAWDATA(map->outputformat) ) {
+  if( image == NULL ) {
+    status = MS_SUCCESS; /* drawn while writing */
+  } else if( MS_RENDERER_RAWDATA(map->outputformat) ) {
     status = msDrawRasterLayerLow( map, layer, image, NULL );
   } else {
     rasterBufferObj rb;
@@ -3650,9 +3693,9 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     psRangeParameters = xmlNewChild(psFile, psGmlNs, BAD_CAST "rangeParameters", NULL);
 
     default_filename = msStrdup("out.");
-    default_filename = msStringConcatenate(default_filename, MS_IMAGE_EXTENSION(image->format));
+    default_filename = msStringConcatenate(default_filename, MS_IMAGE_EXTENSION(map->outputformat));
 
-    filename = msGetOutputFormatOption(image->format, "FILENAME", default_filename);
+    filename = msGetOutputFormatOption(map->outputformat, "FILENAME", default_filename);
     length = strlen("cid:coverage/") + strlen(filename) + 1;
     file_ref = msSmallMalloc(length);
     strlcpy(file_ref, "cid:coverage/", length);
@@ -3684,7 +3727,7 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     msIO_printf("\r\n--wcs\r\n");
 
     msWCSWriteDocument20(map, psDoc);
-    msWCSWriteFile20(map, image, params, 1);
+    msWCSWriteFile20(map, image, layer, params, 1);
 
     msFree(file_ref);
     msFree(role);
@@ -3692,12 +3735,13 @@ this request. Check wcs/ows_enable_request settings.", "msWCSGetCoverage20()", p
     xmlCleanupParser();
   /* just print out the file without gml */
   } else {
-    msWCSWriteFile20(map, image, params, 0);
+    msWCSWriteFile20(map, image, layer, params, 0);
   }
 
   msFree(bandlist);
   msWCSClearCoverageMetadata20(&cm);
-  msFreeImage(image);
+  if(image)
+    msFreeImage(image);
   return MS_SUCCESS;
 }
 
@@ -2472,6 +2472,7 @@ int msWFSDispatch(mapObj *map, cgiRequestObj *requestobj, owsRequestObj *ows_req
 #ifdef USE_WFS_SVR
   int status;
   int returnvalue = MS_DONE;
+  owsCacheObj cache;
 
   /* static char *wmtver = NULL, *request=NULL, *service=NULL; */
   wfsParamsObj *paramsObj;
@@ -2636,7 +2637,10 @@ int msWFSDispatch(mapObj *map, cgiRequestObj *requestobj, owsRequestObj *ows_req
       return returnvalue;
     }
 
-    returnvalue = msWFSGetCapabilities(map, paramsObj, requestobj, ows_request);
+    if (msOWSCacheStart(map, requestobj, "FO", "GetCapabilities", &cache) == MS_DONE)
+      returnvalue = MS_SUCCESS;
+    else
+      returnvalue = msOWSCacheEnd(&cache, msWFSGetCapabilities(map, paramsObj, requestobj, ows_request));
     msWFSFreeParamsObj(paramsObj);
     free(paramsObj);
     paramsObj = NULL;
@@ -2677,8 +2681,12 @@ int msWFSDispatch(mapObj *map, cgiRequestObj *requestobj, owsRequestObj *ows_req
   returnvalue = MS_DONE;
   /* Continue dispatching...
    */
-  if (strcasecmp(paramsObj->pszRequest, "DescribeFeatureType") == 0)
-    returnvalue = msWFSDescribeFeatureType(map, paramsObj, ows_request);
+  if (strcasecmp(paramsObj->pszRequest, "DescribeFeatureType") == 0) {
+    if (msOWSCacheStart(map, requestobj, "FO", "DescribeFeatureType", &cache) == MS_DONE)
+      returnvalue = MS_SUCCESS;
+    else
+      returnvalue = msOWSCacheEnd(&cache, msWFSDescribeFeatureType(map, paramsObj, ows_request));
+  }
 
   else if (strcasecmp(paramsObj->pszRequest, "GetFeature") == 0)
     returnvalue = msWFSGetFeature(map, paramsObj, requestobj, ows_request);
@@ -3639,6 +3639,157 @@ int msTranslateWMS2Mapserv(const char **names, const char **values, int numentri
 /*
 ** msWMSGetMap()
 */
+/*
+** msWMSGetMapBatch()
+**
+** Vendor specific GetMap extension for tiling and seeding clients: BBOXES
+** holds a semicolon separated list of bounding boxes (same syntax as BBOX)
+** that are all rendered with the other GetMap parameters in one request, see
+** msDrawMapBatch(). The images are returned as the parts of a multipart/mixed
+** response, in the order of BBOXES.
+**
+** Disabled unless wms_getmap_batch_maxsize (the maximum number of bounding
+** boxes per request) is set, wms_getmap_batch_workers sets the number of
+** rendering threads.
+*/
+#define MS_WMS_BATCH_BOUNDARY "mapserver-getmap-batch"
+
+static int msWMSGetMapBatch(mapObj *map, int nVersion, const char *bboxes, char **names, char **values,
+                            int numentries, char *wms_exception_format)
+{
+  const char *value, *srs = NULL, *http_max_age;
+  char **boxes, **tokens;
+  int numboxes, n, i, maxsize, numworkers = 1, pixel_is_point = MS_FALSE;
+  rectObj *extents;
+  imageObj **images;
+  projectionObj proj;
+
+  value = msOWSLookupMetadata(&(map->web.metadata), "MO", "getmap_batch_maxsize");
+  maxsize = value ? atoi(value) : 0;
+  if (maxsize <= 0) {
+    msSetError(MS_WMSERR, "BBOXES is not enabled on this server.", "msWMSGetMapBatch()");
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
+  if ((value = msOWSLookupMetadata(&(map->web.metadata), "MO", "getmap_batch_workers")) != NULL)
+    numworkers = atoi(value);
+
+  for (i=0; i<numentries; i++) {
+    if ((strcasecmp(names[i], "SRS") == 0 && nVersion < OWS_1_3_0) ||
+        (strcasecmp(names[i], "CRS") == 0 && nVersion >= OWS_1_3_0))
+      srs = values[i];
+    else if (strcasecmp(names[i], "BBOX_PIXEL_IS_POINT") == 0)
+      pixel_is_point = (strcasecmp(values[i], "TRUE") == 0);
+  }
+  if (srs && strncasecmp(srs, "AUTO2:", 6) == 0) {
+    msSetError(MS_WMSERR, "BBOXES is not supported with AUTO2 CRS.", "msWMSGetMapBatch()");
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
+
+  boxes = msStringSplit(bboxes, ';', &numboxes);
+  if (numboxes > maxsize) {
+    msSetError(MS_WMSERR, "Too many bounding boxes in BBOXES (%d, the maximum is %d).", "msWMSGetMapBatch()", numboxes, maxsize);
+    msFreeCharArray(boxes, numboxes);
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
+
+  /* parse the boxes as msWMSLoadGetMapParams() does with BBOX */
+  msInitProjection(&proj);
+  if (nVersion >= OWS_1_3_0 && srs && strncasecmp(srs, "EPSG:", 5) == 0) {
+    char srsbuffer[100];
+    snprintf(srsbuffer, sizeof(srsbuffer), "EPSG:%.20s", srs+5);
+    if (srsbuffer[strlen(srsbuffer)-1] == ',')
+      srsbuffer[strlen(srsbuffer)-1] = '\0';
+    if (msLoadProjectionStringEPSG(&proj, srsbuffer) != 0) {
+      msFreeProjection(&proj);
+      msInitProjection(&proj);
+    }
+  }
+
+  extents = (rectObj *) msSmallMalloc(sizeof(rectObj)*numboxes);
+  for (i=0; i<numboxes; i++) {
+    tokens = msStringSplit(boxes[i], ',', &n);
+    if (tokens==NULL || n != 4) {
+      msSetError(MS_WMSERR, "Wrong number of arguments for bounding box %d of BBOXES.", "msWMSGetMapBatch()", i+1);
+      msFreeCharArray(tokens, n);
+      break;
+    }
+    extents[i].minx = atof(tokens[0]);
+    extents[i].miny = atof(tokens[1]);
+    extents[i].maxx = atof(tokens[2]);
+    extents[i].maxy = atof(tokens[3]);
+    msFreeCharArray(tokens, n);
+
+    if (proj.numargs > 0) {
+      msAxisNormalizePoints( &proj, 1, &extents[i].minx, &extents[i].miny );
+      msAxisNormalizePoints( &proj, 1, &extents[i].maxx, &extents[i].maxy );
+    }
+
+    if (extents[i].minx >= extents[i].maxx || extents[i].miny >= extents[i].maxy) {
+      msSetError(MS_WMSERR, "Invalid values for bounding box %d of BBOXES.", "msWMSGetMapBatch()", i+1);
+      break;
+    }
+
+    /* WMS extents are edge to edge, MapServer's are center of pixel to center of pixel */
+    if (map->width>1 && map->height>1 && !pixel_is_point) {
+      double dx, dy;
+
+      dx = (extents[i].maxx - extents[i].minx) / map->width;
+      extents[i].minx += dx*0.5;
+      extents[i].maxx -= dx*0.5;
+
+      dy = (extents[i].maxy - extents[i].miny) / map->height;
+      extents[i].miny += dy*0.5;
+      extents[i].maxy -= dy*0.5;
+    }
+  }
+  msFreeProjection(&proj);
+
+  if (i < numboxes) {
+    msFree(extents);
+    msFreeCharArray(boxes, numboxes);
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
+
+  images = msDrawMapBatch(map, extents, numboxes, numworkers);
+  if (images == NULL) {
+    msFree(extents);
+    msFreeCharArray(boxes, numboxes);
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+  }
+
+  if( (http_max_age = msOWSLookupMetadata(&(map->web.metadata), "MO", "http_max_age")) ) {
+    msIO_setHeader("Cache-Control","max-age=%s", http_max_age);
+  }
+  msIO_setHeader("Content-Type", "multipart/mixed; boundary=%s", MS_WMS_BATCH_BOUNDARY);
+  msIO_sendHeaders();
+
+  for (i=0; i<numboxes; i++) {
+    msIO_printf("--%s\r\nContent-Type: %s\r\nContent-Description: %s\r\n\r\n",
+                MS_WMS_BATCH_BOUNDARY, MS_IMAGE_MIME_TYPE(images[i]->format), boxes[i]);
+
+    /* georeferenced formats take the extent from the map */
+    map->extent = extents[i];
+    map->cellsize = msAdjustExtent(&(map->extent), map->width, map->height);
+    if (msSaveImage(map, images[i], NULL) != MS_SUCCESS)
+      break;
+    msIO_printf("\r\n");
+  }
+  if (i == numboxes)
+    msIO_printf("--%s--\r\n", MS_WMS_BATCH_BOUNDARY);
+
+  for (n=0; n<numboxes; n++)
+    msFreeImage(images[n]);
+  msFree(images);
+  msFree(extents);
+  msFreeCharArray(boxes, numboxes);
+
+  /* headers are gone, the best we can do is to report the error in the stream */
+  if (i < numboxes)
+    return msWMSException(map, nVersion, NULL, wms_exception_format);
+
+  return MS_SUCCESS;
+}
+
 int msWMSGetMap(mapObj *map, int nVersion, char **names, char **values, int numentries,
                 char *wms_exception_format, owsRequestObj *ows_request)
 {
@@ -3679,6 +3830,16 @@ int msWMSGetMap(mapObj *map, int nVersion, char **names, char **values, int nume
     if (!msIntegerInArray(GET_LAYER(map, i)->index, ows_request->enabled_layers, ows_request->numlayers))
       GET_LAYER(map, i)->status = MS_OFF;
 
+  for (i=0; i<numentries; i++) {
+    if (strcasecmp(names[i], "BBOXES") == 0 && values[i] && strlen(values[i]) > 0) {
+      if (sldspatialfilter) {
+        msSetError(MS_WMSERR, "BBOXES cannot be used with an SLD containing spatial filters.", "msWMSGetMap()");
+        return msWMSException(map, nVersion, NULL, wms_exception_format);
+      }
+      return msWMSGetMapBatch(map, nVersion, values[i], names, values, numentries, wms_exception_format);
+    }
+  }
+
   if (sldrequested && sldspatialfilter) {
     /* set the quermap style so that only selected features will be retruned */
     map->querymap.status = MS_ON;
@@ -4906,6 +5067,7 @@ int msWMSDispatch(mapObj *map, cgiRequestObj *req, owsRequestObj *ows_request, i
                   strcasecmp(request, "GetCapabilities") == 0) ) {
     const char *enable_request;
     int globally_enabled, disabled = MS_FALSE;
+    owsCacheObj cache;
 
     if (nVersion == OWS_VERSION_NOTSET) {
       version = msOWSLookupMetadata(&(map->web.metadata), "M", "getcapabilities_version");
@@ -4927,7 +5089,11 @@ int msWMSDispatch(mapObj *map, cgiRequestObj *req, owsRequestObj *ows_request, i
       msSetError(MS_WMSERR, "WMS request not enabled. Check wms/ows_enable_request settings.", "msWMSGetCapabilities()");
       return msWMSException(map, nVersion, NULL, wms_exception_format);
     }
-    return msWMSGetCapabilities(map, nVersion, req, ows_request, updatesequence, wms_exception_format, language);
+
+    if (msOWSCacheStart(map, req, "MO", "GetCapabilities", &cache) == MS_DONE)
+      return MS_SUCCESS;
+    status = msWMSGetCapabilities(map, nVersion, req, ows_request, updatesequence, wms_exception_format, language);
+    return msOWSCacheEnd(&cache, status);
   } else if (request && (strcasecmp(request, "context") == 0 ||
                          strcasecmp(request, "GetContext") == 0) ) {
     /* Return a context document with all layers in this mapfile
@@ -5092,9 +5258,46 @@ int msWMSDispatch(mapObj *map, cgiRequestObj *req, owsRequestObj *ows_request, i
   /* getMap parameters are used by both getMap, getFeatureInfo, and content dependant legendgraphics */
   if (strcasecmp(request, "map") == 0 || strcasecmp(request, "GetMap") == 0 ||
       strcasecmp(request, "feature_info") == 0 || strcasecmp(request, "GetFeatureInfo") == 0 || strcasecmp(request, "DescribeLayer") == 0 || isContentDependantLegend) {
+    char **names = req->ParamNames, **values = req->ParamValues;
+    int numentries = req->NumParams;
+    char *firstbox = NULL;
+
+    /*
+     * a batch request (BBOXES) doesn't need a BBOX, use the first of the
+     * bounding boxes so that the usual GetMap parameter handling applies.
+     * The caller's request is left untouched.
+     */
+    if (strcasecmp(request, "map") == 0 || strcasecmp(request, "GetMap") == 0) {
+      const char *bboxes = NULL;
+      for(i=0; i<req->NumParams; i++) {
+        if(strcasecmp(req->ParamNames[i], "BBOX") == 0)
+          break;
+        if(strcasecmp(req->ParamNames[i], "BBOXES") == 0 && req->ParamValues[i] && *req->ParamValues[i])
+          bboxes = req->ParamValues[i];
+      }
+      if(i == req->NumParams && bboxes) {
+        firstbox = msStrdup(bboxes);
+        if(strchr(firstbox, ';'))
+          *strchr(firstbox, ';') = '\0';
+        names = (char **) msSmallMalloc(sizeof(char *) * (numentries+1));
+        values = (char **) msSmallMalloc(sizeof(char *) * (numentries+1));
+        if(numentries > 0) {
+          memcpy(names, req->ParamNames, sizeof(char *) * numentries);
+          memcpy(values, req->ParamValues, sizeof(char *) * numentries);
+        }
+        names[numentries] = "BBOX";
+        values[numentries] = firstbox;
+        numentries++;
+      }
+    }
 
-    status = msWMSLoadGetMapParams(map, nVersion, req->ParamNames, req->ParamValues, req->NumParams,
+    status = msWMSLoadGetMapParams(map, nVersion, names, values, numentries,
                                    wms_exception_format, request, ows_request);
+    if (firstbox) {
+      msFree(names);
+      msFree(values);
+      msFree(firstbox);
+    }
     if (status != MS_SUCCESS) return status;
   }
 
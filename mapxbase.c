@@ -114,6 +114,9 @@ static void writeHeader(DBFHandle psDBF)
   }
 }
 
+/* size of the block read ahead when records are accessed in ascending order */
+#define MS_DBF_READAHEAD_SIZE 65536
+
 /************************************************************************/
 /*                           flushRecord()                              */
 /*                                                                      */
@@ -132,9 +135,64 @@ static void flushRecord( DBFHandle psDBF )
 
     safe_fseek( psDBF->fp, nRecordOffset, 0 );
     fwrite( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
+
+    /* the read-ahead block may now be stale */
+    psDBF->nBlockRecords = 0;
   }
 }
 
+/************************************************************************/
+/*                            loadRecord()                              */
+/*                                                                      */
+/*      Make hEntity the current record. When records are requested     */
+/*      sequentially, or with forward jumps shorter than a block (the   */
+/*      shapes of a dense spatial query walked through the status       */
+/*      bitmap), a block of records is read with a single fread() and   */
+/*      later records are served from it, instead of a seek and read    */
+/*      per record. Random access still reads a single record.          */
+/************************************************************************/
+static void loadRecord( DBFHandle psDBF, int hEntity )
+
+{
+  unsigned int nRecordOffset;
+  int nBlockRecords;
+
+  if( psDBF->nCurrentRecord == hEntity )
+    return;
+
+  flushRecord( psDBF );
+
+  if( psDBF->nBlockRecords > 0 && hEntity >= psDBF->nBlockStart
+      && hEntity < psDBF->nBlockStart + psDBF->nBlockRecords ) {
+    memcpy( psDBF->pszCurrentRecord,
+            psDBF->pszRecordBlock + (hEntity - psDBF->nBlockStart) * psDBF->nRecordLength,
+            psDBF->nRecordLength );
+    psDBF->nCurrentRecord = hEntity;
+    return;
+  }
+
+  nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
+  safe_fseek( psDBF->fp, nRecordOffset, 0 );
+
+  nBlockRecords = MS_DBF_READAHEAD_SIZE / psDBF->nRecordLength;
+  if( nBlockRecords > psDBF->nRecords - hEntity )
+    nBlockRecords = psDBF->nRecords - hEntity;
+
+  if( nBlockRecords > 1 && hEntity > psDBF->nCurrentRecord
+      && hEntity - psDBF->nCurrentRecord <= MS_DBF_READAHEAD_SIZE / psDBF->nRecordLength ) {
+    if( psDBF->pszRecordBlock == NULL )
+      psDBF->pszRecordBlock = (char *) msSmallMalloc( MS_DBF_READAHEAD_SIZE );
+
+    psDBF->nBlockStart = hEntity;
+    psDBF->nBlockRecords = fread( psDBF->pszRecordBlock, psDBF->nRecordLength, nBlockRecords, psDBF->fp );
+    if( psDBF->nBlockRecords > 0 )
+      memcpy( psDBF->pszCurrentRecord, psDBF->pszRecordBlock, psDBF->nRecordLength );
+  } else
+    fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
+
+  psDBF->nCurrentRecord = hEntity;
+}
+
 /************************************************************************/
 /*                              msDBFOpen()                             */
 /*                                                                      */
@@ -302,6 +360,7 @@ void  msDBFClose(DBFHandle psDBF)
   free( psDBF->pszCurrentRecord );
 
   if(psDBF->pszStringField) free(psDBF->pszStringField);
+  if(psDBF->pszRecordBlock) free(psDBF->pszRecordBlock);
 
   free( psDBF );
 }
@@ -361,6 +420,10 @@ DBFHandle msDBFCreate( const char * pszFilename )
   psDBF->pszStringField = NULL;
   psDBF->nStringFieldLen = 0;
 
+  psDBF->pszRecordBlock = NULL;
+  psDBF->nBlockStart = 0;
+  psDBF->nBlockRecords = 0;
+
   psDBF->bNoHeader = MS_TRUE;
   psDBF->bUpdated = MS_FALSE;
 
@@ -489,6 +552,56 @@ int DBFIsValueNULL( const char* pszValue, char type )
   }
 }
 
+/************************************************************************/
+/*                           getFieldValue()                            */
+/*                                                                      */
+/*      Locate the value of a field of the current record, without      */
+/*      copying it. Trailing blanks (and leading blanks on numeric      */
+/*      and date fields) are trimmed, NULL numeric and date values      */
+/*      are returned as "0". The value is *not* nul terminated, its     */
+/*      length is returned in pnLength.                                 */
+/************************************************************************/
+static const char *getFieldValue( DBFHandle psDBF, int iField, int *pnLength )
+
+{
+  const char *pszValue = psDBF->pszCurrentRecord + psDBF->panFieldOffset[iField];
+  const char *pszEnd;
+  char chType = psDBF->pachFieldType[iField];
+  int nLength;
+
+  /* values stop at the first nul byte, as they would with strncpy() */
+  pszEnd = (const char *) memchr( pszValue, '\0', psDBF->panFieldSize[iField] );
+  if( pszEnd == NULL )
+    pszEnd = pszValue + psDBF->panFieldSize[iField];
+
+  /*
+  ** Trim trailing blanks (SDL Modification)
+  */
+  while( pszEnd > pszValue && pszEnd[-1] == ' ' )
+    pszEnd--;
+
+  /*
+  ** Trim/skip leading blanks (SDL/DM Modification - only on numeric types)
+  */
+  if( chType == 'N' || chType == 'F' || chType == 'D' ) {
+    while( pszValue < pszEnd && *pszValue == ' ' )
+      pszValue++;
+  }
+  nLength = pszEnd - pszValue;
+
+  /*  detect null values */
+  if( (chType == 'N' || chType == 'F') && nLength > 0 && pszValue[0] == '*' ) {
+    pszValue = "0";
+    nLength = 1;
+  } else if( chType == 'D' && nLength >= 8 && strncmp(pszValue,"00000000",8) == 0 ) {
+    pszValue = "0";
+    nLength = 1;
+  }
+
+  *pnLength = nLength;
+  return pszValue;
+}
+
 /************************************************************************/
 /*                          msDBFReadAttribute()                        */
 /*                                                                      */
@@ -497,10 +610,8 @@ int DBFIsValueNULL( const char* pszValue, char type )
 static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
 
 {
-  int         i;
-  unsigned int nRecordOffset;
-  uchar *pabyRec;
-  char  *pReturnField = NULL;
+  const char *pszValue;
+  int nLength;
 
   /* -------------------------------------------------------------------- */
   /*  Is the request valid?                             */
@@ -518,20 +629,7 @@ static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
   /* -------------------------------------------------------------------- */
   /*  Have we read the record?              */
   /* -------------------------------------------------------------------- */
-  if( psDBF->nCurrentRecord != hEntity ) {
-    flushRecord( psDBF );
-
-    nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
-
-    safe_fseek( psDBF->fp, nRecordOffset, 0 );
-    fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
-
-    psDBF->nCurrentRecord = hEntity;
-  }
-
-  pabyRec = (uchar *) psDBF->pszCurrentRecord;
-  /* DEBUG */
-  /* printf("CurrentRecord(%c):%s\n", psDBF->pachFieldType[iField], pabyRec); */
+  loadRecord( psDBF, hEntity );
 
   /* -------------------------------------------------------------------- */
   /*  Ensure our field buffer is large enough to hold this buffer.      */
@@ -544,39 +642,11 @@ static char *msDBFReadAttribute(DBFHandle psDBF, int hEntity, int iField )
   /* -------------------------------------------------------------------- */
   /*  Extract the requested field.              */
   /* -------------------------------------------------------------------- */
-  strncpy( psDBF->pszStringField,(char *) pabyRec+psDBF->panFieldOffset[iField], psDBF->panFieldSize[iField] );
-  psDBF->pszStringField[psDBF->panFieldSize[iField]] = '\0';
+  pszValue = getFieldValue( psDBF, iField, &nLength );
+  memcpy( psDBF->pszStringField, pszValue, nLength );
+  psDBF->pszStringField[nLength] = '\0';
 
-  /*
-  ** Trim trailing blanks (SDL Modification)
-  */
-  for(i=strlen(psDBF->pszStringField)-1; i>=0; i--) {
-    if(psDBF->pszStringField[i] != ' ') {
-      psDBF->pszStringField[i+1] = '\0';
-      break;
-    }
-  }
-
-  if(i == -1) psDBF->pszStringField[0] = '\0'; /* whole string is blank (SDL fix)       */
-
-  /*
-  ** Trim/skip leading blanks (SDL/DM Modification - only on numeric types)
-  */
-  if( psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D' ) {
-    for(i=0; psDBF->pszStringField[i] != '\0' ; i++) {
-      if(psDBF->pszStringField[i] != ' ')
-        break;
-    }
-    pReturnField = psDBF->pszStringField+i;
-  } else
-    pReturnField = psDBF->pszStringField;
-
-  /*  detect null values */
-  if ( DBFIsValueNULL( pReturnField, psDBF->pachFieldType[iField] )  ) {
-    if (psDBF->pachFieldType[iField] == 'N' || psDBF->pachFieldType[iField] == 'F' || psDBF->pachFieldType[iField] == 'D')
-      pReturnField="0";
-  }
-  return( pReturnField );
+  return( psDBF->pszStringField );
 }
 
 /************************************************************************/
@@ -597,7 +667,22 @@ int msDBFReadIntegerAttribute( DBFHandle psDBF, int iRecord, int iField )
 /************************************************************************/
 double  msDBFReadDoubleAttribute( DBFHandle psDBF, int iRecord, int iField )
 {
-  return(atof(msDBFReadAttribute( psDBF, iRecord, iField )));
+  const char *pszValue;
+  char szNumber[64];
+  int nLength;
+
+  if( iField < 0 || iField >= psDBF->nFields || iRecord < 0 || iRecord >= psDBF->nRecords )
+    return(atof(msDBFReadAttribute( psDBF, iRecord, iField ))); /* reports the error */
+
+  /* numeric fields are short, parse them from a stack copy */
+  loadRecord( psDBF, iRecord );
+  pszValue = getFieldValue( psDBF, iField, &nLength );
+  if( nLength >= (int) sizeof(szNumber) )
+    return(atof(msDBFReadAttribute( psDBF, iRecord, iField )));
+  memcpy( szNumber, pszValue, nLength );
+  szNumber[nLength] = '\0';
+
+  return(atof(szNumber));
 }
 
 /************************************************************************/
@@ -674,7 +759,6 @@ DBFFieldType msDBFGetFieldInfo( DBFHandle psDBF, int iField, char * pszFieldName
 /************************************************************************/
 static int msDBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void * pValue )
 {
-  unsigned int          nRecordOffset;
   int  i, j;
   uchar *pabyRec;
   char  szSField[40], szFormat[12];
@@ -705,16 +789,7 @@ static int msDBFWriteAttribute(DBFHandle psDBF, int hEntity, int iField, void *
   /*      Is this an existing record, but different than the last one     */
   /*      we accessed?                                                    */
   /* -------------------------------------------------------------------- */
-  if( psDBF->nCurrentRecord != hEntity ) {
-    flushRecord( psDBF );
-
-    nRecordOffset = psDBF->nRecordLength * hEntity + psDBF->nHeaderLength;
-
-    safe_fseek( psDBF->fp, nRecordOffset, 0 );
-    fread( psDBF->pszCurrentRecord, psDBF->nRecordLength, 1, psDBF->fp );
-
-    psDBF->nCurrentRecord = hEntity;
-  }
+  loadRecord( psDBF, hEntity );
 
   pabyRec = (uchar *) psDBF->pszCurrentRecord;
 
@@ -881,24 +956,41 @@ int *msDBFGetItemIndexes(DBFHandle dbffile, char **items, int numitems)
   return(itemindexes);
 }
 
+/*
+** Load the values of the requested items (layer->iteminfo) of a record. The
+** record is read once and only the requested fields are decoded, each value
+** is copied straight from the record into its own allocation (the array is
+** released with msFreeCharArray()).
+*/
 char **msDBFGetValueList(DBFHandle dbffile, int record, int *itemindexes, int numitems)
 {
   const char *value;
   char **values=NULL;
-  int i;
+  int i, length;
 
   if(numitems == 0) return(NULL);
 
+  if(record < 0 || record >= dbffile->nRecords) {
+    msSetError(MS_DBFERR, "Invalid record number %d.", "msDBFGetValueList()", record);
+    return(NULL);
+  }
+  for(i=0; i<numitems; i++) {
+    if(itemindexes[i] < 0 || itemindexes[i] >= dbffile->nFields) {
+      msSetError(MS_DBFERR, "Invalid field index %d.", "msDBFGetValueList()", itemindexes[i]);
+      return(NULL);
+    }
+  }
+
   values = (char **)malloc(sizeof(char *)*numitems);
   MS_CHECK_ALLOC(values, sizeof(char *)*numitems, NULL);
 
+  loadRecord(dbffile, record);
+
   for(i=0; i<numitems; i++) {
-    value = msDBFReadStringAttribute(dbffile, record, itemindexes[i]);
-    if (value == NULL) {
-      free(values);
-      return NULL; /* Error already reported by msDBFReadStringAttribute() */
-    }
-    values[i] = msStrdup(value);
+    value = getFieldValue(dbffile, itemindexes[i], &length);
+    values[i] = (char *) msSmallMalloc(length+1);
+    memcpy(values[i], value, length);
+    values[i][length] = '\0';
   }
 
   return(values);
@@ -0,0 +1,107 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command-line utility to build layer occupancy grids (see mapoccupancy.c)
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+
+
+
+void PrintUsage()
+{
+  printf("Usage: msoccupancy mapfile [-levels n] [layer ...]\n");
+  printf("       Builds the occupancy grid of the named layers, or of all layers with\n");
+  printf("       an OCCUPANCY processing key, with 2^n cells on a side (default 8).\n");
+}
+
+int main(int argc, char *argv[])
+{
+  mapObj *map;
+  int levels = 8, numlayers = 0, status = 0, i;
+  char **layers;
+
+  if (argc < 2) {
+    PrintUsage();
+    return 0;
+  }
+
+  layers = (char **) msSmallCalloc(argc, sizeof(char *));
+  for (i=2; i<argc; i++) {
+    if (strcmp(argv[i], "-levels") == 0 && i+1 < argc)
+      levels = atoi(argv[++i]);
+    else if (argv[i][0] == '-') {
+      PrintUsage();
+      msFree(layers);
+      return 1;
+    } else
+      layers[numlayers++] = argv[i];
+  }
+
+  if (msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    msFree(layers);
+    return 1;
+  }
+
+  map = msLoadMap(argv[1], NULL);
+  if (map == NULL) {
+    msWriteError(stderr);
+    msFree(layers);
+    msCleanup(0);
+    return 1;
+  }
+
+  for (i=0; i<numlayers; i++) {
+    if (msGetLayerIndex(map, layers[i]) < 0) {
+      fprintf(stderr, "Layer %s not found in %s.\n", layers[i], argv[1]);
+      status = 1;
+    }
+  }
+
+  for (i=0; i<map->numlayers && status == 0; i++) {
+    layerObj *layer = GET_LAYER(map, i);
+    char path[MS_MAXPATHLEN];
+    int j;
+
+    for (j=0; j<numlayers; j++)
+      if (layer->name && strcmp(layer->name, layers[j]) == 0) break;
+    if (numlayers > 0 ? j == numlayers : msLayerGetOccupancyFile(map, layer, path) == NULL)
+      continue;
+
+    if (msLayerBuildOccupancy(map, layer, levels) != MS_SUCCESS) {
+      msWriteError(stderr);
+      status = 1;
+    } else
+      printf("%s: %s\n", layer->name, msLayerGetOccupancyFile(map, layer, path));
+  }
+
+  msFreeMap(map);
+  msFree(layers);
+  msCleanup(0);
+
+  return status;
+}
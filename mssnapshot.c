@@ -0,0 +1,73 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command-line utility to write mapfile snapshots (see mapsnapshot.c)
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+
+
+
+void PrintUsage()
+{
+  printf("Usage: mssnapshot mapfile [snapshotfile]\n");
+  printf("       Writes a snapshot of mapfile, for applications loading it with\n");
+  printf("       msLoadMapSnapshotIfFresh(). snapshotfile defaults to mapfile%s.\n", MS_SNAPSHOT_EXTENSION);
+}
+
+int main(int argc, char *argv[])
+{
+  mapObj *map;
+
+  if (argc < 2 || argc > 3) {
+    PrintUsage();
+    return 0;
+  }
+
+  if (msSetup() != MS_SUCCESS) {
+    msWriteError(stderr);
+    return 1;
+  }
+
+  map = msLoadMap(argv[1], NULL);
+  if (map == NULL) {
+    msWriteError(stderr);
+    msCleanup(0);
+    return 1;
+  }
+
+  if (msSaveMapSnapshot(map, argv[1], argc == 3 ? argv[2] : NULL) != MS_SUCCESS) {
+    msWriteError(stderr);
+    msFreeMap(map);
+    msCleanup(0);
+    return 1;
+  }
+
+  msFreeMap(map);
+  msCleanup(0);
+
+  return 0;
+}
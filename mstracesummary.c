@@ -0,0 +1,198 @@
+/******************************************************************************
+ * $Id$
+ *
+ * Project:  MapServer
+ * Purpose:  Command-line utility aggregating MS_TRACEFILE output (see
+ *           maptrace.c) into per-stage timing percentiles.
+ * Author:   MapServer Team
+ *
+ ******************************************************************************
+ * Copyright (c) 1996-2013 Regents of the University of Minnesota.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies of this Software or works derived from this Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ ****************************************************************************/
+
+#include "mapserver.h"
+
+
+
+typedef struct {
+  char *key;
+  double *durations; /* in microseconds */
+  int count, size;
+  long features;
+  long bytes;
+} stageObj;
+
+static stageObj *stages = NULL;
+static int numstages = 0;
+
+void PrintUsage()
+{
+  printf("Usage: mstracesummary [-layer] [tracefile ...]\n");
+  printf("       Reads MS_TRACEFILE output (stdin if no file is given) and prints\n");
+  printf("       count, total and percentile timings per stage. -layer breaks the\n");
+  printf("       stages down per layer.\n");
+}
+
+/* extract a "key":"value" string, NULL if absent or null */
+static char *getStringMember(const char *line, const char *key)
+{
+  char pattern[64], *value;
+  const char *start, *end;
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+  if((start = strstr(line, pattern)) == NULL)
+    return NULL;
+  start += strlen(pattern);
+  for(end = start; *end && *end != '"'; end++)
+    if(*end == '\\' && end[1]) end++;
+
+  value = (char *) msSmallMalloc(end - start + 1);
+  strncpy(value, start, end - start);
+  value[end - start] = '\0';
+  return value;
+}
+
+static int getNumberMember(const char *line, const char *key, double *value)
+{
+  char pattern[64];
+  const char *start;
+
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  if((start = strstr(line, pattern)) == NULL)
+    return MS_FALSE;
+  *value = atof(start + strlen(pattern));
+  return MS_TRUE;
+}
+
+static stageObj *getStage(const char *key)
+{
+  int i;
+
+  for(i=0; i<numstages; i++)
+    if(strcmp(stages[i].key, key) == 0) return &(stages[i]);
+
+  stages = (stageObj *) msSmallRealloc(stages, sizeof(stageObj)*(numstages+1));
+  memset(&(stages[numstages]), 0, sizeof(stageObj));
+  stages[numstages].key = msStrdup(key);
+  return &(stages[numstages++]);
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+static int compareStages(const void *a, const void *b)
+{
+  return strcmp(((const stageObj *)a)->key, ((const stageObj *)b)->key);
+}
+
+static double percentile(stageObj *stage, double p)
+{
+  int i = (int) ceil(p/100.0*stage->count) - 1;
+  if(i < 0) i = 0;
+  if(i >= stage->count) i = stage->count-1;
+  return stage->durations[i];
+}
+
+static void readTrace(FILE *fp, int bylayer)
+{
+  char line[4096];
+
+  while(fgets(line, sizeof(line), fp) != NULL) {
+    char *name, *layer, key[1024];
+    double duration, value;
+    stageObj *stage;
+
+    if((name = getStringMember(line, "name")) == NULL || !getNumberMember(line, "dur", &duration)) {
+      msFree(name);
+      continue;
+    }
+
+    layer = bylayer ? getStringMember(line, "layer") : NULL;
+    if(layer)
+      snprintf(key, sizeof(key), "%s [%s]", name, layer);
+    else
+      snprintf(key, sizeof(key), "%s", name);
+    msFree(name);
+    msFree(layer);
+
+    stage = getStage(key);
+    if(stage->count == stage->size) {
+      stage->size = stage->size ? stage->size*2 : 64;
+      stage->durations = (double *) msSmallRealloc(stage->durations, sizeof(double)*stage->size);
+    }
+    stage->durations[stage->count++] = duration;
+    if(getNumberMember(line, "features", &value)) stage->features += (long) value;
+    if(getNumberMember(line, "bytes", &value)) stage->bytes += (long) value;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int i, bylayer = MS_FALSE, numfiles = 0;
+
+  for(i=1; i<argc; i++) {
+    if(strcmp(argv[i], "-layer") == 0)
+      bylayer = MS_TRUE;
+    else if(argv[i][0] == '-' && argv[i][1] != '\0') {
+      PrintUsage();
+      return 0;
+    } else {
+      FILE *fp = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "r");
+      if(fp == NULL) {
+        fprintf(stderr, "ERROR: Failed opening %s\n", argv[i]);
+        return 1;
+      }
+      readTrace(fp, bylayer);
+      if(fp != stdin) fclose(fp);
+      numfiles++;
+    }
+  }
+
+  if(numfiles == 0)
+    readTrace(stdin, bylayer);
+
+  qsort(stages, numstages, sizeof(stageObj), compareStages);
+
+  printf("%-40s %8s %12s %10s %10s %10s %10s %10s %12s %14s\n", "stage", "count", "total(ms)",
+         "mean(ms)", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)", "features", "bytes");
+  for(i=0; i<numstages; i++) {
+    stageObj *stage = &(stages[i]);
+    double total = 0;
+    int j;
+
+    qsort(stage->durations, stage->count, sizeof(double), compareDoubles);
+    for(j=0; j<stage->count; j++) total += stage->durations[j];
+
+    printf("%-40s %8d %12.3f %10.3f %10.3f %10.3f %10.3f %10.3f %12ld %14ld\n", stage->key, stage->count,
+           total/1000.0, total/stage->count/1000.0, percentile(stage, 50)/1000.0,
+           percentile(stage, 90)/1000.0, percentile(stage, 99)/1000.0,
+           stage->durations[stage->count-1]/1000.0, stage->features, stage->bytes);
+
+    msFree(stage->key);
+    msFree(stage->durations);
+  }
+  msFree(stages);
+
+  return 0;
+}
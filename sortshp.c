@@ -4,7 +4,9 @@
  * Project:  MapServer
  * Purpose:  Command line utility to sort a shapefile based on a single
  *           attribute in ascending or decending order. Useful for
- *           prioritizing drawing or labeling of shapes.
+ *           prioritizing drawing or labeling of shapes. Can also sort
+ *           along a Hilbert or Morton curve so that features close on
+ *           the map are close in the file.
  * Author:   Steve Lime and the MapServer team.
  *
  ******************************************************************************
@@ -35,6 +37,7 @@
 #include <string.h>
 
 #include "mapserver.h"
+#include "maptree.h"
 
 
 
@@ -44,6 +47,22 @@ typedef struct {
   int index;
 } sortStruct;
 
+/* ---- Spatial sort key: null shapes last, curve position of the bbox center, then record number ---- */
+typedef struct {
+  int isnull; /* every code is a valid curve position, null shapes are flagged */
+  unsigned int code;
+  int index;
+} spatialKey;
+
+/* ---- One sorted run of keys spilled to disk ---- */
+typedef struct {
+  FILE *fp;
+  spatialKey key;
+  int more;
+} spatialRun;
+
+#define SORTSHP_DEFAULT_MEMORY 256 /* megabytes of keys sorted in memory at once */
+
 static int compare_string_descending(const void *a, const void *b)
 {
   const sortStruct *i = a, *j = b;
@@ -76,20 +95,258 @@ static int compare_number_ascending(const void *a, const void *b)
   return(0);
 }
 
+static int compare_spatial(const void *a, const void *b)
+{
+  const spatialKey *i = a, *j = b;
+  if(i->isnull != j->isnull)
+    return i->isnull ? 1 : -1;
+  if(i->code != j->code)
+    return (i->code < j->code) ? -1 : 1;
+  return (i->index < j->index) ? -1 : (i->index > j->index);
+}
+
+/* ---- Position of (x,y) on a 65536x65536 Hilbert curve ---- */
+static unsigned int hilbert_code(unsigned int x, unsigned int y)
+{
+  unsigned int rx, ry, s, t, d=0;
+
+  for(s=1<<15; s>0; s>>=1) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if(ry == 0) {
+      if(rx == 1) {
+        x = 0xFFFF - x;
+        y = 0xFFFF - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+/* ---- Position of (x,y) on a 65536x65536 Morton (Z order) curve ---- */
+static unsigned int morton_code(unsigned int x, unsigned int y)
+{
+  unsigned int s, d=0;
+
+  for(s=0; s<16; s++)
+    d |= ((x >> s) & 1) << (2*s) | ((y >> s) & 1) << (2*s+1);
+  return d;
+}
+
+static int read_run_key(spatialRun *run)
+{
+  run->more = (fread(&run->key, sizeof(spatialKey), 1, run->fp) == 1);
+  return run->more;
+}
+
+/*
+** Create the output .shp/.shx and .dbf files, with the fields of the input.
+*/
+static void create_output(char *filename, int shpType, DBFHandle inDBF, int num_fields, SHPHandle *outSHP, DBFHandle *outDBF)
+{
+  DBFFieldType dbfField;
+  char         fName[20];
+  int          fWidth,fnDecimals;
+  char         buffer[1024];
+  int i;
+
+  *outSHP = msSHPCreate(filename,shpType);
+  if( *outSHP == NULL ) {
+    fprintf( stderr, "Failed to create file '%s'.\n", filename );
+    exit( 1 );
+  }
+
+  snprintf(buffer,sizeof(buffer),"%s.dbf",filename);
+  *outDBF = msDBFCreate(buffer);
+  if( *outDBF == NULL ) {
+    fprintf( stderr, "Failed to create dbf file '%s'.\n", buffer );
+    exit( 1 );
+  }
+
+  for(i=0; i<num_fields; i++) {
+    dbfField = msDBFGetFieldInfo(inDBF,i,fName,&fWidth,&fnDecimals); /* ---- Get field info from in file ---- */
+    msDBFAddField(*outDBF,fName,dbfField,fWidth,fnDecimals);
+  }
+}
+
+/*
+** Copy input record "from" to output record "to" (.shp/.shx and .dbf).
+*/
+static void copy_record(SHPHandle inSHP, DBFHandle inDBF, SHPHandle outSHP, DBFHandle outDBF, int from, int to, int num_fields)
+{
+  DBFFieldType dbfField;
+  shapeObj     shape;
+  char         fName[20];
+  int          fWidth,fnDecimals;
+  int j;
+
+  for(j=0; j<num_fields; j++) { /* ---- For each .dbf field ---- */
+
+    dbfField = msDBFGetFieldInfo(inDBF,j,fName,&fWidth,&fnDecimals);
+
+    switch (dbfField) {
+      case FTInteger:
+        msDBFWriteIntegerAttribute(outDBF, to, j, msDBFReadIntegerAttribute( inDBF, from, j));
+        break;
+      case FTDouble:
+        msDBFWriteDoubleAttribute(outDBF, to, j, msDBFReadDoubleAttribute( inDBF, from, j));
+        break;
+      case FTString:
+        msDBFWriteStringAttribute(outDBF, to, j, msDBFReadStringAttribute( inDBF, from, j));
+        break;
+      default:
+        fprintf(stderr,"Unsupported data type for field: %s, exiting.\n",fName);
+        exit(0);
+    }
+  }
+
+  msSHPReadShape( inSHP, from, &shape );
+  msSHPWriteShape( outSHP, &shape );
+  msFreeShape( &shape );
+}
+
+/*
+** Write the records in curve order of their bbox centers. The keys are
+** sorted in memory when they fit in memory_mb, otherwise sorted runs are
+** spilled to temporary files and merged while writing, so only the keys of
+** one run are ever held in memory.
+*/
+static int sort_spatial(SHPHandle inSHP, DBFHandle inDBF, SHPHandle outSHP, DBFHandle outDBF,
+                        int num_records, int num_fields, int hilbert, int memory_mb)
+{
+  spatialKey *keys;
+  spatialRun *runs = NULL;
+  rectObj extent, bounds;
+  double xscale, yscale;
+  int runsize, numruns=0, numkeys=0;
+  int i, j;
+
+  runsize = (int) MS_MIN((double) memory_mb*1024*1024/sizeof(spatialKey), (double) num_records);
+  if(runsize < 1) runsize = 1;
+
+  keys = (spatialKey *) malloc(sizeof(spatialKey)*runsize);
+  if(!keys) {
+    fprintf(stderr, "Unable to allocate sort array.\n");
+    return MS_FAILURE;
+  }
+
+  msSHPReadBounds(inSHP, -1, &extent);
+  xscale = (extent.maxx > extent.minx) ? 65535.0/(extent.maxx - extent.minx) : 0;
+  yscale = (extent.maxy > extent.miny) ? 65535.0/(extent.maxy - extent.miny) : 0;
+
+  for(i=0; i<num_records; i++) {
+    keys[numkeys].index = i;
+    keys[numkeys].isnull = (msSHPReadBounds(inSHP, i, &bounds) != MS_SUCCESS);
+    if(keys[numkeys].isnull)
+      keys[numkeys].code = 0; /* null shapes go last, see compare_spatial() */
+    else {
+      unsigned int x = (unsigned int) ((MS_MIN(MS_MAX((bounds.minx + bounds.maxx)/2, extent.minx), extent.maxx) - extent.minx)*xscale);
+      unsigned int y = (unsigned int) ((MS_MIN(MS_MAX((bounds.miny + bounds.maxy)/2, extent.miny), extent.maxy) - extent.miny)*yscale);
+      keys[numkeys].code = hilbert ? hilbert_code(x, y) : morton_code(x, y);
+    }
+    numkeys++;
+
+    if(numkeys == runsize && i < num_records-1) { /* ---- Spill a run ---- */
+      qsort(keys, numkeys, sizeof(spatialKey), compare_spatial);
+      runs = (spatialRun *) msSmallRealloc(runs, sizeof(spatialRun)*(numruns+1));
+      runs[numruns].fp = tmpfile();
+      if(!runs[numruns].fp || fwrite(keys, sizeof(spatialKey), numkeys, runs[numruns].fp) != (size_t) numkeys) {
+        fprintf(stderr, "Unable to write temporary sort file.\n");
+        return MS_FAILURE;
+      }
+      numruns++;
+      numkeys = 0;
+    }
+  }
+
+  qsort(keys, numkeys, sizeof(spatialKey), compare_spatial);
+
+  if(numruns == 0) { /* ---- Everything fit in memory ---- */
+    for(i=0; i<numkeys; i++)
+      copy_record(inSHP, inDBF, outSHP, outDBF, keys[i].index, i, num_fields);
+    free(keys);
+    return MS_SUCCESS;
+  }
+
+  /* ---- The last run stays in memory, merge it with the spilled ones ---- */
+  for(j=0; j<numruns; j++) {
+    rewind(runs[j].fp);
+    read_run_key(&runs[j]);
+  }
+
+  for(i=0, j=0; i<num_records; i++) {
+    spatialKey *next = (j < numkeys) ? &keys[j] : NULL;
+    int k, from = -1;
+
+    for(k=0; k<numruns; k++) {
+      if(runs[k].more && (!next || compare_spatial(&runs[k].key, next) < 0)) {
+        next = &runs[k].key;
+        from = k;
+      }
+    }
+
+    copy_record(inSHP, inDBF, outSHP, outDBF, next->index, i, num_fields);
+
+    if(from == -1)
+      j++;
+    else
+      read_run_key(&runs[from]);
+  }
+
+  for(j=0; j<numruns; j++)
+    fclose(runs[j].fp);
+  free(runs);
+  free(keys);
+
+  return MS_SUCCESS;
+}
+
+/*
+** Build the .qix of the freshly written shapefile, as shptree would.
+*/
+static int write_index(char *filename)
+{
+  shapefileObj shapefile;
+  treeObj *tree;
+  char buffer[1024];
+
+  if(msShapefileOpen(&shapefile, "rb", filename, MS_TRUE) == -1) {
+    fprintf(stderr, "Error opening shapefile %s.\n", filename);
+    return MS_FAILURE;
+  }
+
+  tree = msCreateTree(&shapefile, 0);
+  if(!tree) {
+    fprintf(stderr, "Error generating spatial index of %s.\n", filename);
+    msShapefileClose(&shapefile);
+    return MS_FAILURE;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%s%s", filename, MS_INDEX_EXTENSION);
+  msWriteTree(tree, buffer, MS_NEW_LSB_ORDER);
+  msDestroyTree(tree);
+  msShapefileClose(&shapefile);
+
+  return MS_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
   SHPHandle    inSHP,outSHP; /* ---- Shapefile file pointers ---- */
   DBFHandle    inDBF,outDBF; /* ---- DBF file pointers ---- */
   sortStruct   *array;
-  shapeObj     shape;
   int          shpType, nShapes;
   int          fieldNumber=-1; /* ---- Field number of item to be sorted on ---- */
   DBFFieldType dbfField;
   char         fName[20];
-  int          fWidth,fnDecimals;
   char         buffer[1024];
-  int i,j;
+  int i;
   int num_fields, num_records;
+  int spatial=0, memory_mb=SORTSHP_DEFAULT_MEMORY;
 
   if(argc > 1 && strcmp(argv[1], "-v") == 0) {
     printf("%s\n", msGetVersion());
@@ -99,8 +356,17 @@ int main(int argc, char *argv[])
   /* ------------------------------------------------------------------------------- */
   /*       Check the number of arguments, return syntax if not correct               */
   /* ------------------------------------------------------------------------------- */
-  if( argc != 5 ) {
+  if(argc >= 4 && (strcasecmp(argv[3], "-hilbert") == 0 || strcasecmp(argv[3], "-morton") == 0)) {
+    spatial = MS_TRUE;
+    if(argc == 5) memory_mb = atoi(argv[4]);
+  }
+
+  if( (!spatial && argc != 5) || (spatial && (argc > 5 || memory_mb <= 0)) ) {
     fprintf(stderr,"Syntax: sortshp [infile] [outfile] [item] [ascending|descending]\n" );
+    fprintf(stderr,"        sortshp [infile] [outfile] [-hilbert|-morton] [memory_mb]\n" );
+    fprintf(stderr,"The second form orders the shapes along a space filling curve and\n" );
+    fprintf(stderr,"writes a .qix spatial index for the output. memory_mb (default %d)\n", SORTSHP_DEFAULT_MEMORY );
+    fprintf(stderr,"bounds the sort keys held in memory, larger files are sorted on disk.\n" );
     exit(1);
   }
 
@@ -129,7 +395,7 @@ int main(int argc, char *argv[])
   num_fields = msDBFGetFieldCount(inDBF);
   num_records = msDBFGetRecordCount(inDBF);
 
-  for(i=0; i<num_fields; i++) {
+  for(i=0; i<num_fields && !spatial; i++) {
     msDBFGetFieldInfo(inDBF,i,fName,NULL,NULL);
     if(strncasecmp(argv[3],fName,strlen(argv[3])) == 0) { /* ---- Found it ---- */
       fieldNumber = i;
@@ -137,11 +403,36 @@ int main(int argc, char *argv[])
     }
   }
 
-  if(fieldNumber < 0) {
+  if(!spatial && fieldNumber < 0) {
     fprintf(stderr,"Item %s doesn't exist in %s\n",argv[3],buffer);
     exit(1);
   }
 
+  /* ------------------------------------------------------------------------------- */
+  /*       Setup the output .shp/.shx and .dbf files                                 */
+  /* ------------------------------------------------------------------------------- */
+  if(spatial)
+    create_output(argv[2], shpType, inDBF, num_fields, &outSHP, &outDBF);
+
+  if(spatial) {
+    /* ------------------------------------------------------------------------------- */
+    /*       Write the shapes in curve order and index them                            */
+    /* ------------------------------------------------------------------------------- */
+    if(sort_spatial(inSHP, inDBF, outSHP, outDBF, num_records, num_fields,
+                    strcasecmp(argv[3], "-hilbert") == 0, memory_mb) != MS_SUCCESS)
+      exit(1);
+
+    msSHPClose(inSHP);
+    msDBFClose(inDBF);
+    msSHPClose(outSHP);
+    msDBFClose(outDBF);
+
+    if(write_index(argv[2]) != MS_SUCCESS)
+      exit(1);
+
+    return(0);
+  }
+
   array = (sortStruct *)malloc(sizeof(sortStruct)*num_records); /* ---- Allocate the array ---- */
   if(!array) {
     fprintf(stderr, "Unable to allocate sort array.\n");
@@ -182,56 +473,13 @@ int main(int argc, char *argv[])
       exit(1);
   }
 
-  /* ------------------------------------------------------------------------------- */
-  /*       Setup the output .shp/.shx and .dbf files                                 */
-  /* ------------------------------------------------------------------------------- */
-  outSHP = msSHPCreate(argv[2],shpType);
-  if( outSHP == NULL ) {
-    fprintf( stderr, "Failed to create file '%s'.\n", argv[2] );
-    exit( 1 );
-  }
-
-  sprintf(buffer,"%s.dbf",argv[2]);
-  outDBF = msDBFCreate(buffer);
-  if( outDBF == NULL ) {
-    fprintf( stderr, "Failed to create dbf file '%s'.\n", buffer );
-    exit( 1 );
-  }
-
-  for(i=0; i<num_fields; i++) {
-    dbfField = msDBFGetFieldInfo(inDBF,i,fName,&fWidth,&fnDecimals); /* ---- Get field info from in file ---- */
-    msDBFAddField(outDBF,fName,dbfField,fWidth,fnDecimals);
-  }
+  create_output(argv[2], shpType, inDBF, num_fields, &outSHP, &outDBF);
 
   /* ------------------------------------------------------------------------------- */
   /*       Write the sorted .shp/.shx and .dbf files                                 */
   /* ------------------------------------------------------------------------------- */
-  for(i=0; i<num_records; i++) { /* ---- For each shape/record ---- */
-
-    for(j=0; j<num_fields; j++) { /* ---- For each .dbf field ---- */
-
-      dbfField = msDBFGetFieldInfo(inDBF,j,fName,&fWidth,&fnDecimals);
-
-      switch (dbfField) {
-        case FTInteger:
-          msDBFWriteIntegerAttribute(outDBF, i, j, msDBFReadIntegerAttribute( inDBF, array[i].index, j));
-          break;
-        case FTDouble:
-          msDBFWriteDoubleAttribute(outDBF, i, j, msDBFReadDoubleAttribute( inDBF, array[i].index, j));
-          break;
-        case FTString:
-          msDBFWriteStringAttribute(outDBF, i, j, msDBFReadStringAttribute( inDBF, array[i].index, j));
-          break;
-        default:
-          fprintf(stderr,"Unsupported data type for field: %s, exiting.\n",fName);
-          exit(0);
-      }
-    }
-
-    msSHPReadShape( inSHP, array[i].index, &shape );
-    msSHPWriteShape( outSHP, &shape );
-    msFreeShape( &shape );
-  }
+  for(i=0; i<num_records; i++) /* ---- For each shape/record ---- */
+    copy_record(inSHP, inDBF, outSHP, outDBF, array[i].index, i, num_fields);
 
   free(array);
 